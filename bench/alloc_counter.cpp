@@ -0,0 +1,89 @@
+// Global operator new/delete replacements that count heap allocations for
+// bench::alloc_stats(). Counting is relaxed-atomic so the overhead stays in
+// the noise of the allocations themselves.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#include "bench.h"
+
+namespace {
+
+std::atomic<size_t> g_count{0};
+std::atomic<size_t> g_bytes{0};
+
+// Null if the heap is exhausted. Alignments above what malloc guarantees go
+// through aligned_alloc, whose size must be a multiple of the alignment;
+// both are released with free.
+void *counted_alloc(const size_t size, const size_t align = 0) {
+  g_count.fetch_add(1, std::memory_order_relaxed);
+  g_bytes.fetch_add(size, std::memory_order_relaxed);
+  if (align <= alignof(std::max_align_t))
+    return std::malloc(size ? size : 1);
+  return std::aligned_alloc(align, (size + align - 1) / align * align);
+}
+
+void *counted_new(const size_t size, const size_t align = 0) {
+  if (void *p = counted_alloc(size, align))
+    return p;
+  throw std::bad_alloc{};
+}
+
+} // namespace
+
+bench::AllocStats bench::alloc_stats() {
+  return {g_count.load(std::memory_order_relaxed),
+          g_bytes.load(std::memory_order_relaxed)};
+}
+
+// Every form is replaced, so none of them pairs the library's allocator
+// with this free.
+void *operator new(const size_t size) { return counted_new(size); }
+void *operator new[](const size_t size) { return counted_new(size); }
+void *operator new(const size_t size, const std::nothrow_t &) noexcept {
+  return counted_alloc(size);
+}
+void *operator new[](const size_t size, const std::nothrow_t &) noexcept {
+  return counted_alloc(size);
+}
+void *operator new(const size_t size, const std::align_val_t align) {
+  return counted_new(size, static_cast<size_t>(align));
+}
+void *operator new[](const size_t size, const std::align_val_t align) {
+  return counted_new(size, static_cast<size_t>(align));
+}
+void *operator new(const size_t size, const std::align_val_t align,
+                   const std::nothrow_t &) noexcept {
+  return counted_alloc(size, static_cast<size_t>(align));
+}
+void *operator new[](const size_t size, const std::align_val_t align,
+                     const std::nothrow_t &) noexcept {
+  return counted_alloc(size, static_cast<size_t>(align));
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+void operator delete[](void *p, size_t) noexcept { std::free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+  std::free(p);
+}
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+void operator delete[](void *p, size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+void operator delete(void *p, std::align_val_t,
+                     const std::nothrow_t &) noexcept {
+  std::free(p);
+}
+void operator delete[](void *p, std::align_val_t,
+                       const std::nothrow_t &) noexcept {
+  std::free(p);
+}
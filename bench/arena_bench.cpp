@@ -0,0 +1,223 @@
+// Build and teardown cost of arena-allocated AST nodes compared with the
+// previous scheme, where every node was a std::unique_ptr<ASTNode> holding a
+// std::string id and a std::vector of children.
+
+#include <cctype>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ast.h"
+#include "bench.h"
+#include "source_file.h"
+#include "syntax_analyzer.h"
+#include "tokenizer.h"
+
+namespace {
+
+namespace legacy {
+
+struct Node {
+  virtual ~Node() {}
+  virtual ServerLang::Type type() const { return ServerLang::Type::UNDEFINED; }
+
+  Node *parent = nullptr;
+  ServerLang::Type preferred = ServerLang::Type::UNDEFINED;
+  std::string id = "__NO_ID__";
+  std::vector<std::unique_ptr<Node>> children;
+};
+
+struct Scope : Node {
+  ServerLang::Type type() const override { return ServerLang::Type::SCOPE; }
+  bool executable = false;
+};
+
+struct Route : Scope {
+  ServerLang::Type type() const override { return ServerLang::Type::ROUTE; }
+};
+
+struct Variant : Node {
+  ServerLang::Type type() const override { return ServerLang::Type::VARIANT; }
+  std::string value;
+};
+
+struct I32 : Node {
+  ServerLang::Type type() const override { return ServerLang::Type::I32; }
+  int32_t value = 0;
+};
+
+struct CallExpression : Node {
+  ServerLang::Type type() const override {
+    return ServerLang::Type::CALLEXPRESSION;
+  }
+  Node *lhs = nullptr, *rhs = nullptr;
+  ServerLang::Operators opr = ServerLang::Operators::CALL;
+};
+
+} // namespace legacy
+
+// Both builders produce the same shape: `routes` Route nodes, each holding a
+// Scope with `body` statements that cycle through a Variant, an I32 and a
+// CallExpression.
+constexpr size_t nodes_per_route(const size_t body) { return 2 + body; }
+
+std::vector<std::unique_ptr<legacy::Node>>
+build_legacy(const std::vector<std::string> &ids, const size_t body) {
+  std::vector<std::unique_ptr<legacy::Node>> roots;
+  for (auto const &id : ids) {
+    auto route = std::make_unique<legacy::Route>();
+    route->id = id;
+    auto scope = std::make_unique<legacy::Scope>();
+    for (size_t j = 0; j < body; ++j) {
+      std::unique_ptr<legacy::Node> stmt;
+      switch (j % 3) {
+      case 0:
+        stmt = std::make_unique<legacy::Variant>();
+        stmt->id = "local_variable_name";
+        break;
+      case 1:
+        stmt = std::make_unique<legacy::I32>();
+        stmt->id = "counter";
+        break;
+      default:
+        stmt = std::make_unique<legacy::CallExpression>();
+        break;
+      }
+      scope->children.push_back(std::move(stmt));
+    }
+    route->children.push_back(std::move(scope));
+    roots.push_back(std::move(route));
+  }
+  return roots;
+}
+
+void build_arena(ServerLang::ParseResult &result,
+                 const std::vector<std::string> &ids, const size_t body) {
+  auto &arena = result.arena();
+  for (auto const &id : ids) {
+    auto route = arena.make<ServerLang::CompoundTypes::Route>();
+    route->setId(ServerLang::intern(id));
+    auto scope = arena.make<ServerLang::Scope>();
+    for (size_t j = 0; j < body; ++j) {
+      ServerLang::ASTNode *stmt = nullptr;
+      switch (j % 3) {
+      case 0:
+        stmt = arena.make<ServerLang::InternalTypes::Variant>();
+        stmt->setId(ServerLang::intern("local_variable_name"));
+        break;
+      case 1:
+        stmt = arena.make<ServerLang::InternalTypes::I32>();
+        stmt->setId(ServerLang::intern("counter"));
+        break;
+      default:
+        stmt = arena.make<ServerLang::Expressions::CallExpression>(
+            nullptr, nullptr, ServerLang::Operators::CALL);
+        break;
+      }
+      scope->children().push_back(arena, stmt);
+    }
+    route->children().push_back(arena, scope);
+    result.nodes().push_back(arena, route);
+  }
+}
+
+void report(const char *name, const bench::Stats &build,
+            const bench::Stats &teardown, const size_t nodes) {
+  fprintf(stdout,
+          "%-10s build %9.3f ms (%6.1f ns/node)  teardown %9.3f ms "
+          "(%6.1f ns/node)\n",
+          name, build.best, build.best * 1e6 / nodes, teardown.best,
+          teardown.best * 1e6 / nodes);
+}
+
+int run_synthetic(const size_t routes, const size_t body,
+                  const size_t iterations) {
+  std::vector<std::string> ids;
+  ids.reserve(routes);
+  for (size_t i = 0; i < routes; ++i)
+    ids.push_back("/api/v1/resource/" + std::to_string(i));
+
+  const size_t nodes = routes * nodes_per_route(body);
+  fprintf(stdout, "synthetic tree: %zu routes, %zu nodes, best of %zu\n",
+          routes, nodes, iterations);
+
+  bench::Stats build, teardown;
+  for (size_t i = 0; i < iterations; ++i) {
+    auto start = bench::Clock::now();
+    auto roots = build_legacy(ids, body);
+    build.add(bench::elapsed_ms(start));
+    bench::do_not_optimize(roots.data());
+
+    start = bench::Clock::now();
+    roots.clear();
+    teardown.add(bench::elapsed_ms(start));
+  }
+  report("node_ptr", build, teardown, nodes);
+
+  build = {}, teardown = {};
+  for (size_t i = 0; i < iterations; ++i) {
+    auto start = bench::Clock::now();
+    auto result = std::make_unique<ServerLang::ParseResult>();
+    build_arena(*result, ids, body);
+    build.add(bench::elapsed_ms(start));
+    bench::do_not_optimize(result->nodes().begin());
+
+    start = bench::Clock::now();
+    result.reset();
+    teardown.add(bench::elapsed_ms(start));
+  }
+  report("arena", build, teardown, nodes);
+  return 0;
+}
+
+size_t count_nodes(const ServerLang::node_list &nodes) {
+  size_t n = 0;
+  for (auto const *v : nodes)
+    if (v)
+      n += 1 + count_nodes(v->children_const());
+  return n;
+}
+
+int run_script(const char *path, const size_t iterations) {
+  SourceFile file;
+  if (!file.open(path)) {
+    fprintf(stderr, "Could not open the specified file: %s \n", path);
+    return 1;
+  }
+  bench::Stats build, teardown;
+  size_t nodes = 0;
+  for (size_t i = 0; i < iterations; ++i) {
+    SyntaxAnalyzer analyzer;
+    TokenStream tokens(file.data());
+    auto start = bench::Clock::now();
+    auto result =
+        std::make_unique<ServerLang::ParseResult>(analyzer.analyze(tokens));
+    build.add(bench::elapsed_ms(start));
+    nodes = count_nodes(result->nodes());
+
+    start = bench::Clock::now();
+    result.reset();
+    teardown.add(bench::elapsed_ms(start));
+  }
+  fprintf(stdout, "%s: %zu nodes, best of %zu\n", path, nodes, iterations);
+  report("analyze", build, teardown, nodes ? nodes : 1);
+  return 0;
+}
+
+int run(int argc, char **argv) {
+  if (argc > 1 && !std::isdigit(static_cast<unsigned char>(argv[1][0])))
+    return run_script(argv[1], bench::arg_or(argc, argv, 2, 10));
+
+  const size_t routes = bench::arg_or(argc, argv, 1, 20000);
+  const size_t body = bench::arg_or(argc, argv, 2, 8);
+  const size_t iterations = bench::arg_or(argc, argv, 3, 10);
+  return run_synthetic(routes, body, iterations);
+}
+
+const bench::Register registration{
+    "arena", "AST build/teardown: arena vs node_ptr  [routes body iters | "
+             "script.nsl iters]",
+    run};
+
+} // namespace
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string_view>
+#include <vector>
+
+namespace bench {
+
+using Clock = std::chrono::steady_clock;
+
+inline double elapsed_ms(const Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+
+// Keeps the optimizer from discarding the computation that produced `value`.
+template <typename T> inline void do_not_optimize(T const &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct Stats {
+  double best = 0;
+  double total = 0;
+  int runs = 0;
+
+  void add(const double ms) {
+    best = runs == 0 ? ms : std::min(best, ms);
+    total += ms;
+    ++runs;
+  }
+  double mean() const { return runs ? total / runs : 0; }
+};
+
+using SuiteFn = int (*)(int argc, char **argv);
+
+struct Suite {
+  const char *name;
+  const char *summary;
+  SuiteFn run;
+};
+
+inline std::vector<Suite> &registry() {
+  static std::vector<Suite> suites;
+  return suites;
+}
+
+struct Register {
+  Register(const char *name, const char *summary, const SuiteFn fn) {
+    registry().push_back({name, summary, fn});
+  }
+};
+
+// Heap allocations made through the global operator new since startup,
+// counted by alloc_counter.cpp. Arena chunks come from malloc and are not
+// included.
+struct AllocStats {
+  size_t count = 0;
+  size_t bytes = 0;
+};
+AllocStats alloc_stats();
+
+inline size_t arg_or(int argc, char **argv, const int index,
+                     const size_t fallback) {
+  return index < argc ? std::strtoull(argv[index], nullptr, 10) : fallback;
+}
+
+} // namespace bench
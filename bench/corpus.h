@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <random>
+#include <string>
+
+namespace bench {
+
+// Shape of a generated NSL script. Densities are the probability that a body
+// statement carries a string literal / is preceded by a comment line.
+struct CorpusSpec {
+  size_t routes = 2000;
+  size_t functions = 500;
+  size_t classes = 500;
+  size_t statements = 8; // per body
+  size_t depth = 2;      // Class bodies nested inside each route
+  double string_density = 0.5;
+  double comment_density = 0.2;
+  uint32_t seed = 1;
+};
+
+// Emits a script in the dialect of test/sample.nsl that the analyzer accepts
+// without errors: library imports, functions, classes with methods and
+// routes whose bodies nest `depth` levels of Class declarations.
+class CorpusGenerator {
+public:
+  explicit CorpusGenerator(const CorpusSpec &spec)
+      : m_spec(spec), m_rng(spec.seed) {}
+
+  std::string generate() {
+    m_out.clear();
+    m_out += "//NAISYS SERVERLANG\n\n@lib[\"Core\"];\n@lib[\"Json\"];\n\n";
+    for (size_t i = 0; i < m_spec.functions; ++i) {
+      m_out += "def function_" + std::to_string(i) +
+               " (var name: String = \"arg\") : Void {\n";
+      body(1);
+      m_out += "}\n\n";
+    }
+    for (size_t i = 0; i < m_spec.classes; ++i) {
+      m_out += "const class_" + std::to_string(i) + ": Class = {\n";
+      m_out += "    def init(type: String, size: I32) : Void {\n";
+      body(2);
+      m_out += "    }\n};\n\n";
+    }
+    for (size_t i = 0; i < m_spec.routes; ++i) {
+      m_out += "const @[/route/" + std::to_string(i) + "]: Route = {\n";
+      m_out += "    This.Header = \"text/html\";\n";
+      nested(1, m_spec.depth);
+      m_out += "};\n\n";
+    }
+    return std::move(m_out);
+  }
+
+private:
+  void indent(const size_t level) { m_out.append(level * 4, ' '); }
+
+  void nested(const size_t level, const size_t remaining) {
+    body(level);
+    if (!remaining)
+      return;
+    indent(level);
+    m_out += "const inner_" + std::to_string(remaining) + ": Class = {\n";
+    nested(level + 1, remaining - 1);
+    indent(level);
+    m_out += "};\n";
+  }
+
+  void body(const size_t level) {
+    for (size_t i = 0; i < m_spec.statements; ++i) {
+      if (chance(m_spec.comment_density)) {
+        indent(level);
+        m_out += "// statement " + std::to_string(i) + " says \"hi\"\n";
+      }
+      const bool str = chance(m_spec.string_density);
+      const auto n = std::to_string(m_counter++);
+      indent(level);
+      switch (m_rng() % 4) {
+      case 0:
+        m_out += str ? "var text_" + n + ": String = \"value " + n + "\";\n"
+                     : "var num_" + n + ": I32 = " + n + ";\n";
+        break;
+      case 1:
+        m_out += str ? "This.Body = \"<h1>Page " + n + "</h1>\";\n"
+                     : "This.Status = " + n + ";\n";
+        break;
+      case 2:
+        m_out += str ? "Core::Println(\"%{0} visited\", path_" + n + ");\n"
+                     : "Core::Println(path_" + n + ");\n";
+        break;
+      default:
+        m_out += "var result_" + n + " = Core::Json::Stringify(conn);\n";
+        break;
+      }
+    }
+  }
+
+  bool chance(const double p) {
+    return std::uniform_real_distribution<double>(0, 1)(m_rng) < p;
+  }
+
+  CorpusSpec m_spec;
+  std::mt19937 m_rng;
+  std::string m_out;
+  size_t m_counter = 0;
+};
+
+} // namespace bench
@@ -0,0 +1,111 @@
+// Expression parse cost per atom as single expressions grow: long argument
+// lists, chained member accesses and operator chains of mixed precedence.
+// Flat ns/atom across lengths means the parser reads every atom once and
+// never copies or rescans a span. Each tree is checked to hold one
+// Identifier per operand.
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "syntax_analyzer.h"
+
+namespace {
+
+using namespace ServerLang;
+
+struct Shape {
+  const char *name;
+  std::string (*generate)(size_t length);
+};
+
+std::string arguments(const size_t length) {
+  std::string out = "f(";
+  for (size_t i = 0; i < length; ++i)
+    out += (i ? ", a" : "a") + std::to_string(i);
+  return out + ");\n";
+}
+
+std::string accesses(const size_t length) {
+  std::string out = "a0";
+  for (size_t i = 1; i < length; ++i)
+    out += (i % 2 ? "." : "::") + std::string{"a"} + std::to_string(i);
+  return out + "();\n";
+}
+
+std::string operators(const size_t length) {
+  static const char *const ops[] = {" + ", " * ", " - ", " / ", " == "};
+  std::string out = "x = a0";
+  for (size_t i = 1; i < length; ++i)
+    out += ops[i % 5] + std::string{"a"} + std::to_string(i);
+  return out + ";\n";
+}
+
+// Walks operands as well as children. The trees can be as deep as they are
+// long, so this does not recurse.
+size_t count_identifiers(const node_list &roots) {
+  std::vector<const ASTNode *> stack(roots.begin(), roots.end());
+  size_t n = 0;
+  while (!stack.empty()) {
+    auto const *v = stack.back();
+    stack.pop_back();
+    if (!v)
+      continue;
+    n += v->type() == Type::IDENTIFIER;
+    for (auto const *c : v->children_const())
+      stack.push_back(c);
+    switch (v->type()) {
+    case Type::ARITHMETICEXPRESSION... Type::ACCESSEXPRESSION:
+      stack.push_back(static_cast<const Expression *>(v)->lhs());
+      stack.push_back(static_cast<const Expression *>(v)->rhs());
+      break;
+    default:
+      break;
+    }
+  }
+  return n;
+}
+
+int run(int argc, char **argv) {
+  const size_t max_length = bench::arg_or(argc, argv, 1, 16384);
+  const size_t iterations = bench::arg_or(argc, argv, 2, 5);
+  const Shape shapes[] = {{"arguments", arguments},
+                          {"accesses", accesses},
+                          {"operators", operators}};
+
+  fprintf(stdout, "best of %zu\n", iterations);
+  fprintf(stdout, "%-10s %8s %10s %12s\n", "shape", "length", "ms",
+          "ns/operand");
+  for (auto const &shape : shapes) {
+    for (size_t length = 16; length <= max_length; length *= 4) {
+      auto const source = shape.generate(length);
+      bench::Stats parse;
+      for (size_t i = 0; i < iterations; ++i) {
+        TokenStream tokens(source);
+        SyntaxAnalyzer analyzer;
+        auto start = bench::Clock::now();
+        auto const result = analyzer.analyze(tokens);
+        parse.add(bench::elapsed_ms(start));
+
+        // `x = ...` and `f(...)` name one more identifier than they have
+        // operands.
+        const size_t expected = length + (shape.generate != accesses);
+        if (auto const n = count_identifiers(result.nodes()); n != expected) {
+          fprintf(stderr, "MISMATCH: %s of %zu, %zu identifiers\n",
+                  shape.name, length, n);
+          return 1;
+        }
+      }
+      fprintf(stdout, "%-10s %8zu %10.3f %12.1f\n", shape.name, length,
+              parse.best, parse.best * 1e6 / length);
+    }
+  }
+  return 0;
+}
+
+const bench::Register registration{
+    "expressions",
+    "Expression parse cost per operand vs length  [max_length iters]", run};
+
+} // namespace
@@ -0,0 +1,136 @@
+// Pointer tree against its flat, index-based copy. Reports bytes per node and
+// the cost of a whole-tree pass three ways: a recursive walk of the ASTNode
+// hierarchy, a depth-first walk of the flat links and a linear scan of the
+// flat tag column. All three must count the same nodes by type.
+
+#include <array>
+#include <cstdio>
+
+#include "bench.h"
+#include "corpus.h"
+#include "flat_ast.h"
+#include "syntax_analyzer.h"
+
+namespace {
+
+using namespace ServerLang;
+
+constexpr size_t tag_count = 256;
+using Histogram = std::array<uint32_t, tag_count>;
+
+void count(const ASTNode *n, Histogram &h) {
+  if (!n) {
+    ++h[static_cast<uint8_t>(Type::UNDEFINED)];
+    return;
+  }
+  ++h[static_cast<uint8_t>(n->type())];
+  for (auto const *c : n->children_const())
+    count(c, h);
+  switch (n->type()) {
+  case Type::ARITHMETICEXPRESSION... Type::ACCESSEXPRESSION:
+  case Type::RETURNEXPRESSION: {
+    auto const *e = static_cast<const Expression *>(n);
+    if (e->lhs())
+      count(e->lhs(), h);
+    if (e->rhs())
+      count(e->rhs(), h);
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+void count(const FlatTree &t, uint32_t i, Histogram &h) {
+  for (; i != FlatTree::none; i = t.next_sibling(i)) {
+    ++h[static_cast<uint8_t>(t.tag(i))];
+    count(t, t.first_child(i), h);
+    switch (t.tag(i)) {
+    case Type::ARITHMETICEXPRESSION... Type::ACCESSEXPRESSION:
+    case Type::RETURNEXPRESSION: {
+      auto const &e = t.expression(i);
+      if (e.lhs != FlatTree::none)
+        count(t, e.lhs, h);
+      if (e.rhs != FlatTree::none)
+        count(t, e.rhs, h);
+      break;
+    }
+    default:
+      break;
+    }
+  }
+}
+
+void scan(const FlatTree &t, Histogram &h) {
+  for (uint32_t i = 0, n = t.size(); i < n; ++i)
+    ++h[static_cast<uint8_t>(t.tag(i))];
+}
+
+int run(int argc, char **argv) {
+  bench::CorpusSpec spec;
+  spec.routes = bench::arg_or(argc, argv, 1, 20000);
+  spec.functions = spec.routes / 4;
+  spec.classes = spec.routes / 4;
+  const size_t iterations = bench::arg_or(argc, argv, 2, 10);
+
+  auto const source = bench::CorpusGenerator(spec).generate();
+  TokenStream tokens(source);
+  SyntaxAnalyzer analyzer;
+  auto result = analyzer.analyze(tokens);
+
+  bench::Stats build, walk, dfs, linear;
+  FlatTree flat;
+  Histogram expected{}, h{};
+  for (size_t i = 0; i < iterations; ++i) {
+    auto start = bench::Clock::now();
+    flat = FlatTree::build(result.nodes());
+    build.add(bench::elapsed_ms(start));
+
+    expected.fill(0);
+    start = bench::Clock::now();
+    for (auto const *n : result.nodes())
+      count(n, expected);
+    bench::do_not_optimize(expected);
+    walk.add(bench::elapsed_ms(start));
+
+    h.fill(0);
+    start = bench::Clock::now();
+    count(flat, flat.root(), h);
+    bench::do_not_optimize(h);
+    dfs.add(bench::elapsed_ms(start));
+    if (h != expected) {
+      fprintf(stderr, "MISMATCH: flat walk counted different nodes\n");
+      return 1;
+    }
+
+    h.fill(0);
+    start = bench::Clock::now();
+    scan(flat, h);
+    bench::do_not_optimize(h);
+    linear.add(bench::elapsed_ms(start));
+    if (h != expected) {
+      fprintf(stderr, "MISMATCH: flat scan counted different nodes\n");
+      return 1;
+    }
+  }
+
+  const size_t nodes = flat.size();
+  const double tree_bytes = result.arena().bytes_used();
+  fprintf(stdout, "%zu nodes, best of %zu\n", nodes, iterations);
+  fprintf(stdout, "pointer tree       %9.1f bytes/node\n", tree_bytes / nodes);
+  fprintf(stdout, "flat tree          %9.1f bytes/node  (%.1fx smaller)\n",
+          static_cast<double>(flat.bytes()) / nodes,
+          tree_bytes / flat.bytes());
+  fprintf(stdout, "build flat         %9.3f ms\n", build.best);
+  fprintf(stdout, "walk pointers      %9.3f ms\n", walk.best);
+  fprintf(stdout, "walk flat links    %9.3f ms  (%.1fx)\n", dfs.best,
+          walk.best / dfs.best);
+  fprintf(stdout, "scan flat tags     %9.3f ms  (%.1fx)\n", linear.best,
+          walk.best / linear.best);
+  return 0;
+}
+
+const bench::Register registration{
+    "flat", "Pointer AST vs flat index-based AST  [routes iters]", run};
+
+} // namespace
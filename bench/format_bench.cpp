@@ -0,0 +1,166 @@
+// Cost of formatting a Println line.
+//
+// Renders "%{0} Running on %{1}, request %{2} took %{3} ms" with two strings,
+// an integer and a float, `lines` times per run. The precompiled template
+// appending into a reused buffer is compared with re-parsing the format on
+// every call into a fresh string, as an interpreter without load-time
+// compilation would, with snprintf and with std::ostringstream. All of them
+// must produce the same text. Then whole lines are printed to /dev/null:
+// Println through the per-thread output buffer against one fprintf and
+// fflush per line. Allocations are counted per line.
+
+#include <cstdio>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+#include "bench.h"
+#include "libraries.h"
+
+namespace {
+
+using namespace ServerLang;
+
+const char *const source = "%{0} Running on %{1}, request %{2} took %{3} ms";
+
+// Parses `format` while rendering it, every time.
+std::string reparse(const std::string_view format, const Value *args,
+                    const size_t argc) {
+  std::string out;
+  for (size_t i = 0; i < format.size(); ++i) {
+    if (format[i] == '%' && i + 1 < format.size() && format[i + 1] == '{') {
+      const auto close = format.find('}', i + 2);
+      if (close != std::string_view::npos) {
+        const size_t n = std::stoul(std::string(format.substr(i + 2)));
+        if (n < argc) {
+          out += args[n].to_string();
+          i = close;
+          continue;
+        }
+      }
+    }
+    out += format[i];
+  }
+  return out;
+}
+
+struct Measure {
+  double ns;
+  double allocs;
+};
+
+int run(int argc, char **argv) {
+  const size_t lines = bench::arg_or(argc, argv, 1, 1000);
+  const size_t iterations = bench::arg_or(argc, argv, 2, 200);
+
+  const std::string hello = "Hello", os = "MacOS";
+  Value args[4] = {Value::string(&hello), Value::string(&os), {},
+                   Value::number(1.25)};
+  const FormatTemplate compiled(source);
+
+  auto const time = [&](auto &&line) {
+    bench::Stats stats;
+    auto const before = bench::alloc_stats();
+    for (size_t round = 0; round < iterations; ++round) {
+      auto const start = bench::Clock::now();
+      for (size_t i = 0; i < lines; ++i) {
+        args[2] = Value::integer(static_cast<int64_t>(i));
+        line(i);
+      }
+      stats.add(bench::elapsed_ms(start));
+    }
+    const double total = static_cast<double>(lines * iterations);
+    return Measure{stats.best * 1e6 / static_cast<double>(lines),
+                   static_cast<double>(bench::alloc_stats().count -
+                                       before.count) /
+                       total};
+  };
+
+  // Every formatter's text for line `i`, checked against the template's.
+  std::string want, buffer;
+  auto const check = [&](const std::string_view got, const size_t i,
+                         const char *who) {
+    want.clear();
+    args[2] = Value::integer(static_cast<int64_t>(i));
+    compiled.render(want, args, 4);
+    if (got == want)
+      return true;
+    fprintf(stderr, "MISMATCH (%s): \"%.*s\", expected \"%s\"\n", who,
+            static_cast<int>(got.size()), got.data(), want.c_str());
+    return false;
+  };
+
+  buffer.reserve(256);
+  const Measure precompiled = time([&](size_t) {
+    buffer.clear();
+    compiled.render(buffer, args, 4);
+    bench::do_not_optimize(buffer.data());
+  });
+  const Measure reparsed = time([&](size_t) {
+    bench::do_not_optimize(reparse(source, args, 4).size());
+  });
+  char text[256];
+  const Measure printf_like = time([&](const size_t i) {
+    snprintf(text, sizeof text, "%s Running on %s, request %lld took %f ms",
+             hello.c_str(), os.c_str(), static_cast<long long>(i), 1.25);
+    bench::do_not_optimize(text[0]);
+  });
+  std::ostringstream stream;
+  stream << std::fixed;
+  const Measure ostream = time([&](const size_t i) {
+    stream.str({});
+    stream << hello << " Running on " << os << ", request " << i << " took "
+           << 1.25 << " ms";
+    bench::do_not_optimize(stream.tellp());
+  });
+
+  const size_t last = lines - 1;
+  buffer.clear();
+  args[2] = Value::integer(static_cast<int64_t>(last));
+  compiled.render(buffer, args, 4);
+  snprintf(text, sizeof text, "%s Running on %s, request %lld took %f ms",
+           hello.c_str(), os.c_str(), static_cast<long long>(last), 1.25);
+  if (!check(buffer, last, "template") ||
+      !check(reparse(source, args, 4), last, "re-parsed") ||
+      !check(text, last, "snprintf") ||
+      !check(stream.str(), last, "ostringstream"))
+    return 1;
+
+  FILE *null = fopen("/dev/null", "w");
+  if (!null) {
+    fprintf(stderr, "Could not open /dev/null\n");
+    return 1;
+  }
+  FILE *const previous = Core::Output::sink().exchange(null);
+  const FormatArg literal{&compiled};
+  const Measure println = time([&](size_t) {
+    Core::println(literal, {args, 4});
+  });
+  Core::flush_output();
+  const Measure fprintf_flush = time([&](const size_t i) {
+    fprintf(null, "%s Running on %s, request %lld took %f ms\n",
+            hello.c_str(), os.c_str(), static_cast<long long>(i), 1.25);
+    fflush(null);
+  });
+  Core::Output::sink().store(previous);
+  fclose(null);
+
+  fprintf(stdout, "%zu lines x %zu runs\n", lines, iterations);
+  fprintf(stdout, "%-34s %10s %10s\n", "", "ns/line", "allocs");
+  auto const row = [](const char *label, const Measure &m) {
+    fprintf(stdout, "%-34s %10.1f %10.2f\n", label, m.ns, m.allocs);
+  };
+  row("precompiled template", precompiled);
+  row("re-parsed on every call", reparsed);
+  row("snprintf", printf_like);
+  row("std::ostringstream", ostream);
+  row("Println, buffered per thread", println);
+  row("fprintf + fflush per line", fprintf_flush);
+  return 0;
+}
+
+const bench::Register registration{
+    "format", "Println formatting and output  [lines iterations]", run};
+
+} // namespace
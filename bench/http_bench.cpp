@@ -0,0 +1,288 @@
+// Load generator for the HTTP front end.
+//
+// Opens `connections` keep-alive connections to 127.0.0.1 and keeps
+// `pipeline` requests in flight on each, sent in one write, until `requests`
+// responses have arrived. With port 0 it serves a generated script itself
+// on `threads` event loops and checks every response's status and body;
+// given a port it drives that server instead, requesting `path` and only
+// checking for a 200. Requests per second and per-request latency are
+// reported for no pipelining and for the requested depth.
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "http_server.h"
+
+namespace {
+
+using namespace ServerLang;
+
+const char *const script = "//NAISYS SERVERLANG\n\n"
+                           "const @[/hello]: Route = {\n"
+                           "    This.Header = \"text/plain\";\n"
+                           "    This.Body = \"Hello, World!\";\n"
+                           "};\n\n"
+                           "const @[/answer]: Route = {\n"
+                           "    var n = 6 * 7;\n"
+                           "    This.Header = \"text/plain\";\n"
+                           "    This.Body = \"answer \" + n;\n"
+                           "};\n";
+
+struct Target {
+  const char *path;
+  const char *body; // nullptr: any 200 will do
+};
+
+struct Client {
+  int fd;
+  std::string in;
+  size_t in_flight = 0;
+  size_t next = 0; // index into the targets for the next batch
+  bench::Clock::time_point sent;
+};
+
+// Length of the first complete response in `in`, or 0. Sets `ok` if it has
+// the expected status and body.
+size_t response(const std::string &in, const Target &t, bool &ok) {
+  const auto head = in.find("\r\n\r\n");
+  if (head == std::string::npos)
+    return 0;
+  size_t length = 0;
+  const auto cl = in.find("Content-Length: ");
+  if (cl < head)
+    length = std::strtoul(in.c_str() + cl + 16, nullptr, 10);
+  if (in.size() < head + 4 + length)
+    return 0;
+  ok = in.compare(0, 12, "HTTP/1.1 200") == 0 &&
+       (!t.body || std::string_view(in).substr(head + 4, length) == t.body);
+  return head + 4 + length;
+}
+
+int connect_to(const uint16_t port) {
+  const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (fd < 0 ||
+      ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof addr) < 0) {
+    perror("connect");
+    if (fd >= 0)
+      ::close(fd);
+    return -1;
+  }
+  const int on = 1;
+  ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+  return fd;
+}
+
+struct Result {
+  double ms;
+  size_t failed;
+  std::vector<uint32_t> latency_us;
+};
+
+bool drive(const uint16_t port, const std::vector<Target> &targets,
+           const size_t connections, const size_t requests,
+           const size_t pipeline, Result &r) {
+  std::vector<Client> clients(connections);
+  const int ep = ::epoll_create1(EPOLL_CLOEXEC);
+  for (size_t i = 0; i < connections; ++i) {
+    clients[i].fd = connect_to(port);
+    if (clients[i].fd < 0)
+      return false;
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.u64 = i;
+    ::epoll_ctl(ep, EPOLL_CTL_ADD, clients[i].fd, &ev);
+  }
+
+  size_t sent = 0, done = 0;
+  std::string batch;
+  auto const send = [&](Client &c) {
+    batch.clear();
+    const size_t n = std::min(pipeline, requests - sent);
+    for (size_t k = 0; k < n; ++k) {
+      batch += "GET ";
+      batch += targets[(c.next + k) % targets.size()].path;
+      batch += " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    }
+    sent += n;
+    c.in_flight = n;
+    c.sent = bench::Clock::now();
+    for (size_t off = 0; off < batch.size();) {
+      const ssize_t w = ::write(c.fd, batch.data() + off, batch.size() - off);
+      if (w <= 0)
+        return false;
+      off += static_cast<size_t>(w);
+    }
+    return true;
+  };
+
+  r.failed = 0;
+  r.latency_us.clear();
+  auto const start = bench::Clock::now();
+  for (auto &c : clients)
+    if (sent < requests && !send(c))
+      return false;
+  epoll_event events[64];
+  char buf[64 * 1024];
+  while (done < requests) {
+    const int n = ::epoll_wait(ep, events, 64, 5000);
+    if (n <= 0) {
+      fprintf(stderr, "Timed out with %zu of %zu responses\n", done,
+              requests);
+      break;
+    }
+    for (int e = 0; e < n; ++e) {
+      auto &c = clients[events[e].data.u64];
+      const ssize_t got = ::read(c.fd, buf, sizeof buf);
+      if (got <= 0) {
+        fprintf(stderr, "Connection closed by the server\n");
+        return false;
+      }
+      c.in.append(buf, static_cast<size_t>(got));
+      bool ok = false;
+      while (size_t len = response(c.in, targets[c.next % targets.size()],
+                                   ok)) {
+        c.in.erase(0, len);
+        r.failed += !ok;
+        r.latency_us.push_back(static_cast<uint32_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                bench::Clock::now() - c.sent)
+                .count()));
+        ++c.next;
+        ++done;
+        if (--c.in_flight == 0 && sent < requests && !send(c))
+          return false;
+      }
+    }
+  }
+  r.ms = bench::elapsed_ms(start);
+  for (auto &c : clients)
+    ::close(c.fd);
+  ::close(ep);
+  return done == requests;
+}
+
+// Repeated Content-Length headers are accepted only if they agree.
+bool check_lengths() {
+  const struct {
+    const char *lengths;
+    HttpParser::Status want;
+  } cases[] = {
+      {"Content-Length: 2\r\nContent-Length: 2\r\n",
+       HttpParser::Status::DONE},
+      {"Content-Length: 2\r\nContent-Length: 20\r\n",
+       HttpParser::Status::BAD},
+  };
+  for (auto const &c : cases) {
+    const std::string in =
+        std::string("POST / HTTP/1.1\r\n") + c.lengths + "\r\nhi";
+    HttpParser parser;
+    HttpRequest req;
+    if (parser.parse(in, req) != c.want) {
+      fprintf(stderr, "MISMATCH: parsing %s", c.lengths);
+      return false;
+    }
+  }
+  return true;
+}
+
+void report(const char *label, Result &r, const size_t requests) {
+  std::sort(r.latency_us.begin(), r.latency_us.end());
+  auto const at = [&](const size_t pct) {
+    return r.latency_us.empty() ? 0u
+                                : r.latency_us[r.latency_us.size() * pct / 100];
+  };
+  fprintf(stdout, "%-12s %10.2f %12.0f %8u %8u %8u\n", label, r.ms,
+          requests / r.ms * 1e3, at(50), at(99),
+          r.latency_us.empty() ? 0u : r.latency_us.back());
+}
+
+int run(int argc, char **argv) {
+  const size_t connections = bench::arg_or(argc, argv, 1, 16);
+  const size_t requests = bench::arg_or(argc, argv, 2, 100000);
+  const size_t pipeline = bench::arg_or(argc, argv, 3, 16);
+  const size_t threads = bench::arg_or(argc, argv, 4, 0);
+  const auto external = static_cast<uint16_t>(bench::arg_or(argc, argv, 5, 0));
+  const char *path = argc > 6 ? argv[6] : "/";
+
+  if (!check_lengths())
+    return 1;
+
+  std::vector<Target> targets;
+  std::string dir, file;
+  std::unique_ptr<ThreadPool> pool;
+  std::unique_ptr<HotReloader> reloader;
+  std::unique_ptr<HttpServer> server;
+  uint16_t port = external;
+  if (!external) {
+    dir = "/tmp/serverlang_http_" + std::to_string(::getpid());
+    file = dir + "/server.nsl";
+    if (::mkdir(dir.c_str(), 0700) != 0) {
+      fprintf(stderr, "Could not create %s\n", dir.c_str());
+      return 1;
+    }
+    std::ofstream(file, std::ios::binary) << script;
+    pool = std::make_unique<ThreadPool>(1);
+    reloader = std::make_unique<HotReloader>(file, *pool);
+    const bool loaded = reloader->reload();
+    std::remove(file.c_str());
+    std::remove(CompiledImage::path_for(file).c_str());
+    ::rmdir(dir.c_str());
+    if (!loaded)
+      return 1;
+    HttpServer::Options options;
+    options.port = 0;
+    if (threads)
+      options.threads = threads;
+    server = std::make_unique<HttpServer>(reloader->programs(), options);
+    if (!server->start())
+      return 1;
+    port = server->port();
+    targets = {{"/hello", "Hello, World!"}, {"/answer", "answer 42"}};
+  } else
+    targets = {{path, nullptr}};
+
+  fprintf(stdout, "%zu connections, %zu requests, port %u%s\n", connections,
+          requests, port, external ? "" : " (in process)");
+  fprintf(stdout, "%-12s %10s %12s %8s %8s %8s\n", "pipeline", "ms", "req/s",
+          "p50 us", "p99 us", "max us");
+  for (const size_t depth : {size_t{1}, pipeline}) {
+    Result r;
+    if (!drive(port, targets, connections, requests, depth, r))
+      return 1;
+    if (r.failed) {
+      fprintf(stderr, "MISMATCH: %zu of %zu responses wrong\n", r.failed,
+              requests);
+      return 1;
+    }
+    report(std::to_string(depth).c_str(), r, requests);
+    if (depth == pipeline)
+      break;
+  }
+  return 0;
+}
+
+const bench::Register registration{
+    "http",
+    "HTTP load generator  [connections requests pipeline threads port path]",
+    run};
+
+} // namespace
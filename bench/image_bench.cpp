@@ -0,0 +1,152 @@
+// Cold start from source vs from a compiled .nslc image. The image path maps
+// the file, checks it and links its bytecode; the source path tokenizes,
+// analyzes and compiles. Every route must produce the same response on both.
+
+#include <cstdio>
+#include <string>
+
+#include <unistd.h>
+
+#include "bench.h"
+#include "compiled_image.h"
+#include "corpus.h"
+#include "libraries.h"
+#include "modules.h"
+#include "runtime.h"
+
+namespace {
+
+int run(int argc, char **argv) {
+  bench::CorpusSpec spec;
+  spec.routes = bench::arg_or(argc, argv, 1, 20000);
+  spec.functions = spec.routes / 4;
+  spec.classes = spec.routes / 4;
+  const size_t iterations = bench::arg_or(argc, argv, 2, 5);
+
+  auto const source = bench::CorpusGenerator(spec).generate();
+  const uint64_t hash = ServerLang::fnv1a(source);
+  const std::string path =
+      "/tmp/serverlang_image_" + std::to_string(::getpid()) + ".nslc";
+
+  // The routes print; keep that out of the report.
+  FILE *null = fopen("/dev/null", "w");
+  if (!null) {
+    fprintf(stderr, "Could not open /dev/null\n");
+    return 1;
+  }
+  FILE *const previous = ServerLang::Core::Output::sink().exchange(null);
+  auto const finish = [&](const int status) {
+    ServerLang::Core::flush_output();
+    ServerLang::Core::Output::sink().store(previous);
+    fclose(null);
+    std::remove(path.c_str());
+    return status;
+  };
+
+  // LoadedProgram writes no image for a script whose analysis reported
+  // errors, so each must be counted.
+  {
+    TokenStream tokens("var q: I32 = ;\nvar big: I16 = 40000;\n");
+    SyntaxAnalyzer analyzer;
+    if (auto const errors = analyzer.analyze(tokens).errors(); errors != 2) {
+      fprintf(stderr, "MISMATCH: %zu analysis errors counted, expected 2\n",
+              errors);
+      return finish(1);
+    }
+  }
+
+  bench::Stats parse, build, map, eval_nodes, eval_image, hashing;
+  size_t image_size = 0;
+  for (size_t i = 0; i < iterations; ++i) {
+    auto start = bench::Clock::now();
+    TokenStream tokens(source);
+    SyntaxAnalyzer analyzer;
+    auto const result = analyzer.analyze(tokens);
+    parse.add(bench::elapsed_ms(start));
+    if (result.errors()) {
+      fprintf(stderr, "MISMATCH: the corpus reported %zu errors\n",
+              result.errors());
+      return finish(1);
+    }
+
+    start = bench::Clock::now();
+    Runtime from_nodes;
+    ServerLang::CompiledModule module;
+    from_nodes.eval(result, module);
+    eval_nodes.add(bench::elapsed_ms(start));
+
+    start = bench::Clock::now();
+    auto const bytes = ServerLang::CompiledImage::build(
+        result, from_nodes.program(), module, hash, 0);
+    build.add(bench::elapsed_ms(start));
+    image_size = bytes.size();
+    if (!ServerLang::CompiledImage::write(path, bytes)) {
+      fprintf(stderr, "Could not write %s\n", path.c_str());
+      return finish(1);
+    }
+
+    start = bench::Clock::now();
+    bench::do_not_optimize(ServerLang::fnv1a(source));
+    hashing.add(bench::elapsed_ms(start));
+
+    start = bench::Clock::now();
+    ServerLang::CompiledImage image;
+    const bool mapped = image.map(path, hash);
+    map.add(bench::elapsed_ms(start));
+    if (!mapped || image.root_count() != result.nodes().size()) {
+      fprintf(stderr, "MISMATCH: image did not map back (%zu roots)\n",
+              mapped ? image.root_count() : 0);
+      return finish(1);
+    }
+
+    start = bench::Clock::now();
+    Runtime from_image;
+    const bool linked = from_image.eval(image);
+    eval_image.add(bench::elapsed_ms(start));
+    if (!linked) {
+      fprintf(stderr, "MISMATCH: image did not link\n");
+      return finish(1);
+    }
+
+    if (i == 0) {
+      auto a = from_nodes.context(), b = from_image.context();
+      for (size_t r = 0; r < spec.routes; ++r) {
+        const auto route = "/route/" + std::to_string(r);
+        ServerLang::Value x, y;
+        std::string body_x, body_y;
+        const bool ran = from_nodes.exec_route(route, *a, x) &&
+                         from_image.exec_route(route, *b, y);
+        for (const auto f :
+             {ServerLang::Field::HEADER, ServerLang::Field::BODY,
+              ServerLang::Field::STATUS}) {
+          body_x += a->field(f).to_string() + '\n';
+          body_y += b->field(f).to_string() + '\n';
+        }
+        if (!ran || x.to_string() != y.to_string() || body_x != body_y) {
+          fprintf(stderr, "MISMATCH: %s differs when run from the image\n",
+                  route.c_str());
+          return finish(1);
+        }
+      }
+    }
+  }
+  finish(0);
+
+  fprintf(stdout, "source %.2f MB, image %.2f MB, best of %zu\n",
+          source.size() / 1e6, image_size / 1e6, iterations);
+  fprintf(stdout, "tokenize+analyze   %9.3f ms\n", parse.best);
+  fprintf(stdout, "build image        %9.3f ms\n", build.best);
+  fprintf(stdout, "hash source        %9.3f ms\n", hashing.best);
+  fprintf(stdout, "map+check image    %9.3f ms\n", map.best);
+  fprintf(stdout, "compile+eval nodes %9.3f ms\n", eval_nodes.best);
+  fprintf(stdout, "link+eval image    %9.3f ms\n", eval_image.best);
+  fprintf(stdout, "cold start: source %.3f ms, image %.3f ms\n",
+          parse.best + eval_nodes.best,
+          hashing.best + map.best + eval_image.best);
+  return 0;
+}
+
+const bench::Register registration{
+    "image", "Cold start from source vs compiled .nslc  [routes iters]", run};
+
+} // namespace
@@ -0,0 +1,116 @@
+// @script import resolution over a generated dependency DAG. Every file
+// imports a few later files, so most files are reachable along many paths.
+// The suite checks that each file is parsed exactly once per cache and that
+// a second resolve is served entirely from the cache, then times the
+// resolve with growing thread pools.
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+#include "bench.h"
+#include "corpus.h"
+#include "modules.h"
+
+namespace {
+
+std::string file_name(const size_t i) {
+  return "module_" + std::to_string(i) + ".nsl";
+}
+
+bool write_dag(const std::string &dir, const size_t files,
+               const size_t fanout, const size_t routes) {
+  std::mt19937 rng(7);
+  for (size_t i = 0; i < files; ++i) {
+    std::string text;
+    for (size_t k = 0; k < fanout && i + 1 < files; ++k) {
+      std::uniform_int_distribution<size_t> pick(i + 1, files - 1);
+      text += "@script[\"" + file_name(pick(rng)) + "\"];\n";
+    }
+    bench::CorpusSpec spec;
+    spec.routes = routes;
+    spec.functions = routes / 4;
+    spec.classes = routes / 4;
+    spec.seed = static_cast<uint32_t>(i + 1);
+    text += bench::CorpusGenerator(spec).generate();
+
+    FILE *f = fopen((dir + '/' + file_name(i)).c_str(), "w");
+    if (!f)
+      return false;
+    fwrite(text.data(), 1, text.size(), f);
+    fclose(f);
+  }
+  return true;
+}
+
+void remove_dag(const std::string &dir, const size_t files) {
+  for (size_t i = 0; i < files; ++i)
+    unlink((dir + '/' + file_name(i)).c_str());
+  rmdir(dir.c_str());
+}
+
+int run(int argc, char **argv) {
+  const size_t files = bench::arg_or(argc, argv, 1, 64);
+  const size_t fanout = bench::arg_or(argc, argv, 2, 4);
+  const size_t routes = bench::arg_or(argc, argv, 3, 200);
+  const size_t iterations = bench::arg_or(argc, argv, 4, 5);
+
+  char tmpl[] = "/tmp/serverlang_imports_XXXXXX";
+  if (!mkdtemp(tmpl)) {
+    fprintf(stderr, "Could not create a temporary directory\n");
+    return 1;
+  }
+  const std::string dir = tmpl;
+  if (!write_dag(dir, files, fanout, routes)) {
+    fprintf(stderr, "Could not write the generated scripts to %s\n",
+            dir.c_str());
+    remove_dag(dir, files);
+    return 1;
+  }
+  const std::string root = dir + '/' + file_name(0);
+
+  fprintf(stdout, "%zu files, fanout %zu, %zu routes each, best of %zu\n",
+          files, fanout, routes, iterations);
+  int status = 0;
+  // At least 4 threads so the concurrent path is exercised on small machines.
+  const size_t max_threads =
+      std::max<size_t>(4, std::thread::hardware_concurrency());
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    ServerLang::ThreadPool pool(threads);
+    bench::Stats cold;
+    size_t modules = 0, parses = 0;
+    for (size_t i = 0; i < iterations; ++i) {
+      ServerLang::ModuleCache cache;
+      auto const start = bench::Clock::now();
+      auto const graph = ServerLang::ImportResolver(cache, pool).resolve(root);
+      cold.add(bench::elapsed_ms(start));
+      modules = graph.order.size();
+      parses = cache.parses();
+
+      auto const again = ServerLang::ImportResolver(cache, pool).resolve(root);
+      if (parses != modules || cache.parses() != parses ||
+          again.order.size() != modules) {
+        fprintf(stderr,
+                "MISMATCH: %zu threads, %zu modules, %zu parses, %zu after a "
+                "cached resolve\n",
+                threads, modules, parses, cache.parses());
+        status = 1;
+      }
+    }
+    fprintf(stdout, "%3zu threads %9.2f ms  %4zu modules  %4zu parses\n",
+            threads, cold.best, modules, parses);
+  }
+
+  remove_dag(dir, files);
+  return status;
+}
+
+const bench::Register registration{
+    "imports", "Parallel @script resolution  [files fanout routes iters]",
+    run};
+
+} // namespace
@@ -0,0 +1,275 @@
+// JSON serialization of object values.
+//
+// Four documents are built the way the compiler builds Json declarations:
+// a small one shaped like a database connection, a wide one with `width`
+// members (strings of mixed length, every eighth with characters to
+// escape, integers and floats), one of `width / 4` long strings and one
+// nested `depth` levels deep. Each is
+// written with JsonWriter into a reused string and into a fixed buffer,
+// once per available escape kernel, through the Core::Json::Stringify
+// stub, and by a reference serializer that returns a string per value and
+// escapes byte by byte, as Stringify did before. All of them must produce
+// the same text. Time, throughput and allocations are per document.
+
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bench.h"
+#include "json.h"
+#include "libraries.h"
+#include "vm.h"
+
+namespace {
+
+using namespace ServerLang;
+
+// A string per value, concatenated into its parent's.
+std::string reference(const Value &v) {
+  switch (v.kind) {
+  case Value::Kind::BOOL:
+    return v.b ? "true" : "false";
+  case Value::Kind::INT:
+    return std::to_string(v.i);
+  case Value::Kind::FLOAT: {
+    char buf[32];
+    return std::string(buf, std::to_chars(buf, buf + sizeof buf, v.f).ptr);
+  }
+  case Value::Kind::STRING: {
+    std::string out = "\"";
+    for (const char c : *v.s) {
+      switch (c) {
+      case '"':
+        out += "\\\"";
+        break;
+      case '\\':
+        out += "\\\\";
+        break;
+      case '\n':
+        out += "\\n";
+        break;
+      case '\r':
+        out += "\\r";
+        break;
+      case '\t':
+        out += "\\t";
+        break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          char esc[8];
+          snprintf(esc, sizeof esc, "\\u%04x", c);
+          out += esc;
+        } else
+          out += c;
+      }
+    }
+    return out + '"';
+  }
+  case Value::Kind::OBJECT: {
+    std::string out(1, v.o->array ? '[' : '{');
+    for (auto const &m : v.o->members) {
+      if (out.size() > 1)
+        out += ',';
+      if (!v.o->array)
+        out += "\"" + std::string(m.name) + "\":";
+      out += reference(m.value);
+    }
+    return out + (v.o->array ? ']' : '}');
+  }
+  default:
+    return "null";
+  }
+}
+
+class Documents {
+public:
+  Value small() {
+    auto &r = m_program.add_record();
+    add(r, "db_host", text("db.internal.example.com"));
+    add(r, "port", Value::integer(5432));
+    add(r, "user", text("service"));
+    add(r, "ratio", Value::number(0.75));
+    add(r, "tls", Value::boolean(true));
+    add(r, "pool", Value{});
+    return Value::object(&r);
+  }
+
+  Value wide(const size_t width) {
+    auto &r = m_program.add_record();
+    for (size_t i = 0; i < width; ++i) {
+      Value v;
+      if (i % 3 == 0)
+        v = Value::integer(static_cast<int64_t>(i * 7919));
+      else if (i % 3 == 1)
+        v = Value::number(static_cast<double>(i) / 7.0);
+      else {
+        std::string s(8 + i % 57, static_cast<char>('a' + i % 26));
+        if (i % 8 == 2)
+          s += "\t\"quoted\"\\\n";
+        v = text(s);
+      }
+      add(r, "field_" + std::to_string(i), v);
+    }
+    return Value::object(&r);
+  }
+
+  // Long strings, a few of them with a character to escape near the end.
+  Value text_heavy(const size_t members) {
+    auto &r = m_program.add_record();
+    for (size_t i = 0; i < members; ++i) {
+      std::string s(512, static_cast<char>('A' + i % 26));
+      if (i % 16 == 0)
+        s[500] = '"';
+      add(r, "text_" + std::to_string(i), text(s));
+    }
+    return Value::object(&r);
+  }
+
+  Value deep(const size_t depth) {
+    Value inner = text("leaf");
+    for (size_t d = 0; d < depth; ++d) {
+      auto &r = m_program.add_record();
+      r.array = d % 4 == 3;
+      add(r, "level", Value::integer(static_cast<int64_t>(depth - d)));
+      add(r, "child", inner);
+      inner = Value::object(&r);
+    }
+    return inner;
+  }
+
+  Program &program() { return m_program; }
+
+private:
+  Value text(const std::string_view s) {
+    return Value::string(m_program.keep(s));
+  }
+  void add(Record &r, const std::string &name, const Value v) {
+    r.members.push_back({*m_program.keep(name), v});
+  }
+
+  Program m_program;
+};
+
+struct Measure {
+  double ns;
+  double allocs;
+};
+
+int run(int argc, char **argv) {
+  const size_t width = bench::arg_or(argc, argv, 1, 1000);
+  const size_t depth = bench::arg_or(argc, argv, 2, 200);
+  const size_t iterations = bench::arg_or(argc, argv, 3, 2000);
+
+  Documents docs;
+  Machine vm(docs.program());
+  const Native::Fn stringify = builtin_libraries()
+                                   .find("Json")
+                                   ->find(intern("Core::Json::Stringify"))
+                                   ->fn;
+  struct Case {
+    const char *name;
+    Value doc;
+    size_t runs;
+  };
+  const Case cases[] = {{"small", docs.small(), iterations * 50},
+                        {"wide", docs.wide(width), iterations},
+                        {"text", docs.text_heavy(width / 4), iterations},
+                        {"deep", docs.deep(depth), iterations * 5}};
+
+  auto const time = [&](const size_t runs, auto &&write) {
+    bench::Stats stats;
+    size_t allocs = 0;
+    for (int round = 0; round < 5; ++round) {
+      auto const before = bench::alloc_stats();
+      auto const start = bench::Clock::now();
+      for (size_t i = 0; i < runs; ++i)
+        write();
+      stats.add(bench::elapsed_ms(start));
+      allocs = bench::alloc_stats().count - before.count;
+    }
+    return Measure{stats.best * 1e6 / static_cast<double>(runs),
+                   static_cast<double>(allocs) / static_cast<double>(runs)};
+  };
+
+  fprintf(stdout, "%-6s %-28s %10s %9s %8s\n", "doc", "writer", "ns/doc",
+          "MB/s", "allocs");
+  std::string out;
+  std::vector<char> fixed;
+  for (auto const &c : cases) {
+    const std::string want = reference(c.doc);
+    fixed.assign(want.size(), 0);
+    auto const row = [&](const std::string &label, const Measure &m) {
+      const double bytes = static_cast<double>(want.size());
+      fprintf(stdout, "%-6s %-28s %10.1f %9.1f %8.2f\n", c.name,
+              label.c_str(), m.ns, bytes / m.ns * 1e3, m.allocs);
+    };
+    auto const check = [&](const std::string_view got, const char *who) {
+      if (got == want)
+        return true;
+      fprintf(stderr, "MISMATCH (%s, %s): %zu bytes, expected %zu\n", c.name,
+              who, got.size(), want.size());
+      return false;
+    };
+
+    for (auto const *kernels : Scan::available_kernels()) {
+      const Measure grown = time(c.runs, [&] {
+        out.clear();
+        JsonWriter w(out, *kernels);
+        write_json(w, c.doc);
+      });
+      if (!check(out, kernels->name))
+        return 1;
+      row(std::string("string, ") + kernels->name, grown);
+
+      bool ok = true;
+      std::string_view written;
+      const Measure bounded = time(c.runs, [&] {
+        JsonWriter w(fixed.data(), fixed.size(), *kernels);
+        write_json(w, c.doc);
+        ok = w.ok();
+        written = w.text();
+        bench::do_not_optimize(written.data());
+      });
+      if (!ok) {
+        fprintf(stderr, "MISMATCH (%s, %s): fixed buffer overflowed\n",
+                c.name, kernels->name);
+        return 1;
+      }
+      if (!check(written, kernels->name))
+        return 1;
+      row(std::string("fixed buffer, ") + kernels->name, bounded);
+    }
+
+    const Measure stub = time(c.runs, [&] {
+      vm.release(0);
+      bench::do_not_optimize(stringify(vm, &c.doc, 1).s);
+    });
+    vm.release(0);
+    const Value text = stringify(vm, &c.doc, 1);
+    if (!check(*text.s, "stub"))
+      return 1;
+    row("Core::Json::Stringify stub", stub);
+
+    std::string ref;
+    const Measure concatenated = time(c.runs, [&] {
+      ref = reference(c.doc);
+      bench::do_not_optimize(ref.data());
+    });
+    row("reference (concatenating)", concatenated);
+
+    // A buffer one byte short must report the overflow, not overrun.
+    JsonWriter w(fixed.data(), fixed.size() - 1);
+    write_json(w, c.doc);
+    if (w.ok()) {
+      fprintf(stderr, "MISMATCH (%s): overflow not reported\n", c.name);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+const bench::Register registration{
+    "json", "JSON serialization of objects  [width depth iterations]", run};
+
+} // namespace
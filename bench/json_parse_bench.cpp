@@ -0,0 +1,414 @@
+// Reading a few fields of a large request body.
+//
+// The body is an object with `items` entries (ids, names with escapes,
+// nested tags, prices) followed by the `user` a route wants. Two fields
+// of `user` and one item's price are read from it: with JsonDocument, once
+// per available kernel, by indexing the body and walking the index to
+// them, and by an eager parser that builds the whole tree of maps, vectors
+// and decoded strings first, as a full Json value per request would. The
+// index alone is timed too.
+//
+// Every kernel's index must equal the one built by a reference scan that
+// steps through the text a byte at a time, on that body and on one made of
+// backslash runs and escaped quotes straddling the 64-byte blocks. The
+// fields read must match the eager parser's. Time, throughput and
+// allocations are per body.
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bench.h"
+#include "json_document.h"
+
+namespace {
+
+using namespace ServerLang;
+
+std::string make_body(const size_t items) {
+  std::string out = "{\"version\": 3, \"items\": [";
+  for (size_t i = 0; i < items; ++i) {
+    if (i)
+      out += ", ";
+    out += "{\"id\": " + std::to_string(i * 7919) + ", \"name\": \"item ";
+    out += std::to_string(i);
+    out += i % 8 == 0 ? " \\\"special\\\" \\u00e9\\n\"" : " plain\"";
+    out += ", \"tags\": [\"t" + std::to_string(i % 5) + "\", {\"k\": [" +
+           std::to_string(i % 3) + "]}], \"price\": ";
+    out += std::to_string(i) + "." + std::to_string(i % 100) + "}";
+  }
+  out += "], \"user\": {\"id\": 1234567, \"name\": \"J\\u00f6rg \\\"jo\\\" "
+         "\\ud83d\\ude00\", \"admin\": false, \"quota\": null}}";
+  return out;
+}
+
+// Strings of backslashes, escaped quotes and brackets at every alignment.
+std::string make_escapes(const size_t items) {
+  std::string out = "[";
+  for (size_t i = 0; i < items; ++i) {
+    if (i)
+      out += ",";
+    std::string s(i % 67, 'x');
+    for (size_t b = 0; b < i % 9; ++b)
+      s += "\\\\";
+    s += i % 2 ? "\\\"{[,:" : "]}\\\\";
+    out += "{\"" + s + "\":\"" + s + "\\\"\"}";
+  }
+  return out + "]";
+}
+
+// Structural offsets found one byte at a time, as JsonDocument::index
+// should find them with any kernel.
+std::vector<uint32_t> reference_index(const std::string_view text) {
+  std::vector<uint32_t> out;
+  bool inside = false;
+  for (size_t i = 0; i < text.size(); ++i) {
+    const char c = text[i];
+    if (inside && c == '\\')
+      ++i;
+    else if (c == '"') {
+      inside = !inside;
+      out.push_back(static_cast<uint32_t>(i));
+    } else if (!inside && (c == '{' || c == '}' || c == '[' || c == ']' ||
+                           c == ':' || c == ','))
+      out.push_back(static_cast<uint32_t>(i));
+  }
+  return out;
+}
+
+// An eagerly parsed value, every string decoded and every member kept.
+struct Node {
+  enum class Kind { NIL, BOOL, NUMBER, STRING, OBJECT, ARRAY } kind;
+  bool b = false;
+  double number = 0;
+  std::string text;
+  std::map<std::string, std::unique_ptr<Node>> members;
+  std::vector<std::unique_ptr<Node>> elements;
+
+  const Node *get(const std::string &key) const {
+    auto const it = members.find(key);
+    return it == members.end() ? nullptr : it->second.get();
+  }
+  const Node *get(const size_t n) const {
+    return n < elements.size() ? elements[n].get() : nullptr;
+  }
+};
+
+class EagerParser {
+public:
+  explicit EagerParser(const std::string_view text) : m_text(text) {}
+
+  std::unique_ptr<Node> parse() {
+    auto n = value();
+    blank();
+    return m_pos == m_text.size() ? std::move(n) : nullptr;
+  }
+
+private:
+  void blank() {
+    while (m_pos < m_text.size() &&
+           (m_text[m_pos] == ' ' || m_text[m_pos] == '\t' ||
+            m_text[m_pos] == '\n' || m_text[m_pos] == '\r'))
+      ++m_pos;
+  }
+
+  bool eat(const char c) {
+    blank();
+    if (m_pos < m_text.size() && m_text[m_pos] == c) {
+      ++m_pos;
+      return true;
+    }
+    return false;
+  }
+
+  std::unique_ptr<Node> value() {
+    blank();
+    if (m_pos == m_text.size())
+      return nullptr;
+    auto n = std::make_unique<Node>();
+    switch (m_text[m_pos]) {
+    case '{':
+      n->kind = Node::Kind::OBJECT;
+      ++m_pos;
+      if (eat('}'))
+        return n;
+      do {
+        blank();
+        std::string key;
+        if (!string(key) || !eat(':'))
+          return nullptr;
+        auto v = value();
+        if (!v)
+          return nullptr;
+        n->members.emplace(std::move(key), std::move(v));
+      } while (eat(','));
+      return eat('}') ? std::move(n) : nullptr;
+    case '[':
+      n->kind = Node::Kind::ARRAY;
+      ++m_pos;
+      if (eat(']'))
+        return n;
+      do {
+        auto v = value();
+        if (!v)
+          return nullptr;
+        n->elements.push_back(std::move(v));
+      } while (eat(','));
+      return eat(']') ? std::move(n) : nullptr;
+    case '"':
+      n->kind = Node::Kind::STRING;
+      return string(n->text) ? std::move(n) : nullptr;
+    case 't':
+    case 'f':
+    case 'n': {
+      const std::string_view word = m_text[m_pos] == 't'   ? "true"
+                                    : m_text[m_pos] == 'f' ? "false"
+                                                           : "null";
+      if (m_text.substr(m_pos, word.size()) != word)
+        return nullptr;
+      m_pos += word.size();
+      n->kind = word == "null" ? Node::Kind::NIL : Node::Kind::BOOL;
+      n->b = word == "true";
+      return n;
+    }
+    default: {
+      char *end;
+      const std::string number(m_text.substr(m_pos, 32));
+      n->kind = Node::Kind::NUMBER;
+      n->number = std::strtod(number.c_str(), &end);
+      if (end == number.c_str())
+        return nullptr;
+      m_pos += static_cast<size_t>(end - number.c_str());
+      return n;
+    }
+    }
+  }
+
+  bool string(std::string &out) {
+    if (m_text[m_pos] != '"')
+      return false;
+    for (++m_pos; m_pos < m_text.size(); ++m_pos) {
+      const char c = m_text[m_pos];
+      if (c == '"') {
+        ++m_pos;
+        return true;
+      }
+      if (c != '\\') {
+        out += c;
+        continue;
+      }
+      if (++m_pos == m_text.size())
+        return false;
+      switch (const char e = m_text[m_pos]) {
+      case 'n':
+        out += '\n';
+        break;
+      case 't':
+        out += '\t';
+        break;
+      case 'u': {
+        unsigned cp = hex(m_pos + 1);
+        m_pos += 4;
+        if (cp >= 0xD800 && cp < 0xDC00 &&
+            m_text.substr(m_pos + 1, 2) == "\\u") {
+          cp = 0x10000 + ((cp - 0xD800) << 10) + (hex(m_pos + 3) - 0xDC00);
+          m_pos += 6;
+        }
+        utf8(out, cp);
+        break;
+      }
+      default:
+        out += e;
+        break;
+      }
+    }
+    return false;
+  }
+
+  unsigned hex(const size_t at) const {
+    return static_cast<unsigned>(
+        std::strtoul(std::string(m_text.substr(at, 4)).c_str(), nullptr, 16));
+  }
+
+  static void utf8(std::string &out, const unsigned cp) {
+    if (cp < 0x80)
+      out += static_cast<char>(cp);
+    else if (cp < 0x800) {
+      out += static_cast<char>(0xC0 | (cp >> 6));
+      out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+      out += static_cast<char>(0xE0 | (cp >> 12));
+      out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+      out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else {
+      out += static_cast<char>(0xF0 | (cp >> 18));
+      out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+      out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+      out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+  }
+
+  std::string_view m_text;
+  size_t m_pos = 0;
+};
+
+// What a route reads: user.id, user.name and items[n].price.
+struct Fields {
+  int64_t id = 0;
+  std::string name;
+  double price = 0;
+
+  bool operator==(const Fields &o) const {
+    return id == o.id && name == o.name && price == o.price;
+  }
+};
+
+bool read_lazily(JsonDocument &doc, const std::string_view body,
+                 const size_t item, Fields &out) {
+  if (!doc.index(body))
+    return false;
+  const auto user = doc.find(JsonDocument::root, "user");
+  const auto items = doc.find(JsonDocument::root, "items");
+  out.name = doc.string(doc.find(user, "name"));
+  return doc.integer(doc.find(user, "id"), out.id) &&
+         doc.number(doc.find(doc.at(items, item), "price"), out.price);
+}
+
+bool read_eagerly(const std::string_view body, const size_t item,
+                  Fields &out) {
+  auto const root = EagerParser(body).parse();
+  const Node *user = root ? root->get("user") : nullptr;
+  const Node *items = root ? root->get("items") : nullptr;
+  const Node *entry = items ? items->get(item) : nullptr;
+  const Node *id = user ? user->get("id") : nullptr;
+  const Node *name = user ? user->get("name") : nullptr;
+  const Node *price = entry ? entry->get("price") : nullptr;
+  if (!id || !name || !price)
+    return false;
+  out.id = static_cast<int64_t>(id->number);
+  out.name = name->text;
+  out.price = price->number;
+  return true;
+}
+
+struct Measure {
+  double ns;
+  double allocs;
+};
+
+// Every kernel's index of `text` against the reference scan.
+bool check_index(const char *label, const std::string_view text) {
+  const auto want = reference_index(text);
+  for (auto const *kernels : Scan::available_kernels()) {
+    JsonDocument doc(*kernels);
+    bool same = doc.index(text) && doc.size() == want.size();
+    for (size_t i = 0; same && i < want.size(); ++i)
+      same = doc.offset(i + 1) == want[i];
+    if (!same) {
+      fprintf(stderr, "MISMATCH (%s, %s): index differs from the reference\n",
+              label, kernels->name);
+      return false;
+    }
+  }
+  return true;
+}
+
+// Whether every kernel accepts a document where the eager parser does,
+// above all when text follows the root.
+bool check_accepts() {
+  static const char *const texts[] = {
+      "{\"a\":1}", "{\"a\":1} \n", "{\"a\":1} x", "{\"a\":1} ,",
+      "[1,2] garbage", "[1,2]]", "\"s\" x", "\"s\"\t",
+      "12 x", " true ", "true false", "null}",
+  };
+  for (auto const *text : texts) {
+    const bool want = EagerParser(text).parse() != nullptr;
+    for (auto const *kernels : Scan::available_kernels()) {
+      JsonDocument doc(*kernels);
+      if (doc.index(text) != want) {
+        fprintf(stderr, "MISMATCH (%s): '%s' should be %s\n", kernels->name,
+                text, want ? "accepted" : "rejected");
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+int run(int argc, char **argv) {
+  const size_t items = bench::arg_or(argc, argv, 1, 2000);
+  const size_t iterations = bench::arg_or(argc, argv, 2, 200);
+
+  const std::string body = make_body(items);
+  const size_t item = items / 2;
+  if (!check_accepts() || !check_index("body", body) ||
+      !check_index("escapes", make_escapes(items)))
+    return 1;
+
+  auto const time = [&](auto &&read) {
+    bench::Stats stats;
+    size_t allocs = 0;
+    for (int round = 0; round < 5; ++round) {
+      auto const before = bench::alloc_stats();
+      auto const start = bench::Clock::now();
+      for (size_t i = 0; i < iterations; ++i)
+        read();
+      stats.add(bench::elapsed_ms(start));
+      allocs = bench::alloc_stats().count - before.count;
+    }
+    return Measure{stats.best * 1e6 / static_cast<double>(iterations),
+                   static_cast<double>(allocs) /
+                       static_cast<double>(iterations)};
+  };
+
+  Fields want;
+  if (!read_eagerly(body, item, want)) {
+    fprintf(stderr, "MISMATCH (eager): body did not parse\n");
+    return 1;
+  }
+
+  fprintf(stdout, "%zu items, %zu bytes\n", items, body.size());
+  fprintf(stdout, "%-30s %12s %9s %8s\n", "", "ns/body", "MB/s", "allocs");
+  auto const row = [&](const std::string &label, const Measure &m) {
+    fprintf(stdout, "%-30s %12.0f %9.1f %8.2f\n", label.c_str(), m.ns,
+            static_cast<double>(body.size()) / m.ns * 1e3, m.allocs);
+  };
+
+  for (auto const *kernels : Scan::available_kernels()) {
+    JsonDocument doc(*kernels);
+    Fields got;
+    bool ok = true;
+    const Measure lazy = time([&] {
+      ok = read_lazily(doc, body, item, got) && ok;
+      bench::do_not_optimize(got.id);
+    });
+    if (!ok || !(got == want)) {
+      fprintf(stderr, "MISMATCH (%s): fields differ from the eager parse\n",
+              kernels->name);
+      return 1;
+    }
+    row(std::string("index + 3 fields, ") + kernels->name, lazy);
+    const Measure index = time([&] {
+      bench::do_not_optimize(doc.index(body));
+    });
+    row(std::string("index only, ") + kernels->name, index);
+  }
+
+  Fields got;
+  const Measure eager = time([&] {
+    read_eagerly(body, item, got);
+    bench::do_not_optimize(got.id);
+  });
+  row("eager tree + 3 fields", eager);
+  return 0;
+}
+
+const bench::Register registration{
+    "jsonparse", "Lazy JSON body reads vs a full parse  [items iterations]",
+    run};
+
+} // namespace
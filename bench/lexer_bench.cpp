@@ -0,0 +1,276 @@
+// Differential check and throughput of the span-scanning tokenizer. Every
+// kernel set available on this CPU must produce exactly the token stream of
+// the original per-byte loop (reference_tokenizer.h) on generated corpora
+// before any timing is reported, with every token's offset pointing at its
+// first character. The one known difference, `[` and `]` as punctuators, is
+// allowed for explicitly and checked on its own. The line table behind
+// diagnostics is checked against a byte-by-byte line count and timed per
+// kernel: built once, then looked up.
+
+#include <cstdio>
+#include <iterator>
+#include <random>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "bench.h"
+#include "line_table.h"
+#include "reference_tokenizer.h"
+#include "tokenizer.h"
+
+namespace {
+
+// NSL-like text with the constructs the span kernels care about: long and
+// empty strings, strings starting with '/', comments containing quotes,
+// mixed blank runs and CRLF line ends.
+std::string generate_nsl(std::mt19937 &rng, const size_t size) {
+  static const char *const fragments[] = {
+      "var ",     "const ",    "def ",         "I32",   "String",
+      "Route",    "name",      "_tmp1",        "42",    "3.14",
+      "1.2.3",    ": ",        "::",           "=",     "==",
+      "&&",       "!",         "$",            ".",     "This.Body",
+      "@[/home]", "/*",        "{",            "}",     "(",
+      ")",        ";",         ",",            "+",     "-",
+      "*",        "^",         "[",            "]",     "%{0}",
+      "\"\"",     "\"/\"",     "\"//x\"",      "\"/a\"", "\"a b\tc\"",
+      "\"",       "// c \"q\" ", "//",         "/",     "\xC3\xA9",
+      " ",        "  ",        "\t",           "\n",    "\r\n",
+      "                                ",        "\n\n\n\t\t",
+  };
+  constexpr size_t count = sizeof(fragments) / sizeof(*fragments);
+  std::uniform_int_distribution<size_t> pick(0, count - 1);
+  std::uniform_int_distribution<int> len(0, 80);
+  std::uniform_int_distribution<int> printable(32, 126);
+
+  std::string out;
+  out.reserve(size + 128);
+  while (out.size() < size) {
+    if (rng() % 16 == 0) {
+      out.push_back(rng() % 2 ? '"' : '/');
+      if (out.back() == '/')
+        out.push_back('/');
+      for (int i = len(rng); i > 0; --i)
+        out.push_back(static_cast<char>(printable(rng)));
+      if (rng() % 4)
+        out.push_back(out.back() == '/' ? '\n' : '"');
+    } else
+      out += fragments[pick(rng)];
+  }
+  return out;
+}
+
+std::string generate_noise(std::mt19937 &rng, const size_t size) {
+  static const char alphabet[] = " \t\r\n\"/*a_Z09:;.{}()@$!&=+-^[]%\xC3";
+  std::uniform_int_distribution<size_t> pick(0, sizeof(alphabet) - 2);
+  std::string out(size, ' ');
+  for (auto &c : out)
+    c = alphabet[pick(rng)];
+  return out;
+}
+
+// Known difference: `[` and `]` are punctuators, lexed exactly like `(` and
+// `)`, where the original loop dropped them. The reference is run on the
+// source with brackets turned into parentheses, and token text is compared
+// through the same substitution.
+char as_reference(const char c) {
+  return c == '[' ? '(' : c == ']' ? ')' : c;
+}
+
+std::string reference_input(std::string source) {
+  for (auto &c : source)
+    c = as_reference(c);
+  return source;
+}
+
+bool same_text(const std::string_view expected,
+               const std::string_view actual) {
+  if (expected.size() != actual.size())
+    return false;
+  for (size_t i = 0; i < actual.size(); ++i)
+    if (expected[i] != as_reference(actual[i]))
+      return false;
+  return true;
+}
+
+bool same_tokens(const Tokenizer::token_list &a,
+                 const Tokenizer::token_list &b, size_t &at) {
+  for (at = 0; at < a.size() && at < b.size(); ++at) {
+    if (a[at].type() != b[at].type() ||
+        !same_text(a[at].const_data(), b[at].const_data()) ||
+        a[at].keyword() != b[at].keyword() ||
+        a[at].builtin_type() != b[at].builtin_type())
+      return false;
+  }
+  return a.size() == b.size();
+}
+
+// Offsets increase, and each token's text starts at its offset, or right
+// after it for a string literal (or a comment that began as one). Text that
+// was copied because characters were dropped from it is only checked for
+// its first character, and empty text not at all.
+bool offsets_match(const std::string_view source,
+                   const Tokenizer::token_list &tokens, size_t &at) {
+  for (at = 0; at < tokens.size(); ++at) {
+    auto const &t = tokens[at];
+    const size_t offset = t.offset();
+    if (offset >= source.size() ||
+        (at && offset <= tokens[at - 1].offset()))
+      return false;
+    auto const text = t.const_data();
+    const size_t first = offset + (source[offset] == '"');
+    if (source.data() <= text.data() &&
+        text.data() < source.data() + source.size()) {
+      if (text.data() != source.data() + first)
+        return false;
+    } else if (!text.empty() && source.substr(first, 1) != text.substr(0, 1))
+      return false;
+  }
+  return true;
+}
+
+// The punctuator rule itself: a subscript splits into punctuators, and
+// brackets inside strings and comments stay text.
+bool check_brackets() {
+  using T = Token::TokenType;
+  const std::string source = "b[\"k\"][0] \"[x]\" // [y]\n";
+  const std::pair<T, std::string_view> want[] = {
+      {T::IDENTIFIER, "b"},      {T::PUNCTUATOR, "["},
+      {T::STRING_LITERAL, "k"},  {T::PUNCTUATOR, "]"},
+      {T::PUNCTUATOR, "["},      {T::NUMERIC_LITERAL, "0"},
+      {T::PUNCTUATOR, "]"},      {T::STRING_LITERAL, "[x]"},
+      {T::COMMENT, "// [y]"},
+  };
+  for (auto const *k : ServerLang::Scan::available_kernels()) {
+    auto const tokens = Tokenizer::evaluate(source, *k);
+    bool ok = tokens.size() == std::size(want);
+    for (size_t i = 0; ok && i < tokens.size(); ++i)
+      ok = tokens[i].type() == want[i].first &&
+           tokens[i].const_data() == want[i].second;
+    if (!ok) {
+      fprintf(stderr, "MISMATCH: kernels '%s' lex brackets differently\n",
+              k->name);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool verify(const std::string &source, const char *what, const size_t seed) {
+  // Reference tokens may point into the text they were lexed from.
+  auto const input = reference_input(source);
+  auto const expected = reference::evaluate(input);
+  for (auto const *k : ServerLang::Scan::available_kernels()) {
+    auto const actual = Tokenizer::evaluate(source, *k);
+    size_t at = 0;
+    if (!offsets_match(source, actual, at)) {
+      fprintf(stderr,
+              "MISMATCH: %s corpus, seed %zu, kernels '%s', offset of token "
+              "%zu\n",
+              what, seed, k->name, at);
+      return false;
+    }
+    if (!same_tokens(expected, actual, at)) {
+      fprintf(stderr,
+              "MISMATCH: %s corpus, seed %zu, kernels '%s', token %zu "
+              "(%zu vs %zu tokens)\n",
+              what, seed, k->name, at, expected.size(), actual.size());
+      return false;
+    }
+  }
+  return true;
+}
+
+int run(int argc, char **argv) {
+  const size_t size_mb = bench::arg_or(argc, argv, 1, 8);
+  const size_t seeds = bench::arg_or(argc, argv, 2, 200);
+
+  if (!check_brackets())
+    return 1;
+  for (size_t seed = 1; seed <= seeds; ++seed) {
+    std::mt19937 rng(static_cast<uint32_t>(seed));
+    const size_t size = 1 + rng() % 4096;
+    if (!verify(generate_nsl(rng, size), "nsl", seed) ||
+        !verify(generate_noise(rng, size), "noise", seed))
+      return 1;
+  }
+  fprintf(stdout, "differential: %zu seeds x 2 corpora match reference\n",
+          seeds);
+
+  std::mt19937 rng(0x5eed);
+  auto const source = generate_nsl(rng, size_mb << 20);
+  if (!verify(source, "timing", 0))
+    return 1;
+
+  const int iterations = 5;
+  auto measure = [&](const char *name, auto &&lex) {
+    bench::Stats stats;
+    size_t tokens = 0;
+    for (int i = 0; i < iterations; ++i) {
+      auto const start = bench::Clock::now();
+      auto const list = lex();
+      stats.add(bench::elapsed_ms(start));
+      tokens = list.size();
+    }
+    fprintf(stdout, "%-10s %8.2f ms  %8.1f MB/s  %7.2f Mtok/s\n", name,
+            stats.best, source.size() / 1e3 / stats.best,
+            tokens / 1e3 / stats.best);
+  };
+
+  fprintf(stdout, "corpus: %.1f MB, best of %d\n", source.size() / 1e6,
+          iterations);
+  measure("reference", [&] { return reference::evaluate(source); });
+  for (auto const *k : ServerLang::Scan::available_kernels())
+    measure(k->name, [&] { return Tokenizer::evaluate(source, *k); });
+
+  // Line of every 4097th byte, counted one byte at a time.
+  struct Probe {
+    size_t offset;
+    ServerLang::SourcePosition at;
+  };
+  std::vector<Probe> probes;
+  uint32_t line = 1, column = 1;
+  for (size_t i = 0; i <= source.size(); ++i) {
+    if (i % 4097 == 0 || i == source.size())
+      probes.push_back({i, {line, column}});
+    if (i < source.size() && source[i] == '\n') {
+      ++line;
+      column = 1;
+    } else
+      ++column;
+  }
+
+  fprintf(stdout, "line table: %u lines\n", line);
+  for (auto const *k : ServerLang::Scan::available_kernels()) {
+    bench::Stats build, lookup;
+    for (int i = 0; i < iterations; ++i) {
+      ServerLang::LineTable table(source, *k);
+      auto start = bench::Clock::now();
+      bench::do_not_optimize(table.lines());
+      build.add(bench::elapsed_ms(start));
+      start = bench::Clock::now();
+      for (auto const &p : probes) {
+        auto const got = table.position(p.offset);
+        if (got.line != p.at.line || got.column != p.at.column) {
+          fprintf(stderr,
+                  "MISMATCH: kernels '%s', offset %zu at %u:%u, expected "
+                  "%u:%u\n",
+                  k->name, p.offset, got.line, got.column, p.at.line,
+                  p.at.column);
+          return 1;
+        }
+      }
+      lookup.add(bench::elapsed_ms(start));
+    }
+    fprintf(stdout, "%-10s %8.2f ms  %8.1f MB/s  %7.1f ns/lookup\n", k->name,
+            build.best, source.size() / 1e3 / build.best,
+            lookup.best * 1e6 / static_cast<double>(probes.size()));
+  }
+  return 0;
+}
+
+const bench::Register registration{
+    "lexer", "Tokenizer kernels vs per-byte reference  [size_mb seeds]", run};
+
+} // namespace
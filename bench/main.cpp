@@ -0,0 +1,26 @@
+#include <cstdio>
+#include <string_view>
+
+#include "bench.h"
+
+static void print_suites(const char *prog) {
+  fprintf(stderr, "Usage: %s <suite> [args...]\n\nSuites:\n", prog);
+  for (auto const &s : bench::registry())
+    fprintf(stderr, "  %-12s %s\n", s.name, s.summary);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    print_suites(argv[0]);
+    return 1;
+  }
+
+  const std::string_view name = argv[1];
+  for (auto const &s : bench::registry())
+    if (name == s.name)
+      return s.run(argc - 1, argv + 1);
+
+  fprintf(stderr, "Unknown suite: %s\n\n", argv[1]);
+  print_suites(argv[0]);
+  return 1;
+}
@@ -0,0 +1,162 @@
+// Cost of a native call, per call site.
+//
+// A script function sums `calls` calls of Core::Length(s). Compiled, each
+// site is bound at load to a CALLN on the native's marshalling stub. That is
+// compared with the same sum over a script function, with the stub called
+// through a function pointer from C++, with Core::length itself called
+// through a function pointer, and with a by-name dispatcher that walks
+// "Core" -> "Length" through string-keyed maps and boxes the arguments into
+// a vector on every call, as a runtime without link-time binding would. All
+// of them must produce the same sum.
+
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "bench.h"
+#include "libraries.h"
+#include "runtime.h"
+#include "syntax_analyzer.h"
+
+namespace {
+
+using namespace ServerLang;
+
+std::string script(const size_t calls) {
+  std::string out = "//NAISYS SERVERLANG\n\n@lib[\"Core\"];\n\n"
+                    "def len (var s: String = \"\") : I64 {\n"
+                    "    return 5;\n}\n\n";
+  for (const char *callee : {"Core::Length", "len"}) {
+    out += callee[0] == 'l' ? "def by_script" : "def by_native";
+    out += " (var s: String = \"\") : I64 {\n    return 0";
+    for (size_t i = 0; i < calls; ++i)
+      out += std::string(" + ") + callee + "(s)";
+    out += ";\n}\n\n";
+  }
+  return out;
+}
+
+// Resolves the qualified name on every call, one `::` component at a time.
+class ByName {
+public:
+  explicit ByName(const NativeRegistry &natives) {
+    auto const *core = natives.find("Core");
+    m_roots["Core"]["Length"] = *core->find(intern("Core::Length"));
+  }
+
+  Value call(Machine &vm, const std::string &name,
+             const std::vector<Value> &args) {
+    const auto sep = name.find("::");
+    auto &lib = m_roots.at(name.substr(0, sep));
+    auto const &n = lib.at(name.substr(sep + 2));
+    return n.fn(vm, args.data(), static_cast<uint16_t>(args.size()));
+  }
+
+private:
+  std::unordered_map<std::string, std::unordered_map<std::string, Native>>
+      m_roots;
+};
+
+int run(int argc, char **argv) {
+  const size_t calls = bench::arg_or(argc, argv, 1, 64);
+  const size_t iterations = bench::arg_or(argc, argv, 2, 20000);
+
+  auto const source = script(calls);
+  TokenStream tokens(source);
+  SyntaxAnalyzer analyzer;
+  auto result = analyzer.analyze(tokens);
+  Program program;
+  Compiler compiler(program);
+  compiler.import_library("Core");
+  compiler.compile_module(result.nodes());
+  if (compiler.errors())
+    return 1;
+  Machine vm(program);
+
+  const std::string text = "hello";
+  const Value arg = Value::string(&text);
+  const auto want = static_cast<int64_t>(calls * text.size());
+  int64_t got[5] = {};
+
+  auto const per_call = [&](bench::Stats &stats) {
+    return stats.best * 1e6 / static_cast<double>(iterations * calls);
+  };
+  auto const time = [&](auto &&body, int64_t &sum) {
+    bench::Stats stats;
+    for (int round = 0; round < 5; ++round) {
+      auto const start = bench::Clock::now();
+      for (size_t i = 0; i < iterations; ++i) {
+        vm.release(0);
+        sum = body();
+      }
+      stats.add(bench::elapsed_ms(start));
+    }
+    return per_call(stats);
+  };
+
+  const uint16_t native_chunk = program.function(intern("by_native"));
+  const uint16_t script_chunk = program.function(intern("by_script"));
+  const double native = time(
+      [&] { return vm.run(native_chunk, &arg, 1).i; }, got[0]);
+  const double scripted = time(
+      [&] { return vm.run(script_chunk, &arg, 1).i; }, got[1]);
+
+  const Native bound =
+      *builtin_libraries().find("Core")->find(intern("Core::Length"));
+  volatile Native::Fn stub = bound.fn;
+  const double through_stub = time(
+      [&] {
+        int64_t sum = 0;
+        for (size_t c = 0; c < calls; ++c)
+          sum += stub(vm, &arg, 1).i;
+        return sum;
+      },
+      got[2]);
+
+  int64_t (*volatile length)(std::string_view) = &Core::length;
+  const double direct = time(
+      [&] {
+        int64_t sum = 0;
+        for (size_t c = 0; c < calls; ++c)
+          sum += length(*arg.s);
+        return sum;
+      },
+      got[3]);
+
+  ByName by_name(builtin_libraries());
+  const std::string name = "Core::Length";
+  const double looked_up = time(
+      [&] {
+        int64_t sum = 0;
+        for (size_t c = 0; c < calls; ++c)
+          sum += by_name.call(vm, name, {arg}).i;
+        return sum;
+      },
+      got[4]);
+
+  for (auto const g : got)
+    if (g != want) {
+      fprintf(stderr, "MISMATCH: sum %lld, expected %lld\n",
+              static_cast<long long>(g), static_cast<long long>(want));
+      return 1;
+    }
+
+  fprintf(stdout, "%zu call sites x %zu runs, ns per call site\n", calls,
+          iterations);
+  fprintf(stdout, "%-34s %8.2f\n", "C++ through a function pointer", direct);
+  fprintf(stdout, "%-34s %8.2f\n", "stub through a function pointer",
+          through_stub);
+  fprintf(stdout, "%-34s %8.2f\n", "bytecode, bound native (CALLN)", native);
+  fprintf(stdout, "%-34s %8.2f\n", "bytecode, script function (CALL)",
+          scripted);
+  fprintf(stdout, "%-34s %8.2f  (%.1fx the bound call)\n",
+          "resolved by name on every call", looked_up, looked_up / native);
+  return 0;
+}
+
+const bench::Register registration{
+    "natives", "Native call cost, bound vs by name  [calls iterations]", run};
+
+} // namespace
@@ -0,0 +1,78 @@
+// Parse cost per token as the nesting depth grows. The same statements are
+// wrapped in `depth` levels of Class/Route bodies; when compound bodies were
+// copied out and re-analyzed, every level added another pass over the inner
+// tokens. Flat ns/token across depths means each token is visited a constant
+// number of times.
+
+#include <cstdio>
+#include <string>
+
+#include "bench.h"
+#include "syntax_analyzer.h"
+#include "tokenizer.h"
+
+namespace {
+
+std::string generate_nested(const size_t depth, const size_t statements) {
+  std::string out;
+  for (size_t d = 0; d < depth; ++d) {
+    out += d % 2 ? "const c" + std::to_string(d) + ": Class = {\n"
+                 : "const @[/r" + std::to_string(d) + "]: Route = {\n";
+  }
+  for (size_t i = 0; i < statements; ++i)
+    out += "var v" + std::to_string(i) + " = " + std::to_string(i) + ";\n";
+  for (size_t d = 0; d < depth; ++d)
+    out += "};\n";
+  return out;
+}
+
+size_t count_nodes(const ServerLang::node_list &nodes) {
+  size_t n = 0;
+  for (auto const *v : nodes)
+    if (v)
+      n += 1 + count_nodes(v->children_const());
+  return n;
+}
+
+int run(int argc, char **argv) {
+  const size_t statements = bench::arg_or(argc, argv, 1, 20000);
+  const size_t iterations = bench::arg_or(argc, argv, 2, 5);
+
+  fprintf(stdout, "%zu statements, best of %zu\n", statements, iterations);
+  fprintf(stdout, "%6s %9s %8s %14s %14s\n", "depth", "tokens", "nodes",
+          "stream ns/tok", "range ns/tok");
+  for (size_t depth = 1; depth <= 512; depth *= 2) {
+    auto const source = generate_nested(depth, statements);
+    auto const tokens = Tokenizer::evaluate(source);
+
+    bench::Stats stream, range;
+    size_t nodes = 0;
+    for (size_t i = 0; i < iterations; ++i) {
+      SyntaxAnalyzer analyzer;
+      TokenStream cursor(source);
+      auto start = bench::Clock::now();
+      auto const a = analyzer.analyze(cursor);
+      stream.add(bench::elapsed_ms(start));
+      nodes = count_nodes(a.nodes());
+
+      start = bench::Clock::now();
+      auto const b = analyzer.analyze(tokens);
+      range.add(bench::elapsed_ms(start));
+      if (count_nodes(b.nodes()) != nodes) {
+        fprintf(stderr, "MISMATCH: depth %zu, %zu vs %zu nodes\n", depth,
+                nodes, count_nodes(b.nodes()));
+        return 1;
+      }
+    }
+    fprintf(stdout, "%6zu %9zu %8zu %14.1f %14.1f\n", depth, tokens.size(),
+            nodes, stream.best * 1e6 / tokens.size(),
+            range.best * 1e6 / tokens.size());
+  }
+  return 0;
+}
+
+const bench::Register registration{
+    "nesting", "Parse cost per token vs nesting depth  [statements iters]",
+    run};
+
+} // namespace
@@ -0,0 +1,248 @@
+// End-to-end cost of each pipeline stage on a generated corpus:
+// Tokenizer::evaluate, SyntaxAnalyzer::analyze (on the pre-lexed list) and
+// Runtime::eval. Every stage reports throughput, heap allocations and peak
+// RSS, and the run is written as JSON so results can be diffed.
+//
+// Arguments are key=value pairs; see print_help(). `corpus` writes the
+// generated script instead, for use with ServerLang_Prototype.
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "bench.h"
+#include "corpus.h"
+#include "runtime.h"
+#include "syntax_analyzer.h"
+#include "tokenizer.h"
+
+namespace {
+
+struct Options {
+  bench::CorpusSpec spec;
+  size_t iterations = 5;
+  std::string json = "pipeline.json";
+  std::string out; // corpus suite only; empty means stdout
+};
+
+void print_help(const char *suite) {
+  fprintf(stderr,
+          "Usage: %s [key=value...]\n"
+          "  routes=N functions=N classes=N statements=N depth=N\n"
+          "  strings=0..1 comments=0..1 seed=N iters=N json=path out=path\n",
+          suite);
+}
+
+bool parse_options(int argc, char **argv, Options &opts) {
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    const auto eq = arg.find('=');
+    if (eq == std::string_view::npos) {
+      fprintf(stderr, "Expected key=value, got: %s\n", argv[i]);
+      return false;
+    }
+    const auto key = arg.substr(0, eq);
+    const char *value = argv[i] + eq + 1;
+    auto &s = opts.spec;
+    if (key == "routes")
+      s.routes = std::strtoull(value, nullptr, 10);
+    else if (key == "functions")
+      s.functions = std::strtoull(value, nullptr, 10);
+    else if (key == "classes")
+      s.classes = std::strtoull(value, nullptr, 10);
+    else if (key == "statements")
+      s.statements = std::strtoull(value, nullptr, 10);
+    else if (key == "depth")
+      s.depth = std::strtoull(value, nullptr, 10);
+    else if (key == "strings")
+      s.string_density = std::strtod(value, nullptr);
+    else if (key == "comments")
+      s.comment_density = std::strtod(value, nullptr);
+    else if (key == "seed")
+      s.seed = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+    else if (key == "iters")
+      opts.iterations = std::strtoull(value, nullptr, 10);
+    else if (key == "json")
+      opts.json = value;
+    else if (key == "out")
+      opts.out = value;
+    else {
+      fprintf(stderr, "Unknown option: %s\n", argv[i]);
+      return false;
+    }
+  }
+  return opts.iterations > 0;
+}
+
+// Peak RSS in KiB. On Linux the high-water mark can be reset through
+// /proc/self/clear_refs, which lets every stage report its own peak; where
+// that fails the value is the process-wide peak so far.
+long peak_rss_kb() {
+  if (FILE *f = fopen("/proc/self/status", "r")) {
+    char line[256];
+    long kb = -1;
+    while (fgets(line, sizeof(line), f))
+      if (std::strncmp(line, "VmHWM:", 6) == 0) {
+        kb = std::strtol(line + 6, nullptr, 10);
+        break;
+      }
+    fclose(f);
+    if (kb >= 0)
+      return kb;
+  }
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+void reset_peak_rss() {
+  if (FILE *f = fopen("/proc/self/clear_refs", "w")) {
+    fputs("5", f);
+    fclose(f);
+  }
+}
+
+struct StageResult {
+  const char *name = nullptr;
+  bench::Stats time;
+  size_t items = 0; // tokens, nodes or declarations
+  const char *item_name = nullptr;
+  size_t allocs = 0; // per iteration
+  size_t alloc_bytes = 0;
+  long peak_rss_kb = 0;
+};
+
+// Times `iterations` runs of `fn`, which returns the number of items it
+// produced. Allocation counts are taken from the last run.
+template <typename Fn>
+StageResult measure(const char *name, const char *item_name,
+                    const size_t iterations, Fn &&fn) {
+  StageResult r;
+  r.name = name;
+  r.item_name = item_name;
+  reset_peak_rss();
+  for (size_t i = 0; i < iterations; ++i) {
+    auto const before = bench::alloc_stats();
+    auto const start = bench::Clock::now();
+    r.items = fn();
+    r.time.add(bench::elapsed_ms(start));
+    auto const after = bench::alloc_stats();
+    r.allocs = after.count - before.count;
+    r.alloc_bytes = after.bytes - before.bytes;
+  }
+  r.peak_rss_kb = peak_rss_kb();
+  return r;
+}
+
+size_t count_nodes(const ServerLang::node_list &nodes) {
+  size_t n = 0;
+  for (auto const *v : nodes)
+    if (v)
+      n += 1 + count_nodes(v->children_const());
+  return n;
+}
+
+bool write_json(const Options &opts, const size_t bytes,
+                const std::vector<StageResult> &stages) {
+  FILE *f = fopen(opts.json.c_str(), "w");
+  if (!f) {
+    fprintf(stderr, "Could not write %s\n", opts.json.c_str());
+    return false;
+  }
+  auto const &s = opts.spec;
+  fprintf(f,
+          "{\n  \"corpus\": {\"bytes\": %zu, \"routes\": %zu, "
+          "\"functions\": %zu, \"classes\": %zu, \"statements\": %zu, "
+          "\"depth\": %zu, \"string_density\": %g, \"comment_density\": %g, "
+          "\"seed\": %u},\n  \"iterations\": %zu,\n  \"stages\": [\n",
+          bytes, s.routes, s.functions, s.classes, s.statements, s.depth,
+          s.string_density, s.comment_density, s.seed, opts.iterations);
+  for (size_t i = 0; i < stages.size(); ++i) {
+    auto const &r = stages[i];
+    const double sec = r.time.best / 1e3;
+    fprintf(f,
+            "    {\"name\": \"%s\", \"best_ms\": %.4f, \"mean_ms\": %.4f, "
+            "\"mb_per_s\": %.2f, \"%s\": %zu, \"%s_per_s\": %.0f, "
+            "\"allocations\": %zu, \"allocated_bytes\": %zu, "
+            "\"peak_rss_kb\": %ld}%s\n",
+            r.name, r.time.best, r.time.mean(), bytes / 1e6 / sec,
+            r.item_name, r.items, r.item_name, r.items / sec, r.allocs,
+            r.alloc_bytes, r.peak_rss_kb, i + 1 < stages.size() ? "," : "");
+  }
+  fprintf(f, "  ]\n}\n");
+  fclose(f);
+  return true;
+}
+
+int run(int argc, char **argv) {
+  Options opts;
+  if (!parse_options(argc, argv, opts)) {
+    print_help(argv[0]);
+    return 1;
+  }
+
+  auto const source = bench::CorpusGenerator(opts.spec).generate();
+  auto const tokens = Tokenizer::evaluate(source);
+
+  std::vector<StageResult> stages;
+  stages.push_back(measure("tokenize", "tokens", opts.iterations, [&] {
+    auto const list = Tokenizer::evaluate(source);
+    return list.size();
+  }));
+  stages.push_back(measure("analyze", "nodes", opts.iterations, [&] {
+    SyntaxAnalyzer analyzer;
+    auto const result = analyzer.analyze(tokens);
+    return count_nodes(result.nodes());
+  }));
+
+  SyntaxAnalyzer analyzer;
+  auto const result = analyzer.analyze(tokens);
+  stages.push_back(measure("eval", "decls", opts.iterations, [&] {
+    Runtime rt;
+    rt.eval(result);
+    return result.nodes().size();
+  }));
+
+  fprintf(stdout, "corpus: %.2f MB, %zu tokens, best of %zu\n",
+          source.size() / 1e6, tokens.size(), opts.iterations);
+  for (auto const &r : stages) {
+    const double sec = r.time.best / 1e3;
+    fprintf(stdout,
+            "%-9s %9.3f ms %8.1f MB/s %8.2f M%s/s %9zu allocs %8ld KiB peak\n",
+            r.name, r.time.best, source.size() / 1e6 / sec,
+            r.items / 1e6 / sec, r.item_name, r.allocs, r.peak_rss_kb);
+  }
+  return write_json(opts, source.size(), stages) ? 0 : 1;
+}
+
+int run_corpus(int argc, char **argv) {
+  Options opts;
+  if (!parse_options(argc, argv, opts)) {
+    print_help(argv[0]);
+    return 1;
+  }
+  auto const source = bench::CorpusGenerator(opts.spec).generate();
+  FILE *f = opts.out.empty() ? stdout : fopen(opts.out.c_str(), "w");
+  if (!f) {
+    fprintf(stderr, "Could not write %s\n", opts.out.c_str());
+    return 1;
+  }
+  fwrite(source.data(), 1, source.size(), f);
+  if (f != stdout)
+    fclose(f);
+  return 0;
+}
+
+const bench::Register registration{
+    "pipeline", "Tokenize/analyze/eval throughput as JSON  [key=value...]",
+    run};
+
+const bench::Register corpus_registration{
+    "corpus", "Write a generated NSL corpus  [key=value... out=path]",
+    run_corpus};
+
+} // namespace
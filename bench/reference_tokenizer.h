@@ -0,0 +1,162 @@
+#pragma once
+
+// Frozen copy of the original per-byte Tokenizer::evaluate loop. The lexer
+// suite checks the span-scanning tokenizer against it, token for token.
+
+#include <string_view>
+
+#include "tokenizer.h"
+
+namespace reference {
+
+inline void end_token(Token &_token, Tokenizer::token_list &_list) {
+  if (_token.type() != Token::TokenType::WHITE_SPACE) {
+    _token.classify();
+    _list.push_back(_token);
+  }
+  _token.setType(Token::TokenType::WHITE_SPACE);
+  _token.clear();
+}
+
+inline Tokenizer::token_list evaluate(std::string_view source) {
+  Tokenizer::token_list list;
+  Token current_token;
+  for (auto const &v : source) {
+    switch (v) {
+    case 48 ... 57: // 0-9
+      if (current_token.type() == Token::TokenType::WHITE_SPACE) {
+        current_token.setType(Token::TokenType::NUMERIC_LITERAL);
+        current_token.append(v);
+      } else
+        current_token.append(v);
+      break;
+
+    case '_':
+    case 65 ... 90:  // A-Z
+    case 97 ... 122: // a-z
+      if (__NOT_STRING_OR_COMMENT__) {
+        // if (current_token.type() != Token::TokenType::IDENTIFIER) {
+        //   end_token(current_token, list);
+        //   current_token.setType(Token::TokenType::IDENTIFIER);
+        // }
+        current_token.setType(Token::TokenType::IDENTIFIER);
+        current_token.append(v);
+      } else
+        current_token.append(v);
+      break;
+    case '{':
+    case '}':
+    case '(':
+    case ')':
+    case ';':
+    case ',':
+    case '@':
+      if (__NOT_STRING_OR_COMMENT__) {
+        end_token(current_token, list);
+        current_token.setType(Token::TokenType::PUNCTUATOR);
+        current_token.append(v);
+        end_token(current_token, list);
+      } else
+        current_token.append(v);
+      break;
+    case ':':
+      if (current_token.type() == Token::TokenType::PUNCTUATOR &&
+          current_token.const_data() == ":") {
+        current_token.setType(Token::TokenType::ACCESS_OPERATOR);
+        current_token.append(v);
+        end_token(current_token, list);
+      } else if (__NOT_STRING_OR_COMMENT__) {
+        end_token(current_token, list);
+        current_token.setType(Token::TokenType::PUNCTUATOR);
+        current_token.append(v);
+        // end_token(current_token, list);
+      } else
+        current_token.append(v);
+      break;
+    case '$':
+      if (__NOT_STRING_OR_COMMENT__) {
+        current_token.setType(Token::TokenType::POINTER_OPERATOR);
+        current_token.append(v);
+        end_token(current_token, list);
+      } else {
+        current_token.append(v);
+      }
+      break;
+    case '.':
+      if (current_token.type() == Token::TokenType::NUMERIC_LITERAL)
+        current_token.append(v);
+      else if (__NOT_STRING_OR_COMMENT__) {
+        current_token.setType(Token::TokenType::ACCESS_OPERATOR);
+        current_token.append(v);
+        end_token(current_token, list);
+      } else {
+        current_token.append(v);
+      }
+      break;
+    case '!':
+    case '&':
+    case '|':
+    case '>':
+    case '<':
+      if (__NOT_STRING_OR_COMMENT__) {
+        current_token.setType(Token::TokenType::LOGIC_OPERATOR);
+        current_token.append(v);
+      } else
+        current_token.append(v);
+      break;
+    case '*':
+      if (__NOT_STRING_OR_COMMENT__ && current_token.const_data() == "/") {
+        current_token.setType(Token::TokenType::IDENTIFIER);
+        current_token.append(v);
+      } else if (__NOT_STRING_OR_COMMENT__) {
+        current_token.setType(Token::TokenType::ARITHMETIC_OPERATOR);
+        current_token.append(v);
+      } else
+        current_token.append(v);
+      break;
+    case '/':
+      if (current_token.const_data() == "/")
+        current_token.setType(Token::TokenType::COMMENT);
+      [[fallthrough]];
+    case '+':
+    case '-':
+    case '^':
+    case '=':
+      if (__NOT_STRING_OR_COMMENT__) {
+        current_token.setType(Token::TokenType::ARITHMETIC_OPERATOR);
+        current_token.append(v);
+      } else
+        current_token.append(v);
+      break;
+    case '\r':
+    case '\n':
+      end_token(current_token, list);
+      break;
+    case '\t':
+    case ' ':
+      if (current_token.type() == Token::TokenType::STRING_LITERAL ||
+          current_token.type() == Token::TokenType::COMMENT)
+        current_token.append(v);
+      else
+        end_token(current_token, list);
+      break;
+    case '\"':
+      if (__NOT_STRING_OR_COMMENT__) {
+        end_token(current_token, list);
+        current_token.setType(Token::TokenType::STRING_LITERAL);
+      } else if (current_token.type() == Token::TokenType::STRING_LITERAL) {
+        end_token(current_token, list);
+      }
+      break;
+    default:
+      if (current_token.type() == Token::TokenType::STRING_LITERAL ||
+          current_token.type() == Token::TokenType::COMMENT)
+        current_token.append(v);
+
+      break;
+    }
+  }
+  return list;
+}
+
+} // namespace reference
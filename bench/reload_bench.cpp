@@ -0,0 +1,245 @@
+// Hot reload: the cost of publishing a new version and what it does to
+// requests being served at the same time.
+//
+// A root script imports `files` generated scripts. The suite reports a cold
+// load, a reload after editing one import (only that file, and the root,
+// whose compiled image was linked against it, are parsed again),
+// the time from a save to the new version being live through inotify, and
+// route lookup latency on reader threads with and without reloads running.
+// A reader pinned to the old version must keep seeing it across a reload.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "corpus.h"
+#include "hot_reload.h"
+
+namespace {
+
+using namespace ServerLang;
+
+// How long a save may take to go live before the suite fails.
+constexpr int save_timeout_s = 5;
+
+void write_file(const std::string &path, const std::string &text) {
+  std::ofstream(path, std::ios::binary | std::ios::trunc) << text;
+}
+
+// Appends a route only the edited version declares.
+void edit(const std::string &path, const std::string &base,
+          const size_t serial) {
+  write_file(path, base + "const @[/edit/" + std::to_string(serial) +
+                       "]: Route = {\n    This.Body = \"edited\";\n};\n");
+}
+
+struct Latency {
+  double p50, p99, max;
+};
+
+Latency percentiles(std::vector<uint32_t> &ns) {
+  if (ns.empty())
+    return {0, 0, 0};
+  std::sort(ns.begin(), ns.end());
+  return {static_cast<double>(ns[ns.size() / 2]),
+          static_cast<double>(ns[ns.size() * 99 / 100]),
+          static_cast<double>(ns.back())};
+}
+
+// Readers look up random routes, each request pinning the current version,
+// until `stop`. Returns every request's latency in ns.
+std::vector<uint32_t> serve(RcuCell<LoadedProgram> &programs,
+                            const std::vector<std::string> &paths,
+                            const size_t readers, std::atomic<bool> &stop) {
+  std::vector<std::vector<uint32_t>> samples(readers);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < readers; ++t)
+    threads.emplace_back([&, t] {
+      RcuCell<LoadedProgram>::Reader reader(programs);
+      std::mt19937 rng(static_cast<uint32_t>(t));
+      auto &out = samples[t];
+      while (!stop.load(std::memory_order_relaxed)) {
+        auto const &path = paths[rng() % paths.size()];
+        auto const start = bench::Clock::now();
+        {
+          RcuCell<LoadedProgram>::Guard program(reader);
+          bench::do_not_optimize(program->runtime.match_route(path));
+        }
+        out.push_back(static_cast<uint32_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                bench::Clock::now() - start)
+                .count()));
+      }
+    });
+  for (auto &t : threads)
+    t.join();
+  std::vector<uint32_t> all;
+  for (auto &s : samples)
+    all.insert(all.end(), s.begin(), s.end());
+  return all;
+}
+
+int run(int argc, char **argv) {
+  const size_t files = bench::arg_or(argc, argv, 1, 16);
+  const size_t routes = bench::arg_or(argc, argv, 2, 500);
+  const size_t readers = bench::arg_or(argc, argv, 3, 2);
+  const size_t reloads = bench::arg_or(argc, argv, 4, 20);
+
+  const std::string dir =
+      "/tmp/serverlang_reload_" + std::to_string(::getpid());
+  if (::mkdir(dir.c_str(), 0700) != 0) {
+    fprintf(stderr, "Could not create %s\n", dir.c_str());
+    return 1;
+  }
+  const std::string root_path = dir + "/root.nsl";
+
+  // Removes the generated files however the suite ends; declared before
+  // the reloader, so its watcher has stopped by then.
+  struct Cleanup {
+    const std::string &dir, &root_path;
+    size_t files;
+    ~Cleanup() {
+      for (size_t f = 0; f < files; ++f)
+        std::remove((dir + "/part_" + std::to_string(f) + ".nsl").c_str());
+      std::remove(root_path.c_str());
+      std::remove(CompiledImage::path_for(root_path).c_str());
+      ::rmdir(dir.c_str());
+    }
+  } const cleanup{dir, root_path, files};
+
+  std::string root = "//NAISYS SERVERLANG\n\n";
+  std::vector<std::string> imports;
+  for (size_t f = 0; f < files; ++f) {
+    bench::CorpusSpec spec;
+    spec.routes = routes;
+    spec.functions = routes / 4;
+    spec.classes = routes / 4;
+    spec.seed = static_cast<uint32_t>(f + 1);
+    imports.push_back(bench::CorpusGenerator(spec).generate());
+    const auto name = "part_" + std::to_string(f) + ".nsl";
+    write_file(dir + "/" + name, imports.back());
+    root += "@script[\"" + name + "\"];\n";
+  }
+  const std::string edited = dir + "/part_0.nsl";
+  write_file(root_path, root);
+
+  std::vector<std::string> paths;
+  for (size_t i = 0; i < routes; ++i)
+    paths.push_back("/route/" + std::to_string(i));
+
+  ThreadPool pool;
+  HotReloader reloader(root_path, pool);
+  if (!reloader.reload())
+    return 1;
+  const double cold = reloader.last().ms;
+
+  // Reload after an edit, with a reader holding the old version throughout.
+  bench::Stats reload;
+  size_t serial = 0, parsed = 0;
+  {
+    RcuCell<LoadedProgram>::Reader reader(reloader.programs());
+    for (size_t i = 0; i < reloads; ++i) {
+      const auto path = "/edit/" + std::to_string(++serial);
+      edit(edited, imports[0], serial);
+      const LoadedProgram *old = reader.lock();
+      // The reader is pinned, so publishing has to wait for it. Another
+      // thread checks that the old version is intact once the new one has
+      // been swapped in, then lets it go.
+      bool unchanged = false;
+      std::thread release([&] {
+        while (reloader.programs().unsafe_get() == old)
+          std::this_thread::yield();
+        unchanged = old->runtime.match_route(path) == nullptr;
+        reader.unlock();
+      });
+      auto const start = bench::Clock::now();
+      const bool ok = reloader.reload();
+      release.join();
+      reload.add(bench::elapsed_ms(start));
+      RcuCell<LoadedProgram>::Guard now(reader);
+      if (!ok || !unchanged || !now->runtime.match_route(path)) {
+        fprintf(stderr, "MISMATCH: version %llu does not serve %s\n",
+                static_cast<unsigned long long>(now->version), path.c_str());
+        return 1;
+      }
+      parsed = reloader.last().parsed;
+    }
+  }
+
+  // From saving the file to the new version being current.
+  reloader.start(1);
+  bench::Stats live;
+  for (size_t i = 0; i < reloads; ++i) {
+    const auto before = reloader.last().version;
+    auto const start = bench::Clock::now();
+    edit(edited, imports[0], ++serial);
+    auto const deadline = start + std::chrono::seconds(save_timeout_s);
+    while (reloader.last().version == before &&
+           bench::Clock::now() < deadline)
+      std::this_thread::yield();
+    if (reloader.last().version == before) {
+      fprintf(stderr, "MISMATCH: saving %s reloaded nothing within %d s\n",
+              edited.c_str(), save_timeout_s);
+      return 1;
+    }
+    live.add(bench::elapsed_ms(start));
+  }
+
+  // Lookup latency while idle, then while reloading back to back.
+  std::atomic<bool> stop{false};
+  std::vector<uint32_t> idle, busy;
+  {
+    std::thread readers_thread(
+        [&] { idle = serve(reloader.programs(), paths, readers, stop); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    stop = true;
+    readers_thread.join();
+  }
+  reloader.stop();
+  stop = false;
+  size_t busy_reloads = 0;
+  {
+    std::thread readers_thread(
+        [&] { busy = serve(reloader.programs(), paths, readers, stop); });
+    auto const until = bench::Clock::now() + std::chrono::milliseconds(300);
+    while (bench::Clock::now() < until) {
+      edit(edited, imports[0], ++serial);
+      busy_reloads += reloader.reload();
+    }
+    stop = true;
+    readers_thread.join();
+  }
+  auto const a = percentiles(idle), b = percentiles(busy);
+  fprintf(stdout, "%zu files x %zu routes, %zu readers\n", files, routes,
+          readers);
+  fprintf(stdout, "cold load            %9.3f ms  (%zu modules)\n", cold,
+          files + 1);
+  fprintf(stdout, "reload after edit    %9.3f ms  (%zu of %zu parsed, best "
+                  "of %zu)\n",
+          reload.best, parsed, files + 1, reloads);
+  fprintf(stdout, "save to live         %9.3f ms  (inotify, 1 ms debounce)\n",
+          live.best);
+  fprintf(stdout, "lookup idle          p50 %6.0f ns  p99 %6.0f ns  max %8.0f "
+                  "ns  (%zu requests)\n",
+          a.p50, a.p99, a.max, idle.size());
+  fprintf(stdout, "lookup reloading     p50 %6.0f ns  p99 %6.0f ns  max %8.0f "
+                  "ns  (%zu requests, %zu reloads)\n",
+          b.p50, b.p99, b.max, busy.size(), busy_reloads);
+  return 0;
+}
+
+const bench::Register registration{
+    "reload", "Hot reload latency and its effect on lookups  "
+              "[files routes readers reloads]",
+    run};
+
+} // namespace
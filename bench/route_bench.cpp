@@ -0,0 +1,155 @@
+// Route matching: the compiled RouteTable against a linear scan over every
+// declared pattern (what matching against decl_heap amounts to). The two
+// must agree on every generated path before timings are reported, and table
+// lookups must not allocate.
+
+#include <cstdio>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "bench.h"
+#include "route_table.h"
+
+namespace {
+
+using route_list = std::vector<std::pair<std::string, int32_t>>;
+
+route_list generate_routes(std::mt19937 &rng, const size_t count) {
+  static const char *const words[] = {"api",   "users", "orders", "items",
+                                      "admin", "v1",    "v2",     "static",
+                                      "img",   "docs",  "search", "home"};
+  std::uniform_int_distribution<size_t> word(0, std::size(words) - 1);
+  route_list routes;
+  routes.emplace_back("/*", 0);
+  while (routes.size() < count) {
+    std::string path;
+    const size_t depth = 1 + rng() % 5;
+    for (size_t d = 0; d < depth; ++d) {
+      path += '/';
+      path += words[word(rng)];
+      if (rng() % 2)
+        path += std::to_string(rng() % 100);
+    }
+    if (rng() % 8 == 0)
+      path += "/*";
+    routes.emplace_back(std::move(path),
+                        static_cast<int32_t>(routes.size()));
+  }
+  return routes;
+}
+
+// Most-specific-wins over the raw patterns; later duplicates win, as in
+// RouteTable.
+int32_t linear_lookup(const route_list &routes, const std::string &path) {
+  int32_t exact = ServerLang::RouteTable::no_route;
+  int32_t wildcard = ServerLang::RouteTable::no_route;
+  size_t wildcard_len = 0;
+  for (auto const &[pattern, value] : routes) {
+    if (pattern.size() >= 2 &&
+        pattern.compare(pattern.size() - 2, 2, "/*") == 0) {
+      const size_t prefix = pattern.size() - 1;
+      if (path.size() >= prefix && prefix >= wildcard_len &&
+          path.compare(0, prefix, pattern, 0, prefix) == 0) {
+        wildcard = value;
+        wildcard_len = prefix;
+      }
+    } else if (pattern == path)
+      exact = value;
+  }
+  return exact != ServerLang::RouteTable::no_route ? exact : wildcard;
+}
+
+std::vector<std::string> generate_paths(std::mt19937 &rng,
+                                        const route_list &routes,
+                                        const size_t count) {
+  std::vector<std::string> paths;
+  std::uniform_int_distribution<size_t> pick(0, routes.size() - 1);
+  while (paths.size() < count) {
+    std::string p = routes[pick(rng)].first;
+    if (p.size() >= 2 && p.compare(p.size() - 2, 2, "/*") == 0)
+      p.resize(p.size() - 1);
+    switch (rng() % 4) {
+    case 0: // exact literal
+      break;
+    case 1: // below a prefix
+      p += "/deeper/" + std::to_string(rng() % 1000);
+      break;
+    case 2: // near miss
+      p.back() = static_cast<char>('a' + rng() % 26);
+      break;
+    default: // truncated
+      p.resize(1 + rng() % p.size());
+      break;
+    }
+    paths.push_back(std::move(p));
+  }
+  return paths;
+}
+
+int run(int argc, char **argv) {
+  const size_t count = bench::arg_or(argc, argv, 1, 10000);
+  const size_t lookups = bench::arg_or(argc, argv, 2, 1000000);
+  const size_t iterations = bench::arg_or(argc, argv, 3, 5);
+
+  std::mt19937 rng(0x707e);
+  auto const routes = generate_routes(rng, count);
+  auto start = bench::Clock::now();
+  const ServerLang::RouteTable table(routes);
+  const double build_ms = bench::elapsed_ms(start);
+
+  auto const check = generate_paths(rng, routes, 20000);
+  for (auto const &p : check) {
+    const auto expected = linear_lookup(routes, p);
+    const auto actual = table.lookup(p);
+    if (expected != actual) {
+      fprintf(stderr, "MISMATCH: %s -> table %d, linear %d\n", p.c_str(),
+              actual, expected);
+      return 1;
+    }
+  }
+
+  auto const paths = generate_paths(rng, routes, lookups);
+  size_t path_bytes = 0;
+  for (auto const &p : paths)
+    path_bytes += p.size();
+
+  bench::Stats table_time;
+  size_t allocs = 0;
+  for (size_t i = 0; i < iterations; ++i) {
+    int64_t sum = 0;
+    auto const before = bench::alloc_stats();
+    start = bench::Clock::now();
+    for (auto const &p : paths)
+      sum += table.lookup(p);
+    table_time.add(bench::elapsed_ms(start));
+    allocs = bench::alloc_stats().count - before.count;
+    bench::do_not_optimize(sum);
+  }
+
+  const size_t linear_lookups = std::min<size_t>(lookups, 2000);
+  start = bench::Clock::now();
+  int64_t sum = 0;
+  for (size_t i = 0; i < linear_lookups; ++i)
+    sum += linear_lookup(routes, paths[i]);
+  const double linear_ms = bench::elapsed_ms(start);
+  bench::do_not_optimize(sum);
+
+  fprintf(stdout,
+          "%zu routes -> %zu nodes, built in %.2f ms; %zu paths agree with "
+          "the linear scan\n",
+          routes.size(), table.node_count(), build_ms, check.size());
+  fprintf(stdout, "table   %8.1f ns/lookup  %6.2f ns/byte  %zu allocations\n",
+          table_time.best * 1e6 / lookups,
+          table_time.best * 1e6 / path_bytes, allocs);
+  fprintf(stdout, "linear  %8.1f ns/lookup\n",
+          linear_ms * 1e6 / linear_lookups);
+  return allocs == 0 ? 0 : 1;
+}
+
+const bench::Register registration{
+    "routes", "RouteTable vs linear route matching  [routes lookups iters]",
+    run};
+
+} // namespace
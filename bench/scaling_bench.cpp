@@ -0,0 +1,143 @@
+// Route throughput against thread count on one shared, frozen Runtime.
+//
+// Every route calls down a chain of functions that each call the one below
+// twice, so a request is pure VM work with a cost set by its depth; depths
+// differ by route. The script is parsed and evaluated once. Each thread
+// serves on its own context, the way an HttpServer loop does, and takes
+// every n-th request, the way SO_REUSEPORT spreads connections over loops.
+// One thread serving every request is the baseline; every response's
+// result, Body and Status must match what the functions compute.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+#include "runtime.h"
+#include "syntax_analyzer.h"
+
+namespace {
+
+using namespace ServerLang;
+
+constexpr size_t route_count = 8;
+
+// f0(x) = 3x + 1 and fk(x) = fk-1(x) + fk-1(x + 1): 2^k calls.
+std::string script(const size_t depth) {
+  std::string out = "//NAISYS SERVERLANG\n\n"
+                    "def f0 (var x: I64 = 0) : I64 {\n"
+                    "    return x * 3 + 1;\n}\n\n";
+  for (size_t k = 1; k <= depth + 2; ++k) {
+    const auto n = std::to_string(k), m = std::to_string(k - 1);
+    out += "def f" + n + " (var x: I64 = 0) : I64 {\n    return f" + m +
+           "(x) + f" + m + "(x + 1);\n}\n\n";
+  }
+  for (size_t r = 0; r < route_count; ++r) {
+    const auto k = std::to_string(depth + r % 3);
+    out += "const @[/work/" + std::to_string(r) + "]: Route = {\n" +
+           "    This.Header = \"text/plain\";\n" + "    var r = f" + k + "(" +
+           std::to_string(r) + ");\n" +
+           "    This.Body = \"result \" + r;\n" +
+           "    This.Status = 200;\n" + "    return r;\n};\n\n";
+  }
+  return out;
+}
+
+int64_t expected(const size_t k, const int64_t x) {
+  return k == 0 ? 3 * x + 1 : expected(k - 1, x) + expected(k - 1, x + 1);
+}
+
+bool check(const Runtime &runtime, Machine &ctx, const std::string &path,
+           const int64_t want) {
+  Value result;
+  if (!runtime.exec_route(path, ctx, result))
+    return false;
+  auto const &body = ctx.field(Field::BODY);
+  auto const &status = ctx.field(Field::STATUS);
+  return result.kind == Value::Kind::INT && result.i == want &&
+         body.kind == Value::Kind::STRING &&
+         *body.s == "result " + std::to_string(want) &&
+         status.kind == Value::Kind::INT && status.i == 200 &&
+         ctx.field(Field::HEADER).kind == Value::Kind::STRING;
+}
+
+int run(int argc, char **argv) {
+  const size_t requests = bench::arg_or(argc, argv, 1, 20000);
+  const size_t depth = bench::arg_or(argc, argv, 2, 8);
+  const size_t max_threads = bench::arg_or(
+      argc, argv, 3, std::max(4u, std::thread::hardware_concurrency()));
+
+  auto const source = script(depth);
+  TokenStream tokens(source);
+  SyntaxAnalyzer analyzer;
+  auto result = analyzer.analyze(tokens);
+  Runtime runtime;
+  runtime.eval(result);
+
+  std::vector<std::string> paths;
+  std::vector<int64_t> want;
+  std::mt19937 rng(7);
+  for (size_t i = 0; i < requests; ++i) {
+    const size_t r = rng() % route_count;
+    paths.push_back("/work/" + std::to_string(r));
+    want.push_back(expected(depth + r % 3, static_cast<int64_t>(r)));
+  }
+
+  // Serves requests `first`, `first + step`, ... on a context of its own
+  // and returns how many came back wrong.
+  auto const serve = [&](const size_t first, const size_t step) {
+    auto ctx = runtime.context();
+    size_t failed = 0;
+    for (size_t i = first; i < requests; i += step)
+      failed += !check(runtime, *ctx, paths[i], want[i]);
+    return failed;
+  };
+
+  auto const start = bench::Clock::now();
+  if (serve(0, 1)) {
+    fprintf(stderr, "MISMATCH: wrong responses on one thread\n");
+    return 1;
+  }
+  const double baseline = bench::elapsed_ms(start);
+
+  fprintf(stdout, "%zu requests, depth %zu..%zu (%zu..%zu calls), %u cores\n",
+          requests, depth, depth + 2, size_t{1} << depth,
+          size_t{1} << (depth + 2), std::thread::hardware_concurrency());
+  fprintf(stdout, "%-12s %10s %12s %9s %11s\n", "threads", "ms", "req/s",
+          "speedup", "efficiency");
+  fprintf(stdout, "%-12s %10.2f %12.0f %9s %11s\n", "baseline", baseline,
+          requests / baseline * 1e3, "", "");
+
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    std::atomic<size_t> failed{0};
+    std::vector<std::thread> workers;
+    auto const start = bench::Clock::now();
+    for (size_t t = 0; t < threads; ++t)
+      workers.emplace_back([&, t] {
+        failed.fetch_add(serve(t, threads), std::memory_order_relaxed);
+      });
+    for (auto &w : workers)
+      w.join();
+    const double ms = bench::elapsed_ms(start);
+    if (failed) {
+      fprintf(stderr, "MISMATCH: %zu responses wrong on %zu threads\n",
+              failed.load(), threads);
+      return 1;
+    }
+    const double speedup = baseline / ms;
+    fprintf(stdout, "%-12zu %10.2f %12.0f %8.2fx %10.0f%%\n", threads, ms,
+            requests / ms * 1e3, speedup,
+            speedup / static_cast<double>(threads) * 100);
+  }
+  return 0;
+}
+
+const bench::Register registration{
+    "scaling",
+    "Route throughput vs threads  [requests depth max_threads]", run};
+
+} // namespace
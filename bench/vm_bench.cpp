@@ -0,0 +1,502 @@
+// Bytecode VM against a naive tree-walking interpreter that boxes every
+// intermediate result on the heap and keeps variables in a hash map per call.
+// Both run the same hand-built trees; their results must agree before any
+// timing is reported. A script with more routes than a program has chunk
+// indices must first serve the routes that fit and refuse the rest, and
+// folded initializers must be range checked like literal ones.
+
+#include <cstdio>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+#include "ast.h"
+#include "bench.h"
+#include "compiler.h"
+#include "const_fold.h"
+#include "runtime.h"
+#include "syntax_analyzer.h"
+#include "vm.h"
+
+namespace {
+
+using namespace ServerLang;
+
+// Builds the trees the analyzer will produce for the same source.
+class Builder {
+public:
+  explicit Builder(Arena &arena) : m_arena(arena) {}
+
+  node_ptr ident(const char *name) {
+    auto *n = m_arena.make<Identifier>();
+    n->setId(intern(name));
+    return n;
+  }
+  node_ptr integer(const int64_t v) {
+    auto *n = m_arena.make<InternalTypes::I64>();
+    n->setValue(v);
+    return n;
+  }
+  node_ptr string(const char *v) {
+    auto *n = m_arena.make<InternalTypes::String>();
+    n->setValue(v);
+    return n;
+  }
+  node_ptr binary(const Operators op, node_ptr l, node_ptr r) {
+    return m_arena.make<Expressions::ArithmeticExpression>(l, r, op);
+  }
+  node_ptr assign(const char *name, node_ptr value) {
+    return m_arena.make<Expressions::AssignmentExpression>(
+        ident(name), value, Operators::ASGN);
+  }
+  node_ptr call(const char *name, std::initializer_list<node_ptr> args) {
+    auto *n = m_arena.make<Expressions::CallExpression>(ident(name), nullptr,
+                                                        Operators::CALL);
+    for (auto *a : args)
+      n->children().push_back(m_arena, a);
+    return n;
+  }
+  node_ptr ret(node_ptr value) {
+    return m_arena.make<Expressions::ReturnExpression>(value, nullptr,
+                                                       Operators::RET);
+  }
+  node_ptr var(const char *name, node_ptr init) {
+    auto *n = m_arena.make<InternalTypes::Variant>();
+    n->setId(intern(name));
+    n->children().push_back(m_arena, init);
+    return n;
+  }
+  node_ptr constant(const char *name, node_ptr init) {
+    auto *n = var(name, init);
+    n->setConstant(true);
+    return n;
+  }
+  node_ptr function(const char *name,
+                    std::initializer_list<const char *> params,
+                    const std::vector<node_ptr> &body) {
+    auto *fn = m_arena.make<Function<node_ptr>>();
+    fn->setId(intern(name));
+    for (auto const *p : params) {
+      auto *decl = m_arena.make<InternalTypes::Variant>();
+      decl->setId(intern(p));
+      fn->parameters().push_back(m_arena, decl);
+    }
+    auto *scope = m_arena.make<Scope>();
+    for (auto *s : body)
+      scope->children().push_back(m_arena, s);
+    fn->children().push_back(m_arena, scope);
+    return fn;
+  }
+
+private:
+  Arena &m_arena;
+};
+
+// The naive interpreter: every result is a fresh heap object.
+struct Boxed {
+  std::variant<std::monostate, int64_t, std::string> v;
+};
+using boxed_ptr = std::shared_ptr<Boxed>;
+
+class Walker {
+public:
+  explicit Walker(const node_list &module) {
+    for (auto const *n : module)
+      if (n && n->type() == Type::FUNCTION)
+        m_functions[n->id()] = static_cast<const Function<node_ptr> *>(n);
+  }
+
+  boxed_ptr call(const Symbol name, const std::vector<boxed_ptr> &args) {
+    auto const *fn = m_functions.at(name);
+    std::unordered_map<Symbol, boxed_ptr> env;
+    auto const &params = fn->parameters_const();
+    for (size_t i = 0; i < params.size(); ++i)
+      env[params[i]->id()] = i < args.size() ? args[i] : box();
+    for (auto const *s : fn->children_const()[0]->children_const()) {
+      if (s->type() == Type::RETURNEXPRESSION)
+        return eval(static_cast<const Expression *>(s)->lhs(), env);
+      if (s->type() == Type::VARIANT)
+        env[s->id()] = eval(s->children_const()[0], env);
+      else
+        eval(s, env);
+    }
+    return box();
+  }
+
+private:
+  static boxed_ptr box() { return std::make_shared<Boxed>(); }
+  template <typename T> static boxed_ptr box(T v) {
+    auto b = box();
+    b->v = std::move(v);
+    return b;
+  }
+
+  boxed_ptr eval(const ASTNode *n,
+                 std::unordered_map<Symbol, boxed_ptr> &env) {
+    switch (n->type()) {
+    case Type::I64:
+      return box(static_cast<const InternalTypes::I64 *>(n)->value());
+    case Type::STRING:
+      return box(static_cast<const InternalTypes::String *>(n)->value());
+    case Type::IDENTIFIER:
+      return env.at(n->id());
+    case Type::ASSIGNMENTEXPRESSION: {
+      auto const *e = static_cast<const Expression *>(n);
+      return env[e->lhs()->id()] = eval(e->rhs(), env);
+    }
+    case Type::CALLEXPRESSION: {
+      auto const *e = static_cast<const Expression *>(n);
+      std::vector<boxed_ptr> args;
+      for (auto const *a : e->children_const())
+        args.push_back(eval(a, env));
+      return call(e->lhs()->id(), args);
+    }
+    case Type::ARITHMETICEXPRESSION: {
+      auto const *e = static_cast<const Expression *>(n);
+      auto l = eval(e->lhs(), env), r = eval(e->rhs(), env);
+      auto const *li = std::get_if<int64_t>(&l->v);
+      auto const *ri = std::get_if<int64_t>(&r->v);
+      if (li && ri) {
+        switch (e->opr()) {
+        case Operators::ADD:
+          return box(*li + *ri);
+        case Operators::SUB:
+          return box(*li - *ri);
+        case Operators::MUL:
+          return box(*li * *ri);
+        default:
+          return box(*li / *ri);
+        }
+      }
+      return box(text(*l) + text(*r));
+    }
+    default:
+      return box();
+    }
+  }
+
+  static std::string text(const Boxed &b) {
+    if (auto const *i = std::get_if<int64_t>(&b.v))
+      return std::to_string(*i);
+    if (auto const *s = std::get_if<std::string>(&b.v))
+      return *s;
+    return "null";
+  }
+
+private:
+  std::unordered_map<Symbol, const Function<node_ptr> *> m_functions;
+};
+
+node_list arithmetic_module(Builder &b, Arena &arena, const size_t stmts) {
+  using O = Operators;
+  std::vector<node_ptr> body{b.var("x", b.ident("a"))};
+  // x = (x * 3 + b) / 4 - a; stays bounded however many times it runs.
+  for (size_t i = 0; i < stmts; ++i)
+    body.push_back(b.assign(
+        "x", b.binary(O::SUB,
+                      b.binary(O::DIV,
+                               b.binary(O::ADD,
+                                        b.binary(O::MUL, b.ident("x"),
+                                                 b.integer(3)),
+                                        b.ident("b")),
+                               b.integer(4)),
+                      b.ident("a"))));
+  body.push_back(b.ret(b.ident("x")));
+  node_list module;
+  module.push_back(arena, b.function("arith", {"a", "b"}, body));
+  return module;
+}
+
+node_list call_module(Builder &b, Arena &arena, const size_t stmts) {
+  using O = Operators;
+  std::vector<node_ptr> body{b.var("x", b.ident("n"))};
+  for (size_t i = 0; i < stmts; ++i)
+    body.push_back(b.assign(
+        "x", i % 2 ? b.call("add", {b.ident("x"), b.integer(1)})
+                   : b.call("twice", {b.ident("x")})));
+  body.push_back(b.ret(b.ident("x")));
+  node_list module;
+  module.push_back(arena, b.function("calls", {"n"}, body));
+  module.push_back(arena,
+                   b.function("add", {"a", "b"},
+                              {b.ret(b.binary(O::ADD, b.ident("a"),
+                                              b.ident("b")))}));
+  module.push_back(
+      arena,
+      b.function("twice", {"a"},
+                 {b.ret(b.binary(O::SUB, b.call("add", {b.ident("a"),
+                                                        b.ident("a")}),
+                                 b.ident("a")))}));
+  return module;
+}
+
+node_list string_module(Builder &b, Arena &arena, const size_t stmts) {
+  using O = Operators;
+  std::vector<node_ptr> body{b.var("out", b.string(""))};
+  for (size_t i = 0; i < stmts; ++i)
+    body.push_back(b.assign(
+        "out", b.binary(O::ADD,
+                        b.binary(O::ADD, b.ident("out"), b.ident("s")),
+                        b.string(","))));
+  body.push_back(b.ret(b.ident("out")));
+  node_list module;
+  module.push_back(arena, b.function("build", {"s"}, body));
+  return module;
+}
+
+// const HOUR = 3600; const DAY = HOUR * 24;
+// def spans(a) { var x = a; x = x + DAY - HOUR / 8; ...; return x; }
+node_list constants_module(Builder &b, Arena &arena, const size_t stmts) {
+  using O = Operators;
+  std::vector<node_ptr> body{b.var("x", b.ident("a"))};
+  for (size_t i = 0; i < stmts; ++i)
+    body.push_back(b.assign(
+        "x", b.binary(O::SUB, b.binary(O::ADD, b.ident("x"), b.ident("DAY")),
+                      b.binary(O::DIV, b.ident("HOUR"), b.integer(8)))));
+  body.push_back(b.ret(b.ident("x")));
+  node_list module;
+  module.push_back(arena, b.constant("HOUR", b.integer(3600)));
+  module.push_back(arena,
+                   b.constant("DAY", b.binary(O::MUL, b.ident("HOUR"),
+                                              b.integer(24))));
+  module.push_back(arena, b.function("spans", {"a"}, body));
+  return module;
+}
+
+// Compiles `module`, runs its initializers and times `runs` calls of spans.
+struct ConstantsRun {
+  size_t instrs = 0;
+  double ns = 0;
+  int64_t result = 0;
+};
+ConstantsRun run_constants(const node_list &module, const size_t runs,
+                           const size_t iterations) {
+  Program program;
+  Compiler compiler(program);
+  const auto init = compiler.compile_module(module);
+  Machine vm(program);
+  vm.run(init);
+  ConstantsRun out;
+  auto const &chunk = program.chunk(program.function(intern("spans")));
+  out.instrs = chunk.code.size();
+
+  bench::Stats time;
+  for (size_t it = 0; it < iterations; ++it) {
+    auto const start = bench::Clock::now();
+    int64_t sum = 0;
+    for (size_t i = 0; i < runs; ++i) {
+      const Value arg = Value::integer(static_cast<int64_t>(i));
+      sum += vm.run(program.function(intern("spans")), &arg, 1).i;
+    }
+    time.add(bench::elapsed_ms(start));
+    out.result = sum;
+  }
+  out.ns = time.best * 1e6 / runs;
+  return out;
+}
+
+bool same(const Value &v, const Boxed &b) {
+  if (auto const *i = std::get_if<int64_t>(&b.v))
+    return v.kind == Value::Kind::INT && v.i == *i;
+  if (auto const *s = std::get_if<std::string>(&b.v))
+    return v.kind == Value::Kind::STRING && *v.s == *s;
+  return v.kind == Value::Kind::NIL;
+}
+
+// 70000 routes, each setting its own Body. Chunk indices are 16 bits, so
+// the routes past the limit must be left without a body rather than wrap
+// around onto an earlier route's.
+bool check_pool_limit() {
+  constexpr size_t routes = 70000;
+  std::string source = "//NAISYS SERVERLANG\n\n";
+  for (size_t r = 0; r < routes; ++r)
+    source += "const @[/r" + std::to_string(r) +
+              "]: Route = { This.Body = \"body" + std::to_string(r) +
+              "\"; };\n";
+  TokenStream tokens(source);
+  SyntaxAnalyzer analyzer;
+  auto const result = analyzer.analyze(tokens);
+  Runtime runtime;
+  runtime.eval(result);
+
+  auto const ctx = runtime.context();
+  for (const size_t r : {size_t{0}, size_t{4463}, size_t{65534}, size_t{65535},
+                         size_t{69999}}) {
+    const std::string path = "/r" + std::to_string(r);
+    Value v;
+    const bool served = runtime.exec_route(path, *ctx, v);
+    auto const &body = ctx->field(Field::BODY);
+    const bool fits = r < Program::no_chunk;
+    if (served != fits ||
+        (fits && (body.kind != Value::Kind::STRING ||
+                  *body.s != "body" + std::to_string(r)))) {
+      fprintf(stderr, "MISMATCH: %s %s\n", path.c_str(),
+              !served ? "was not served"
+              : fits  ? "served the wrong body"
+                      : "was served past the limit");
+      return false;
+    }
+  }
+  return true;
+}
+
+// `30000 + 30000` does not fit an I16 nor `0 - 1` a U8: both are reported,
+// as the literal 99999 would be, and dropped rather than left to run.
+bool check_folded_ranges() {
+  const std::string source = "//NAISYS SERVERLANG\n\n"
+                             "var x: I16 = 30000 + 30000;\n"
+                             "var u: U8 = 0 - 1;\n"
+                             "var ok: I16 = 30000 + 2767;\n";
+  TokenStream tokens(source);
+  SyntaxAnalyzer analyzer;
+  auto const result = analyzer.analyze(tokens);
+  auto const &nodes = result.nodes();
+  if (nodes.size() != 3 || !nodes[0] || !nodes[1] || !nodes[2]) {
+    fprintf(stderr, "MISMATCH: %zu declarations folded\n", nodes.size());
+    return false;
+  }
+  for (size_t i = 0; i < 2; ++i)
+    if (!nodes[i]->children_const().empty()) {
+      fprintf(stderr, "MISMATCH: out of range %s was kept\n",
+              nodes[i]->name());
+      return false;
+    }
+  auto const ok = Literals::value(nodes[2]);
+  if (ok.kind != Constant::Kind::INT || ok.i != 32767) {
+    fprintf(stderr, "MISMATCH: ok was not folded to 32767\n");
+    return false;
+  }
+  return true;
+}
+
+int run(int argc, char **argv) {
+  const size_t stmts = bench::arg_or(argc, argv, 1, 100);
+  const size_t runs = bench::arg_or(argc, argv, 2, 20000);
+  const size_t iterations = bench::arg_or(argc, argv, 3, 3);
+  if (!check_pool_limit() || !check_folded_ranges())
+    return 1;
+
+  Arena arena;
+  Builder b(arena);
+  struct Case {
+    const char *name;
+    const char *entry;
+    node_list module;
+    bool string_arg;
+  };
+  const Case cases[] = {
+      {"arithmetic", "arith", arithmetic_module(b, arena, stmts), false},
+      {"calls", "calls", call_module(b, arena, stmts), false},
+      {"strings", "build", string_module(b, arena, stmts), true},
+  };
+
+  int status = 0;
+  for (auto const &c : cases) {
+    Program program;
+    Compiler compiler(program);
+    compiler.compile_module(c.module);
+    if (compiler.errors())
+      return 1;
+    Machine vm(program);
+    Walker walker(c.module);
+    const uint16_t entry = program.function(intern(c.entry));
+    const Symbol entry_sym = intern(c.entry);
+    const uint32_t text = program.string_constant("ab");
+
+    auto const vm_args = [&](const size_t i, Value *args) {
+      if (c.string_arg)
+        args[0] = program.constant_at(text);
+      else {
+        args[0] = Value::integer(static_cast<int64_t>(i));
+        args[1] = Value::integer(5);
+      }
+    };
+    auto const walker_args = [&](const size_t i) {
+      std::vector<boxed_ptr> args(c.string_arg ? 1 : 2);
+      for (auto &a : args)
+        a = std::make_shared<Boxed>();
+      if (c.string_arg)
+        args[0]->v = std::string("ab");
+      else {
+        args[0]->v = static_cast<int64_t>(i);
+        args[1]->v = int64_t{5};
+      }
+      return args;
+    };
+
+    for (size_t i = 0; i < 100; ++i) {
+      Value args[2];
+      vm_args(i, args);
+      const auto mark = vm.mark();
+      auto const v = vm.run(entry, args, 2);
+      auto const w = walker.call(entry_sym, walker_args(i));
+      if (!vm.ok() || !same(v, *w)) {
+        fprintf(stderr, "MISMATCH in %s for run %zu: %s\n", c.name, i,
+                vm.ok() ? "different results" : vm.error().c_str());
+        return 1;
+      }
+      vm.release(mark);
+    }
+
+    bench::Stats vm_time, walker_time;
+    size_t allocs = 0;
+    for (size_t it = 0; it < iterations; ++it) {
+      auto const before = bench::alloc_stats();
+      auto start = bench::Clock::now();
+      for (size_t i = 0; i < runs; ++i) {
+        Value args[2];
+        vm_args(i, args);
+        const auto mark = vm.mark();
+        bench::do_not_optimize(vm.run(entry, args, 2).i);
+        vm.release(mark);
+      }
+      vm_time.add(bench::elapsed_ms(start));
+      allocs = bench::alloc_stats().count - before.count;
+
+      const size_t walker_runs = runs / 10 + 1;
+      start = bench::Clock::now();
+      for (size_t i = 0; i < walker_runs; ++i)
+        bench::do_not_optimize(walker.call(entry_sym, walker_args(i)));
+      walker_time.add(bench::elapsed_ms(start) * runs / walker_runs);
+    }
+
+    size_t code = 0;
+    for (size_t i = 0; i < program.chunk_count(); ++i)
+      code += program.chunk(i).code.size();
+    fprintf(stdout,
+            "%-10s %4zu instrs  vm %9.1f ns/run  walker %9.1f ns/run  "
+            "%5.1fx  %.1f vm allocs/run\n",
+            c.name, code, vm_time.best * 1e6 / runs,
+            walker_time.best * 1e6 / runs, walker_time.best / vm_time.best,
+            static_cast<double>(allocs) / runs);
+    if (!c.string_arg && allocs)
+      status = 1;
+  }
+
+  // The same module as parsed and after constant folding.
+  auto const unfolded = constants_module(b, arena, stmts);
+  auto folded = constants_module(b, arena, stmts);
+  const size_t replaced = ConstantFolder(arena).fold(folded);
+  auto const before = run_constants(unfolded, runs, iterations);
+  auto const after = run_constants(folded, runs, iterations);
+  if (before.result != after.result) {
+    fprintf(stderr, "MISMATCH: folding changed the result (%lld vs %lld)\n",
+            static_cast<long long>(before.result),
+            static_cast<long long>(after.result));
+    return 1;
+  }
+  fprintf(stdout,
+          "%-10s %4zu instrs  unfolded %9.1f ns/run  folded %4zu instrs "
+          "%9.1f ns/run  (%zu subtrees folded)\n",
+          "constants", before.instrs, before.ns, after.instrs, after.ns,
+          replaced);
+  return status;
+}
+
+const bench::Register registration{
+    "vm", "Bytecode VM vs a naive AST walker  [stmts runs iters]", run};
+
+} // namespace
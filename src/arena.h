@@ -0,0 +1,178 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace ServerLang {
+
+// Chunked bump allocator. Memory is only ever released all at once, either by
+// release() or when the arena is destroyed. Objects that are not trivially
+// destructible get their destructor registered and run on release.
+class Arena {
+public:
+  explicit Arena(const size_t chunk_size = 64 * 1024)
+      : m_chunk_size(chunk_size) {}
+  ~Arena() { release(); }
+
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  Arena(Arena &&other) noexcept { steal(other); }
+  Arena &operator=(Arena &&other) noexcept {
+    if (this != &other) {
+      release();
+      steal(other);
+    }
+    return *this;
+  }
+
+public:
+  void *allocate(const size_t size, const size_t align) {
+    auto addr = reinterpret_cast<uintptr_t>(m_cursor);
+    auto aligned = (addr + align - 1) & ~(uintptr_t{align} - 1);
+    if (!m_cursor || aligned + size > reinterpret_cast<uintptr_t>(m_end)) {
+      grow(size + align);
+      addr = reinterpret_cast<uintptr_t>(m_cursor);
+      aligned = (addr + align - 1) & ~(uintptr_t{align} - 1);
+    }
+    m_cursor = reinterpret_cast<char *>(aligned + size);
+    m_used += size;
+    return reinterpret_cast<void *>(aligned);
+  }
+
+  template <typename T> T *allocate_array(const size_t count) {
+    static_assert(std::is_trivially_destructible_v<T>,
+                  "Arena arrays are never destroyed");
+    return static_cast<T *>(allocate(sizeof(T) * count, alignof(T)));
+  }
+
+  template <typename T, typename... Args> T *make(Args &&...args) {
+    void *mem = allocate(sizeof(T), alignof(T));
+    T *obj = new (mem) T(std::forward<Args>(args)...);
+    if constexpr (!std::is_trivially_destructible_v<T>) {
+      auto *fin = static_cast<Finalizer *>(
+          allocate(sizeof(Finalizer), alignof(Finalizer)));
+      fin->destroy = [](void *p) { static_cast<T *>(p)->~T(); };
+      fin->object = obj;
+      fin->next = m_finalizers;
+      m_finalizers = fin;
+    }
+    return obj;
+  }
+
+  // Copies `str` into the arena and NUL-terminates it.
+  const char *copy_string(const std::string_view str) {
+    auto *mem = static_cast<char *>(allocate(str.size() + 1, 1));
+    std::memcpy(mem, str.data(), str.size());
+    mem[str.size()] = '\0';
+    return mem;
+  }
+
+  void release() {
+    for (auto *fin = m_finalizers; fin; fin = fin->next)
+      fin->destroy(fin->object);
+    m_finalizers = nullptr;
+
+    while (m_chunks) {
+      auto *next = m_chunks->next;
+      std::free(m_chunks);
+      m_chunks = next;
+    }
+    m_cursor = m_end = nullptr;
+    m_used = 0;
+  }
+
+  size_t bytes_used() const { return m_used; }
+
+private:
+  struct Chunk {
+    Chunk *next;
+  };
+
+  struct Finalizer {
+    void (*destroy)(void *);
+    void *object;
+    Finalizer *next;
+  };
+
+  void grow(const size_t min_size) {
+    const size_t size = std::max(m_chunk_size, min_size + sizeof(Chunk));
+    auto *chunk = static_cast<Chunk *>(std::malloc(size));
+    if (!chunk)
+      throw std::bad_alloc{};
+    chunk->next = m_chunks;
+    m_chunks = chunk;
+    m_cursor = reinterpret_cast<char *>(chunk + 1);
+    m_end = reinterpret_cast<char *>(chunk) + size;
+  }
+
+  void steal(Arena &other) {
+    m_chunk_size = other.m_chunk_size;
+    m_chunks = std::exchange(other.m_chunks, nullptr);
+    m_finalizers = std::exchange(other.m_finalizers, nullptr);
+    m_cursor = std::exchange(other.m_cursor, nullptr);
+    m_end = std::exchange(other.m_end, nullptr);
+    m_used = std::exchange(other.m_used, 0);
+  }
+
+private:
+  size_t m_chunk_size = 64 * 1024;
+  Chunk *m_chunks = nullptr;
+  Finalizer *m_finalizers = nullptr;
+  char *m_cursor = nullptr;
+  char *m_end = nullptr;
+  size_t m_used = 0;
+};
+
+// Growable array whose storage lives in an Arena. Growing abandons the old
+// block, so the arena holds at most twice the final size.
+template <typename T> class ArenaList {
+  static_assert(std::is_trivially_copyable_v<T>,
+                "ArenaList elements are relocated with memcpy");
+
+public:
+  using value_type = T;
+  using iterator = T *;
+  using const_iterator = const T *;
+
+  void push_back(Arena &arena, const T &value) {
+    if (m_size == m_capacity) {
+      const size_t capacity = m_capacity ? m_capacity * 2 : 4;
+      T *data = arena.allocate_array<T>(capacity);
+      if (m_size)
+        std::memcpy(data, m_data, sizeof(T) * m_size);
+      m_data = data;
+      m_capacity = capacity;
+    }
+    m_data[m_size++] = value;
+  }
+
+  size_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+  // Keeps the block for reuse; the arena still owns it.
+  void clear() { m_size = 0; }
+
+  T &operator[](const size_t i) { return m_data[i]; }
+  const T &operator[](const size_t i) const { return m_data[i]; }
+  T &at(const size_t i) { return m_data[i]; }
+  const T &at(const size_t i) const { return m_data[i]; }
+
+  iterator begin() { return m_data; }
+  iterator end() { return m_data + m_size; }
+  const_iterator begin() const { return m_data; }
+  const_iterator end() const { return m_data + m_size; }
+
+private:
+  T *m_data = nullptr;
+  uint32_t m_size = 0;
+  uint32_t m_capacity = 0;
+};
+
+} // namespace ServerLang
@@ -0,0 +1,447 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+
+#include "arena.h"
+#include "interner.h"
+#include "types.h"
+
+#define DEFAULT_NODE_CONSTRUCTOR(x)                                            \
+  x() { setPreferredType(this->type()); }
+
+#define GET_SET(x, _type, _virt)                                               \
+  _virt _type x() const { return m_##x; }                                      \
+  _virt void set##x(_type newValue) { m_##x = newValue; }
+
+namespace ServerLang {
+
+// Forward:
+class ASTNode;
+
+// Typedefs:
+// Nodes are owned by the Arena of the ParseResult that produced them.
+using node_ptr = ASTNode *;
+using node_list = ArenaList<node_ptr>;
+
+enum class Operators {
+  ADD,
+  SUB,
+  MUL,
+  DIV,
+  INCR,
+  DCR,
+  AND,
+  OR,
+  XOR,
+  NAND,
+  NOR,
+  ASGN,
+  CALL,
+  ACC,
+  RET,
+  EQ,
+  NEQ,
+  LT,
+  GT,
+  LTE,
+  GTE,
+  NOT,
+  NEG,
+  INDEX
+};
+
+class ASTNode {
+
+public: // virtual methods
+  ASTNode() = default;
+  virtual ServerLang::Type type() const { return Type::UNDEFINED; };
+  virtual const char *type_string() const { return "Undefined"; };
+
+public:
+  Type preferredType() const { return m_preferredType; }
+  void setPreferredType(const Type newType) { m_preferredType = newType; }
+
+  // Set on `const` declarations.
+  bool constant() const { return m_constant; }
+  void setConstant(const bool newValue) { m_constant = newValue; }
+
+  // Interned name of the node; name() is its text.
+  Symbol id() const { return m_id; }
+  void setId(const Symbol newId) { m_id = newId; }
+  const char *name() const { return symbol_name(m_id); }
+
+  GET_SET(parent, ASTNode *, virtual)
+
+  node_list &children() { return m_children; }
+  const node_list &children_const() const { return m_children; }
+
+protected:
+  // Nodes are never deleted individually; the arena releases them in bulk and
+  // only runs destructors for nodes that own heap memory.
+  ~ASTNode() = default;
+
+private:
+  ASTNode *m_parent = nullptr;
+  Type m_preferredType = type();
+  bool m_constant = false;
+  Symbol m_id = no_id;
+  node_list m_children;
+};
+
+class Scope : public ASTNode {
+public:
+  DEFAULT_NODE_CONSTRUCTOR(Scope)
+  ServerLang::Type type() const override { return Type::SCOPE; }
+  const char *type_string() const override { return "Scope"; }
+
+public:
+  // node_list &children() { return m_children; }
+  // const node_list &children_const() const { return m_children; }
+
+public:
+  virtual bool executable() const { return m_executable; };
+  virtual void setExecutable(bool newVal) { m_executable = newVal; };
+
+private:
+  // node_list m_children;
+  bool m_executable = false;
+};
+
+class Object : public Scope {
+public:
+  DEFAULT_NODE_CONSTRUCTOR(Object)
+  ServerLang::Type type() const override { return Type::OBJECT; }
+  const char *type_string() const override { return "Object"; }
+};
+
+template <typename T> class Function : public Scope {
+public:
+  DEFAULT_NODE_CONSTRUCTOR(Function)
+  ServerLang::Type type() const override { return Type::FUNCTION; }
+  const char *type_string() const override { return "Function"; }
+
+public:
+  T value() const { return m_value; }
+  void setValue(const T &newValue) { m_value = newValue; }
+  Type return_t() const { return m_return_t; }
+  void setReturn_t(const Type newValue) { m_return_t = newValue; }
+
+  // Declarations of the parameters, in order; the body is the Scope child.
+  node_list &parameters() { return m_parameters; }
+  const node_list &parameters_const() const { return m_parameters; }
+
+private:
+  T m_value{};
+  Type m_return_t = Type::VOID;
+  node_list m_parameters;
+};
+
+template <typename T> class Primitive : public ASTNode {
+public:
+  DEFAULT_NODE_CONSTRUCTOR(Primitive)
+  ServerLang::Type type() const override { return Type::PRIMITIVE; }
+  const char *type_string() const override { return "Primitive"; }
+
+  T value() const { return m_value; }
+  void setValue(const T &newValue) {
+    m_value = newValue;
+    m_hasValue = true;
+  }
+  // False until a literal or a folded constant has been stored.
+  bool hasValue() const { return m_hasValue; }
+
+private:
+  T m_value{};
+  bool m_hasValue = false;
+};
+
+class Expression : public ASTNode {
+public:
+  DEFAULT_NODE_CONSTRUCTOR(Expression)
+  ServerLang::Type type() const override { return Type::EXPRESSION; }
+  const char *type_string() const override { return "Expression"; }
+
+public: // virtual methods
+  GET_SET(opr, Operators, virtual)
+  GET_SET(lhs, ASTNode *, virtual)
+  GET_SET(rhs, ASTNode *, virtual)
+
+private:
+  ASTNode *m_lhs = nullptr, *m_rhs = nullptr;
+  Operators m_opr = Operators::ADD;
+};
+
+// A use of a named value inside an expression.
+class Identifier : public ASTNode {
+public:
+  DEFAULT_NODE_CONSTRUCTOR(Identifier)
+  ServerLang::Type type() const override { return Type::IDENTIFIER; }
+  const char *type_string() const override { return "Identifier"; }
+};
+
+namespace Expressions {
+class AccessExpression : public Expression {
+public:
+  AccessExpression(ASTNode *_lhs, ASTNode *_rhs, const Operators _op) {
+    this->setlhs(_lhs);
+    this->setrhs(_rhs);
+    this->setopr(_op);
+  };
+  ServerLang::Type type() const override { return Type::ACCESSEXPRESSION; }
+  const char *type_string() const override { return "AccessExpression"; }
+};
+class ArithmeticExpression : public Expression {
+public:
+  ArithmeticExpression(ASTNode *_lhs, ASTNode *_rhs, const Operators _op) {
+    this->setlhs(_lhs);
+    this->setrhs(_rhs);
+    this->setopr(_op);
+  };
+  ServerLang::Type type() const override { return Type::ARITHMETICEXPRESSION; }
+  const char *type_string() const override { return "ArithmeticExpression"; }
+};
+class AssignmentExpression : public Expression {
+public:
+  AssignmentExpression(ASTNode *_lhs, ASTNode *_rhs, const Operators _op) {
+    this->setlhs(_lhs);
+    this->setrhs(_rhs);
+    this->setopr(_op);
+  };
+  ServerLang::Type type() const override { return Type::ASSIGNMENTEXPRESSION; }
+  const char *type_string() const override { return "AssignmentExpression"; }
+};
+class CallExpression : public Expression {
+public:
+  CallExpression(ASTNode *_lhs, ASTNode *_rhs, const Operators _op) {
+    this->setlhs(_lhs);
+    this->setrhs(_rhs);
+    this->setopr(_op);
+  };
+  ServerLang::Type type() const override { return Type::CALLEXPRESSION; }
+  const char *type_string() const override { return "CallExpression"; }
+};
+class LogicalExpression : public Expression {
+public:
+  LogicalExpression(ASTNode *_lhs, ASTNode *_rhs, const Operators _op) {
+    this->setlhs(_lhs);
+    this->setrhs(_rhs);
+    this->setopr(_op);
+  };
+  ServerLang::Type type() const override { return Type::LOGICALEXPRESSION; }
+  const char *type_string() const override { return "LogicalExpression"; }
+};
+class ReturnExpression : public Expression {
+public:
+  ReturnExpression(ASTNode *_lhs, ASTNode *_rhs, const Operators _op) {
+    this->setlhs(_lhs);
+    this->setrhs(_rhs);
+    this->setopr(_op);
+  };
+  ServerLang::Type type() const override { return Type::RETURNEXPRESSION; }
+  const char *type_string() const override { return "ReturnExpression"; }
+};
+} // namespace Expressions
+
+namespace InternalTypes {
+
+class I16 : public Primitive<int16_t> {
+public:
+  DEFAULT_NODE_CONSTRUCTOR(I16)
+  ServerLang::Type type() const override { return Type::I16; }
+  const char *type_string() const override { return "Integer_16"; }
+};
+
+class I32 : public Primitive<int32_t> {
+public:
+  DEFAULT_NODE_CONSTRUCTOR(I32)
+  ServerLang::Type type() const override { return Type::I32; }
+  const char *type_string() const override { return "Integer_32"; }
+};
+
+class I64 : public Primitive<int64_t> {
+public:
+  DEFAULT_NODE_CONSTRUCTOR(I64)
+  ServerLang::Type type() const override { return Type::I64; }
+  const char *type_string() const override { return "Integer_64"; }
+};
+
+class U8 : public Primitive<u_int8_t> {
+public:
+  DEFAULT_NODE_CONSTRUCTOR(U8)
+  ServerLang::Type type() const override { return Type::U8; }
+  const char *type_string() const override { return "Unsigned_8"; }
+};
+
+class U16 : public Primitive<u_int16_t> {
+public:
+  DEFAULT_NODE_CONSTRUCTOR(U16)
+  ServerLang::Type type() const override { return Type::U16; }
+  const char *type_string() const override { return "Unsigned_16"; }
+};
+
+class F32 : public Primitive<float> {
+public:
+  DEFAULT_NODE_CONSTRUCTOR(F32)
+  ServerLang::Type type() const override { return Type::F32; }
+  const char *type_string() const override { return "Float_32"; }
+};
+
+class F64 : public Primitive<double> {
+public:
+  DEFAULT_NODE_CONSTRUCTOR(F64)
+  ServerLang::Type type() const override { return Type::F64; }
+  const char *type_string() const override { return "Float_64"; }
+};
+
+class Bool : public Primitive<bool> {
+public:
+  DEFAULT_NODE_CONSTRUCTOR(Bool)
+  ServerLang::Type type() const override { return Type::BOOL; }
+  const char *type_string() const override { return "Boolean"; }
+};
+
+class Complex : public Primitive<size_t> {
+public:
+  DEFAULT_NODE_CONSTRUCTOR(Complex)
+  ServerLang::Type type() const override { return Type::COMPLEX; }
+  const char *type_string() const override { return "Complex"; }
+};
+
+class String : public Primitive<std::string> {
+public:
+  DEFAULT_NODE_CONSTRUCTOR(String)
+  ServerLang::Type type() const override { return Type::STRING; }
+  const char *type_string() const override { return "String"; }
+};
+
+class Variant : public Primitive<std::string> {
+public:
+  DEFAULT_NODE_CONSTRUCTOR(Variant)
+  ServerLang::Type type() const override { return Type::VARIANT; }
+  const char *type_string() const override { return "Variant"; }
+};
+
+class Void : public Primitive<bool> {
+public:
+  DEFAULT_NODE_CONSTRUCTOR(Void)
+  ServerLang::Type type() const override { return Type::VOID; }
+  const char *type_string() const override { return "Void"; }
+};
+
+} // namespace InternalTypes
+
+namespace CompoundTypes {
+
+class Array : public Object {
+public:
+  DEFAULT_NODE_CONSTRUCTOR(Array)
+  ServerLang::Type type() const override { return Type::ARRAY; }
+  const char *type_string() const override { return "Array"; }
+};
+
+class Class : public Object {
+public:
+  DEFAULT_NODE_CONSTRUCTOR(Class)
+  ServerLang::Type type() const override { return Type::CLASS; }
+  const char *type_string() const override { return "Class"; }
+};
+
+class Struct : public Object {
+public:
+  DEFAULT_NODE_CONSTRUCTOR(Struct)
+  ServerLang::Type type() const override { return Type::STRUCT; }
+  const char *type_string() const override { return "Struct"; }
+};
+
+class Json : public Object {
+public:
+  DEFAULT_NODE_CONSTRUCTOR(Json)
+  ServerLang::Type type() const override { return Type::JSON; }
+  const char *type_string() const override { return "Json"; }
+};
+
+class Route : public Object {
+public:
+  DEFAULT_NODE_CONSTRUCTOR(Route)
+  ServerLang::Type type() const override { return Type::ROUTE; }
+  const char *type_string() const override { return "Route"; }
+};
+
+} // namespace CompoundTypes
+
+inline ASTNode *get_type_instance(Arena &_arena, const Type _t) {
+  switch (_t) {
+  case ServerLang::Type::I16:
+    return _arena.make<InternalTypes::I16>();
+  case ServerLang::Type::I32:
+    return _arena.make<InternalTypes::I32>();
+  case ServerLang::Type::I64:
+    return _arena.make<InternalTypes::I64>();
+  case ServerLang::Type::U8:
+    return _arena.make<InternalTypes::U8>();
+  case ServerLang::Type::U16:
+    return _arena.make<InternalTypes::U16>();
+  case ServerLang::Type::F32:
+    return _arena.make<InternalTypes::F32>();
+  case ServerLang::Type::F64:
+    return _arena.make<InternalTypes::F64>();
+  case ServerLang::Type::BOOL:
+    return _arena.make<InternalTypes::Bool>();
+  case ServerLang::Type::COMPLEX:
+    return _arena.make<InternalTypes::Complex>();
+  case ServerLang::Type::STRING:
+    return _arena.make<InternalTypes::String>();
+  case ServerLang::Type::VARIANT:
+    return _arena.make<InternalTypes::Variant>();
+  case ServerLang::Type::VOID:
+    return _arena.make<InternalTypes::Void>();
+  case ServerLang::Type::ARRAY:
+    return _arena.make<CompoundTypes::Array>();
+  case ServerLang::Type::CLASS:
+    return _arena.make<CompoundTypes::Class>();
+  case ServerLang::Type::STRUCT:
+    return _arena.make<CompoundTypes::Struct>();
+  case ServerLang::Type::JSON:
+    return _arena.make<CompoundTypes::Json>();
+  case ServerLang::Type::ROUTE:
+    return _arena.make<CompoundTypes::Route>();
+  default:
+    return {};
+    break;
+  }
+}
+
+// A `@script["..."]` or `@lib["..."]` statement. The name is an arena copy of
+// the string literal, unresolved.
+struct Import {
+  enum class Kind : uint8_t { SCRIPT, LIBRARY };
+
+  Kind kind;
+  const char *name;
+};
+
+// Owns every node produced by one SyntaxAnalyzer::analyze call. Nodes and
+// their child lists are bump-allocated and released together.
+class ParseResult {
+public:
+  ParseResult() = default;
+
+  Arena &arena() { return m_arena; }
+  node_list &nodes() { return m_nodes; }
+  const node_list &nodes() const { return m_nodes; }
+  ArenaList<Import> &imports() { return m_imports; }
+  const ArenaList<Import> &imports() const { return m_imports; }
+  // Number of syntax and range errors reported while analyzing the module.
+  size_t errors() const { return m_errors; }
+  void set_errors(const size_t errors) { m_errors = errors; }
+
+private:
+  Arena m_arena;
+  node_list m_nodes;
+  ArenaList<Import> m_imports;
+  size_t m_errors = 0;
+};
+
+} // namespace ServerLang
@@ -0,0 +1,539 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "interner.h"
+#include "json.h"
+#include "json_document.h"
+
+namespace ServerLang {
+
+class FormatTemplate;
+struct Record;
+
+// A VM operand. Numbers and booleans are stored inline; strings point at text
+// owned by the Program (constants) or the Machine (results). A FORMAT is a
+// format string literal the compiler has already parsed for a native, an
+// OBJECT a Json, Struct, Array or Object declaration. A JSON value is a
+// string, object or array inside a parsed request body, read in place.
+struct Value {
+  enum class Kind : uint8_t { NIL, BOOL, INT, FLOAT, STRING, FORMAT, OBJECT,
+                              JSON };
+
+  Kind kind = Kind::NIL;
+  JsonDocument::Ref at = 0; // JSON: where in `d` the value is
+  union {
+    bool b;
+    int64_t i = 0;
+    double f;
+    const std::string *s;
+    const FormatTemplate *t;
+    const Record *o;
+    const JsonDocument *d;
+  };
+
+  static Value boolean(const bool v) {
+    Value r;
+    r.kind = Kind::BOOL;
+    r.b = v;
+    return r;
+  }
+  static Value integer(const int64_t v) {
+    Value r;
+    r.kind = Kind::INT;
+    r.i = v;
+    return r;
+  }
+  static Value number(const double v) {
+    Value r;
+    r.kind = Kind::FLOAT;
+    r.f = v;
+    return r;
+  }
+  static Value string(const std::string *v) {
+    Value r;
+    r.kind = Kind::STRING;
+    r.s = v;
+    return r;
+  }
+
+  static Value format(const FormatTemplate *v) {
+    Value r;
+    r.kind = Kind::FORMAT;
+    r.t = v;
+    return r;
+  }
+  static Value object(const Record *v) {
+    Value r;
+    r.kind = Kind::OBJECT;
+    r.o = v;
+    return r;
+  }
+  static Value json(const JsonDocument *v, const JsonDocument::Ref at) {
+    Value r;
+    r.kind = Kind::JSON;
+    r.d = v;
+    r.at = at;
+    return r;
+  }
+
+  // The text of a STRING, or of a JSON value that is a string.
+  bool text(std::string_view &out) const {
+    if (kind == Kind::STRING)
+      out = *s;
+    else if (kind == Kind::JSON && d->kind(at) == JsonDocument::Kind::STRING)
+      out = d->string(at);
+    else
+      return false;
+    return true;
+  }
+
+  // Text form used for string concatenation and printing; an object's is
+  // its JSON. append_to() adds it to `out` without building a string of its
+  // own.
+  std::string to_string() const {
+    std::string out;
+    append_to(out);
+    return out;
+  }
+  inline void append_to(std::string &out) const;
+};
+
+// A format string parsed once into literal text and argument slots. `%{n}`
+// stands for argument n; a placeholder with no such argument at render time
+// is written as it appears in the source.
+class FormatTemplate {
+public:
+  FormatTemplate() = default;
+  explicit FormatTemplate(const std::string_view source) { compile(source); }
+
+  // Replaces the template, reusing its storage.
+  void compile(const std::string_view source) {
+    m_source.assign(source);
+    m_segments.clear();
+    size_t literal = 0;
+    for (size_t i = 0; i + 2 < source.size(); ++i) {
+      if (source[i] != '%' || source[i + 1] != '{')
+        continue;
+      size_t close = i + 2;
+      uint32_t n = 0;
+      while (close < source.size() && source[close] >= '0' &&
+             source[close] <= '9' && n < (1u << 24))
+        n = n * 10 + static_cast<uint32_t>(source[close++] - '0');
+      if (close == i + 2 || close == source.size() || source[close] != '}')
+        continue;
+      if (i > literal)
+        m_segments.push_back({static_cast<uint32_t>(literal),
+                              static_cast<uint32_t>(i - literal), text});
+      m_segments.push_back({static_cast<uint32_t>(i),
+                            static_cast<uint32_t>(close + 1 - i), n});
+      literal = close + 1;
+      i = close;
+    }
+    if (source.size() > literal)
+      m_segments.push_back({static_cast<uint32_t>(literal),
+                            static_cast<uint32_t>(source.size() - literal),
+                            text});
+  }
+
+  // Appends the template with `args` substituted to `out`.
+  void render(std::string &out, const Value *args, const size_t argc) const {
+    for (auto const &seg : m_segments) {
+      if (seg.arg != text && seg.arg < argc)
+        args[seg.arg].append_to(out);
+      else
+        out.append(m_source, seg.offset, seg.length);
+    }
+  }
+
+  const std::string &source() const { return m_source; }
+  size_t placeholders() const {
+    size_t n = 0;
+    for (auto const &seg : m_segments)
+      n += seg.arg != text;
+    return n;
+  }
+
+private:
+  static constexpr uint32_t text = ~0u;
+
+  // Source text, or the argument `arg` with its placeholder as fallback.
+  struct Segment {
+    uint32_t offset;
+    uint32_t length;
+    uint32_t arg;
+  };
+
+  std::string m_source;
+  std::vector<Segment> m_segments;
+};
+
+// The members of an object value in declaration order. Built by the
+// compiler from the declaration's initializer and never modified, so
+// Machines share it. An array's members have no names.
+struct Record {
+  struct Member {
+    std::string_view name;
+    Value value;
+  };
+
+  bool array = false;
+  std::vector<Member> members;
+};
+
+// The value at `r` in a parsed body. Numbers, booleans and null are read
+// out now; strings, objects and arrays stay references into the document.
+inline Value json_value(const JsonDocument *d, const JsonDocument::Ref r) {
+  int64_t i;
+  double f;
+  switch (d->kind(r)) {
+  case JsonDocument::Kind::NUMBER:
+    if (d->integer(r, i))
+      return Value::integer(i);
+    return d->number(r, f) ? Value::number(f) : Value{};
+  case JsonDocument::Kind::TRUE:
+    return Value::boolean(true);
+  case JsonDocument::Kind::FALSE:
+    return Value::boolean(false);
+  case JsonDocument::Kind::STRING:
+  case JsonDocument::Kind::OBJECT:
+  case JsonDocument::Kind::ARRAY:
+    return Value::json(d, r);
+  default:
+    return {};
+  }
+}
+
+// Writes `v` as JSON, objects member by member.
+inline void write_json(JsonWriter &w, const Value &v) {
+  switch (v.kind) {
+  case Value::Kind::BOOL:
+    return w.boolean(v.b);
+  case Value::Kind::INT:
+    return w.integer(v.i);
+  case Value::Kind::FLOAT:
+    return w.number(v.f);
+  case Value::Kind::STRING:
+    return w.string(*v.s);
+  case Value::Kind::FORMAT:
+    return w.string(v.t->source());
+  case Value::Kind::OBJECT:
+    if (v.o->array) {
+      w.begin_array();
+      for (auto const &m : v.o->members)
+        write_json(w, m.value);
+      return w.end_array();
+    }
+    w.begin_object();
+    for (auto const &m : v.o->members) {
+      w.key(m.name);
+      write_json(w, m.value);
+    }
+    return w.end_object();
+  case Value::Kind::JSON:
+    // Already JSON; copied as it appears in the body.
+    return w.raw(v.d->raw(v.at));
+  default:
+    return w.null();
+  }
+}
+
+inline void Value::append_to(std::string &out) const {
+  char buf[64];
+  switch (kind) {
+  case Kind::BOOL:
+    out += b ? "true" : "false";
+    break;
+  case Kind::INT:
+    out.append(buf, std::to_chars(buf, buf + sizeof buf, i).ptr);
+    break;
+  case Kind::FLOAT: {
+    // The same text as std::to_string.
+    const int n = snprintf(buf, sizeof buf, "%f", f);
+    if (n > 0 && static_cast<size_t>(n) < sizeof buf)
+      out.append(buf, static_cast<size_t>(n));
+    else
+      out += std::to_string(f);
+    break;
+  }
+  case Kind::STRING:
+    out += *s;
+    break;
+  case Kind::FORMAT:
+    out += t->source();
+    break;
+  case Kind::OBJECT: {
+    JsonWriter w(out);
+    write_json(w, *this);
+    break;
+  }
+  case Kind::JSON:
+    out += d->kind(at) == JsonDocument::Kind::STRING ? d->string(at)
+                                                      : d->raw(at);
+    break;
+  default:
+    out += "null";
+    break;
+  }
+}
+
+// Register bytecode. Every instruction is one fixed-size word; `a` names a
+// register of the current frame, `b` and `c` are registers or, where noted,
+// 16-bit indices.
+enum class Op : uint8_t {
+  LOADK,  // R[a] = K[b | c << 16]
+  LOADNIL, // R[a] = null
+  MOVE,   // R[a] = R[b]
+  GETG,   // R[a] = G[b]
+  SETG,   // G[b] = R[a]
+  ADD,    // R[a] = R[b] + R[c]; concatenates if either side is a string
+  SUB,    // R[a] = R[b] - R[c]
+  MUL,    // R[a] = R[b] * R[c]
+  DIV,    // R[a] = R[b] / R[c]
+  AND,    // R[a] = R[b] & R[c]; logical on booleans, bitwise on integers
+  OR,     // R[a] = R[b] | R[c]
+  XOR,    // R[a] = R[b] ^ R[c]
+  NOT,    // R[a] = !R[b]
+  EQ,     // R[a] = R[b] == R[c]; values of different kinds are unequal
+  LT,     // R[a] = R[b] < R[c]; numbers or strings
+  LE,     // R[a] = R[b] <= R[c]
+  GETF,   // R[a] = This.F[b]
+  SETF,   // This.F[b] = R[a]
+  INDEX,  // R[a] = R[b][R[c]]; null if there is no such member
+  BODY,   // R[a] = the request body, parsed as JSON on first use
+  CALL,   // R[a] = Chunk[b](R[a + 1] .. R[a + c])
+  CALLN,  // R[a] = Native[b](R[a + 1] .. R[a + c])
+  RET,    // return R[a]
+  RETNIL, // return null
+};
+
+inline constexpr int op_count = static_cast<int>(Op::RETNIL) + 1;
+
+// Fields of `This`, the request a route is serving. They belong to the
+// Machine running the route and start out null for every request.
+enum class Field : uint8_t { HEADER, BODY, STATUS };
+
+inline constexpr int field_count = static_cast<int>(Field::STATUS) + 1;
+inline constexpr const char *field_names[field_count] = {"Header", "Body",
+                                                         "Status"};
+
+struct Instr {
+  Op op;
+  uint8_t a;
+  uint16_t b;
+  uint16_t c;
+};
+
+class Machine;
+
+// A C++ function callable from bytecode, bound when a call site is compiled.
+// `fn` is the marshalling stub for the function's signature; the compiler
+// has already checked the argument count against `arity`.
+struct Native {
+  using Fn = Value (*)(Machine &vm, const Value *args, uint16_t argc);
+
+  Symbol name = no_id; // qualified, e.g. Core::Json::Stringify
+  Fn fn = nullptr;
+  uint16_t arity = 0;
+  bool variadic = false; // takes `arity` or more arguments
+  // The first argument is a format string; the compiler turns a literal
+  // there into a FormatTemplate constant.
+  bool formats = false;
+};
+
+// Bytecode of one function or route body. Parameters arrive in registers
+// [0, params); the frame needs `registers` slots in total.
+struct Chunk {
+  Symbol name = no_id;
+  uint16_t params = 0;
+  uint16_t registers = 0;
+  std::vector<Instr> code;
+};
+
+// Everything the compiler produced so far: chunks, constants and the global
+// slots they refer to. Grows as further modules are compiled into it.
+class Program {
+public:
+  // Each pool is indexed by a 16-bit operand, except constants, which LOADK
+  // indexes with b and c together. The last index is never handed out, so
+  // it can stand for "none": a full pool reports an error once and then
+  // answers no_slot, or no_constant.
+  static constexpr uint16_t no_slot = 0xFFFF;
+  static constexpr uint16_t no_chunk = no_slot;
+  static constexpr uint32_t no_constant = 0xFFFFFFFF;
+
+  Program() = default;
+  Program(const Program &) = delete;
+  Program &operator=(const Program &) = delete;
+
+public:
+  uint16_t add_chunk(const Symbol name) {
+    if (full(m_chunks.size(), Pool::CHUNKS))
+      return no_chunk;
+    m_chunks.emplace_back();
+    m_chunks.back().name = name;
+    return static_cast<uint16_t>(m_chunks.size() - 1);
+  }
+  Chunk &chunk(const uint16_t index) { return m_chunks[index]; }
+  const Chunk &chunk(const uint16_t index) const { return m_chunks[index]; }
+  size_t chunk_count() const { return m_chunks.size(); }
+
+  // Named functions callable from compiled code.
+  void define_function(const Symbol name, const uint16_t chunk) {
+    m_functions.insert_or_assign(name, chunk);
+  }
+  uint16_t function(const Symbol name) const {
+    auto const *c = m_functions.find(name);
+    return c ? *c : no_chunk;
+  }
+
+  // Slot of the native `n`, added on first use.
+  uint16_t native(const Native &n) {
+    if (auto const *slot = m_native_slots.find(n.name))
+      return *slot;
+    if (full(m_natives.size(), Pool::NATIVES))
+      return no_slot;
+    m_natives.push_back(n);
+    const auto slot = static_cast<uint16_t>(m_natives.size() - 1);
+    m_native_slots.insert_or_assign(n.name, slot);
+    return slot;
+  }
+  const Native &native_at(const uint16_t slot) const {
+    return m_natives[slot];
+  }
+
+  // Booleans, numbers and strings share one slot per value; every object
+  // and format template gets its own.
+  uint32_t constant(const Value v) {
+    uint64_t bits = 0;
+    switch (v.kind) {
+    case Value::Kind::BOOL:
+      bits = v.b;
+      break;
+    case Value::Kind::INT:
+      bits = static_cast<uint64_t>(v.i);
+      break;
+    case Value::Kind::FLOAT:
+      std::memcpy(&bits, &v.f, sizeof bits);
+      break;
+    case Value::Kind::STRING:
+      return string_constant(*v.s);
+    default:
+      return add_constant(v);
+    }
+    auto const [it, added] =
+        m_shared.try_emplace({v.kind, bits}, no_constant);
+    if (added || it->second == no_constant)
+      it->second = add_constant(v);
+    return it->second;
+  }
+  uint32_t string_constant(const std::string_view text) {
+    auto const *s = keep(text);
+    auto const [it, added] = m_shared.try_emplace(
+        {Value::Kind::STRING, reinterpret_cast<uintptr_t>(s)}, no_constant);
+    if (added || it->second == no_constant)
+      it->second = add_constant(Value::string(s));
+    return it->second;
+  }
+  uint32_t format_constant(const std::string_view text) {
+    if (full(m_constants.size(), Pool::CONSTANTS))
+      return no_constant;
+    m_formats.emplace_back(text);
+    return constant(Value::format(&m_formats.back()));
+  }
+  // Storage for object constants and the text they refer to; neither moves
+  // once added. Each distinct text is kept once.
+  Record &add_record() { return m_records.emplace_back(); }
+  const std::string *keep(const std::string_view text) {
+    if (auto const it = m_kept.find(text); it != m_kept.end())
+      return it->second;
+    auto const *s = &m_strings.emplace_back(text);
+    m_kept.emplace(*s, s);
+    return s;
+  }
+  const Value &constant_at(const uint32_t index) const {
+    return m_constants[index];
+  }
+  size_t constant_count() const { return m_constants.size(); }
+
+  // Slot of the global `name`, allocated on first use.
+  uint16_t global(const Symbol name) {
+    if (auto const *g = m_global_slots.find(name))
+      return *g;
+    if (full(m_globals.size(), Pool::GLOBALS))
+      return no_slot;
+    m_globals.push_back(name);
+    const auto slot = static_cast<uint16_t>(m_globals.size() - 1);
+    m_global_slots.insert_or_assign(name, slot);
+    return slot;
+  }
+  Symbol global_name(const uint16_t slot) const { return m_globals[slot]; }
+  size_t global_count() const { return m_globals.size(); }
+
+  // True if `chunks` more chunks fit, along with whichever of `globals` and
+  // `natives` the program has no slot for yet. Reports nothing.
+  bool has_room(const size_t chunks, const std::vector<Symbol> &globals,
+                const std::vector<const Native *> &natives) const {
+    size_t new_globals = 0, new_natives = 0;
+    for (auto const g : globals)
+      new_globals += !m_global_slots.find(g);
+    for (auto const *n : natives)
+      new_natives += !m_native_slots.find(n->name);
+    return m_chunks.size() + chunks <= no_slot &&
+           m_globals.size() + new_globals <= no_slot &&
+           m_natives.size() + new_natives <= no_slot;
+  }
+
+private:
+  enum class Pool : uint8_t { CHUNKS, CONSTANTS, NATIVES, GLOBALS };
+
+  // True if a pool holding `size` entries has no room for another.
+  bool full(const size_t size, const Pool pool) {
+    const size_t limit = pool == Pool::CONSTANTS ? no_constant : no_slot;
+    if (size < limit)
+      return false;
+    static constexpr const char *names[] = {"functions and routes",
+                                            "constants", "native functions",
+                                            "globals"};
+    const auto bit = 1u << static_cast<unsigned>(pool);
+    if (!(m_full & bit)) {
+      m_full |= bit;
+      fprintf(stderr, "[Error]: More than %zu %s in one program\n", limit,
+              names[static_cast<int>(pool)]);
+    }
+    return true;
+  }
+
+  uint32_t add_constant(const Value v) {
+    if (full(m_constants.size(), Pool::CONSTANTS))
+      return no_constant;
+    m_constants.push_back(v);
+    return static_cast<uint32_t>(m_constants.size() - 1);
+  }
+
+  std::vector<Chunk> m_chunks;
+  std::vector<Value> m_constants;
+  std::map<std::pair<Value::Kind, uint64_t>, uint32_t> m_shared;
+  std::deque<std::string> m_strings;
+  std::unordered_map<std::string_view, const std::string *> m_kept;
+  std::deque<FormatTemplate> m_formats;
+  std::deque<Record> m_records;
+  std::vector<Symbol> m_globals;
+  SymbolMap<uint16_t> m_global_slots;
+  SymbolMap<uint16_t> m_functions;
+  std::vector<Native> m_natives;
+  SymbolMap<uint16_t> m_native_slots;
+  unsigned m_full = 0; // pools that have reported being full
+};
+
+} // namespace ServerLang
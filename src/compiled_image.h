@@ -0,0 +1,750 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <unistd.h>
+
+#include "ast.h"
+#include "bytecode.h"
+#include "compiler.h"
+#include "source_file.h"
+
+namespace ServerLang {
+
+// Identifies the sources of the analyzer and compiler; CMake derives it from
+// src/*.h. Without it images are keyed by their layout alone.
+#ifndef SERVERLANG_BUILD_ID
+#define SERVERLANG_BUILD_ID 0
+#endif
+
+// Compiled script image (.nslc). A flat, offset-based encoding of one module
+// that can be mapped and read in place: the tree from SyntaxAnalyzer::analyze
+// and the bytecode the Compiler made of it.
+//
+//   Header | Constant[] | Node[] | ImportEntry[] | Member[] | Chunk[] |
+//   uint32_t links[] | uint32_t routes[] | Instr[] | strings
+//
+// Nodes are stored breadth-first, so the roots are nodes [0, root_count) and
+// the children of a node are the contiguous run starting at first_child.
+// Strings (ids, type names, import names, constant text) are NUL-terminated
+// and referenced by their offset into the string blob.
+//
+// The bytecode is relocatable. Its operands index the image's own tables:
+// constants are stored by value, and the globals, natives and functions of
+// other modules it uses by name, in `links`. Runtime::eval links it into a
+// Program that already holds the module's imports. It was compiled against
+// particular versions of the imported scripts, which imports_hash names.
+namespace Nslc {
+
+struct Header {
+  char magic[4];
+  uint32_t reserved;
+  uint64_t compiler_key;
+  uint64_t source_hash;
+  uint64_t imports_hash;
+  uint32_t node_count;
+  uint32_t root_count;
+  uint32_t import_count;
+  uint32_t constant_count;
+  uint32_t member_count;
+  uint32_t chunk_count;
+  uint32_t function_count; // chunks [0, function_count) define functions
+  uint32_t init_chunk;     // or Program::no_chunk
+  uint32_t global_count;   // links [0, global_count) name globals,
+  uint32_t native_count;   // the next native_count natives
+  uint32_t extern_count;   // and the rest functions of other modules
+  uint32_t route_count;
+  uint32_t code_size; // in instructions
+  uint32_t strings_size;
+};
+
+enum NodeFlags : uint8_t { NULL_NODE = 1 };
+
+struct Node {
+  uint8_t type;
+  uint8_t preferred_type;
+  uint8_t aux; // Function return type or Expression operator
+  uint8_t flags;
+  uint32_t id;
+  uint32_t type_name;
+  uint32_t first_child;
+  uint32_t child_count;
+};
+
+struct ImportEntry {
+  uint32_t kind;
+  uint32_t name;
+};
+
+enum ConstantFlags : uint8_t { ARRAY = 1 };
+
+// A Value. An object's members are the Member entries [bits, bits + size),
+// each naming a constant that comes before the object.
+struct Constant {
+  uint8_t kind; // Value::Kind, never JSON
+  uint8_t flags;
+  uint16_t reserved;
+  uint32_t size; // STRING, FORMAT: length of the text; OBJECT: member count
+  // BOOL, INT, FLOAT: the value; STRING, FORMAT: offset of the text; OBJECT:
+  // the first member.
+  uint64_t bits;
+};
+
+struct Member {
+  uint32_t name;
+  uint32_t value;
+};
+
+// Instructions [first, first + size) of the code. A LOADK indexes the
+// constants, GETG and SETG the globals and CALLN the natives among links;
+// a CALL names chunk b if b < chunk_count and otherwise the function of
+// another module at links[global_count + native_count + b - chunk_count].
+struct Chunk {
+  uint32_t name;
+  uint16_t params;
+  uint16_t registers;
+  uint32_t first;
+  uint32_t size;
+};
+
+inline constexpr char magic[4] = {'N', 'S', 'L', 'C'};
+
+// Largest values the tag bytes of a Node may hold.
+inline constexpr uint8_t last_type =
+    static_cast<uint8_t>(Type::RETURNEXPRESSION);
+inline constexpr uint8_t last_operator =
+    static_cast<uint8_t>(Operators::INDEX);
+
+// The checks in CompiledImage::validate() are written for these sizes and
+// tag ranges; revisit them along with any change that trips an assert.
+static_assert(sizeof(Header) == 88 && sizeof(Node) == 20 &&
+                  sizeof(ImportEntry) == 8 && sizeof(Constant) == 16 &&
+                  sizeof(Member) == 8 && sizeof(Chunk) == 16 &&
+                  sizeof(Instr) == 6,
+              "the image layout changed");
+static_assert(last_type == 29 && last_operator == 23 && op_count == 24 &&
+                  field_count == 3 &&
+                  static_cast<int>(Value::Kind::JSON) == 7 &&
+                  static_cast<int>(Import::Kind::LIBRARY) == 1,
+              "a tag stored in images changed its range");
+
+// Folds the eight bytes of `v` into the FNV-1a hash `h`.
+constexpr uint64_t mix(uint64_t h, const uint64_t v) {
+  for (int shift = 0; shift < 64; shift += 8) {
+    h ^= (v >> shift) & 0xFF;
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+// Images are only read by a build like the one that wrote them: the key
+// changes with the interpreter's sources, the size of every table entry
+// and the range of every tag an image stores.
+inline constexpr uint64_t compiler_key = [] {
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (const uint64_t v :
+       {uint64_t{SERVERLANG_BUILD_ID}, uint64_t{sizeof(Header)},
+        uint64_t{sizeof(Node)}, uint64_t{sizeof(ImportEntry)},
+        uint64_t{sizeof(Constant)}, uint64_t{sizeof(Member)},
+        uint64_t{sizeof(Chunk)}, uint64_t{sizeof(Instr)},
+        uint64_t{last_type}, uint64_t{last_operator}, uint64_t{op_count},
+        uint64_t{field_count}, static_cast<uint64_t>(Value::Kind::JSON),
+        static_cast<uint64_t>(Import::Kind::LIBRARY)})
+    h = mix(h, v);
+  return h;
+}();
+
+// Where each section of the image `h` describes starts, and its size.
+struct Layout {
+  explicit Layout(const Header &h) {
+    constants = sizeof(Header);
+    nodes = constants + uint64_t{h.constant_count} * sizeof(Constant);
+    imports = nodes + uint64_t{h.node_count} * sizeof(Node);
+    members = imports + uint64_t{h.import_count} * sizeof(ImportEntry);
+    chunks = members + uint64_t{h.member_count} * sizeof(Member);
+    links = chunks + uint64_t{h.chunk_count} * sizeof(Chunk);
+    routes = links + (uint64_t{h.global_count} + h.native_count +
+                      h.extern_count) *
+                         sizeof(uint32_t);
+    code = routes + uint64_t{h.route_count} * sizeof(uint32_t);
+    strings = code + uint64_t{h.code_size} * sizeof(Instr);
+    end = strings + h.strings_size;
+  }
+
+  uint64_t constants, nodes, imports, members, chunks, links, routes, code,
+      strings, end;
+};
+
+// Collects the tables of one image from the module a Program holds.
+class Writer {
+public:
+  Writer(const Program &program, const CompiledModule &module)
+      : m_program(program), m_module(module),
+        m_chunk_count(static_cast<uint16_t>(module.end_chunk -
+                                            module.first_chunk)) {}
+
+public:
+  uint32_t string(const std::string_view str) {
+    auto [it, inserted] =
+        m_offsets.try_emplace(str, static_cast<uint32_t>(strings.size()));
+    if (inserted) {
+      strings.append(str);
+      strings += '\0';
+    }
+    return it->second;
+  }
+
+  // Writes the module's chunks with their operands relocated.
+  void code() {
+    for (auto i = m_module.first_chunk; i < m_module.end_chunk; ++i) {
+      auto const &c = m_program.chunk(i);
+      chunks.push_back({string(symbol_name(c.name)), c.params, c.registers,
+                        static_cast<uint32_t>(instrs.size()),
+                        static_cast<uint32_t>(c.code.size())});
+      for (auto const &in : c.code)
+        instrs.push_back(relocate(in));
+      // A function defined twice leaves a chunk that was never compiled
+      // and is never called.
+      if (c.code.empty()) {
+        instrs.push_back({Op::RETNIL, 0, 0, 0});
+        chunks.back().size = 1;
+      }
+    }
+    for (auto const &r : m_module.routes)
+      routes.push_back(local(r.chunk));
+  }
+
+  uint32_t local(const uint16_t chunk) const {
+    return chunk == Program::no_chunk ? Program::no_chunk
+                                      : chunk - m_module.first_chunk;
+  }
+
+  std::vector<Constant> constants;
+  std::vector<Member> members;
+  std::vector<Chunk> chunks;
+  std::vector<uint32_t> globals, natives, externs;
+  std::vector<uint32_t> routes;
+  std::vector<Instr> instrs;
+  std::string strings;
+
+private:
+  Instr relocate(Instr in) {
+    switch (in.op) {
+    case Op::LOADK: {
+      const auto k = constant(in.b | uint32_t{in.c} << 16);
+      in.b = static_cast<uint16_t>(k);
+      in.c = static_cast<uint16_t>(k >> 16);
+      break;
+    }
+    case Op::GETG:
+    case Op::SETG:
+      in.b = link(m_globals, globals, in.b,
+                  symbol_name(m_program.global_name(in.b)));
+      break;
+    case Op::CALLN:
+      in.b = link(m_natives, natives, in.b,
+                  symbol_name(m_program.native_at(in.b).name));
+      break;
+    case Op::CALL:
+      if (in.b >= m_module.first_chunk && in.b < m_module.end_chunk)
+        in.b = static_cast<uint16_t>(in.b - m_module.first_chunk);
+      else
+        in.b = static_cast<uint16_t>(
+            m_chunk_count + link(m_externs, externs, in.b,
+                                 symbol_name(m_program.chunk(in.b).name)));
+      break;
+    default:
+      break;
+    }
+    return in;
+  }
+
+  // Index in `names` of the program's slot `slot`, named `name`.
+  uint16_t link(std::unordered_map<uint16_t, uint16_t> &index,
+                std::vector<uint32_t> &names, const uint16_t slot,
+                const char *name) {
+    auto [it, added] =
+        index.try_emplace(slot, static_cast<uint16_t>(names.size()));
+    if (added)
+      names.push_back(string(name));
+    return it->second;
+  }
+
+  // Index in the image of the program's constant `k`.
+  uint32_t constant(const uint32_t k) {
+    auto const it = m_constants.find(k);
+    if (it != m_constants.end())
+      return it->second;
+    const auto index = value(m_program.constant_at(k));
+    m_constants.emplace(k, index);
+    return index;
+  }
+
+  uint32_t value(const Value &v) {
+    Constant c{};
+    c.kind = static_cast<uint8_t>(v.kind);
+    switch (v.kind) {
+    case Value::Kind::BOOL:
+      c.bits = v.b;
+      break;
+    case Value::Kind::INT:
+      c.bits = static_cast<uint64_t>(v.i);
+      break;
+    case Value::Kind::FLOAT:
+      std::memcpy(&c.bits, &v.f, sizeof c.bits);
+      break;
+    case Value::Kind::STRING:
+      c.bits = string(*v.s);
+      c.size = static_cast<uint32_t>(v.s->size());
+      break;
+    case Value::Kind::FORMAT:
+      c.bits = string(v.t->source());
+      c.size = static_cast<uint32_t>(v.t->source().size());
+      break;
+    case Value::Kind::OBJECT: {
+      // The members' values go first, nested objects included.
+      std::vector<Member> ms;
+      for (auto const &m : v.o->members)
+        ms.push_back({string(m.name), value(m.value)});
+      c.flags = v.o->array ? ARRAY : 0;
+      c.bits = members.size();
+      c.size = static_cast<uint32_t>(ms.size());
+      members.insert(members.end(), ms.begin(), ms.end());
+      break;
+    }
+    default:
+      c.kind = static_cast<uint8_t>(Value::Kind::NIL);
+      break;
+    }
+    constants.push_back(c);
+    return static_cast<uint32_t>(constants.size() - 1);
+  }
+
+  const Program &m_program;
+  const CompiledModule &m_module;
+  const uint16_t m_chunk_count;
+  std::unordered_map<std::string_view, uint32_t> m_offsets;
+  std::unordered_map<uint32_t, uint32_t> m_constants;
+  std::unordered_map<uint16_t, uint16_t> m_globals, m_natives, m_externs;
+};
+
+} // namespace Nslc
+
+class CompiledImage {
+public:
+  CompiledImage() = default;
+  CompiledImage(const CompiledImage &) = delete;
+  CompiledImage &operator=(const CompiledImage &) = delete;
+
+public:
+  // `script.nsl` -> `script.nslc`; other names get `.nslc` appended.
+  static std::string path_for(const std::string &script) {
+    const std::string_view ext = ".nsl";
+    if (script.size() > ext.size() &&
+        script.compare(script.size() - ext.size(), ext.size(), ext) == 0)
+      return script + 'c';
+    return script + ".nslc";
+  }
+
+  // The image of the module `result`, which compiling it has added to
+  // `program` as `module`. `imports_hash` names the imported scripts it was
+  // linked against.
+  static std::string build(const ParseResult &result, const Program &program,
+                           const CompiledModule &module,
+                           const uint64_t source_hash,
+                           const uint64_t imports_hash) {
+    Nslc::Writer w(program, module);
+    std::vector<Nslc::Node> nodes;
+    std::vector<const ASTNode *> order;
+
+    for (auto const *root : result.nodes())
+      order.push_back(root);
+    const auto root_count = static_cast<uint32_t>(order.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+      auto const *v = order[i];
+      Nslc::Node n{};
+      if (!v) {
+        n.flags = Nslc::NULL_NODE;
+        n.first_child = static_cast<uint32_t>(order.size());
+        nodes.push_back(n);
+        continue;
+      }
+      n.type = static_cast<uint8_t>(v->type());
+      n.preferred_type = static_cast<uint8_t>(v->preferredType());
+      n.aux = aux_of(v);
+      n.id = w.string(v->name());
+      n.type_name = w.string(v->type_string());
+      n.first_child = static_cast<uint32_t>(order.size());
+      n.child_count = static_cast<uint32_t>(v->children_const().size());
+      for (auto const *c : v->children_const())
+        order.push_back(c);
+      nodes.push_back(n);
+    }
+
+    std::vector<Nslc::ImportEntry> imports;
+    for (auto const &imp : result.imports())
+      imports.push_back({static_cast<uint32_t>(imp.kind), w.string(imp.name)});
+    w.code();
+
+    Nslc::Header h{};
+    std::memcpy(h.magic, Nslc::magic, sizeof(h.magic));
+    h.compiler_key = Nslc::compiler_key;
+    h.source_hash = source_hash;
+    h.imports_hash = imports_hash;
+    h.node_count = static_cast<uint32_t>(nodes.size());
+    h.root_count = root_count;
+    h.import_count = static_cast<uint32_t>(imports.size());
+    h.constant_count = static_cast<uint32_t>(w.constants.size());
+    h.member_count = static_cast<uint32_t>(w.members.size());
+    h.chunk_count = static_cast<uint32_t>(w.chunks.size());
+    h.function_count = module.functions;
+    h.init_chunk = w.local(module.init);
+    h.global_count = static_cast<uint32_t>(w.globals.size());
+    h.native_count = static_cast<uint32_t>(w.natives.size());
+    h.extern_count = static_cast<uint32_t>(w.externs.size());
+    h.route_count = static_cast<uint32_t>(w.routes.size());
+    h.code_size = static_cast<uint32_t>(w.instrs.size());
+    h.strings_size = static_cast<uint32_t>(w.strings.size());
+
+    std::string out;
+    out.reserve(Nslc::Layout(h).end);
+    auto const append = [&out](auto const &items) {
+      out.append(reinterpret_cast<const char *>(items.data()),
+                 items.size() * sizeof(items[0]));
+    };
+    out.append(reinterpret_cast<const char *>(&h), sizeof(h));
+    append(w.constants);
+    append(nodes);
+    append(imports);
+    append(w.members);
+    append(w.chunks);
+    append(w.globals);
+    append(w.natives);
+    append(w.externs);
+    append(w.routes);
+    append(w.instrs);
+    out += w.strings;
+    return out;
+  }
+
+  // Writes through a temporary file and a rename, so a concurrent reader sees
+  // either the old image or the complete new one.
+  static bool write(const std::string &path, const std::string_view bytes) {
+    const auto tmp = path + ".tmp." + std::to_string(::getpid());
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f)
+      return false;
+    const bool ok = fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+    if (fclose(f) != 0 || !ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+      std::remove(tmp.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  // Maps `path` and uses it if it is a well-formed image of a source with
+  // `source_hash` written by this compiler version.
+  bool map(const std::string &path, const uint64_t source_hash) {
+    m_owned.clear();
+    if (!m_file.open(path.c_str()))
+      return false;
+    if (validate(m_file.data(), source_hash))
+      return true;
+    m_file.close();
+    return false;
+  }
+
+  // Uses an image built in memory.
+  bool adopt(std::string bytes, const uint64_t source_hash) {
+    m_file.close();
+    m_owned = std::move(bytes);
+    return validate(m_owned, source_hash);
+  }
+
+public:
+  const Nslc::Header &header() const { return *m_header; }
+  size_t root_count() const { return m_header->root_count; }
+  const Nslc::Node &node(const uint32_t i) const { return m_nodes[i]; }
+  const char *string(const uint32_t offset) const {
+    return m_strings + offset;
+  }
+
+  std::vector<Import> imports() const {
+    std::vector<Import> ret;
+    for (uint32_t i = 0; i < m_header->import_count; ++i)
+      ret.push_back({static_cast<Import::Kind>(m_imports[i].kind),
+                     string(m_imports[i].name)});
+    return ret;
+  }
+
+  const Nslc::Constant &constant(const uint32_t i) const {
+    return m_constants[i];
+  }
+  const Nslc::Member &member(const uint32_t i) const { return m_members[i]; }
+  // The text of a STRING or FORMAT constant.
+  std::string_view text(const Nslc::Constant &c) const {
+    return {m_strings + c.bits, c.size};
+  }
+  const Nslc::Chunk &chunk(const uint32_t i) const { return m_chunks[i]; }
+  const Instr *code(const Nslc::Chunk &c) const { return m_code + c.first; }
+  const char *global(const uint32_t i) const { return string(m_links[i]); }
+  const char *native(const uint32_t i) const {
+    return string(m_links[m_header->global_count + i]);
+  }
+  const char *external(const uint32_t i) const {
+    return string(
+        m_links[m_header->global_count + m_header->native_count + i]);
+  }
+  // Chunk of the i-th route in declaration order, or Program::no_chunk.
+  uint32_t route(const uint32_t i) const { return m_routes[i]; }
+
+  // Same output as SyntaxAnalyzer::print_tree on the original nodes.
+  void print_tree() const { print_tree(0, m_header->root_count, 0); }
+
+private:
+  static uint8_t aux_of(const ASTNode *v) {
+    switch (v->type()) {
+    case Type::FUNCTION:
+      return static_cast<uint8_t>(
+          static_cast<const Function<node_ptr> *>(v)->return_t());
+    case Type::ARITHMETICEXPRESSION:
+    case Type::LOGICALEXPRESSION:
+    case Type::ASSIGNMENTEXPRESSION:
+    case Type::CALLEXPRESSION:
+    case Type::ACCESSEXPRESSION:
+    case Type::RETURNEXPRESSION:
+      return static_cast<uint8_t>(static_cast<const Expression *>(v)->opr());
+    default:
+      return 0;
+    }
+  }
+
+  // Whether `n`'s tag bytes name a Type and, in aux, the Type or operator
+  // that aux_of() stores for that kind of node.
+  static bool valid_tags(const Nslc::Node &n) {
+    if (n.type > Nslc::last_type || n.preferred_type > Nslc::last_type)
+      return false;
+    switch (static_cast<Type>(n.type)) {
+    case Type::FUNCTION:
+      return n.aux <= Nslc::last_type;
+    case Type::ARITHMETICEXPRESSION:
+    case Type::LOGICALEXPRESSION:
+    case Type::ASSIGNMENTEXPRESSION:
+    case Type::CALLEXPRESSION:
+    case Type::ACCESSEXPRESSION:
+    case Type::RETURNEXPRESSION:
+      return n.aux <= Nslc::last_operator;
+    default:
+      return n.aux == 0;
+    }
+  }
+
+  // Whether `in` only reads registers below `registers` and entries that
+  // exist in the tables of `h`.
+  static bool valid_instr(const Instr &in, const uint32_t registers,
+                          const Nslc::Header &h) {
+    auto const reg = [registers](const uint32_t r) { return r < registers; };
+    switch (in.op) {
+    case Op::LOADK:
+      return reg(in.a) && (in.b | uint32_t{in.c} << 16) < h.constant_count;
+    case Op::LOADNIL:
+    case Op::BODY:
+    case Op::RET:
+      return reg(in.a);
+    case Op::MOVE:
+    case Op::NOT:
+      return reg(in.a) && reg(in.b);
+    case Op::GETG:
+    case Op::SETG:
+      return reg(in.a) && in.b < h.global_count;
+    case Op::ADD:
+    case Op::SUB:
+    case Op::MUL:
+    case Op::DIV:
+    case Op::AND:
+    case Op::OR:
+    case Op::XOR:
+    case Op::EQ:
+    case Op::LT:
+    case Op::LE:
+    case Op::INDEX:
+      return reg(in.a) && reg(in.b) && reg(in.c);
+    case Op::GETF:
+    case Op::SETF:
+      return reg(in.a) && in.b < field_count;
+    case Op::CALL:
+      return reg(uint32_t{in.a} + in.c) &&
+             in.b < uint64_t{h.chunk_count} + h.extern_count;
+    case Op::CALLN:
+      return reg(uint32_t{in.a} + in.c) && in.b < h.native_count;
+    case Op::RETNIL:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  // Whether the constant `i` of `h` is a Value: its text or members are in
+  // range, and the members refer to earlier constants.
+  static bool valid_constant(const uint32_t i, const Nslc::Constant *constants,
+                             const Nslc::Member *members,
+                             const Nslc::Header &h) {
+    auto const &c = constants[i];
+    if (c.flags & ~Nslc::ARRAY ||
+        (c.flags && c.kind != static_cast<uint8_t>(Value::Kind::OBJECT)))
+      return false;
+    switch (static_cast<Value::Kind>(c.kind)) {
+    case Value::Kind::NIL:
+    case Value::Kind::INT:
+    case Value::Kind::FLOAT:
+      return true;
+    case Value::Kind::BOOL:
+      return c.bits <= 1;
+    case Value::Kind::STRING:
+    case Value::Kind::FORMAT:
+      return c.bits < h.strings_size && c.size < h.strings_size - c.bits;
+    case Value::Kind::OBJECT:
+      if (c.bits > h.member_count || c.size > h.member_count - c.bits)
+        return false;
+      for (auto m = c.bits; m < c.bits + c.size; ++m)
+        if (members[m].name >= h.strings_size || members[m].value >= i)
+          return false;
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  // Bounds-checks every offset, tag and operand once so the accessors, and
+  // the bytecode once linked, can stay unchecked. Children always follow
+  // their parent in breadth-first order, so walking the tree from the roots
+  // ends. The imports are checked against imports_hash by the caller.
+  bool validate(const std::string_view image, const uint64_t source_hash) {
+    if (image.size() < sizeof(Nslc::Header))
+      return false;
+    auto const *h = reinterpret_cast<const Nslc::Header *>(image.data());
+    const Nslc::Layout at(*h);
+    if (std::memcmp(h->magic, Nslc::magic, sizeof(h->magic)) != 0 ||
+        h->compiler_key != Nslc::compiler_key ||
+        h->source_hash != source_hash || h->root_count > h->node_count ||
+        at.end != image.size() || (h->strings_size && image.back() != '\0'))
+      return false;
+    auto const section = [&image](const uint64_t offset) {
+      return image.data() + offset;
+    };
+
+    auto const *nodes = reinterpret_cast<const Nslc::Node *>(section(at.nodes));
+    uint32_t routes = 0;
+    for (uint32_t i = 0; i < h->node_count; ++i) {
+      auto const &n = nodes[i];
+      if (n.flags & ~Nslc::NULL_NODE)
+        return false;
+      if (n.flags & Nslc::NULL_NODE)
+        continue;
+      if (n.id >= h->strings_size || n.type_name >= h->strings_size ||
+          n.first_child <= i ||
+          uint64_t{n.first_child} + n.child_count > h->node_count ||
+          !valid_tags(n))
+        return false;
+      routes +=
+          i < h->root_count && n.type == static_cast<uint8_t>(Type::ROUTE);
+    }
+    auto const *imports =
+        reinterpret_cast<const Nslc::ImportEntry *>(section(at.imports));
+    for (uint32_t i = 0; i < h->import_count; ++i)
+      if (imports[i].name >= h->strings_size ||
+          imports[i].kind > static_cast<uint32_t>(Import::Kind::LIBRARY))
+        return false;
+
+    auto const *constants =
+        reinterpret_cast<const Nslc::Constant *>(section(at.constants));
+    auto const *members =
+        reinterpret_cast<const Nslc::Member *>(section(at.members));
+    for (uint32_t i = 0; i < h->constant_count; ++i)
+      if (!valid_constant(i, constants, members, *h))
+        return false;
+
+    auto const *chunks =
+        reinterpret_cast<const Nslc::Chunk *>(section(at.chunks));
+    auto const *code = reinterpret_cast<const Instr *>(section(at.code));
+    for (uint32_t i = 0; i < h->chunk_count; ++i) {
+      auto const &c = chunks[i];
+      if (c.name >= h->strings_size || c.params > c.registers || !c.size ||
+          c.first > h->code_size || c.size > h->code_size - c.first)
+        return false;
+      for (uint32_t k = c.first; k < c.first + c.size; ++k)
+        if (!valid_instr(code[k], c.registers, *h))
+          return false;
+      // Execution cannot run off the end of a chunk.
+      auto const last = code[c.first + c.size - 1].op;
+      if (last != Op::RET && last != Op::RETNIL)
+        return false;
+    }
+
+    auto const *links = reinterpret_cast<const uint32_t *>(section(at.links));
+    for (uint64_t i = 0; i < (at.routes - at.links) / sizeof(uint32_t); ++i)
+      if (links[i] >= h->strings_size)
+        return false;
+    auto const *route_chunks =
+        reinterpret_cast<const uint32_t *>(section(at.routes));
+    auto const chunk_or_none = [h](const uint32_t c) {
+      return c < h->chunk_count || c == Program::no_chunk;
+    };
+    if (h->route_count != routes || h->function_count > h->chunk_count ||
+        !chunk_or_none(h->init_chunk))
+      return false;
+    for (uint32_t i = 0; i < h->route_count; ++i)
+      if (!chunk_or_none(route_chunks[i]))
+        return false;
+
+    m_header = h;
+    m_nodes = nodes;
+    m_imports = imports;
+    m_constants = constants;
+    m_members = members;
+    m_chunks = chunks;
+    m_links = links;
+    m_routes = route_chunks;
+    m_code = code;
+    m_strings = section(at.strings);
+    return true;
+  }
+
+  void print_tree(const uint32_t first, const uint32_t count,
+                  const int offset) const {
+    for (uint32_t i = first; i < first + count; ++i) {
+      auto const &n = m_nodes[i];
+      if (n.flags & Nslc::NULL_NODE) {
+        fprintf(stdout, "[_NULL_OBJECT_]\n");
+        continue;
+      }
+      auto str = std::string(offset, '.');
+      fprintf(stdout, "%s| %s : %s\n", str.c_str(), string(n.id),
+              string(n.type_name));
+      if (n.child_count)
+        print_tree(n.first_child, n.child_count, offset + 3);
+    }
+  }
+
+private:
+  SourceFile m_file;
+  std::string m_owned;
+  const Nslc::Header *m_header = nullptr;
+  const Nslc::Node *m_nodes = nullptr;
+  const Nslc::ImportEntry *m_imports = nullptr;
+  const Nslc::Constant *m_constants = nullptr;
+  const Nslc::Member *m_members = nullptr;
+  const Nslc::Chunk *m_chunks = nullptr;
+  const uint32_t *m_links = nullptr;
+  const uint32_t *m_routes = nullptr;
+  const Instr *m_code = nullptr;
+  const char *m_strings = nullptr;
+};
+
+} // namespace ServerLang
@@ -0,0 +1,661 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ast.h"
+#include "bytecode.h"
+#include "const_fold.h"
+#include "libraries.h"
+#include "native.h"
+#include "trace.h"
+
+namespace ServerLang {
+
+struct CompiledRoute {
+  Symbol pattern;
+  uint16_t chunk;
+};
+
+// The chunks one module added to a Program, enough to write the module out
+// and link it into another Program: its functions come first, then its
+// routes and last its init chunk.
+struct CompiledModule {
+  uint16_t first_chunk = 0;
+  uint16_t end_chunk = 0;
+  // Chunks [first_chunk, first_chunk + functions) define the functions, in
+  // source order.
+  uint16_t functions = 0;
+  uint16_t init = Program::no_chunk;
+  std::vector<CompiledRoute> routes; // in declaration order
+  size_t errors = 0;                  // reported while compiling it
+};
+
+// Lowers declarations to Program bytecode.
+//
+// A function body is the Scope child of its Function node and its parameters
+// come from parameters_const(); a route body is the Scope child of its Route.
+// Inside a body, variable declarations become registers, a Primitive in an
+// operand position is a literal (null if it holds no value), an Identifier
+// is a local or, failing that, a global, and Expressions map onto one
+// instruction each where they can.
+//
+// Calls through a `::` chain whose root a native library exports under, such
+// as Core::Json::Stringify(v), are bound here to that native: the call site
+// becomes a CALLN on a slot of the Program's native table, so running it
+// looks nothing up by name.
+class Compiler {
+public:
+  explicit Compiler(Program &program,
+                    const NativeRegistry &natives = builtin_libraries())
+      : m_program(program), m_natives(natives) {}
+
+public:
+  // Brings the exports of `@lib[name]` into scope for the call sites
+  // compiled afterwards. Returns false if there is no such library.
+  bool import_library(const std::string_view name) {
+    if (auto const *lib = m_natives.find(name)) {
+      m_libraries.push_back(lib);
+      return true;
+    }
+    ++m_errors;
+    fprintf(stderr, "[Error]: Unknown library '%.*s'\n",
+            static_cast<int>(name.size()), name.data());
+    return false;
+  }
+
+  // Compiles the top level of one module. Functions and routes get a chunk
+  // each; every other declaration becomes a global set by the returned init
+  // chunk. Functions are declared before any body is compiled, so calls may
+  // refer to functions defined further down.
+  uint16_t compile_module(const node_list &nodes) {
+    m_module = {};
+    m_module.first_chunk = static_cast<uint16_t>(m_program.chunk_count());
+    for (auto const *n : nodes)
+      if (n && n->type() == Type::FUNCTION)
+        if (const auto f = m_program.add_chunk(n->id()); slot(f)) {
+          m_program.define_function(n->id(), f);
+          ++m_module.functions;
+        }
+
+    for (auto const *n : nodes) {
+      if (!n)
+        continue;
+      if (n->type() == Type::FUNCTION) {
+        if (const auto f = m_program.function(n->id()); f != Program::no_chunk)
+          compile_function(n, f);
+      } else if (n->type() == Type::ROUTE)
+        m_module.routes.push_back({n->id(), compile_route(n)});
+    }
+
+    const auto init = m_program.add_chunk(intern("__init__"));
+    m_module.end_chunk = static_cast<uint16_t>(m_program.chunk_count());
+    if (!slot(init)) {
+      m_module.errors = m_errors;
+      return init;
+    }
+    m_module.init = init;
+    begin(init, 0);
+    // Globals are initialized and top-level statements run in source order.
+    for (auto const *n : nodes) {
+      if (!n || n->type() == Type::FUNCTION || n->type() == Type::ROUTE)
+        continue;
+      if (!(is_variable(n->type()) || is_record(n->type()))) {
+        statement(n);
+        continue;
+      }
+      const auto save = m_top;
+      const auto r = push_temp();
+      initializer(n, r);
+      if (const auto g = m_program.global(n->id()); slot(g))
+        emit(Op::SETG, r, g);
+      m_top = save;
+    }
+    end();
+    m_module.errors = m_errors;
+    return init;
+  }
+
+  // Compiles `fn` (a Function<node_ptr>) into the existing chunk `index`.
+  void compile_function(const ASTNode *fn, const uint16_t index) {
+    auto const &params =
+        static_cast<const Function<node_ptr> *>(fn)->parameters_const();
+    begin(index, static_cast<uint16_t>(params.size()));
+    for (auto const *p : params)
+      if (p)
+        add_local(p->id());
+    body(fn);
+    end();
+  }
+
+  // Returns no_chunk, leaving the route without a body, if the program has
+  // no room for another chunk.
+  uint16_t compile_route(const ASTNode *route) {
+    const auto index = m_program.add_chunk(route->id());
+    if (!slot(index))
+      return index;
+    begin(index, 0);
+    body(route);
+    end();
+    return index;
+  }
+
+  // Routes compiled by compile_module, in declaration order.
+  const std::vector<CompiledRoute> &routes() const { return m_module.routes; }
+  // What the last compile_module added.
+  const CompiledModule &module() const { return m_module; }
+
+  // Number of errors reported so far.
+  size_t errors() const { return m_errors; }
+
+private:
+  static constexpr uint16_t max_registers = 256;
+
+  struct Local {
+    Symbol name;
+    uint8_t reg;
+  };
+
+  static bool is_variable(const Type t) {
+    return t >= Type::I16 && t <= Type::VOID;
+  }
+
+  // Declarations whose `{ ... }` initializer lists members rather than
+  // statements; they become constant objects.
+  static bool is_record(const Type t) {
+    return t == Type::ARRAY || t == Type::STRUCT || t == Type::JSON ||
+           t == Type::OBJECT;
+  }
+
+  void begin(const uint16_t index, const uint16_t params) {
+    m_chunk = &m_program.chunk(index);
+    m_chunk->params = params;
+    m_chunk->registers = params;
+    m_chunk->code.clear();
+    m_locals.clear();
+    m_top = 0;
+  }
+
+  void end() {
+    emit(Op::RETNIL, 0);
+    m_chunk = nullptr;
+  }
+
+  void error(const char *what, const Symbol name) {
+    ++m_errors;
+    fprintf(stderr, "[Error]: %s '%s' in %s\n", what, symbol_name(name),
+            symbol_name(m_chunk->name));
+  }
+
+  // False, counting an error, if `index` is the no_slot a full pool of the
+  // program answers with; the pool has already reported it.
+  bool slot(const uint16_t index) {
+    if (index != Program::no_slot)
+      return true;
+    ++m_errors;
+    return false;
+  }
+
+  // R[dst] = K[k], or null if the constant did not fit.
+  void load(const uint8_t dst, const uint32_t k) {
+    if (k == Program::no_constant) {
+      ++m_errors;
+      emit(Op::LOADNIL, dst);
+    } else
+      emit(Op::LOADK, dst, static_cast<uint16_t>(k),
+           static_cast<uint16_t>(k >> 16));
+  }
+
+  void emit(const Op op, const uint8_t a, const uint16_t b = 0,
+            const uint16_t c = 0) {
+    m_chunk->code.push_back({op, a, b, c});
+  }
+
+  uint8_t push_temp() {
+    if (m_top == max_registers) {
+      error("Too many registers needed by", m_chunk->name);
+      return max_registers - 1;
+    }
+    const auto r = static_cast<uint8_t>(m_top++);
+    if (m_top > m_chunk->registers)
+      m_chunk->registers = m_top;
+    return r;
+  }
+
+  void add_local(const Symbol name) {
+    m_locals.push_back({name, push_temp()});
+  }
+
+  // Register of the local `name`, searching the innermost declaration first.
+  int find_local(const Symbol name) const {
+    for (auto it = m_locals.rbegin(); it != m_locals.rend(); ++it)
+      if (it->name == name)
+        return it->reg;
+    return -1;
+  }
+
+  void body(const ASTNode *decl) {
+    for (auto const *c : decl->children_const())
+      if (c && c->type() == Type::SCOPE)
+        for (auto const *s : c->children_const())
+          statement(s);
+  }
+
+  void statement(const ASTNode *n) {
+    if (!n)
+      return;
+    const auto save = m_top;
+    switch (n->type()) {
+    case Type::I16... Type::VOID:
+    case Type::ARRAY:
+    case Type::STRUCT:
+    case Type::JSON:
+    case Type::OBJECT: {
+      // The name only becomes visible after its initializer, so
+      // `var x = x + 1` still reads an outer x.
+      const auto r = push_temp();
+      initializer(n, r);
+      m_locals.push_back({n->id(), r});
+      return;
+    }
+    case Type::RETURNEXPRESSION: {
+      auto const *value = static_cast<const Expression *>(n)->lhs();
+      if (value)
+        emit(Op::RET, operand(value));
+      else
+        emit(Op::RETNIL, 0);
+      break;
+    }
+    case Type::ASSIGNMENTEXPRESSION:
+    case Type::ARITHMETICEXPRESSION:
+    case Type::LOGICALEXPRESSION:
+    case Type::CALLEXPRESSION: {
+      auto const *e = static_cast<const Expression *>(n);
+      if (n->type() == Type::ASSIGNMENTEXPRESSION)
+        assign(e);
+      else
+        expression(n, push_temp());
+      break;
+    }
+    default:
+      TRACE_LOG(RUNTIME, VERBOSE, "Not compiled: %s %s", n->type_string(),
+                n->name());
+      break;
+    }
+    m_top = save;
+  }
+
+  // A declaration's value: its initializer expression if it has one,
+  // otherwise the literal stored on the node itself. An object declaration
+  // loads its constant object.
+  void initializer(const ASTNode *decl, const uint8_t dst) {
+    auto const &c = decl->children_const();
+    if (is_record(decl->type()))
+      load(dst, m_program.constant(Value::object(&record(decl))));
+    else if (c.size() && c[0] && c[0]->type() != Type::SCOPE)
+      expression(c[0], dst);
+    else
+      literal(decl, dst);
+  }
+
+  void literal(const ASTNode *n, const uint8_t dst) {
+    const Value v = value_of(Literals::value(n));
+    if (v.kind == Value::Kind::NIL)
+      emit(Op::LOADNIL, dst);
+    else
+      load(dst, m_program.constant(v));
+  }
+
+  Value value_of(const Constant &c) {
+    switch (c.kind) {
+    case Constant::Kind::BOOL:
+      return Value::boolean(c.b);
+    case Constant::Kind::INT:
+      return Value::integer(c.i);
+    case Constant::Kind::FLOAT:
+      return Value::number(c.f);
+    case Constant::Kind::STRING:
+      return Value::string(m_program.keep(c.s));
+    default:
+      return {};
+    }
+  }
+
+  // The object `decl` declares. Each declaration in its initializer becomes
+  // a member holding that declaration's literal, or a nested object; a
+  // member initialized by anything else is null.
+  const Record &record(const ASTNode *decl) {
+    auto &r = m_program.add_record();
+    r.array = decl->type() == Type::ARRAY;
+    for (auto const *c : decl->children_const()) {
+      if (!c || c->type() != Type::SCOPE)
+        continue;
+      for (auto const *m : c->children_const()) {
+        if (!m || !(is_variable(m->type()) || is_record(m->type())))
+          continue;
+        Value v;
+        if (is_record(m->type()))
+          v = Value::object(&record(m));
+        else {
+          auto const &init = m->children_const();
+          const bool expr = init.size() && init[0] &&
+                            init[0]->type() != Type::SCOPE;
+          v = value_of(Literals::value(expr ? init[0] : m));
+          if (expr && v.kind == Value::Kind::NIL)
+            TRACE_LOG(RUNTIME, VERBOSE, "Not compiled: member %s of %s",
+                      m->name(), decl->name());
+        }
+        r.members.push_back({symbol_name(m->id()), v});
+      }
+    }
+    return r;
+  }
+
+  // Register already holding `n` if it is a local, otherwise a new temporary
+  // with `n` evaluated into it. The caller releases temporaries.
+  uint8_t operand(const ASTNode *n) {
+    if (n && n->type() == Type::IDENTIFIER)
+      if (const int r = find_local(n->id()); r >= 0)
+        return static_cast<uint8_t>(r);
+    const auto r = push_temp();
+    expression(n, r);
+    return r;
+  }
+
+  void expression(const ASTNode *n, const uint8_t dst) {
+    if (!n) {
+      emit(Op::LOADNIL, dst);
+      return;
+    }
+    const auto save = m_top;
+    switch (n->type()) {
+    case Type::IDENTIFIER:
+      if (const int r = find_local(n->id()); r >= 0) {
+        if (r != dst)
+          emit(Op::MOVE, dst, static_cast<uint8_t>(r));
+      } else if (n->id() == intern("RUNTIME_HTTP_BODY"))
+        emit(Op::BODY, dst);
+      else if (const auto g = m_program.global(n->id()); slot(g))
+        emit(Op::GETG, dst, g);
+      else
+        emit(Op::LOADNIL, dst);
+      break;
+    case Type::ARITHMETICEXPRESSION:
+    case Type::LOGICALEXPRESSION:
+      binary(static_cast<const Expression *>(n), dst);
+      break;
+    case Type::ASSIGNMENTEXPRESSION:
+      if (const auto r = assign(static_cast<const Expression *>(n)); r != dst)
+        emit(Op::MOVE, dst, r);
+      break;
+    case Type::CALLEXPRESSION:
+      call(static_cast<const Expression *>(n), dst);
+      break;
+    case Type::ACCESSEXPRESSION:
+      if (auto const *e = static_cast<const Expression *>(n);
+          e->opr() == Operators::INDEX) {
+        const auto object = operand(e->lhs());
+        emit(Op::INDEX, dst, object, operand(e->rhs()));
+      } else if (const int f = request_field(n); f >= 0)
+        emit(Op::GETF, dst, static_cast<uint16_t>(f));
+      else {
+        TRACE_LOG(RUNTIME, VERBOSE, "Not compiled: member read in %s",
+                  symbol_name(m_chunk->name));
+        emit(Op::LOADNIL, dst);
+      }
+      break;
+    default:
+      literal(n, dst);
+      break;
+    }
+    m_top = save;
+  }
+
+  void binary(const Expression *e, const uint8_t dst) {
+    Op op;
+    bool negate = false, swap = false;
+    switch (e->opr()) {
+    case Operators::ADD:
+    case Operators::INCR:
+      op = Op::ADD;
+      break;
+    case Operators::SUB:
+    case Operators::DCR:
+      op = Op::SUB;
+      break;
+    case Operators::MUL:
+      op = Op::MUL;
+      break;
+    case Operators::DIV:
+      op = Op::DIV;
+      break;
+    case Operators::NAND:
+      negate = true;
+      [[fallthrough]];
+    case Operators::AND:
+      op = Op::AND;
+      break;
+    case Operators::NOR:
+      negate = true;
+      [[fallthrough]];
+    case Operators::OR:
+      op = Op::OR;
+      break;
+    case Operators::XOR:
+      op = Op::XOR;
+      break;
+    case Operators::NEQ:
+      negate = true;
+      [[fallthrough]];
+    case Operators::EQ:
+      op = Op::EQ;
+      break;
+    case Operators::GT:
+      swap = true;
+      [[fallthrough]];
+    case Operators::LT:
+      op = Op::LT;
+      break;
+    case Operators::GTE:
+      swap = true;
+      [[fallthrough]];
+    case Operators::LTE:
+      op = Op::LE;
+      break;
+    case Operators::NOT:
+      emit(Op::NOT, dst, operand(e->lhs()));
+      return;
+    case Operators::NEG: {
+      const auto zero = push_temp();
+      load(zero, m_program.constant(Value::integer(0)));
+      emit(Op::SUB, dst, zero, operand(e->lhs()));
+      return;
+    }
+    default:
+      error("Unsupported operator in", e->id());
+      emit(Op::LOADNIL, dst);
+      return;
+    }
+
+    // x++ and x-- update x and evaluate to the new value.
+    if (e->opr() == Operators::INCR || e->opr() == Operators::DCR) {
+      const auto one = push_temp();
+      load(one, m_program.constant(Value::integer(1)));
+      const auto x = operand(e->lhs());
+      emit(op, x, x, one);
+      store(e->lhs(), x);
+      if (x != dst)
+        emit(Op::MOVE, dst, x);
+      return;
+    }
+
+    const auto l = operand(e->lhs());
+    const auto r = operand(e->rhs());
+    if (swap)
+      emit(op, dst, r, l);
+    else
+      emit(op, dst, l, r);
+    if (negate)
+      emit(Op::NOT, dst, dst);
+  }
+
+  // Writes `value` back to the variable named by `target`; a no-op for
+  // locals that were updated in place.
+  void store(const ASTNode *target, const uint8_t value) {
+    if (const int f = request_field(target); f >= 0) {
+      emit(Op::SETF, value, static_cast<uint16_t>(f));
+      return;
+    }
+    if (target && target->type() == Type::ACCESSEXPRESSION) {
+      TRACE_LOG(RUNTIME, VERBOSE, "Not compiled: store to a member in %s",
+                symbol_name(m_chunk->name));
+      return;
+    }
+    if (!target || target->type() != Type::IDENTIFIER) {
+      error("Cannot assign to", target ? target->id() : no_id);
+      return;
+    }
+    const int r = find_local(target->id());
+    if (r < 0) {
+      if (const auto g = m_program.global(target->id()); slot(g))
+        emit(Op::SETG, value, g);
+    } else if (r != value)
+      emit(Op::MOVE, static_cast<uint8_t>(r), value);
+  }
+
+  // Index of the request field `n` names if it is `This.<field>`, or -1.
+  static int request_field(const ASTNode *n) {
+    if (!n || n->type() != Type::ACCESSEXPRESSION)
+      return -1;
+    auto const *e = static_cast<const Expression *>(n);
+    if (!e->lhs() || !e->rhs() || e->lhs()->id() != intern("This"))
+      return -1;
+    for (int f = 0; f < field_count; ++f)
+      if (e->rhs()->id() == intern(field_names[f]))
+        return f;
+    return -1;
+  }
+
+  // Returns the register holding the assigned value.
+  uint8_t assign(const Expression *e) {
+    auto const *target = e->lhs();
+    if (target && target->type() == Type::IDENTIFIER)
+      if (const int r = find_local(target->id()); r >= 0) {
+        expression(e->rhs(), static_cast<uint8_t>(r));
+        return static_cast<uint8_t>(r);
+      }
+    const auto v = operand(e->rhs());
+    store(target, v);
+    return v;
+  }
+
+  // The callee's frame starts right after `base`, so the arguments are
+  // evaluated straight into place.
+  void call(const Expression *e, const uint8_t dst) {
+    auto const *callee = e->lhs();
+    // Library functions and methods are reached through a member access.
+    if (callee && callee->type() == Type::ACCESSEXPRESSION) {
+      native_call(e, dst);
+      return;
+    }
+    const uint16_t chunk = callee && callee->type() == Type::IDENTIFIER
+                               ? m_program.function(callee->id())
+                               : Program::no_chunk;
+    if (chunk == Program::no_chunk) {
+      error("Call to unknown function", callee ? callee->id() : no_id);
+      emit(Op::LOADNIL, dst);
+      return;
+    }
+
+    const auto base = push_temp();
+    auto const &args = e->children_const();
+    for (auto const *a : args)
+      expression(a, push_temp());
+    emit(Op::CALL, base, chunk, static_cast<uint16_t>(args.size()));
+    if (base != dst)
+      emit(Op::MOVE, dst, base);
+  }
+
+  // Appends the `::` form of an access chain of identifiers to `out`.
+  static bool qualified_name(const ASTNode *n, std::string &out) {
+    if (n && n->type() == Type::IDENTIFIER) {
+      out += symbol_name(n->id());
+      return true;
+    }
+    if (!n || n->type() != Type::ACCESSEXPRESSION)
+      return false;
+    auto const *e = static_cast<const Expression *>(n);
+    if (!qualified_name(e->lhs(), out))
+      return false;
+    out += "::";
+    return qualified_name(e->rhs(), out);
+  }
+
+  void native_call(const Expression *e, const uint8_t dst) {
+    std::string name;
+    if (!qualified_name(e->lhs(), name) ||
+        !m_natives.exports_under(name.substr(0, name.find("::")))) {
+      TRACE_LOG(RUNTIME, VERBOSE, "Not compiled: member call in %s",
+                symbol_name(m_chunk->name));
+      emit(Op::LOADNIL, dst);
+      return;
+    }
+    const Symbol sym = intern(name);
+    const Native *n = nullptr;
+    for (auto const *lib : m_libraries)
+      if ((n = lib->find(sym)))
+        break;
+    if (!n) {
+      if (auto const *lib = m_natives.exporter(sym)) {
+        ++m_errors;
+        fprintf(stderr, "[Error]: %s needs @lib[\"%s\"] in %s\n",
+                name.c_str(), lib->name().c_str(),
+                symbol_name(m_chunk->name));
+      } else
+        error("Call to unknown native function", sym);
+      emit(Op::LOADNIL, dst);
+      return;
+    }
+
+    auto const &args = e->children_const();
+    if (args.size() < n->arity || (!n->variadic && args.size() > n->arity)) {
+      error("Wrong number of arguments to", sym);
+      emit(Op::LOADNIL, dst);
+      return;
+    }
+    const auto native = m_program.native(*n);
+    if (!slot(native)) {
+      emit(Op::LOADNIL, dst);
+      return;
+    }
+    const auto base = push_temp();
+    for (size_t i = 0; i < args.size(); ++i) {
+      const auto r = push_temp();
+      if (i == 0 && n->formats && args[0] && args[0]->type() == Type::STRING)
+        if (auto const c = Literals::value(args[0]);
+            c.kind == Constant::Kind::STRING) {
+          load(r, m_program.format_constant(c.s));
+          continue;
+        }
+      expression(args[i], r);
+    }
+    emit(Op::CALLN, base, native, static_cast<uint16_t>(args.size()));
+    if (base != dst)
+      emit(Op::MOVE, dst, base);
+  }
+
+private:
+  Program &m_program;
+  const NativeRegistry &m_natives;
+  std::vector<const NativeLibrary *> m_libraries;
+  Chunk *m_chunk = nullptr;
+  std::vector<Local> m_locals;
+  uint16_t m_top = 0;
+  CompiledModule m_module;
+  size_t m_errors = 0;
+};
+
+} // namespace ServerLang
@@ -0,0 +1,546 @@
+#pragma once
+
+#include <cfloat>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "arena.h"
+#include "ast.h"
+#include "trace.h"
+
+namespace ServerLang {
+
+// A value known before the script runs. Arithmetic follows the VM: integers
+// wrap, mixing in a float gives a float and '+' with a string concatenates.
+struct Constant {
+  enum class Kind : uint8_t { NONE, BOOL, INT, FLOAT, STRING };
+
+  Kind kind = Kind::NONE;
+  bool b = false;
+  int64_t i = 0;
+  double f = 0;
+  std::string s;
+
+  static Constant boolean(const bool v) {
+    Constant c;
+    c.kind = Kind::BOOL;
+    c.b = v;
+    return c;
+  }
+  static Constant integer(const int64_t v) {
+    Constant c;
+    c.kind = Kind::INT;
+    c.i = v;
+    return c;
+  }
+  static Constant number(const double v) {
+    Constant c;
+    c.kind = Kind::FLOAT;
+    c.f = v;
+    return c;
+  }
+  static Constant string(std::string v) {
+    Constant c;
+    c.kind = Kind::STRING;
+    c.s = std::move(v);
+    return c;
+  }
+
+  // An integer unless the text has a fraction or an exponent. Leaves `out`
+  // untouched and returns false if `text` is not entirely a number or does
+  // not fit in 64 bits.
+  static bool parse_number(const std::string_view text, Constant &out) {
+    auto const *first = text.data(), *last = text.data() + text.size();
+    if (text.find_first_of(".eE") == std::string_view::npos) {
+      int64_t v;
+      auto const [end, ec] = std::from_chars(first, last, v);
+      if (ec != std::errc{} || end != last)
+        return false;
+      out = integer(v);
+      return true;
+    }
+    double v;
+    auto const [end, ec] = std::from_chars(first, last, v);
+    if (ec != std::errc{} || end != last)
+      return false;
+    out = number(v);
+    return true;
+  }
+
+  bool numeric() const { return kind == Kind::INT || kind == Kind::FLOAT; }
+  double as_double() const {
+    return kind == Kind::INT ? static_cast<double>(i) : f;
+  }
+
+  // Same text as Value::to_string.
+  std::string to_string() const {
+    switch (kind) {
+    case Kind::BOOL:
+      return b ? "true" : "false";
+    case Kind::INT:
+      return std::to_string(i);
+    case Kind::FLOAT:
+      return std::to_string(f);
+    case Kind::STRING:
+      return s;
+    default:
+      return "null";
+    }
+  }
+};
+
+namespace Literals {
+
+template <typename N> auto value_of(const ASTNode *n) {
+  return static_cast<const N *>(n)->value();
+}
+template <typename N> bool has_value(const ASTNode *n) {
+  return static_cast<const N *>(n)->hasValue();
+}
+
+// Value stored on a primitive node, whether a literal or a declaration that
+// has been materialized; NONE if it has none.
+inline Constant value(const ASTNode *n) {
+  if (!n)
+    return {};
+  switch (n->type()) {
+  case Type::I16:
+    return has_value<InternalTypes::I16>(n)
+               ? Constant::integer(value_of<InternalTypes::I16>(n))
+               : Constant{};
+  case Type::I32:
+    return has_value<InternalTypes::I32>(n)
+               ? Constant::integer(value_of<InternalTypes::I32>(n))
+               : Constant{};
+  case Type::I64:
+    return has_value<InternalTypes::I64>(n)
+               ? Constant::integer(value_of<InternalTypes::I64>(n))
+               : Constant{};
+  case Type::U8:
+    return has_value<InternalTypes::U8>(n)
+               ? Constant::integer(value_of<InternalTypes::U8>(n))
+               : Constant{};
+  case Type::U16:
+    return has_value<InternalTypes::U16>(n)
+               ? Constant::integer(value_of<InternalTypes::U16>(n))
+               : Constant{};
+  case Type::COMPLEX:
+    return has_value<InternalTypes::Complex>(n)
+               ? Constant::integer(static_cast<int64_t>(
+                     value_of<InternalTypes::Complex>(n)))
+               : Constant{};
+  case Type::F32:
+    return has_value<InternalTypes::F32>(n)
+               ? Constant::number(value_of<InternalTypes::F32>(n))
+               : Constant{};
+  case Type::F64:
+    return has_value<InternalTypes::F64>(n)
+               ? Constant::number(value_of<InternalTypes::F64>(n))
+               : Constant{};
+  case Type::BOOL:
+    return has_value<InternalTypes::Bool>(n)
+               ? Constant::boolean(value_of<InternalTypes::Bool>(n))
+               : Constant{};
+  case Type::STRING:
+  case Type::VARIANT:
+    return has_value<Primitive<std::string>>(n)
+               ? Constant::string(value_of<Primitive<std::string>>(n))
+               : Constant{};
+  default:
+    return {};
+  }
+}
+
+template <typename N> bool store_integer(ASTNode *decl, const Constant &c) {
+  using T = decltype(value_of<N>(decl));
+  if (c.kind != Constant::Kind::INT)
+    return false;
+  if constexpr (std::is_unsigned_v<T>) {
+    if (c.i < 0 || static_cast<uint64_t>(c.i) > std::numeric_limits<T>::max())
+      return false;
+  } else if (c.i < std::numeric_limits<T>::min() ||
+             c.i > std::numeric_limits<T>::max())
+    return false;
+  static_cast<N *>(decl)->setValue(static_cast<T>(c.i));
+  return true;
+}
+
+// Stores `c` as the value of the declaration `decl`, converted to its
+// declared type. Returns false if `c` has another kind or is out of range; a
+// Variant only stores strings, other kinds stay as an initializer child.
+inline bool store(ASTNode *decl, const Constant &c) {
+  switch (decl->type()) {
+  case Type::I16:
+    return store_integer<InternalTypes::I16>(decl, c);
+  case Type::I32:
+    return store_integer<InternalTypes::I32>(decl, c);
+  case Type::I64:
+    return store_integer<InternalTypes::I64>(decl, c);
+  case Type::U8:
+    return store_integer<InternalTypes::U8>(decl, c);
+  case Type::U16:
+    return store_integer<InternalTypes::U16>(decl, c);
+  case Type::COMPLEX:
+    return store_integer<InternalTypes::Complex>(decl, c);
+  case Type::F32:
+    if (!c.numeric() || (std::isfinite(c.as_double()) &&
+                         std::fabs(c.as_double()) > FLT_MAX))
+      return false;
+    static_cast<InternalTypes::F32 *>(decl)->setValue(
+        static_cast<float>(c.as_double()));
+    return true;
+  case Type::F64:
+    if (!c.numeric())
+      return false;
+    static_cast<InternalTypes::F64 *>(decl)->setValue(c.as_double());
+    return true;
+  case Type::BOOL:
+    if (c.kind != Constant::Kind::BOOL)
+      return false;
+    static_cast<InternalTypes::Bool *>(decl)->setValue(c.b);
+    return true;
+  case Type::STRING:
+  case Type::VARIANT:
+    if (c.kind != Constant::Kind::STRING)
+      return false;
+    static_cast<Primitive<std::string> *>(decl)->setValue(c.s);
+    return true;
+  default:
+    return false;
+  }
+}
+
+// A new literal node holding `c`: I64, F64, Bool or String.
+inline node_ptr make(Arena &arena, const Constant &c) {
+  switch (c.kind) {
+  case Constant::Kind::BOOL: {
+    auto *n = arena.make<InternalTypes::Bool>();
+    n->setValue(c.b);
+    return n;
+  }
+  case Constant::Kind::INT: {
+    auto *n = arena.make<InternalTypes::I64>();
+    n->setValue(c.i);
+    return n;
+  }
+  case Constant::Kind::FLOAT: {
+    auto *n = arena.make<InternalTypes::F64>();
+    n->setValue(c.f);
+    return n;
+  }
+  case Constant::Kind::STRING: {
+    auto *n = arena.make<InternalTypes::String>();
+    n->setValue(c.s);
+    return n;
+  }
+  default:
+    return nullptr;
+  }
+}
+
+} // namespace Literals
+
+// Evaluates constant expressions once, at load time. Arithmetic and logical
+// subtrees whose operands are literals become literals, and a use of a
+// `const` whose value is known is replaced by that value, so chains of
+// constants collapse in declaration order. Declarations whose initializer
+// folds to a literal get the value stored on the node and lose the child.
+class ConstantFolder {
+public:
+  explicit ConstantFolder(Arena &arena) : m_arena(arena) {}
+
+public:
+  // Returns the number of subtrees replaced.
+  size_t fold(node_list &nodes) {
+    statements(nodes);
+    return m_folded;
+  }
+  // Number of initializers rejected so far.
+  size_t errors() const { return m_errors; }
+
+private:
+  // A name in scope; `decl` is null for names that are not known constants,
+  // so they hide outer constants of the same name.
+  struct Binding {
+    Symbol name;
+    const ASTNode *decl;
+  };
+
+  static bool is_variable(const Type t) {
+    return t >= Type::I16 && t <= Type::VOID;
+  }
+
+  void statements(node_list &nodes) {
+    const auto depth = m_scope.size();
+    for (auto &n : nodes)
+      n = statement(n);
+    m_scope.resize(depth);
+  }
+
+  node_ptr statement(node_ptr n) {
+    if (!n)
+      return n;
+    if (is_variable(n->type())) {
+      declaration(n);
+      return n;
+    }
+    switch (n->type()) {
+    case Type::FUNCTION: {
+      m_scope.push_back({n->id(), nullptr});
+      const auto depth = m_scope.size();
+      for (auto const *p : static_cast<Function<node_ptr> *>(n)->parameters())
+        if (p)
+          m_scope.push_back({p->id(), nullptr});
+      nested(n);
+      m_scope.resize(depth);
+      return n;
+    }
+    case Type::SCOPE:
+      statements(n->children());
+      return n;
+    case Type::ARRAY... Type::ROUTE:
+    case Type::OBJECT:
+      m_scope.push_back({n->id(), nullptr});
+      nested(n);
+      return n;
+    default:
+      return expression(n);
+    }
+  }
+
+  void nested(node_ptr n) {
+    for (auto &c : n->children())
+      if (c && c->type() == Type::SCOPE)
+        statements(c->children());
+  }
+
+  // A folded initializer is stored like a literal one, and rejected like one
+  // if it does not fit the declared type.
+  void declaration(node_ptr decl) {
+    auto &c = decl->children();
+    if (c.size() && c[0] && c[0]->type() != Type::SCOPE) {
+      c[0] = expression(c[0]);
+      auto const v = Literals::value(c[0]);
+      // A Variant keeps values other than strings as its initializer.
+      const bool kept =
+          v.kind == Constant::Kind::NONE ||
+          (decl->type() == Type::VARIANT && v.kind != Constant::Kind::STRING);
+      if (!kept && !Literals::store(decl, v)) {
+        ++m_errors;
+        auto const text = v.to_string();
+        fprintf(stderr, "[Error]: '%s' is not a valid %s for '%s'\n",
+                text.c_str(), decl->type_string(), decl->name());
+      }
+      if (!kept)
+        c.clear();
+    } else
+      nested(decl);
+
+    // A Variant keeps non-string values as a literal child.
+    const bool known =
+        decl->constant() &&
+        Literals::value(c.empty() ? decl : c[0]).kind != Constant::Kind::NONE;
+    m_scope.push_back({decl->id(), known ? decl : nullptr});
+    if (known)
+      TRACE_LOG(DECL, VERBOSE, "Constant: %s", decl->name());
+  }
+
+  const ASTNode *lookup(const Symbol name) const {
+    for (auto it = m_scope.rbegin(); it != m_scope.rend(); ++it)
+      if (it->name == name)
+        return it->decl;
+    return nullptr;
+  }
+
+  node_ptr expression(node_ptr n) {
+    if (!n)
+      return n;
+    switch (n->type()) {
+    case Type::IDENTIFIER:
+      if (auto const *decl = lookup(n->id())) {
+        auto const &c = decl->children_const();
+        return replace(Literals::value(c.empty() ? decl : c[0]), n);
+      }
+      return n;
+    case Type::ARITHMETICEXPRESSION:
+    case Type::LOGICALEXPRESSION: {
+      auto *e = static_cast<Expression *>(n);
+      // x++ and x-- write to their operand, which must stay a name.
+      if (e->opr() == Operators::INCR || e->opr() == Operators::DCR)
+        return n;
+      e->setlhs(expression(e->lhs()));
+      e->setrhs(expression(e->rhs()));
+      auto const l = Literals::value(e->lhs());
+      if (e->opr() == Operators::NOT || e->opr() == Operators::NEG)
+        return l.kind == Constant::Kind::NONE ? n
+                                              : replace(unary(e->opr(), l), n);
+      auto const r = Literals::value(e->rhs());
+      if (l.kind == Constant::Kind::NONE || r.kind == Constant::Kind::NONE)
+        return n;
+      return replace(evaluate(e->opr(), l, r), n);
+    }
+    case Type::ASSIGNMENTEXPRESSION:
+    case Type::RETURNEXPRESSION: {
+      auto *e = static_cast<Expression *>(n);
+      if (n->type() == Type::ASSIGNMENTEXPRESSION)
+        e->setrhs(expression(e->rhs()));
+      else
+        e->setlhs(expression(e->lhs()));
+      return n;
+    }
+    case Type::CALLEXPRESSION:
+      for (auto &a : n->children())
+        a = expression(a);
+      return n;
+    case Type::ACCESSEXPRESSION: {
+      // A subscript's key is an expression; the rhs of `a.b` is a name.
+      auto *e = static_cast<Expression *>(n);
+      if (e->opr() == Operators::INDEX)
+        e->setrhs(expression(e->rhs()));
+      return n;
+    }
+    default:
+      return n;
+    }
+  }
+
+  node_ptr replace(const Constant &c, node_ptr original) {
+    if (c.kind == Constant::Kind::NONE)
+      return original;
+    ++m_folded;
+    return Literals::make(m_arena, c);
+  }
+
+  static Constant unary(const Operators op, const Constant &c) {
+    using K = Constant::Kind;
+    if (op == Operators::NOT)
+      return c.kind == K::BOOL  ? Constant::boolean(!c.b)
+             : c.kind == K::INT ? Constant::integer(~c.i)
+                                : Constant{};
+    if (c.kind == K::INT)
+      return Constant::integer(
+          static_cast<int64_t>(0 - static_cast<uint64_t>(c.i)));
+    return c.kind == K::FLOAT ? Constant::number(-c.f) : Constant{};
+  }
+
+  // Same ordering as the VM: integers exactly, mixed numbers as doubles,
+  // strings by their bytes. NONE if the operands cannot be compared.
+  static Constant compare(const Operators op, const Constant &l,
+                          const Constant &r) {
+    using K = Constant::Kind;
+    int order;
+    if (l.kind == K::BOOL && r.kind == K::BOOL &&
+        (op == Operators::EQ || op == Operators::NEQ))
+      order = l.b == r.b ? 0 : 1;
+    else if (l.kind == K::INT && r.kind == K::INT)
+      order = (l.i > r.i) - (l.i < r.i);
+    else if (l.kind == K::STRING && r.kind == K::STRING) {
+      const int c = l.s.compare(r.s);
+      order = (c > 0) - (c < 0);
+    }
+    else if (l.numeric() && r.numeric()) {
+      const double a = l.as_double(), b = r.as_double();
+      order = a < b ? -1 : a > b ? 1 : a == b ? 0 : 2; // 2: unordered
+    } else if (op == Operators::EQ || op == Operators::NEQ)
+      order = 1; // values of different kinds are unequal
+    else
+      return {};
+    switch (op) {
+    case Operators::EQ:
+      return Constant::boolean(order == 0);
+    case Operators::NEQ:
+      return Constant::boolean(order != 0);
+    case Operators::LT:
+      return Constant::boolean(order < 0);
+    case Operators::GT:
+      return Constant::boolean(order > 0 && order != 2);
+    case Operators::LTE:
+      return Constant::boolean(order <= 0);
+    default:
+      return Constant::boolean(order >= 0 && order != 2);
+    }
+  }
+
+  // NONE when the operation has to be left for run time, e.g. an integer
+  // division by zero, which must still fail when it executes.
+  static Constant evaluate(const Operators op, const Constant &l,
+                           const Constant &r) {
+    using K = Constant::Kind;
+    if (op >= Operators::EQ && op <= Operators::GTE)
+      return compare(op, l, r);
+    if (l.kind == K::INT && r.kind == K::INT) {
+      const auto a = static_cast<uint64_t>(l.i), b = static_cast<uint64_t>(r.i);
+      switch (op) {
+      case Operators::ADD:
+        return Constant::integer(static_cast<int64_t>(a + b));
+      case Operators::SUB:
+        return Constant::integer(static_cast<int64_t>(a - b));
+      case Operators::MUL:
+        return Constant::integer(static_cast<int64_t>(a * b));
+      case Operators::DIV:
+        if (r.i == 0 || (r.i == -1 && l.i == INT64_MIN))
+          return {};
+        return Constant::integer(l.i / r.i);
+      case Operators::AND:
+        return Constant::integer(l.i & r.i);
+      case Operators::OR:
+        return Constant::integer(l.i | r.i);
+      case Operators::XOR:
+        return Constant::integer(l.i ^ r.i);
+      case Operators::NAND:
+        return Constant::integer(~(l.i & r.i));
+      case Operators::NOR:
+        return Constant::integer(~(l.i | r.i));
+      default:
+        return {};
+      }
+    }
+    if (l.kind == K::BOOL && r.kind == K::BOOL) {
+      switch (op) {
+      case Operators::AND:
+        return Constant::boolean(l.b && r.b);
+      case Operators::OR:
+        return Constant::boolean(l.b || r.b);
+      case Operators::XOR:
+        return Constant::boolean(l.b != r.b);
+      case Operators::NAND:
+        return Constant::boolean(!(l.b && r.b));
+      case Operators::NOR:
+        return Constant::boolean(!(l.b || r.b));
+      default:
+        return {};
+      }
+    }
+    if (op == Operators::ADD && (l.kind == K::STRING || r.kind == K::STRING))
+      return Constant::string(l.to_string() + r.to_string());
+    if (l.numeric() && r.numeric()) {
+      switch (op) {
+      case Operators::ADD:
+        return Constant::number(l.as_double() + r.as_double());
+      case Operators::SUB:
+        return Constant::number(l.as_double() - r.as_double());
+      case Operators::MUL:
+        return Constant::number(l.as_double() * r.as_double());
+      case Operators::DIV:
+        return Constant::number(l.as_double() / r.as_double());
+      default:
+        return {};
+      }
+    }
+    return {};
+  }
+
+private:
+  Arena &m_arena;
+  std::vector<Binding> m_scope;
+  size_t m_folded = 0;
+  size_t m_errors = 0;
+};
+
+} // namespace ServerLang
@@ -0,0 +1,388 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+#include "ast.h"
+#include "const_fold.h"
+#include "tokenizer.h"
+#include "trace.h"
+
+namespace ServerLang {
+
+// Precedence-climbing parser for one expression, read straight off a
+// TokenStream in a single left-to-right pass.
+//
+// The tokenizer glues runs of name, digit and operator characters into one
+// token ("a+b*c", "This.", "!done"), so the parser reads atoms rather than
+// tokens: a glued token is walked in place one atom at a time, and any other
+// token is a single atom. Nothing is copied and no atom is read twice.
+//
+// From loosest to tightest binding:
+//
+//   =                        right associative, AssignmentExpression
+//   ||  &&  |  ^  &          LogicalExpression
+//   ==  !=  <  >  <=  >=     LogicalExpression
+//   +  -  *  /               ArithmeticExpression
+//   -x  !x  ++x  --x         prefix
+//   f(...)  a.b  a::b  x++   postfix; call arguments are the children of the
+//   a[k]                     CallExpression and the callee is its lhs
+class ExpressionParser {
+public:
+  ExpressionParser(TokenStream &tokens, Arena &arena)
+      : m_it(tokens), m_arena(arena) {
+    load();
+  }
+
+public:
+  // Parses one expression and stops at the first atom that cannot continue
+  // it, normally a ';', ',' or ')'. Returns nullptr after reporting an error.
+  node_ptr parse() { return expression(0); }
+
+  // Moves the stream past a partly read glued token, leaving it on the token
+  // the expression stopped at. Returns false if that is not a ';'.
+  bool finish() {
+    if (m_pos)
+      ++m_it;
+    return m_it->type() == Token::TokenType::PUNCTUATOR &&
+           m_it->const_data() == ";";
+  }
+
+private:
+  enum class Kind { END, NAME, NUMBER, STRING, OPERATOR, PUNCT };
+
+  struct Binary {
+    int power; // 0 if the atom is not a binary operator
+    Operators opr;
+    Type node;
+  };
+
+  static constexpr int assignment_power = 1;
+
+  static bool is_name(const char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' ||
+           (c >= '0' && c <= '9');
+  }
+  static bool is_digit(const char c) { return c >= '0' && c <= '9'; }
+
+  static Binary binary(const std::string_view op) {
+    using T = Type;
+    using O = Operators;
+    switch (op.size() == 1 ? op[0] : op[0] + (op[1] << 8)) {
+    case '=':
+      return {assignment_power, O::ASGN, T::ASSIGNMENTEXPRESSION};
+    case '|' + ('|' << 8):
+      return {2, O::OR, T::LOGICALEXPRESSION};
+    case '&' + ('&' << 8):
+      return {3, O::AND, T::LOGICALEXPRESSION};
+    case '|':
+      return {4, O::OR, T::LOGICALEXPRESSION};
+    case '^':
+      return {5, O::XOR, T::LOGICALEXPRESSION};
+    case '&':
+      return {6, O::AND, T::LOGICALEXPRESSION};
+    case '=' + ('=' << 8):
+      return {7, O::EQ, T::LOGICALEXPRESSION};
+    case '!' + ('=' << 8):
+      return {7, O::NEQ, T::LOGICALEXPRESSION};
+    case '<':
+      return {8, O::LT, T::LOGICALEXPRESSION};
+    case '>':
+      return {8, O::GT, T::LOGICALEXPRESSION};
+    case '<' + ('=' << 8):
+      return {8, O::LTE, T::LOGICALEXPRESSION};
+    case '>' + ('=' << 8):
+      return {8, O::GTE, T::LOGICALEXPRESSION};
+    case '+':
+      return {9, O::ADD, T::ARITHMETICEXPRESSION};
+    case '-':
+      return {9, O::SUB, T::ARITHMETICEXPRESSION};
+    case '*':
+      return {10, O::MUL, T::ARITHMETICEXPRESSION};
+    case '/':
+      return {10, O::DIV, T::ARITHMETICEXPRESSION};
+    default:
+      return {0, O::ADD, T::UNDEFINED};
+    }
+  }
+
+  // Reads the atom at m_pos of the current token into m_kind / m_atom.
+  void load() {
+    while (m_it->type() == Token::TokenType::COMMENT)
+      ++m_it;
+    auto const text = m_it->const_data();
+    switch (m_it->type()) {
+    case Token::TokenType::STRING_LITERAL:
+      set(Kind::STRING, text);
+      return;
+    case Token::TokenType::PUNCTUATOR:
+      set(Kind::PUNCT, text);
+      return;
+    case Token::TokenType::IDENTIFIER:
+    case Token::TokenType::NUMERIC_LITERAL:
+    case Token::TokenType::ARITHMETIC_OPERATOR:
+    case Token::TokenType::LOGIC_OPERATOR:
+    case Token::TokenType::ACCESS_OPERATOR:
+      break;
+    default:
+      set(Kind::END, {});
+      return;
+    }
+
+    auto const rest = text.substr(m_pos);
+    size_t n = 1;
+    Kind kind = Kind::OPERATOR;
+    if (is_digit(rest[0])) {
+      // Digits, a fraction and an exponent; Constant::parse_number decides
+      // whether the whole run is a number.
+      kind = Kind::NUMBER;
+      while (n < rest.size() && (is_name(rest[n]) || rest[n] == '.'))
+        ++n;
+    } else if (is_name(rest[0])) {
+      kind = Kind::NAME;
+      while (n < rest.size() && is_name(rest[n]))
+        ++n;
+    } else if (rest.size() > 1) {
+      switch (rest[0] + (rest[1] << 8)) {
+      case ':' + (':' << 8):
+      case '=' + ('=' << 8):
+      case '!' + ('=' << 8):
+      case '<' + ('=' << 8):
+      case '>' + ('=' << 8):
+      case '&' + ('&' << 8):
+      case '|' + ('|' << 8):
+      case '+' + ('+' << 8):
+      case '-' + ('-' << 8):
+        n = 2;
+        break;
+      default:
+        break;
+      }
+    }
+    set(kind, rest.substr(0, n));
+  }
+
+  void set(const Kind kind, const std::string_view atom) {
+    m_kind = kind;
+    m_atom = atom;
+  }
+
+  // Steps past the current atom, pulling the next token once the current one
+  // is used up.
+  void advance() {
+    if (m_kind == Kind::END)
+      return;
+    m_pos += m_atom.size();
+    if (m_kind != Kind::NAME && m_kind != Kind::NUMBER &&
+        m_kind != Kind::OPERATOR)
+      m_pos = m_it->const_data().size();
+    if (m_pos >= m_it->const_data().size()) {
+      ++m_it;
+      m_pos = 0;
+    }
+    load();
+  }
+
+  bool at(const Kind kind, const std::string_view atom) const {
+    return m_kind == kind && m_atom == atom;
+  }
+
+  node_ptr fail(const char *expected) {
+    m_it.begin_error(m_pos);
+    fprintf(stderr, "Expected %s in expression. Got '%.*s'\n", expected,
+            static_cast<int>(m_atom.size()), m_atom.data());
+    return nullptr;
+  }
+
+  node_ptr expression(const int min_power) {
+    node_ptr lhs = prefix();
+    if (!lhs)
+      return nullptr;
+    for (;;) {
+      if (m_kind == Kind::PUNCT && m_atom == "(")
+        lhs = call(lhs);
+      else if (m_kind == Kind::PUNCT && m_atom == "[")
+        lhs = index(lhs);
+      else if (m_kind == Kind::OPERATOR && (m_atom == "." || m_atom == "::"))
+        lhs = access(lhs);
+      else if (m_kind == Kind::OPERATOR && (m_atom == "++" || m_atom == "--")) {
+        const auto opr = m_atom == "++" ? Operators::INCR : Operators::DCR;
+        advance();
+        lhs = m_arena.make<Expressions::ArithmeticExpression>(lhs, nullptr,
+                                                              opr);
+      } else {
+        auto const b =
+            m_kind == Kind::OPERATOR ? binary(m_atom) : Binary{0, {}, {}};
+        if (!b.power || b.power < min_power)
+          return lhs;
+        advance();
+        // Assignment groups to the right, everything else to the left.
+        auto const rhs = expression(b.power == assignment_power ? b.power
+                                                                : b.power + 1);
+        if (!rhs)
+          return nullptr;
+        lhs = make(b, lhs, rhs);
+      }
+      if (!lhs)
+        return nullptr;
+    }
+  }
+
+  node_ptr make(const Binary &b, node_ptr lhs, node_ptr rhs) {
+    switch (b.node) {
+    case Type::ASSIGNMENTEXPRESSION:
+      return m_arena.make<Expressions::AssignmentExpression>(lhs, rhs, b.opr);
+    case Type::LOGICALEXPRESSION:
+      return m_arena.make<Expressions::LogicalExpression>(lhs, rhs, b.opr);
+    default:
+      return m_arena.make<Expressions::ArithmeticExpression>(lhs, rhs, b.opr);
+    }
+  }
+
+  // Operands of a prefix operator bind tighter than any binary operator.
+  node_ptr prefix() {
+    constexpr int unary_power = 11;
+    switch (m_kind) {
+    case Kind::NAME:
+      return name();
+    case Kind::NUMBER:
+      return number(m_atom);
+    case Kind::STRING: {
+      auto const n =
+          Literals::make(m_arena, Constant::string(std::string{m_atom}));
+      advance();
+      return n;
+    }
+    case Kind::PUNCT: {
+      if (m_atom != "(")
+        break;
+      advance();
+      auto const inner = expression(0);
+      if (!inner)
+        return nullptr;
+      if (!at(Kind::PUNCT, ")"))
+        return fail("')'");
+      advance();
+      return inner;
+    }
+    case Kind::OPERATOR: {
+      auto const op = m_atom;
+      if (op != "-" && op != "!" && op != "+" && op != "++" && op != "--")
+        break;
+      advance();
+      // A minus in front of a number is part of the literal.
+      if (op == "-" && m_kind == Kind::NUMBER)
+        return number(std::string{"-"}.append(m_atom));
+      auto const operand = expression(unary_power);
+      if (!operand || op == "+")
+        return operand;
+      if (op == "!")
+        return m_arena.make<Expressions::LogicalExpression>(
+            operand, nullptr, Operators::NOT);
+      return m_arena.make<Expressions::ArithmeticExpression>(
+          operand, nullptr,
+          op == "-"    ? Operators::NEG
+          : op == "++" ? Operators::INCR
+                       : Operators::DCR);
+    }
+    default:
+      break;
+    }
+    return fail("an operand");
+  }
+
+  // true, false and null are literals; any other name is an Identifier.
+  node_ptr name() {
+    node_ptr n;
+    if (m_atom == "true" || m_atom == "false")
+      n = Literals::make(m_arena, Constant::boolean(m_atom == "true"));
+    else if (m_atom == "null")
+      n = m_arena.make<InternalTypes::Variant>();
+    else {
+      n = m_arena.make<Identifier>();
+      n->setId(symbol());
+    }
+    advance();
+    return n;
+  }
+
+  // A name that is the whole token was interned by the tokenizer.
+  Symbol symbol() const {
+    return m_atom.size() == m_it->const_data().size() ? m_it->symbol()
+                                                      : intern(m_atom);
+  }
+
+  node_ptr number(const std::string_view text) {
+    Constant value;
+    if (!Constant::parse_number(text, value)) {
+      m_it.begin_error(m_pos);
+      fprintf(stderr, "Invalid numeric literal '%.*s'\n",
+              static_cast<int>(text.size()), text.data());
+      return nullptr;
+    }
+    advance();
+    return Literals::make(m_arena, value);
+  }
+
+  // Expects the cursor on '('; arguments are parsed in place as children.
+  node_ptr call(node_ptr callee) {
+    auto *_call = m_arena.make<Expressions::CallExpression>(callee, nullptr,
+                                                            Operators::CALL);
+    advance();
+    if (at(Kind::PUNCT, ")")) {
+      advance();
+      return _call;
+    }
+    for (;;) {
+      auto const arg = expression(0);
+      if (!arg)
+        return nullptr;
+      _call->children().push_back(m_arena, arg);
+      if (at(Kind::PUNCT, ",")) {
+        advance();
+        continue;
+      }
+      if (!at(Kind::PUNCT, ")"))
+        return fail("',' or ')'");
+      advance();
+      return _call;
+    }
+  }
+
+  // `a.b` and `a::b` both become an AccessExpression whose rhs names the
+  // member.
+  node_ptr access(node_ptr object) {
+    advance();
+    if (m_kind != Kind::NAME)
+      return fail("a member name");
+    auto *member = m_arena.make<Identifier>();
+    member->setId(symbol());
+    advance();
+    return m_arena.make<Expressions::AccessExpression>(object, member,
+                                                      Operators::ACC);
+  }
+
+  // `a[k]` becomes an AccessExpression whose rhs is the key expression and
+  // whose operator is INDEX.
+  node_ptr index(node_ptr object) {
+    advance();
+    auto const key = expression(0);
+    if (!key)
+      return nullptr;
+    if (!at(Kind::PUNCT, "]"))
+      return fail("']'");
+    advance();
+    return m_arena.make<Expressions::AccessExpression>(object, key,
+                                                      Operators::INDEX);
+  }
+
+private:
+  TokenStream &m_it;
+  Arena &m_arena;
+  Kind m_kind = Kind::END;
+  std::string_view m_atom;
+  size_t m_pos = 0; // offset of m_atom in the current token
+};
+
+} // namespace ServerLang
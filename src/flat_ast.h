@@ -0,0 +1,327 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "ast.h"
+#include "const_fold.h"
+#include "interner.h"
+
+namespace ServerLang {
+
+// Data-oriented copy of a parsed tree. Every node is one row across a few
+// parallel columns:
+//
+//   tag | id | first_child | next_sibling | payload
+//
+// Rows are in pre-order and links are 32-bit row indices, so a whole-tree
+// pass is a linear scan of the columns it needs. Per-kind data lives in side
+// tables indexed by `payload`: literal values, function signatures and the
+// operator and operands of expressions. An UNDEFINED tag marks a null slot.
+class FlatTree {
+public:
+  static constexpr uint32_t none = ~uint32_t{0};
+
+  struct Param {
+    Symbol id;
+    Type type;
+  };
+
+  struct FunctionInfo {
+    Type return_t;
+    uint32_t first_param;
+    uint32_t param_count;
+  };
+
+  // Strings are slices of one shared text pool.
+  struct Literal {
+    Constant::Kind kind;
+    uint32_t length;
+    union {
+      bool b;
+      int64_t i;
+      double f;
+      uint32_t offset;
+    };
+  };
+
+  // Operands are rows of their own but not part of the child chain.
+  struct ExpressionInfo {
+    Operators opr;
+    uint32_t lhs;
+    uint32_t rhs;
+  };
+
+  FlatTree() = default;
+
+  static FlatTree build(const node_list &roots) {
+    FlatTree t;
+    uint32_t prev = none;
+    for (auto const *r : roots) {
+      const uint32_t row = t.add(r);
+      if (prev != none)
+        t.m_next_sibling[prev] = row;
+      prev = row;
+    }
+    t.shrink();
+    return t;
+  }
+
+public:
+  uint32_t size() const { return static_cast<uint32_t>(m_tags.size()); }
+  // First root, or none for an empty tree; the others are its siblings.
+  uint32_t root() const { return m_tags.empty() ? none : 0; }
+
+  Type tag(const uint32_t i) const { return m_tags[i]; }
+  Symbol id(const uint32_t i) const { return m_ids[i]; }
+  uint32_t first_child(const uint32_t i) const { return m_first_child[i]; }
+  uint32_t next_sibling(const uint32_t i) const { return m_next_sibling[i]; }
+  bool is_null(const uint32_t i) const { return m_tags[i] == Type::UNDEFINED; }
+
+  // Literal value of a primitive row; Kind::NONE if it has none.
+  Constant value(const uint32_t i) const {
+    if (!is_primitive(m_tags[i]) || m_payload[i] == none)
+      return {};
+    auto const &v = m_values[m_payload[i]];
+    switch (v.kind) {
+    case Constant::Kind::BOOL:
+      return Constant::boolean(v.b);
+    case Constant::Kind::INT:
+      return Constant::integer(v.i);
+    case Constant::Kind::FLOAT:
+      return Constant::number(v.f);
+    default:
+      return Constant::string(m_text.substr(v.offset, v.length));
+    }
+  }
+  const FunctionInfo &function(const uint32_t i) const {
+    return m_functions[m_payload[i]];
+  }
+  const Param &param(const uint32_t index) const { return m_params[index]; }
+  const ExpressionInfo &expression(const uint32_t i) const {
+    return m_expressions[m_payload[i]];
+  }
+
+  // Bytes held by the columns and side tables.
+  size_t bytes() const {
+    return m_tags.capacity() * sizeof(Type) +
+           (m_ids.capacity() + m_first_child.capacity() +
+            m_next_sibling.capacity() + m_payload.capacity()) *
+               sizeof(uint32_t) +
+           m_values.capacity() * sizeof(Literal) + m_text.capacity() +
+           m_functions.capacity() * sizeof(FunctionInfo) +
+           m_params.capacity() * sizeof(Param) +
+           m_expressions.capacity() * sizeof(ExpressionInfo);
+  }
+
+  // Same output as SyntaxAnalyzer::print_tree on the original nodes.
+  void print_tree() const { print_tree(root(), 0); }
+
+  static const char *type_string(const Type t) {
+    switch (t) {
+    case Type::I16:
+      return "Integer_16";
+    case Type::I32:
+      return "Integer_32";
+    case Type::I64:
+      return "Integer_64";
+    case Type::U8:
+      return "Unsigned_8";
+    case Type::U16:
+      return "Unsigned_16";
+    case Type::F32:
+      return "Float_32";
+    case Type::F64:
+      return "Float_64";
+    case Type::BOOL:
+      return "Boolean";
+    case Type::COMPLEX:
+      return "Complex";
+    case Type::STRING:
+      return "String";
+    case Type::VARIANT:
+      return "Variant";
+    case Type::VOID:
+      return "Void";
+    case Type::ARRAY:
+      return "Array";
+    case Type::CLASS:
+      return "Class";
+    case Type::STRUCT:
+      return "Struct";
+    case Type::JSON:
+      return "Json";
+    case Type::ROUTE:
+      return "Route";
+    case Type::SCOPE:
+      return "Scope";
+    case Type::OBJECT:
+      return "Object";
+    case Type::FUNCTION:
+      return "Function";
+    case Type::PRIMITIVE:
+      return "Primitive";
+    case Type::EXPRESSION:
+      return "Expression";
+    case Type::ARITHMETICEXPRESSION:
+      return "ArithmeticExpression";
+    case Type::LOGICALEXPRESSION:
+      return "LogicalExpression";
+    case Type::ASSIGNMENTEXPRESSION:
+      return "AssignmentExpression";
+    case Type::CALLEXPRESSION:
+      return "CallExpression";
+    case Type::ACCESSEXPRESSION:
+      return "AccessExpression";
+    case Type::IDENTIFIER:
+      return "Identifier";
+    case Type::RETURNEXPRESSION:
+      return "ReturnExpression";
+    default:
+      return "Undefined";
+    }
+  }
+
+private:
+  static bool is_primitive(const Type t) {
+    return t >= Type::I16 && t <= Type::VOID;
+  }
+  static bool is_expression(const Type t) {
+    return (t >= Type::ARITHMETICEXPRESSION && t <= Type::ACCESSEXPRESSION) ||
+           t == Type::RETURNEXPRESSION;
+  }
+
+  Literal literal(const Constant &c) {
+    Literal l{c.kind, 0, {}};
+    switch (c.kind) {
+    case Constant::Kind::BOOL:
+      l.b = c.b;
+      break;
+    case Constant::Kind::INT:
+      l.i = c.i;
+      break;
+    case Constant::Kind::FLOAT:
+      l.f = c.f;
+      break;
+    default:
+      l.offset = static_cast<uint32_t>(m_text.size());
+      l.length = static_cast<uint32_t>(c.s.size());
+      m_text += c.s;
+      break;
+    }
+    return l;
+  }
+
+  void shrink() {
+    m_tags.shrink_to_fit();
+    m_ids.shrink_to_fit();
+    m_first_child.shrink_to_fit();
+    m_next_sibling.shrink_to_fit();
+    m_payload.shrink_to_fit();
+    m_values.shrink_to_fit();
+    m_text.shrink_to_fit();
+    m_functions.shrink_to_fit();
+    m_params.shrink_to_fit();
+    m_expressions.shrink_to_fit();
+  }
+
+  uint32_t push(const Type tag, const Symbol id) {
+    m_tags.push_back(tag);
+    m_ids.push_back(id);
+    m_first_child.push_back(none);
+    m_next_sibling.push_back(none);
+    m_payload.push_back(none);
+    return size() - 1;
+  }
+
+  uint32_t add(const ASTNode *n) {
+    if (!n)
+      return push(Type::UNDEFINED, no_id);
+    const uint32_t row = push(n->type(), n->id());
+
+    switch (n->type()) {
+    case Type::I16... Type::VOID:
+      if (auto const v = Literals::value(n); v.kind != Constant::Kind::NONE) {
+        m_payload[row] = static_cast<uint32_t>(m_values.size());
+        m_values.push_back(literal(v));
+      }
+      break;
+    case Type::FUNCTION: {
+      auto const *fn = static_cast<const Function<node_ptr> *>(n);
+      m_payload[row] = static_cast<uint32_t>(m_functions.size());
+      auto const &params = fn->parameters_const();
+      m_functions.push_back({fn->return_t(),
+                             static_cast<uint32_t>(m_params.size()),
+                             static_cast<uint32_t>(params.size())});
+      for (auto const *p : params)
+        m_params.push_back({p ? p->id() : no_id,
+                            p ? p->type() : Type::UNDEFINED});
+      break;
+    }
+    case Type::ARITHMETICEXPRESSION... Type::ACCESSEXPRESSION:
+    case Type::RETURNEXPRESSION:
+      m_payload[row] = static_cast<uint32_t>(m_expressions.size());
+      m_expressions.push_back(
+          {static_cast<const Expression *>(n)->opr(), none, none});
+      break;
+    default:
+      break;
+    }
+
+    uint32_t prev = none;
+    for (auto const *c : n->children_const()) {
+      const uint32_t child = add(c);
+      if (prev == none)
+        m_first_child[row] = child;
+      else
+        m_next_sibling[prev] = child;
+      prev = child;
+    }
+
+    // Operands go after the children; the payload index stays valid while
+    // the side table grows, a reference into it would not.
+    if (is_expression(m_tags[row])) {
+      auto const *e = static_cast<const Expression *>(n);
+      const uint32_t expr = m_payload[row];
+      if (e->lhs()) {
+        const uint32_t lhs = add(e->lhs());
+        m_expressions[expr].lhs = lhs;
+      }
+      if (e->rhs()) {
+        const uint32_t rhs = add(e->rhs());
+        m_expressions[expr].rhs = rhs;
+      }
+    }
+    return row;
+  }
+
+  void print_tree(uint32_t i, const int offset) const {
+    for (; i != none; i = m_next_sibling[i]) {
+      if (is_null(i)) {
+        fprintf(stdout, "[_NULL_OBJECT_]\n");
+        continue;
+      }
+      auto str = std::string(offset, '.');
+      fprintf(stdout, "%s| %s : %s\n", str.c_str(), symbol_name(m_ids[i]),
+              type_string(m_tags[i]));
+      print_tree(m_first_child[i], offset + 3);
+    }
+  }
+
+private:
+  std::vector<Type> m_tags;
+  std::vector<Symbol> m_ids;
+  std::vector<uint32_t> m_first_child;
+  std::vector<uint32_t> m_next_sibling;
+  std::vector<uint32_t> m_payload;
+
+  std::vector<Literal> m_values;
+  std::string m_text;
+  std::vector<FunctionInfo> m_functions;
+  std::vector<Param> m_params;
+  std::vector<ExpressionInfo> m_expressions;
+};
+
+} // namespace ServerLang
@@ -0,0 +1,329 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "compiled_image.h"
+#include "compiler.h"
+#include "hash.h"
+#include "libraries.h"
+#include "modules.h"
+#include "rcu.h"
+#include "runtime.h"
+#include "source_file.h"
+#include "syntax_analyzer.h"
+#include "thread_pool.h"
+#include "tokenizer.h"
+#include "trace.h"
+
+namespace ServerLang {
+
+// Everything one version of a script serves from: the image of the script
+// itself, the modules it imports, which own their ASTs, and the Runtime built
+// from them (declarations, route table and bytecode). Never modified once
+// published.
+struct LoadedProgram {
+  uint64_t version = 0;
+  CompiledImage image;
+  ModuleGraph modules;
+  Runtime runtime;
+  bool from_image = false; // the script itself was not parsed
+
+  // Loads the script at `path` and its imports and runs their initializers.
+  // The script runs from the compiled image next to it if that is fresh for
+  // both the script and its imports; otherwise it is parsed and compiled,
+  // and the image is rewritten unless analyzing or compiling it reported
+  // errors, which are then reported again on the next run. With `cached` false the image is
+  // neither read nor written. Returns false if the script cannot be read.
+  //
+  // Only the script itself has an image. Its @script imports are tokenized
+  // and analyzed through the ModuleCache on every cold start, so a script
+  // split over many files gains less: within a process the cache parses
+  // each file once, but a new process parses every import again.
+  bool load(const std::string &path, ModuleCache &cache, ThreadPool &pool,
+            const bool cached = true) {
+    SourceFile file;
+    if (!file.open(path.c_str())) {
+      fprintf(stderr, "Could not open the specified file: %s \n",
+              path.c_str());
+      return false;
+    }
+    const uint64_t hash = fnv1a(file.data());
+    auto const image_path = CompiledImage::path_for(path);
+    auto const parse = [&file] {
+      TokenStream tokens(file.data());
+      SyntaxAnalyzer analyzer;
+      return analyzer.analyze(tokens);
+    };
+
+    // Imported scripts are parsed concurrently; each file once per cache.
+    // The script's own imports are read from whichever copy of it is used.
+    ParseResult source;
+    std::vector<Import> imports;
+    const bool mapped = cached && image.map(image_path, hash);
+    if (mapped)
+      imports = image.imports();
+    else {
+      source = parse();
+      imports.assign(source.imports().begin(), source.imports().end());
+    }
+    modules = ImportResolver(cache, pool).resolve_imports(path, imports);
+    for (auto const &mod : modules.order)
+      runtime.eval(mod->result);
+
+    const uint64_t imports_hash = modules.content_hash();
+    from_image = mapped && image.header().imports_hash == imports_hash &&
+                 runtime.eval(image);
+    if (from_image) {
+      TRACE_LOG(RUNTIME, INFO, "Using compiled image %s", image_path.c_str());
+    } else {
+      if (mapped)
+        source = parse();
+      CompiledModule module;
+      runtime.eval(source, module);
+      auto bytes = CompiledImage::build(source, runtime.program(), module,
+                                        hash, imports_hash);
+      if (cached && !source.errors() && !module.errors) {
+        if (CompiledImage::write(image_path, bytes))
+          TRACE_LOG(RUNTIME, INFO, "Rebuilt compiled image %s",
+                    image_path.c_str());
+        else
+          TRACE_LOG(RUNTIME, INFO, "Could not write compiled image %s",
+                    image_path.c_str());
+      }
+      // Only fails if the image just built is malformed, which is a bug.
+      if (!image.adopt(std::move(bytes), hash)) {
+        fprintf(stderr, "Could not load the compiled image of %s \n",
+                path.c_str());
+        return false;
+      }
+    }
+    Core::flush_output();
+    return true;
+  }
+};
+
+// Reports changes to a set of files through inotify. The directories are
+// watched rather than the files, so a file an editor replaces by renaming a
+// new copy over it is still seen.
+class FileWatcher {
+public:
+  FileWatcher() : m_fd(::inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) {
+    if (m_fd < 0)
+      perror("[Error]: inotify_init1");
+  }
+  ~FileWatcher() {
+    if (m_fd >= 0)
+      ::close(m_fd);
+  }
+  FileWatcher(const FileWatcher &) = delete;
+  FileWatcher &operator=(const FileWatcher &) = delete;
+
+public:
+  bool ok() const { return m_fd >= 0; }
+
+  // Replaces the watched set with `paths`, which must be canonical.
+  void watch(const std::vector<std::string> &paths) {
+    if (!ok())
+      return;
+    m_files.clear();
+    std::unordered_map<std::string, int> dirs;
+    for (auto const &path : paths) {
+      m_files.insert(path);
+      auto const dir = directory(path);
+      if (dirs.count(dir))
+        continue;
+      const int wd = ::inotify_add_watch(m_fd, dir.c_str(), mask);
+      if (wd < 0)
+        fprintf(stderr, "[Error]: Cannot watch %s\n", dir.c_str());
+      else
+        dirs[dir] = wd;
+    }
+    for (auto const &[wd, dir] : m_dirs)
+      if (!dirs.count(dir))
+        ::inotify_rm_watch(m_fd, wd);
+    m_dirs.clear();
+    for (auto const &[dir, wd] : dirs)
+      m_dirs[wd] = dir;
+  }
+
+  // Waits up to `timeout_ms` for events and returns true if any of them
+  // touched a watched file.
+  bool wait(const int timeout_ms) {
+    if (!ok())
+      return false;
+    pollfd pfd{m_fd, POLLIN, 0};
+    if (::poll(&pfd, 1, timeout_ms) <= 0)
+      return false;
+
+    bool changed = false;
+    alignas(inotify_event) char buf[4096];
+    for (ssize_t n; (n = ::read(m_fd, buf, sizeof buf)) > 0;) {
+      for (char *p = buf; p < buf + n;) {
+        auto const *e = reinterpret_cast<const inotify_event *>(p);
+        p += sizeof(inotify_event) + e->len;
+        auto const dir = m_dirs.find(e->wd);
+        if (!e->len || dir == m_dirs.end())
+          continue;
+        auto const path =
+            (dir->second == "/" ? "" : dir->second) + '/' + e->name;
+        changed = changed || m_files.count(path);
+      }
+    }
+    return changed;
+  }
+
+private:
+  static constexpr uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO;
+
+  static std::string directory(const std::string &path) {
+    const auto slash = path.rfind('/');
+    return slash == 0 || slash == std::string::npos ? "/"
+                                                    : path.substr(0, slash);
+  }
+
+private:
+  int m_fd;
+  std::unordered_map<int, std::string> m_dirs;
+  std::unordered_set<std::string> m_files;
+};
+
+// Keeps the program built from a script and its @script imports current.
+//
+// A reload goes through the ModuleCache, so only files whose content changed
+// are tokenized and analyzed again; the rest of the new version shares their
+// parsed modules with the old one. The script itself runs from its compiled
+// image unless it or one of its imports changed. The new program is
+// published through an RcuCell: requests pinned to the old version finish on
+// it, and it is freed once they have.
+class HotReloader {
+public:
+  struct Stats {
+    uint64_t version;
+    size_t modules;
+    size_t parsed; // modules tokenized and analyzed for this version
+    double ms;
+  };
+  // Called on the reloading thread after each successful load.
+  using Callback = std::function<void(const LoadedProgram &, const Stats &)>;
+
+  HotReloader(std::string path, ThreadPool &pool, Callback on_reload = {})
+      : m_path(std::move(path)), m_pool(pool),
+        m_on_reload(std::move(on_reload)) {}
+  ~HotReloader() { stop(); }
+
+public:
+  // Builds and publishes a new version on the calling thread. Returns false,
+  // keeping the current version, if the script cannot be read.
+  bool reload() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto const start = std::chrono::steady_clock::now();
+    const size_t parses = m_cache.parses();
+
+    auto next = std::make_unique<LoadedProgram>();
+    if (!next->load(m_path, m_cache, m_pool))
+      return false;
+    next->version = ++m_version;
+    m_files.assign(1, canonical_path(m_path));
+    for (auto const &mod : next->modules.order)
+      m_files.push_back(mod->path);
+
+    const LoadedProgram &loaded = *next;
+    m_programs.publish(std::move(next));
+    const Stats stats{
+        loaded.version, loaded.modules.order.size() + 1,
+        m_cache.parses() - parses + !loaded.from_image,
+        std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start)
+            .count()};
+    m_last = stats;
+    if (m_on_reload)
+      m_on_reload(loaded, stats);
+    return true;
+  }
+
+  // Reloads on a background thread whenever a loaded file changes. Saves
+  // that arrive within `debounce_ms` of each other cause one reload. The
+  // files of the current version are watched before this returns, so a
+  // save right after it is not missed.
+  void start(const int debounce_ms = 10) {
+    if (m_thread.joinable() || !m_watcher.ok())
+      return;
+    m_stopping = false;
+    uint64_t watching;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_watcher.watch(m_files);
+      watching = m_version;
+    }
+    m_thread = std::thread([this, debounce_ms, watching]() mutable {
+      while (!m_stopping) {
+        // Once started, the watcher is only touched by this thread; pick up
+        // the files of whatever version was loaded last.
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          if (watching != m_version) {
+            m_watcher.watch(m_files);
+            watching = m_version;
+          }
+        }
+        if (!m_watcher.wait(poll_ms))
+          continue;
+        while (m_watcher.wait(debounce_ms))
+          ;
+        if (!reload())
+          fprintf(stderr,
+                  "[Error]: Reloading %s failed, keeping the current version\n",
+                  m_path.c_str());
+      }
+    });
+  }
+
+  void stop() {
+    m_stopping = true;
+    if (m_thread.joinable())
+      m_thread.join();
+  }
+
+  // Readers attach to this to pin a version while they serve a request.
+  RcuCell<LoadedProgram> &programs() { return m_programs; }
+
+  // Stats of the most recent successful reload.
+  Stats last() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_last;
+  }
+
+private:
+  // How often the watcher thread checks whether it should stop.
+  static constexpr int poll_ms = 100;
+
+  std::string m_path;
+  ThreadPool &m_pool;
+  Callback m_on_reload;
+  ModuleCache m_cache;
+  FileWatcher m_watcher;
+  RcuCell<LoadedProgram> m_programs;
+  mutable std::mutex m_mutex; // one reload at a time
+  uint64_t m_version = 0;
+  std::vector<std::string> m_files; // of version m_version
+  Stats m_last{};
+  std::thread m_thread;
+  std::atomic<bool> m_stopping{false};
+};
+
+} // namespace ServerLang
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace ServerLang {
+
+// One parsed HTTP/1.x request. The views point into the buffer handed to
+// HttpParser::parse and are valid until it is modified.
+struct HttpRequest {
+  std::string_view method;
+  std::string_view target; // as sent, query string included
+  std::string_view path;   // target up to the query string
+  std::string_view body;
+  bool http11 = true;
+  bool keep_alive = true;
+  size_t length = 0; // bytes of the buffer the request took up
+};
+
+// Incremental HTTP/1.x request parser.
+//
+// parse() is handed everything received and not yet consumed, from the
+// start of the next request. Data arriving a few bytes at a time is not
+// rescanned: the search for the end of the head resumes where it stopped,
+// and the head is parsed once even if the body is still on its way. A
+// buffer holding several pipelined requests yields them one per call; the
+// caller drops `length` bytes from the front after each.
+//
+// Only Content-Length bodies are accepted; chunked request bodies are
+// reported as UNSUPPORTED. A head over max_head is HEAD_TOO_LARGE, a
+// Content-Length over max_body BODY_TOO_LARGE.
+class HttpParser {
+public:
+  enum class Status {
+    DONE,
+    PARTIAL,
+    BAD,
+    HEAD_TOO_LARGE,
+    BODY_TOO_LARGE,
+    UNSUPPORTED
+  };
+
+  static constexpr size_t max_head = 16 * 1024;
+  static constexpr size_t max_body = 1024 * 1024;
+
+public:
+  Status parse(const std::string_view in, HttpRequest &req) {
+    if (!m_head) {
+      const size_t from = m_scanned > 3 ? m_scanned - 3 : 0;
+      const auto end = in.find("\r\n\r\n", from);
+      if (end == std::string_view::npos) {
+        m_scanned = in.size();
+        return in.size() > max_head ? Status::HEAD_TOO_LARGE
+                                    : Status::PARTIAL;
+      }
+      m_head = end + 4;
+      if (m_head > max_head)
+        return Status::HEAD_TOO_LARGE;
+      if (const auto s = head(in.substr(0, m_head)); s != Status::DONE)
+        return s;
+    }
+    if (in.size() - m_head < m_body)
+      return Status::PARTIAL;
+
+    req.method = in.substr(0, m_method);
+    req.target = in.substr(m_method + 1, m_target);
+    req.path = req.target.substr(0, req.target.find('?'));
+    req.body = in.substr(m_head, m_body);
+    req.http11 = m_http11;
+    req.keep_alive = m_keep_alive;
+    req.length = m_head + m_body;
+    reset();
+    return Status::DONE;
+  }
+
+  // Forgets a partly parsed request.
+  void reset() { *this = HttpParser{}; }
+
+private:
+  static bool iequals(const std::string_view a, const std::string_view b) {
+    return a.size() == b.size() &&
+           std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+             return std::tolower(static_cast<unsigned char>(x)) ==
+                    std::tolower(static_cast<unsigned char>(y));
+           });
+  }
+
+  static bool icontains(const std::string_view s, const std::string_view w) {
+    for (size_t i = 0; i + w.size() <= s.size(); ++i)
+      if (iequals(s.substr(i, w.size()), w))
+        return true;
+    return false;
+  }
+
+  static std::string_view trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+      s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+      s.remove_suffix(1);
+    return s;
+  }
+
+  // Request line and headers, ending in the blank line.
+  Status head(const std::string_view h) {
+    auto eol = h.find("\r\n");
+    const auto line = h.substr(0, eol);
+    const auto sp1 = line.find(' ');
+    const auto sp2 = line.rfind(' ');
+    if (sp1 == 0 || sp1 == std::string_view::npos || sp2 == sp1)
+      return Status::BAD;
+    const auto version = line.substr(sp2 + 1);
+    if (version.substr(0, 7) != "HTTP/1.")
+      return Status::BAD;
+    m_method = sp1;
+    m_target = sp2 - sp1 - 1;
+    m_http11 = version != "HTTP/1.0";
+    m_keep_alive = m_http11;
+
+    for (size_t pos = eol + 2; pos + 2 < h.size(); pos = eol + 2) {
+      eol = h.find("\r\n", pos);
+      const auto field = h.substr(pos, eol - pos);
+      const auto colon = field.find(':');
+      if (colon == 0 || colon == std::string_view::npos)
+        return Status::BAD;
+      const auto name = field.substr(0, colon);
+      const auto value = trim(field.substr(colon + 1));
+      if (iequals(name, "Content-Length")) {
+        // Repeated lengths that differ leave the end of the request to
+        // whoever reads it (RFC 9112 6.3), so the request is refused.
+        size_t length = 0;
+        auto const [end, ec] =
+            std::from_chars(value.data(), value.data() + value.size(), length);
+        if (ec != std::errc{} || end != value.data() + value.size() ||
+            (m_has_length && length != m_body))
+          return Status::BAD;
+        m_body = length;
+        m_has_length = true;
+        if (m_body > max_body)
+          return Status::BODY_TOO_LARGE;
+      } else if (iequals(name, "Connection")) {
+        if (icontains(value, "close"))
+          m_keep_alive = false;
+        else if (icontains(value, "keep-alive"))
+          m_keep_alive = true;
+      } else if (iequals(name, "Transfer-Encoding")) {
+        if (!iequals(value, "identity"))
+          return Status::UNSUPPORTED;
+      }
+    }
+    return Status::DONE;
+  }
+
+private:
+  size_t m_scanned = 0; // bytes already searched for the end of the head
+  size_t m_head = 0;    // length of the head, once it is complete
+  size_t m_body = 0;
+  bool m_has_length = false; // a Content-Length was seen
+  size_t m_method = 0;
+  size_t m_target = 0;
+  bool m_http11 = true;
+  bool m_keep_alive = true;
+};
+
+// Appends a status line and headers to `out`, ready to be followed by a
+// body of `body_length` bytes.
+inline void http_head(std::string &out, const int status,
+                      const std::string_view content_type,
+                      const size_t body_length, const bool keep_alive) {
+  auto const reason = [](const int s) -> std::string_view {
+    switch (s) {
+    case 200:
+      return "OK";
+    case 201:
+      return "Created";
+    case 204:
+      return "No Content";
+    case 301:
+      return "Moved Permanently";
+    case 302:
+      return "Found";
+    case 304:
+      return "Not Modified";
+    case 400:
+      return "Bad Request";
+    case 403:
+      return "Forbidden";
+    case 404:
+      return "Not Found";
+    case 413:
+      return "Content Too Large";
+    case 431:
+      return "Request Header Fields Too Large";
+    case 500:
+      return "Internal Server Error";
+    case 501:
+      return "Not Implemented";
+    case 503:
+      return "Service Unavailable";
+    default:
+      return s < 400 ? "OK" : s < 500 ? "Client Error" : "Server Error";
+    }
+  };
+  char digits[24];
+  out += "HTTP/1.1 ";
+  out.append(digits, std::to_chars(digits, digits + sizeof digits, status).ptr);
+  out += ' ';
+  out += reason(status);
+  out += "\r\nContent-Type: ";
+  out += content_type;
+  out += "\r\nContent-Length: ";
+  out.append(digits,
+             std::to_chars(digits, digits + sizeof digits, body_length).ptr);
+  out += keep_alive ? "\r\n\r\n" : "\r\nConnection: close\r\n\r\n";
+}
+
+} // namespace ServerLang
@@ -0,0 +1,420 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "hot_reload.h"
+#include "http.h"
+#include "libraries.h"
+#include "rcu.h"
+#include "vm.h"
+
+namespace ServerLang {
+
+// HTTP/1.1 front end dispatching requests to the Route declarations of the
+// current LoadedProgram.
+//
+// Every thread runs its own edge-triggered epoll loop over its own listening
+// socket; SO_REUSEPORT has the kernel spread connections across them, so a
+// connection stays on one thread and no request crosses threads. A thread
+// pins the current program while it handles a batch of events and serves on
+// its own Machine forked from that version, rebuilt when a reload publishes
+// a new one. A route runs on the thread that read its request rather than
+// being handed to a worker pool, so its Body is written from that Machine
+// without a copy and pipelined responses stay in order without a queue.
+//
+// A route's This.Status, This.Header and This.Body become the status,
+// Content-Type and body of the response; a route that sets no Body answers
+// with what it returned. The head is formatted into a per-thread buffer and
+// written together with the Body's own string by one writev, so the body is
+// not copied unless the socket cannot take all of it at once.
+class HttpServer {
+public:
+  struct Options {
+    uint16_t port = 8080; // 0 picks a free one; see port()
+    size_t threads = std::thread::hardware_concurrency();
+  };
+
+  HttpServer(RcuCell<LoadedProgram> &programs, const Options &options)
+      : m_programs(programs), m_options(options) {
+    if (m_options.threads == 0)
+      m_options.threads = 1;
+  }
+  ~HttpServer() { stop(); }
+  HttpServer(const HttpServer &) = delete;
+  HttpServer &operator=(const HttpServer &) = delete;
+
+public:
+  // Binds every thread's socket and starts serving. Returns false, with
+  // nothing started, if a socket cannot be set up.
+  bool start() {
+    m_stop_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_stop_fd < 0) {
+      perror("[Error]: eventfd");
+      return false;
+    }
+    m_port = m_options.port;
+    for (size_t i = 0; i < m_options.threads; ++i) {
+      m_loops.push_back(std::make_unique<Loop>());
+      if (!listen(*m_loops.back())) {
+        close_loops();
+        return false;
+      }
+    }
+    for (auto &loop : m_loops)
+      loop->thread = std::thread([this, l = loop.get()] { run(*l); });
+    return true;
+  }
+
+  // Stops accepting, closes every connection and joins the threads.
+  void stop() {
+    if (m_stop_fd < 0)
+      return;
+    const uint64_t one = 1;
+    if (::write(m_stop_fd, &one, sizeof one) < 0)
+      perror("[Error]: eventfd write");
+    for (auto &loop : m_loops)
+      if (loop->thread.joinable())
+        loop->thread.join();
+    close_loops();
+  }
+
+  uint16_t port() const { return m_port; }
+
+  // Requests answered so far, across threads.
+  uint64_t requests() const {
+    uint64_t n = 0;
+    for (auto const &loop : m_loops)
+      n += loop->requests.load(std::memory_order_relaxed);
+    return n;
+  }
+
+private:
+  static constexpr size_t read_chunk = 16 * 1024;
+  static constexpr int max_events = 256;
+
+  struct Connection {
+    int fd;
+    std::string in;    // received, from the start of the next request
+    std::string out;   // the part of a response the socket did not take
+    size_t filled = 0; // bytes of `in` holding data
+    HttpParser parser;
+    bool closing = false; // close once `out` is flushed
+  };
+
+  struct Loop {
+    int listen_fd = -1;
+    int epoll_fd = -1;
+    std::thread thread;
+    std::unordered_map<int, std::unique_ptr<Connection>> connections;
+    // The context and the version it was forked from.
+    std::unique_ptr<Machine> context;
+    uint64_t version = 0;
+    std::string head;
+    // A Body or Header that is not a string, in text form. Both keep their
+    // capacity from one request to the next.
+    std::string body, type;
+    std::atomic<uint64_t> requests{0};
+  };
+
+  bool listen(Loop &loop) {
+    loop.listen_fd =
+        ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    const int on = 1;
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(m_port);
+    if (loop.listen_fd < 0 ||
+        ::setsockopt(loop.listen_fd, SOL_SOCKET, SO_REUSEADDR, &on,
+                     sizeof on) < 0 ||
+        ::setsockopt(loop.listen_fd, SOL_SOCKET, SO_REUSEPORT, &on,
+                     sizeof on) < 0 ||
+        ::bind(loop.listen_fd, reinterpret_cast<sockaddr *>(&addr),
+               sizeof addr) < 0 ||
+        ::listen(loop.listen_fd, SOMAXCONN) < 0) {
+      fprintf(stderr, "[Error]: Cannot listen on port %u: %s\n", m_port,
+              strerror(errno));
+      return false;
+    }
+    // Port 0 picked a free port for the first socket; the rest share it.
+    socklen_t len = sizeof addr;
+    ::getsockname(loop.listen_fd, reinterpret_cast<sockaddr *>(&addr), &len);
+    m_port = ntohs(addr.sin_port);
+
+    loop.epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = loop.listen_fd;
+    if (loop.epoll_fd < 0 ||
+        ::epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, loop.listen_fd, &ev) < 0) {
+      perror("[Error]: epoll");
+      return false;
+    }
+    // Level-triggered, so one write wakes every loop.
+    ev.events = EPOLLIN;
+    ev.data.fd = m_stop_fd;
+    ::epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, m_stop_fd, &ev);
+    return true;
+  }
+
+  void close_loops() {
+    for (auto &loop : m_loops) {
+      for (auto const &[fd, c] : loop->connections)
+        ::close(fd);
+      if (loop->listen_fd >= 0)
+        ::close(loop->listen_fd);
+      if (loop->epoll_fd >= 0)
+        ::close(loop->epoll_fd);
+    }
+    m_loops.clear();
+    if (m_stop_fd >= 0)
+      ::close(m_stop_fd);
+    m_stop_fd = -1;
+  }
+
+  void run(Loop &loop) {
+    RcuCell<LoadedProgram>::Reader reader(m_programs);
+    epoll_event events[max_events];
+    for (;;) {
+      // Routes print into a per-thread buffer; write it out before idling.
+      Core::flush_output();
+      const int n = ::epoll_wait(loop.epoll_fd, events, max_events, -1);
+      if (n < 0 && errno != EINTR) {
+        perror("[Error]: epoll_wait");
+        return;
+      }
+      RcuCell<LoadedProgram>::Guard program(reader);
+      for (int i = 0; i < n; ++i) {
+        const int fd = events[i].data.fd;
+        if (fd == m_stop_fd)
+          return;
+        if (fd == loop.listen_fd) {
+          accept(loop);
+          continue;
+        }
+        auto const it = loop.connections.find(fd);
+        if (it == loop.connections.end())
+          continue;
+        if ((events[i].events & (EPOLLERR | EPOLLHUP)) ||
+            !handle(loop, *it->second, program.get()))
+          disconnect(loop, fd);
+      }
+    }
+  }
+
+  void accept(Loop &loop) {
+    for (;;) {
+      const int fd =
+          ::accept4(loop.listen_fd, nullptr, nullptr,
+                    SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+          perror("[Error]: accept");
+        if (errno != EINTR)
+          return;
+        continue;
+      }
+      const int on = 1;
+      ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+      epoll_event ev{};
+      ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+      ev.data.fd = fd;
+      if (::epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        ::close(fd);
+        continue;
+      }
+      auto c = std::make_unique<Connection>();
+      c->fd = fd;
+      loop.connections[fd] = std::move(c);
+    }
+  }
+
+  void disconnect(Loop &loop, const int fd) {
+    ::epoll_ctl(loop.epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    ::close(fd);
+    loop.connections.erase(fd);
+  }
+
+  // Runs until the socket would block in the direction that matters.
+  // Edge-triggered events only repeat once it does. Returns false once the
+  // connection should be closed.
+  bool handle(Loop &loop, Connection &c, const LoadedProgram *program) {
+    for (;;) {
+      if (!flush(c))
+        return false;
+      if (!c.out.empty())
+        return true; // EPOLLOUT resumes us
+      if (!serve(loop, c, program))
+        return false;
+      if (!c.out.empty())
+        continue;
+      if (c.closing)
+        return false;
+
+      if (c.in.size() - c.filled < read_chunk / 2)
+        c.in.resize(std::max(c.in.size() * 2, read_chunk));
+      const ssize_t n =
+          ::read(c.fd, c.in.data() + c.filled, c.in.size() - c.filled);
+      if (n > 0)
+        c.filled += static_cast<size_t>(n);
+      else if (n == 0)
+        return false;
+      else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return true;
+      else if (errno != EINTR)
+        return false;
+    }
+  }
+
+  // Writes what is left of an earlier response.
+  static bool flush(Connection &c) {
+    while (!c.out.empty()) {
+      const ssize_t n = ::write(c.fd, c.out.data(), c.out.size());
+      if (n < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+      c.out.erase(0, static_cast<size_t>(n));
+    }
+    return true;
+  }
+
+  // Answers every complete request buffered on `c`, stopping early if the
+  // socket fills up. Returns false on a write error.
+  bool serve(Loop &loop, Connection &c, const LoadedProgram *program) {
+    size_t consumed = 0;
+    HttpRequest req;
+    bool ok = true;
+    while (ok && c.out.empty() && !c.closing) {
+      const auto status = c.parser.parse(
+          std::string_view(c.in.data() + consumed, c.filled - consumed), req);
+      if (status == HttpParser::Status::PARTIAL)
+        break;
+      if (status != HttpParser::Status::DONE) {
+        c.closing = true;
+        ok = respond(loop, c, error_status(status), "text/plain", "", false);
+        break;
+      }
+      consumed += req.length;
+      c.closing = !req.keep_alive;
+      ok = dispatch(loop, c, req, program);
+      loop.requests.fetch_add(1, std::memory_order_relaxed);
+    }
+    // Keep the buffer; only move an unfinished request to its front.
+    std::memmove(c.in.data(), c.in.data() + consumed, c.filled - consumed);
+    c.filled -= consumed;
+    return ok;
+  }
+
+  static int error_status(const HttpParser::Status status) {
+    switch (status) {
+    case HttpParser::Status::HEAD_TOO_LARGE:
+      return 431;
+    case HttpParser::Status::BODY_TOO_LARGE:
+      return 413;
+    case HttpParser::Status::UNSUPPORTED:
+      return 501;
+    default:
+      return 400;
+    }
+  }
+
+  bool dispatch(Loop &loop, Connection &c, const HttpRequest &req,
+                const LoadedProgram *program) {
+    const bool head_only = req.method == "HEAD";
+    if (!program)
+      return respond(loop, c, 503, "text/plain", "", head_only);
+    if (!loop.context || loop.version != program->version) {
+      loop.context = program->runtime.context();
+      loop.version = program->version;
+    }
+    auto &ctx = *loop.context;
+
+    Value result;
+    if (!program->runtime.exec_route(req.path, ctx, result, req.body))
+      return respond(loop, c,
+                     program->runtime.match_route(req.path) ? 500 : 404,
+                     "text/plain", "", head_only);
+
+    auto const &status = ctx.field(Field::STATUS);
+    auto const &header = ctx.field(Field::HEADER);
+    auto const &body = ctx.field(Field::BODY);
+    auto const &content = body.kind == Value::Kind::NIL ? result : body;
+    std::string_view text, type = "text/plain";
+    if (!content.text(text) && content.kind != Value::Kind::NIL) {
+      // Objects go out as JSON, written straight into the loop's buffer.
+      loop.body.clear();
+      content.append_to(loop.body);
+      text = loop.body;
+      if (content.kind == Value::Kind::OBJECT ||
+          content.kind == Value::Kind::JSON)
+        type = "application/json";
+    }
+    if (!header.text(type) && header.kind != Value::Kind::NIL)
+      type = loop.type = header.to_string();
+    return respond(loop, c, status_of(status), type, text, head_only);
+  }
+
+  static int status_of(const Value &v) {
+    return v.kind == Value::Kind::INT && v.i >= 100 && v.i <= 999
+               ? static_cast<int>(v.i)
+               : 200;
+  }
+
+  bool respond(Loop &loop, Connection &c, const int status,
+               const std::string_view type, const std::string_view body,
+               const bool head_only) {
+    loop.head.clear();
+    http_head(loop.head, status, type, body.size(), !c.closing);
+    iovec iov[2] = {{loop.head.data(), loop.head.size()},
+                    {const_cast<char *>(body.data()), body.size()}};
+    const int count = head_only || body.empty() ? 1 : 2;
+    const size_t total = loop.head.size() + (count == 2 ? body.size() : 0);
+    ssize_t n;
+    do
+      n = ::writev(c.fd, iov, count);
+    while (n < 0 && errno == EINTR);
+    if (n < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        return false;
+      n = 0;
+    }
+    // The body's string belongs to the context and goes away with the next
+    // request, so whatever the socket did not take is copied.
+    auto written = static_cast<size_t>(n);
+    if (written < total) {
+      for (int i = 0; i < count; ++i) {
+        const size_t skip = std::min(written, iov[i].iov_len);
+        c.out.append(static_cast<const char *>(iov[i].iov_base) + skip,
+                     iov[i].iov_len - skip);
+        written -= skip;
+      }
+    }
+    return true;
+  }
+
+private:
+  RcuCell<LoadedProgram> &m_programs;
+  Options m_options;
+  uint16_t m_port = 0;
+  int m_stop_fd = -1;
+  std::vector<std::unique_ptr<Loop>> m_loops;
+};
+
+} // namespace ServerLang
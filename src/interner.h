@@ -0,0 +1,200 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <shared_mutex>
+#include <string_view>
+#include <vector>
+
+#include "arena.h"
+#include "hash.h"
+
+namespace ServerLang {
+
+// Compact id of an interned name. Equal names always get the same symbol, so
+// name comparisons are integer compares.
+using Symbol = uint32_t;
+
+// Symbol of "__NO_ID__", the id of nodes that have no name.
+inline constexpr Symbol no_id = 0;
+
+// Process-wide, thread-safe string interner. Every distinct name is stored
+// once, NUL-terminated, and stays valid for the life of the process.
+class Interner {
+public:
+  Interner() { intern("__NO_ID__"); }
+  Interner(const Interner &) = delete;
+  Interner &operator=(const Interner &) = delete;
+
+  static Interner &global() {
+    static Interner interner;
+    return interner;
+  }
+
+public:
+  Symbol intern(const std::string_view name) {
+    const auto hash = static_cast<uint32_t>(fnv1a(name));
+    {
+      std::shared_lock<std::shared_mutex> lock(m_mutex);
+      if (const Symbol s = find(name, hash); s != missing)
+        return s;
+    }
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    if (const Symbol s = find(name, hash); s != missing)
+      return s;
+
+    const auto sym = static_cast<Symbol>(m_names.size());
+    auto *text = m_storage.copy_string(name);
+    m_names.push_back({text, static_cast<uint32_t>(name.size()), hash});
+    if ((m_names.size() + 1) * 4 > m_slots.size() * 3)
+      rehash(m_slots.empty() ? 1024 : m_slots.size() * 2);
+    else
+      place(sym);
+    return sym;
+  }
+
+  // NUL-terminated text of `sym`.
+  const char *name(const Symbol sym) const {
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    return m_names[sym].text;
+  }
+
+  std::string_view view(const Symbol sym) const {
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    return {m_names[sym].text, m_names[sym].size};
+  }
+
+  size_t size() const {
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    return m_names.size();
+  }
+
+private:
+  static constexpr Symbol missing = ~Symbol{0};
+
+  struct Name {
+    const char *text;
+    uint32_t size;
+    uint32_t hash;
+  };
+
+  // Open addressing with linear probing; a slot holds a symbol or `missing`.
+  Symbol find(const std::string_view name, const uint32_t hash) const {
+    if (m_slots.empty())
+      return missing;
+    const size_t mask = m_slots.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+      const Symbol s = m_slots[i];
+      if (s == missing)
+        return missing;
+      auto const &n = m_names[s];
+      if (n.hash == hash && n.size == name.size() &&
+          std::memcmp(n.text, name.data(), name.size()) == 0)
+        return s;
+    }
+  }
+
+  void place(const Symbol sym) {
+    const size_t mask = m_slots.size() - 1;
+    size_t i = m_names[sym].hash & mask;
+    while (m_slots[i] != missing)
+      i = (i + 1) & mask;
+    m_slots[i] = sym;
+  }
+
+  void rehash(const size_t capacity) {
+    m_slots.assign(capacity, missing);
+    for (Symbol s = 0; s < m_names.size(); ++s)
+      place(s);
+  }
+
+private:
+  mutable std::shared_mutex m_mutex;
+  std::vector<Symbol> m_slots;
+  std::vector<Name> m_names;
+  Arena m_storage;
+};
+
+// Interns into the global table. A small per-thread direct-mapped cache in
+// front of it serves repeated names without taking the interner's lock;
+// entries point at interned text, which is never freed.
+inline Symbol intern(const std::string_view name) {
+  struct Entry {
+    const char *text = nullptr;
+    uint32_t size = 0;
+    Symbol sym = no_id;
+  };
+  thread_local Entry cache[256];
+
+  const auto hash = fnv1a(name);
+  auto &e = cache[(hash ^ (hash >> 32)) & 255];
+  if (e.text && e.size == name.size() &&
+      std::memcmp(e.text, name.data(), name.size()) == 0)
+    return e.sym;
+
+  auto &interner = Interner::global();
+  const Symbol sym = interner.intern(name);
+  e = {interner.name(sym), static_cast<uint32_t>(name.size()), sym};
+  return sym;
+}
+
+inline const char *symbol_name(const Symbol sym) {
+  return Interner::global().name(sym);
+}
+
+// Open-addressing map keyed by Symbol. Symbols are dense small integers, so a
+// multiplicative hash spreads them well enough for linear probing.
+template <typename V> class SymbolMap {
+public:
+  void insert_or_assign(const Symbol key, const V &value) {
+    if ((m_size + 1) * 4 > m_slots.size() * 3)
+      grow();
+    auto &slot = m_slots[probe(key)];
+    if (slot.key == empty) {
+      slot.key = key;
+      ++m_size;
+    }
+    slot.value = value;
+  }
+
+  const V *find(const Symbol key) const {
+    if (m_slots.empty())
+      return nullptr;
+    auto const &slot = m_slots[probe(key)];
+    return slot.key == key ? &slot.value : nullptr;
+  }
+
+  size_t size() const { return m_size; }
+
+private:
+  static constexpr Symbol empty = ~Symbol{0};
+
+  struct Slot {
+    Symbol key = empty;
+    V value{};
+  };
+
+  // Slot holding `key`, or the empty slot where it would go.
+  size_t probe(const Symbol key) const {
+    const size_t mask = m_slots.size() - 1;
+    size_t i = (key * 0x9E3779B1u) & mask;
+    while (m_slots[i].key != empty && m_slots[i].key != key)
+      i = (i + 1) & mask;
+    return i;
+  }
+
+  void grow() {
+    std::vector<Slot> old(m_slots.empty() ? 16 : m_slots.size() * 2);
+    old.swap(m_slots);
+    for (auto const &slot : old)
+      if (slot.key != empty)
+        m_slots[probe(slot.key)] = slot;
+  }
+
+private:
+  std::vector<Slot> m_slots;
+  size_t m_size = 0;
+};
+
+} // namespace ServerLang
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include "scan.h"
+
+namespace ServerLang {
+
+// Streams JSON text into a buffer as values are handed to it, in document
+// order: begin_object(), key(), a value, ..., end_object(). Commas and
+// colons are inserted as needed. Strings are escaped with the Scan
+// kernels, which step over runs needing no escape 16 or 32 bytes at a time;
+// numbers are formatted with to_chars, and non-finite ones, which JSON
+// cannot represent, become null.
+//
+// The writer either appends to a std::string, growing it as needed, or
+// fills a fixed buffer, in which case ok() turns false once the text no
+// longer fits and nothing more is written. A string that was cleared but
+// kept its capacity is written without allocating.
+class JsonWriter {
+public:
+  explicit JsonWriter(
+      std::string &out,
+      const Scan::Kernels &kernels = Scan::best_kernels())
+      : m_out(&out), m_start(out.size()), m_kernels(&kernels) {
+    m_pos = m_end = out.data() + out.size();
+  }
+  JsonWriter(char *data, const size_t capacity,
+             const Scan::Kernels &kernels = Scan::best_kernels())
+      : m_begin(data), m_pos(data), m_end(data + capacity),
+        m_kernels(&kernels) {}
+  ~JsonWriter() { finish(); }
+
+  JsonWriter(const JsonWriter &) = delete;
+  JsonWriter &operator=(const JsonWriter &) = delete;
+
+public:
+  void null() { literal("null"); }
+  void boolean(const bool v) { literal(v ? "true" : "false"); }
+
+  void integer(const int64_t v) {
+    separate();
+    digits(v);
+  }
+
+  void number(const double v) {
+    if (v != v || v - v != 0)
+      return null();
+    separate();
+    digits(v);
+  }
+
+  void string(const std::string_view v) {
+    separate();
+    quoted(v);
+  }
+
+  void begin_object() { open('{'); }
+  void end_object() { close('}'); }
+  void begin_array() { open('['); }
+  void end_array() { close(']'); }
+
+  // A value that is already JSON text, written as it is.
+  void raw(const std::string_view json) {
+    separate();
+    put(json);
+  }
+
+  // Names the next value of the enclosing object.
+  void key(const std::string_view name) {
+    separate();
+    quoted(name);
+    put(':');
+    m_after_key = true;
+  }
+
+  // False once a fixed buffer has run out of room.
+  bool ok() const { return !m_overflow; }
+
+  // Everything in the target so far, including what a string held before.
+  std::string_view text() const {
+    const char *begin = m_out ? m_out->data() : m_begin;
+    return {begin, static_cast<size_t>(m_pos - begin)};
+  }
+
+  // Trims a string target to the text written so far. Called by the
+  // destructor; the writer can go on appending afterwards.
+  void finish() {
+    if (m_out) {
+      m_out->resize(static_cast<size_t>(m_pos - m_out->data()));
+      m_pos = m_end = m_out->data() + m_out->size();
+    }
+  }
+
+private:
+  // Writes the comma before a value unless it is the first in its
+  // container or follows its key.
+  void separate() {
+    if (m_after_key)
+      m_after_key = false;
+    else if (!m_first)
+      put(',');
+    m_first = false;
+  }
+
+  void open(const char bracket) {
+    separate();
+    put(bracket);
+    m_first = true;
+  }
+
+  void close(const char bracket) {
+    put(bracket);
+    m_first = false;
+  }
+
+  void literal(const std::string_view text) {
+    separate();
+    put(text);
+  }
+
+  void quoted(const std::string_view v) {
+    put('"');
+    const char *p = v.data(), *const end = p + v.size();
+    while (p < end) {
+      const char *const stop = m_kernels->find_escape(p, end);
+      put({p, static_cast<size_t>(stop - p)});
+      if (stop == end)
+        break;
+      escape(*stop);
+      p = stop + 1;
+    }
+    put('"');
+  }
+
+  void escape(const char c) {
+    static constexpr char hex[] = "0123456789abcdef";
+    switch (c) {
+    case '"':
+      return put("\\\"");
+    case '\\':
+      return put("\\\\");
+    case '\n':
+      return put("\\n");
+    case '\r':
+      return put("\\r");
+    case '\t':
+      return put("\\t");
+    default: {
+      const char u[] = {'\\', 'u', '0', '0', hex[(c >> 4) & 0xF],
+                        hex[c & 0xF]};
+      return put({u, sizeof u});
+    }
+    }
+  }
+
+  template <typename T> void digits(const T v) {
+    char buf[32];
+    put({buf, static_cast<size_t>(std::to_chars(buf, buf + sizeof buf, v).ptr -
+                                  buf)});
+  }
+
+  void put(const char c) {
+    if (room(1))
+      *m_pos++ = c;
+  }
+
+  void put(const std::string_view s) {
+    if (room(s.size())) {
+      std::memcpy(m_pos, s.data(), s.size());
+      m_pos += s.size();
+    }
+  }
+
+  bool room(const size_t n) {
+    return static_cast<size_t>(m_end - m_pos) >= n || grow(n);
+  }
+
+  // Makes room for `n` more bytes in a string target, at least doubling
+  // what this writer has written so that the zero fill of resize() stays
+  // proportional to the output; a fixed buffer overflows instead.
+  bool grow(const size_t n) {
+    if (!m_out) {
+      m_overflow = true;
+      m_pos = m_end;
+      return false;
+    }
+    const auto used = static_cast<size_t>(m_pos - m_out->data());
+    m_out->resize(used + std::max({n, used - m_start, size_t{256}}));
+    m_pos = m_out->data() + used;
+    m_end = m_out->data() + m_out->size();
+    return true;
+  }
+
+  std::string *m_out = nullptr;
+  size_t m_start = 0; // size of the string target when the writer began
+  char *m_begin = nullptr;
+  char *m_pos = nullptr;
+  char *m_end = nullptr;
+  const Scan::Kernels *m_kernels;
+  bool m_first = true;
+  bool m_after_key = false;
+  bool m_overflow = false;
+};
+
+} // namespace ServerLang
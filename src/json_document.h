@@ -0,0 +1,397 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "scan.h"
+
+namespace ServerLang {
+
+// JSON text read on demand, in two stages.
+//
+// index() makes one pass over the text, 64 bytes at a time: the json_block
+// kernel marks quotes, backslashes and structural characters, quotes
+// escaped by an odd run of backslashes are dropped, and a prefix XOR of
+// the remaining quotes masks out everything inside strings. What is left,
+// every { } [ ] : , outside strings plus both quotes of every string, is
+// written to the index as byte offsets, and each opening bracket gets the
+// slot of its closing one. Nothing is decoded, and beyond balanced brackets
+// and terminated strings a value is only checked when it is read.
+//
+// Values are then found by walking the index: a lookup steps from key to
+// key, jumping over nested containers in one step, and only the value
+// asked for is looked at. Scalars are parsed by the caller's request;
+// strings are views into the text unless they contain escapes, which are
+// decoded once into storage the document keeps until the next index().
+//
+// A value is named by a Ref, the slot of the structural character before
+// it; slot 0 stands before the root. The text must outlive the document's
+// use of it.
+class JsonDocument {
+public:
+  using Ref = uint32_t;
+  static constexpr Ref root = 0;
+  static constexpr Ref none = ~Ref{0};
+
+  enum class Kind : uint8_t { INVALID, OBJECT, ARRAY, STRING, NUMBER, TRUE,
+                              FALSE, NULL_VALUE };
+
+  explicit JsonDocument(const Scan::Kernels &kernels = Scan::best_kernels())
+      : m_kernels(&kernels) {}
+
+public:
+  // Builds the structural index of `text`. Returns false, leaving the
+  // document empty, if the text is blank, brackets do not balance, a string
+  // is not terminated, the root is not a value or something follows it.
+  // Storage is reused between calls.
+  bool index(const std::string_view text) {
+    m_text = text;
+    m_count = 0;
+    m_decoded.clear();
+    m_valid = text.size() < none - 64 && build() && link() &&
+              start(root) < text.size() && after(root) == m_count + 1 &&
+              blank_from(m_count ? m_index[m_count] + 1 : text.size());
+    double number;
+    m_valid = m_valid && kind(root) != Kind::INVALID &&
+              (kind(root) != Kind::NUMBER || this->number(root, number));
+    if (!m_valid)
+      m_count = 0;
+    return m_valid;
+  }
+
+  bool valid() const { return m_valid; }
+  std::string_view text() const { return m_text; }
+  // Number of structural characters indexed.
+  size_t size() const { return m_count; }
+  // Byte offset of the index's slot `i`, 1-based.
+  uint32_t offset(const size_t i) const { return m_index[i]; }
+
+  Kind kind(const Ref r) const {
+    if (!m_valid || r == none)
+      return Kind::INVALID;
+    const auto s = start(r);
+    switch (s < m_text.size() ? m_text[s] : '\0') {
+    case '{':
+      return Kind::OBJECT;
+    case '[':
+      return Kind::ARRAY;
+    case '"':
+      return Kind::STRING;
+    case 't':
+      return word(r, s, "true") ? Kind::TRUE : Kind::INVALID;
+    case 'f':
+      return word(r, s, "false") ? Kind::FALSE : Kind::INVALID;
+    case 'n':
+      return word(r, s, "null") ? Kind::NULL_VALUE : Kind::INVALID;
+    case '-':
+    case '0' ... '9':
+      return Kind::NUMBER;
+    default:
+      return Kind::INVALID;
+    }
+  }
+
+  // The member `key` of the object `r`, or `none`. The first of duplicate
+  // keys wins.
+  Ref find(const Ref r, const std::string_view key) const {
+    if (kind(r) != Kind::OBJECT)
+      return none;
+    const Ref open = r + 1, end = m_jump[open];
+    for (Ref k = open + 1; k + 2 < end;) {
+      if (char_at(k) != '"' || char_at(k + 2) != ':')
+        return none;
+      if (string_at(k) == key)
+        return k + 2;
+      const Ref next = after(k + 2);
+      if (next >= end || char_at(next) != ',')
+        return none;
+      k = next + 1;
+    }
+    return none;
+  }
+
+  // Element `n` of the array `r`, or `none`.
+  Ref at(const Ref r, const size_t n) const {
+    if (kind(r) != Kind::ARRAY)
+      return none;
+    const Ref end = m_jump[r + 1];
+    Ref e = r + 1;
+    if (start(e) == m_index[end])
+      return none;
+    for (size_t i = 0; i < n; ++i) {
+      e = after(e);
+      if (e >= end || char_at(e) != ',')
+        return none;
+    }
+    return e;
+  }
+
+  // The text of the string `r`, unescaped.
+  std::string_view string(const Ref r) const {
+    return kind(r) == Kind::STRING ? string_at(r + 1) : std::string_view{};
+  }
+
+  // The JSON text of `r` as it appears in the document.
+  std::string_view raw(const Ref r) const {
+    if (kind(r) == Kind::INVALID)
+      return {};
+    const auto s = start(r);
+    switch (m_text[s]) {
+    case '{':
+    case '[':
+    case '"':
+      return m_text.substr(s, m_index[after(r) - 1] + 1 - s);
+    default:
+      return scalar(r, s);
+    }
+  }
+
+  // A number that is written as an integer and fits in 64 bits.
+  bool integer(const Ref r, int64_t &out) const {
+    auto const t = raw(r);
+    auto const res = std::from_chars(t.data(), t.data() + t.size(), out);
+    return kind(r) == Kind::NUMBER && res.ec == std::errc() &&
+           res.ptr == t.data() + t.size();
+  }
+
+  bool number(const Ref r, double &out) const {
+    auto const t = raw(r);
+    auto const res = std::from_chars(t.data(), t.data() + t.size(), out);
+    return kind(r) == Kind::NUMBER && res.ec == std::errc() &&
+           res.ptr == t.data() + t.size();
+  }
+
+private:
+  static bool is_blank(const char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+  }
+
+  char char_at(const Ref slot) const { return m_text[m_index[slot]]; }
+
+  // True if nothing but blanks follows byte `from`. The structural index
+  // does not see text after the root's last bracket or quote; a scalar
+  // root is checked when it is read.
+  bool blank_from(size_t from) const {
+    while (from < m_text.size() && is_blank(m_text[from]))
+      ++from;
+    return from == m_text.size();
+  }
+
+  // A number or literal starting at byte `s`: the text up to the next
+  // structural character or the end, without trailing blanks.
+  std::string_view scalar(const Ref r, const size_t s) const {
+    size_t end = r + 1 <= m_count ? m_index[r + 1] : m_text.size();
+    while (end > s && is_blank(m_text[end - 1]))
+      --end;
+    return m_text.substr(s, end - s);
+  }
+
+  bool word(const Ref r, const size_t s, const std::string_view w) const {
+    return scalar(r, s) == w;
+  }
+
+  // Byte offset of the first character of the value `r`.
+  size_t start(const Ref r) const {
+    size_t s = r == root ? 0 : m_index[r] + 1;
+    while (s < m_text.size() && is_blank(m_text[s]))
+      ++s;
+    return s;
+  }
+
+  // The slot just past the value `r`: the ',' or closing bracket after it,
+  // or m_count + 1 at the end of the text.
+  Ref after(const Ref r) const {
+    const auto s = start(r);
+    switch (s < m_text.size() ? m_text[s] : '\0') {
+    case '{':
+    case '[':
+      return r + 1 <= m_count && m_index[r + 1] == s ? m_jump[r + 1] + 1
+                                                     : r + 1;
+    case '"':
+      return r + 3;
+    default:
+      return r + 1;
+    }
+  }
+
+  // The string whose opening quote is at `slot`.
+  std::string_view string_at(const Ref slot) const {
+    const size_t begin = m_index[slot] + 1;
+    auto const body = m_text.substr(begin, m_index[slot + 1] - begin);
+    if (std::memchr(body.data(), '\\', body.size()) == nullptr)
+      return body;
+    return decode(body);
+  }
+
+  std::string_view decode(const std::string_view body) const {
+    auto &out = m_decoded.emplace_back();
+    out.reserve(body.size());
+    for (size_t i = 0; i < body.size(); ++i) {
+      if (body[i] != '\\' || i + 1 == body.size()) {
+        out += body[i];
+        continue;
+      }
+      switch (const char c = body[++i]) {
+      case 'b':
+        out += '\b';
+        break;
+      case 'f':
+        out += '\f';
+        break;
+      case 'n':
+        out += '\n';
+        break;
+      case 'r':
+        out += '\r';
+        break;
+      case 't':
+        out += '\t';
+        break;
+      case 'u': {
+        uint32_t cp = 0;
+        if (!hex4(body, i + 1, cp)) {
+          out += "\\u";
+          break;
+        }
+        i += 4;
+        // A high surrogate followed by an escaped low one is one character.
+        uint32_t low = 0;
+        if (cp >= 0xD800 && cp < 0xDC00 && i + 2 < body.size() &&
+            body[i + 1] == '\\' && body[i + 2] == 'u' &&
+            hex4(body, i + 3, low) && low >= 0xDC00 && low < 0xE000) {
+          cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+          i += 6;
+        }
+        utf8(out, cp);
+        break;
+      }
+      default: // '"', '\\', '/' and anything not a valid escape
+        out += c;
+        break;
+      }
+    }
+    return out;
+  }
+
+  static bool hex4(const std::string_view s, const size_t at, uint32_t &out) {
+    if (at + 4 > s.size())
+      return false;
+    auto const r = std::from_chars(s.data() + at, s.data() + at + 4, out, 16);
+    return r.ec == std::errc() && r.ptr == s.data() + at + 4;
+  }
+
+  static void utf8(std::string &out, const uint32_t cp) {
+    if (cp < 0x80)
+      out += static_cast<char>(cp);
+    else if (cp < 0x800) {
+      out += static_cast<char>(0xC0 | (cp >> 6));
+      out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+      out += static_cast<char>(0xE0 | (cp >> 12));
+      out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+      out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else {
+      out += static_cast<char>(0xF0 | (cp >> 18));
+      out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+      out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+      out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+  }
+
+  // Bits of `backslash` escape the byte after them unless escaped
+  // themselves. Backslashes are rare outside of escape-heavy strings, so
+  // they are walked one at a time; `carry` is set when the block's last
+  // byte escapes the next block's first.
+  static uint64_t escaped(uint64_t backslash, bool &carry) {
+    uint64_t out = carry ? 1 : 0;
+    carry = false;
+    backslash &= ~out;
+    while (backslash) {
+      const uint64_t bit = backslash & -backslash;
+      backslash ^= bit;
+      if (bit >> 63)
+        carry = true;
+      else {
+        out |= bit << 1;
+        backslash &= ~(bit << 1);
+      }
+    }
+    return out;
+  }
+
+  static uint64_t prefix_xor(uint64_t x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+  }
+
+  // Stage one: the structural characters' offsets into m_index[1..].
+  bool build() {
+    // Every byte may be structural; the arrays only ever grow.
+    if (m_index.size() < m_text.size() + 2) {
+      m_index.resize(m_text.size() + 2);
+      m_jump.resize(m_text.size() + 2);
+    }
+    uint32_t *out = m_index.data() + 1;
+    uint64_t inside = 0; // all ones while a string is open
+    bool carry = false;
+    char tail[64];
+    for (size_t base = 0; base < m_text.size(); base += 64) {
+      const char *block = m_text.data() + base;
+      if (m_text.size() - base < 64) {
+        std::memset(tail, ' ', sizeof tail);
+        std::memcpy(tail, block, m_text.size() - base);
+        block = tail;
+      }
+      Scan::JsonBlock b;
+      m_kernels->json_block(block, b);
+      uint64_t quotes = b.quote;
+      if (b.backslash | carry)
+        quotes &= ~escaped(b.backslash, carry);
+      const uint64_t strings = prefix_xor(quotes) ^ inside;
+      inside = static_cast<uint64_t>(static_cast<int64_t>(strings) >> 63);
+      for (uint64_t bits = (b.structural & ~strings) | quotes; bits;
+           bits &= bits - 1)
+        *out++ = static_cast<uint32_t>(base + __builtin_ctzll(bits));
+    }
+    m_count = static_cast<size_t>(out - (m_index.data() + 1));
+    return inside == 0;
+  }
+
+  // Stage one, continued: pairs each bracket with its closing one.
+  bool link() {
+    m_open.clear();
+    for (Ref i = 1; i <= m_count; ++i) {
+      const char c = char_at(i);
+      if (c == '{' || c == '[')
+        m_open.push_back(i);
+      else if (c == '}' || c == ']') {
+        if (m_open.empty() || char_at(m_open.back()) != (c == '}' ? '{' : '['))
+          return false;
+        m_jump[m_open.back()] = i;
+        m_open.pop_back();
+      }
+    }
+    return m_open.empty();
+  }
+
+  std::string_view m_text;
+  const Scan::Kernels *m_kernels;
+  std::vector<uint32_t> m_index; // slot 0 is unused: it stands before root
+  std::vector<Ref> m_jump;       // opening bracket slot -> closing slot
+  std::vector<Ref> m_open;
+  size_t m_count = 0;
+  bool m_valid = false;
+  mutable std::deque<std::string> m_decoded;
+};
+
+} // namespace ServerLang
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "types.h"
+
+namespace ServerLang {
+
+enum class Keyword : uint8_t { NONE, VAR, CONST, DEF, RETURN, FOR, WHILE, IF };
+
+namespace Lexicon {
+
+struct Entry {
+  std::string_view word;
+  Keyword keyword = Keyword::NONE;
+  Type type = Type::UNDEFINED;
+};
+
+inline constexpr Entry reserved_words[] = {
+    {"var", Keyword::VAR},
+    {"const", Keyword::CONST},
+    {"def", Keyword::DEF},
+    {"return", Keyword::RETURN},
+    {"for", Keyword::FOR},
+    {"while", Keyword::WHILE},
+    {"if", Keyword::IF},
+    {"I16", Keyword::NONE, Type::I16},
+    {"I32", Keyword::NONE, Type::I32},
+    {"I64", Keyword::NONE, Type::I64},
+    {"U8", Keyword::NONE, Type::U8},
+    {"U16", Keyword::NONE, Type::U16},
+    {"F32", Keyword::NONE, Type::F32},
+    {"F64", Keyword::NONE, Type::F64},
+    {"Bool", Keyword::NONE, Type::BOOL},
+    {"Complex", Keyword::NONE, Type::COMPLEX},
+    {"String", Keyword::NONE, Type::STRING},
+    {"Variant", Keyword::NONE, Type::VARIANT},
+    {"Void", Keyword::NONE, Type::VOID},
+    {"Array", Keyword::NONE, Type::ARRAY},
+    {"Class", Keyword::NONE, Type::CLASS},
+    {"Struct", Keyword::NONE, Type::STRUCT},
+    {"Json", Keyword::NONE, Type::JSON},
+    {"Route", Keyword::NONE, Type::ROUTE},
+};
+
+inline constexpr size_t table_size = 64;
+
+// Length, first and last character are enough to tell every reserved word
+// apart. Adding a word that collides fails to compile in build_table().
+constexpr size_t hash(const std::string_view word) {
+  return (word.size() + static_cast<unsigned char>(word.front()) +
+          9u * static_cast<unsigned char>(word.back())) &
+         (table_size - 1);
+}
+
+constexpr std::array<Entry, table_size> build_table() {
+  std::array<Entry, table_size> table{};
+  for (auto const &e : reserved_words) {
+    auto &slot = table[hash(e.word)];
+    if (!slot.word.empty())
+      throw "reserved word hash collision";
+    slot = e;
+  }
+  return table;
+}
+
+inline constexpr std::array<Entry, table_size> table = build_table();
+
+// Returns an empty entry (no keyword, UNDEFINED type) for other words.
+constexpr Entry find(const std::string_view word) {
+  if (word.empty())
+    return {};
+  auto const &e = table[hash(word)];
+  return e.word == word ? e : Entry{};
+}
+
+} // namespace Lexicon
+
+constexpr Keyword lookup_keyword(const std::string_view word) {
+  return Lexicon::find(word).keyword;
+}
+
+constexpr Type lookup_type(const std::string_view word) {
+  return Lexicon::find(word).type;
+}
+
+static_assert(lookup_keyword("const") == Keyword::CONST);
+static_assert(lookup_keyword("constant") == Keyword::NONE);
+static_assert(lookup_type("Route") == Type::ROUTE);
+static_assert(lookup_type("Float") == Type::UNDEFINED);
+
+} // namespace ServerLang
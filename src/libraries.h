@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+#include "json.h"
+#include "native.h"
+
+namespace ServerLang {
+
+// The natives that ship with the interpreter. `@lib["Core"]` brings in the
+// Core:: functions and `@lib["Json"]` the Core::Json:: ones.
+namespace Core {
+
+inline std::string to_text(const Value &v) { return v.to_string(); }
+
+// Println output. Each thread collects its lines in its own buffer, which
+// is written out with one call once it passes `flush_at`, on
+// flush_output(), and when the thread exits; lines from different threads
+// never interleave mid-line.
+class Output {
+public:
+  static constexpr size_t flush_at = 16 * 1024;
+
+  static Output &local() {
+    thread_local Output out;
+    return out;
+  }
+  ~Output() { flush(); }
+
+  std::string &buffer() { return m_buffer; }
+
+  void line_done() {
+    if (m_buffer.size() >= flush_at)
+      flush();
+  }
+
+  void flush() {
+    if (m_buffer.empty())
+      return;
+    fwrite(m_buffer.data(), 1, m_buffer.size(), sink().load());
+    fflush(sink().load());
+    m_buffer.clear();
+  }
+
+  // Where every thread's output goes; stdout unless redirected.
+  static std::atomic<FILE *> &sink() {
+    static std::atomic<FILE *> file{stdout};
+    return file;
+  }
+
+private:
+  Output() { m_buffer.reserve(flush_at * 2); }
+
+  std::string m_buffer;
+};
+
+// Writes out what the calling thread has printed so far.
+inline void flush_output() { Output::local().flush(); }
+
+// Println(format, args...) prints `format` with each `%{n}` replaced by the
+// text of args[n], rendering straight into the thread's output buffer.
+inline void println(const FormatArg format, const NativeArgs args) {
+  auto &out = Output::local();
+  format.render(out.buffer(), args);
+  out.buffer() += '\n';
+  out.line_done();
+}
+
+// Format(format, args...) is Println's text without the newline.
+inline std::string format(const FormatArg format, const NativeArgs args) {
+  std::string out;
+  format.render(out, args);
+  return out;
+}
+
+inline int64_t length(const std::string_view s) {
+  return static_cast<int64_t>(s.size());
+}
+
+// JSON text of `v`, written into a per-thread buffer that keeps its
+// capacity between calls; the caller copies the text out.
+inline std::string_view stringify(const Value &v) {
+  thread_local std::string buffer;
+  buffer.clear();
+  JsonWriter w(buffer);
+  write_json(w, v);
+  w.finish();
+  return buffer;
+}
+
+} // namespace Core
+
+// The registry of every library above, built on first use.
+inline const NativeRegistry &builtin_libraries() {
+  static const NativeRegistry registry = [] {
+    NativeRegistry r;
+    r.library("Core")
+        .def<&Core::println>("Core::Println")
+        .def<&Core::format>("Core::Format")
+        .def<&Core::length>("Core::Length")
+        .def<&Core::to_text>("Core::ToString");
+    r.library("Json").def<&Core::stringify>("Core::Json::Stringify");
+    return r;
+  }();
+  return registry;
+}
+
+} // namespace ServerLang
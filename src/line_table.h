@@ -0,0 +1,72 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include "scan.h"
+
+namespace ServerLang {
+
+// 1-based line and column of a byte in a source text. Columns count bytes.
+// Line 0 means the position is not known.
+struct SourcePosition {
+  uint32_t line = 0;
+  uint32_t column = 0;
+};
+
+// Maps byte offsets in a source text to lines and columns. Tokens only
+// record their offset; the table of line starts is built the first time a
+// position is asked for, with the newline count kernel sizing it before a
+// memchr pass fills it, and each lookup is then a binary search. A source
+// nobody asks about costs nothing.
+class LineTable {
+public:
+  explicit LineTable(const std::string_view source = {},
+                     const Scan::Kernels &kernels = Scan::best_kernels())
+      : m_source(source), m_kernels(&kernels) {}
+
+public:
+  std::string_view source() const { return m_source; }
+
+  // Position of the byte at `offset`; the end of the source is a valid
+  // position. Unknown if there is no source or the offset is past its end.
+  SourcePosition position(const size_t offset) {
+    if (!m_source.data() || offset > m_source.size())
+      return {};
+    if (m_starts.empty())
+      build();
+    auto const next =
+        std::upper_bound(m_starts.begin(), m_starts.end(), offset);
+    const auto line = static_cast<size_t>(next - m_starts.begin());
+    return {static_cast<uint32_t>(line),
+            static_cast<uint32_t>(offset - m_starts[line - 1] + 1)};
+  }
+
+  // Number of lines, counting a last one without a line break.
+  size_t lines() {
+    if (m_starts.empty())
+      build();
+    return m_starts.size();
+  }
+
+private:
+  void build() {
+    const char *const begin = m_source.data();
+    const char *const end = begin + m_source.size();
+    m_starts.reserve(m_kernels->count_newlines(begin, end) + 1);
+    m_starts.push_back(0);
+    for (const char *p = begin;
+         p && (p = static_cast<const char *>(
+              std::memchr(p, '\n', static_cast<size_t>(end - p))));)
+      m_starts.push_back(static_cast<uint32_t>(++p - begin));
+  }
+
+  std::string_view m_source;
+  const Scan::Kernels *m_kernels;
+  std::vector<uint32_t> m_starts; // offset of the first byte of each line
+};
+
+} // namespace ServerLang
@@ -0,0 +1,293 @@
+#pragma once
+
+#include <atomic>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "ast.h"
+#include "hash.h"
+#include "source_file.h"
+#include "syntax_analyzer.h"
+#include "thread_pool.h"
+#include "tokenizer.h"
+
+namespace ServerLang {
+
+// Empty if the file does not exist.
+inline std::string canonical_path(const std::string &path) {
+  char buf[PATH_MAX];
+  return ::realpath(path.c_str(), buf) ? std::string{buf} : std::string{};
+}
+
+// A @script name is relative to the directory of the script importing it.
+inline std::string import_path(const std::string &importer,
+                               const std::string_view name) {
+  if (!name.empty() && name.front() == '/')
+    return std::string{name};
+  const auto slash = importer.rfind('/');
+  auto dir = slash == std::string::npos ? std::string{"."}
+                                        : importer.substr(0, slash);
+  return dir + '/' + std::string{name};
+}
+
+// Canonical paths of the scripts among `imports` (any range of Import).
+// Imports that cannot be found are reported and left out.
+template <typename Imports>
+std::vector<std::string> script_dependencies(const std::string &importer,
+                                             const Imports &imports) {
+  std::vector<std::string> deps;
+  for (auto const &imp : imports) {
+    if (imp.kind != Import::Kind::SCRIPT)
+      continue;
+    auto path = canonical_path(import_path(importer, imp.name));
+    if (path.empty())
+      fprintf(stderr, "Could not resolve @script[\"%s\"] imported by %s \n",
+              imp.name, importer.c_str());
+    else
+      deps.push_back(std::move(path));
+  }
+  return deps;
+}
+
+// One parsed script; immutable once the cache has published it.
+struct Module {
+  std::string path; // canonical
+  uint64_t hash = 0;
+  ParseResult result;
+  std::vector<std::string> dependencies;
+};
+
+using module_ptr = std::shared_ptr<const Module>;
+
+// Process-wide parse cache keyed by canonical path and content hash. Each
+// version of a file is parsed exactly once, however many importers ask for it
+// and from however many threads; later callers wait for the first parse.
+class ModuleCache {
+public:
+  // `path` must be canonical. Returns nullptr if the file cannot be read.
+  module_ptr load(const std::string &path) {
+    SourceFile file;
+    if (!file.open(path.c_str())) {
+      fprintf(stderr, "Could not open the imported file: %s \n",
+              path.c_str());
+      return nullptr;
+    }
+    const uint64_t hash = fnv1a(file.data());
+
+    std::promise<module_ptr> promise;
+    std::shared_future<module_ptr> existing;
+    uint64_t serial = 0;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      auto &entry = m_entries[path];
+      if (entry.future.valid() && entry.hash == hash) {
+        existing = entry.future;
+      } else {
+        entry.hash = hash;
+        entry.future = promise.get_future().share();
+        entry.serial = serial = ++m_serial;
+      }
+    }
+    if (existing.valid())
+      return existing.get();
+
+    // Callers already waiting on this parse get its exception; the entry is
+    // dropped so that the next load tries again.
+    try {
+      auto mod = std::make_shared<Module>();
+      mod->path = path;
+      mod->hash = hash;
+      TokenStream tokens(file.data());
+      SyntaxAnalyzer analyzer;
+      mod->result = analyzer.analyze(tokens);
+      mod->dependencies = script_dependencies(path, mod->result.imports());
+      ++m_parses;
+
+      promise.set_value(mod);
+      return mod;
+    } catch (...) {
+      promise.set_exception(std::current_exception());
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto const it = m_entries.find(path);
+        if (it != m_entries.end() && it->second.serial == serial)
+          m_entries.erase(it);
+      }
+      throw;
+    }
+  }
+
+  size_t parses() const { return m_parses; }
+
+private:
+  struct Entry {
+    uint64_t hash = 0;
+    uint64_t serial = 0; // tells this parse from a later one of the path
+    std::shared_future<module_ptr> future;
+  };
+
+  std::mutex m_mutex;
+  uint64_t m_serial = 0;
+  std::unordered_map<std::string, Entry> m_entries;
+  std::atomic<size_t> m_parses{0};
+};
+
+struct ModuleGraph {
+  // Every reachable script, dependencies ahead of their importers. Import
+  // cycles are broken at the first repeated edge.
+  std::vector<module_ptr> order;
+  // Distinct @lib names in first-seen order.
+  std::vector<std::string> libraries;
+
+  // Changes whenever a module is added, dropped, reordered or edited.
+  uint64_t content_hash() const {
+    std::string ids;
+    for (auto const &mod : order) {
+      ids += mod->path;
+      ids += '\0';
+      ids.append(reinterpret_cast<const char *>(&mod->hash), sizeof mod->hash);
+    }
+    return fnv1a(ids);
+  }
+};
+
+// Walks @script imports breadth-first on a ThreadPool: a file's imports are
+// scheduled as soon as it has been parsed, so independent files are lexed and
+// parsed concurrently. Must not be called from one of the pool's workers.
+class ImportResolver {
+public:
+  ImportResolver(ModuleCache &cache, ThreadPool &pool)
+      : m_cache(cache), m_pool(pool) {}
+
+public:
+  // Loads `path` and everything it imports; the root module comes last.
+  ModuleGraph resolve(const std::string &path) {
+    const auto root_path = canonical_path(path);
+    const auto root = root_path.empty() ? nullptr : m_cache.load(root_path);
+    if (!root) {
+      fprintf(stderr, "Could not open the specified file: %s \n",
+              path.c_str());
+      return {};
+    }
+    return load_graph(root->dependencies, root_path, root);
+  }
+
+  // For a root the caller has already parsed (or mapped from a compiled
+  // image): loads only what `imports` names.
+  template <typename Imports>
+  ModuleGraph resolve_imports(const std::string &path,
+                              const Imports &imports) {
+    auto const root_path = canonical_path(path);
+    auto graph = load_graph(script_dependencies(root_path, imports),
+                            root_path, nullptr);
+    add_libraries(graph, imports);
+    return graph;
+  }
+
+private:
+  struct Walk {
+    std::mutex mutex;
+    std::condition_variable done;
+    size_t pending = 0;
+    std::unordered_set<std::string> seen;
+    std::unordered_map<std::string, module_ptr> loaded;
+  };
+
+  // Called with walk.mutex held. A parse that throws leaves its module out
+  // of the graph, like a file that cannot be read.
+  void schedule(Walk &walk, const std::string &path) {
+    if (!walk.seen.insert(path).second)
+      return;
+    ++walk.pending;
+    m_pool.submit([this, &walk, path] {
+      module_ptr mod;
+      try {
+        mod = m_cache.load(path);
+      } catch (const std::exception &e) {
+        fprintf(stderr, "Could not parse the imported file %s: %s \n",
+                path.c_str(), e.what());
+      } catch (...) {
+        fprintf(stderr, "Could not parse the imported file: %s \n",
+                path.c_str());
+      }
+      std::lock_guard<std::mutex> lock(walk.mutex);
+      walk.loaded[path] = mod;
+      if (mod)
+        for (auto const &dep : mod->dependencies)
+          schedule(walk, dep);
+      if (--walk.pending == 0)
+        walk.done.notify_all();
+    });
+  }
+
+  // The root is never scheduled, so an import cycle back to it does not
+  // parse it a second time.
+  ModuleGraph load_graph(const std::vector<std::string> &deps,
+                         const std::string &root_path, const module_ptr &root) {
+    Walk walk;
+    {
+      std::unique_lock<std::mutex> lock(walk.mutex);
+      walk.seen.insert(root_path);
+      for (auto const &dep : deps)
+        schedule(walk, dep);
+      walk.done.wait(lock, [&] { return walk.pending == 0; });
+    }
+
+    ModuleGraph graph;
+    std::unordered_set<std::string> visited;
+    if (root) {
+      walk.loaded[root_path] = root;
+      visit(walk, root_path, visited, graph);
+    } else {
+      visited.insert(root_path);
+      for (auto const &dep : deps)
+        visit(walk, dep, visited, graph);
+    }
+    for (auto const &mod : graph.order)
+      add_libraries(graph, mod->result.imports());
+    return graph;
+  }
+
+  void visit(Walk &walk, const std::string &path,
+             std::unordered_set<std::string> &visited, ModuleGraph &graph) {
+    if (!visited.insert(path).second)
+      return;
+    auto const &mod = walk.loaded[path];
+    if (!mod)
+      return;
+    for (auto const &dep : mod->dependencies)
+      visit(walk, dep, visited, graph);
+    graph.order.push_back(mod);
+  }
+
+  template <typename Imports>
+  static void add_libraries(ModuleGraph &graph, const Imports &imports) {
+    for (auto const &imp : imports) {
+      if (imp.kind != Import::Kind::LIBRARY)
+        continue;
+      bool known = false;
+      for (auto const &lib : graph.libraries)
+        known = known || lib == imp.name;
+      if (!known)
+        graph.libraries.emplace_back(imp.name);
+    }
+  }
+
+private:
+  ModuleCache &m_cache;
+  ThreadPool &m_pool;
+};
+
+} // namespace ServerLang
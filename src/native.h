@@ -0,0 +1,246 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "bytecode.h"
+#include "interner.h"
+#include "vm.h"
+
+namespace ServerLang {
+
+// The arguments of a variadic native past its fixed parameters. Declared as
+// a native's last parameter, it takes whatever the call site passes.
+struct NativeArgs {
+  const Value *data = nullptr;
+  size_t size = 0;
+
+  const Value &operator[](const size_t i) const { return data[i]; }
+  const Value *begin() const { return data; }
+  const Value *end() const { return data + size; }
+};
+
+// Conversions between Values and the C++ types natives are declared with.
+// from() rejects a Value of the wrong kind; to() may keep a string alive on
+// the Machine.
+template <typename T> struct Marshal;
+
+template <> struct Marshal<Value> {
+  static constexpr const char *kind = "a value";
+  static bool from(const Value &v, Value &out) {
+    out = v;
+    return true;
+  }
+  static Value to(Machine &, const Value &v) { return v; }
+};
+
+template <> struct Marshal<int64_t> {
+  static constexpr const char *kind = "an integer";
+  static bool from(const Value &v, int64_t &out) {
+    out = v.i;
+    return v.kind == Value::Kind::INT;
+  }
+  static Value to(Machine &, const int64_t v) { return Value::integer(v); }
+};
+
+template <> struct Marshal<double> {
+  static constexpr const char *kind = "a number";
+  static bool from(const Value &v, double &out) {
+    out = v.kind == Value::Kind::INT ? static_cast<double>(v.i) : v.f;
+    return v.kind == Value::Kind::INT || v.kind == Value::Kind::FLOAT;
+  }
+  static Value to(Machine &, const double v) { return Value::number(v); }
+};
+
+template <> struct Marshal<bool> {
+  static constexpr const char *kind = "a boolean";
+  static bool from(const Value &v, bool &out) {
+    out = v.b;
+    return v.kind == Value::Kind::BOOL;
+  }
+  static Value to(Machine &, const bool v) { return Value::boolean(v); }
+};
+
+template <> struct Marshal<std::string_view> {
+  static constexpr const char *kind = "a string";
+  static bool from(const Value &v, std::string_view &out) {
+    return v.text(out);
+  }
+  static Value to(Machine &vm, const std::string_view v) {
+    return Value::string(vm.keep(std::string(v)));
+  }
+};
+
+template <> struct Marshal<std::string> {
+  static constexpr const char *kind = "a string";
+  static Value to(Machine &vm, std::string v) {
+    return Value::string(vm.keep(std::move(v)));
+  }
+};
+
+// A format string parameter. Literals arrive precompiled; any other value
+// is compiled from its text on each call into a per-thread template that
+// reuses its storage.
+struct FormatArg {
+  const FormatTemplate *t = nullptr;
+
+  void render(std::string &out, const NativeArgs args) const {
+    t->render(out, args.data, args.size);
+  }
+};
+
+template <> struct Marshal<FormatArg> {
+  static constexpr const char *kind = "a format string";
+  static bool from(const Value &v, FormatArg &out) {
+    if (v.kind == Value::Kind::FORMAT) {
+      out.t = v.t;
+      return true;
+    }
+    thread_local FormatTemplate scratch;
+    std::string_view text;
+    if (v.text(text))
+      scratch.compile(text);
+    else
+      scratch.compile(v.to_string());
+    out.t = &scratch;
+    return true;
+  }
+};
+
+template <typename F> struct NativeSignature;
+template <typename R, typename... A> struct NativeSignature<R (*)(A...)> {
+  using Result = std::decay_t<R>;
+  using Args = std::tuple<std::decay_t<A>...>;
+  static constexpr size_t count = sizeof...(A);
+  static constexpr bool variadic =
+      count > 0 &&
+      std::is_same_v<std::tuple_element_t<count - 1, Args>, NativeArgs>;
+  static constexpr size_t fixed = count - variadic;
+  static constexpr bool formats =
+      count > 0 && std::is_same_v<std::tuple_element_t<0, Args>, FormatArg>;
+};
+
+// The marshalling stub of `F`, instantiated for its exact signature: each
+// argument is checked and converted inline, then F is called directly.
+template <auto F>
+Value native_stub(Machine &vm, const Value *args, const uint16_t argc) {
+  using Sig = NativeSignature<decltype(F)>;
+  typename Sig::Args unpacked;
+  auto const convert = [&](auto &out, const size_t i) {
+    using T = std::decay_t<decltype(out)>;
+    if constexpr (std::is_same_v<T, NativeArgs>) {
+      out = {args + i, static_cast<size_t>(argc - i)};
+      return true;
+    } else {
+      if (Marshal<T>::from(args[i], out))
+        return true;
+      vm.raise("Argument " + std::to_string(i + 1) +
+               " of a native call must be " + Marshal<T>::kind);
+      return false;
+    }
+  };
+  const bool ok = std::apply(
+      [&](auto &...out) {
+        size_t i = 0;
+        return (convert(out, i++) && ...);
+      },
+      unpacked);
+  if (!ok)
+    return {};
+  if constexpr (std::is_void_v<typename Sig::Result>) {
+    std::apply(F, std::move(unpacked));
+    return {};
+  } else {
+    using R = Marshal<typename Sig::Result>;
+    return R::to(vm, std::apply(F, std::move(unpacked)));
+  }
+}
+
+// The table one `@lib["..."]` import brings into scope: natives keyed by
+// their qualified name.
+class NativeLibrary {
+public:
+  explicit NativeLibrary(std::string name) : m_name(std::move(name)) {}
+
+  const std::string &name() const { return m_name; }
+
+  // Exports `F` as `qualified`, e.g. "Core::Json::Stringify". Its arity and
+  // argument kinds come from its C++ signature.
+  template <auto F> NativeLibrary &def(const std::string_view qualified) {
+    using Sig = NativeSignature<decltype(F)>;
+    Native n;
+    n.name = intern(qualified);
+    n.fn = &native_stub<F>;
+    n.arity = static_cast<uint16_t>(Sig::fixed);
+    n.variadic = Sig::variadic;
+    n.formats = Sig::formats;
+    m_natives.insert_or_assign(n.name, n);
+    const auto root = qualified.substr(0, qualified.find("::"));
+    if (!exports_under(root))
+      m_roots.emplace_back(root);
+    return *this;
+  }
+
+  const Native *find(const Symbol qualified) const {
+    return m_natives.find(qualified);
+  }
+
+  // Whether some export's name starts with `root::`.
+  bool exports_under(const std::string_view root) const {
+    for (auto const &r : m_roots)
+      if (r == root)
+        return true;
+    return false;
+  }
+
+private:
+  std::string m_name;
+  SymbolMap<Native> m_natives;
+  std::vector<std::string> m_roots;
+};
+
+// Every library a script may import. Filled before any script is compiled
+// and only read afterwards.
+class NativeRegistry {
+public:
+  NativeLibrary &library(const std::string_view name) {
+    for (auto &lib : m_libraries)
+      if (lib.name() == name)
+        return lib;
+    return m_libraries.emplace_back(std::string(name));
+  }
+
+  const NativeLibrary *find(const std::string_view name) const {
+    for (auto const &lib : m_libraries)
+      if (lib.name() == name)
+        return &lib;
+    return nullptr;
+  }
+
+  // The library exporting `qualified`, imported or not.
+  const NativeLibrary *exporter(const Symbol qualified) const {
+    for (auto const &lib : m_libraries)
+      if (lib.find(qualified))
+        return &lib;
+    return nullptr;
+  }
+
+  bool exports_under(const std::string_view root) const {
+    for (auto const &lib : m_libraries)
+      if (lib.exports_under(root))
+        return true;
+    return false;
+  }
+
+private:
+  // Libraries never move, so compilers can hold on to them.
+  std::deque<NativeLibrary> m_libraries;
+};
+
+} // namespace ServerLang
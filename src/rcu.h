@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace ServerLang {
+
+// Read-copy-update cell holding one immutable version of a T.
+//
+// Readers never block and never write shared cache lines: each Reader owns a
+// slot, and pinning the current version is a store to that slot followed by
+// one load of the pointer. publish() swaps the pointer and then waits for
+// every reader still pinning an older version before deleting it, so a
+// request that started on the old version finishes on it.
+//
+// A Reader belongs to one thread; publish() may be called from any thread.
+template <typename T> class RcuCell {
+  struct alignas(64) Slot {
+    // Epoch the reader entered at, or 0 outside a read-side section.
+    std::atomic<uint64_t> epoch{0};
+    bool in_use = false;
+  };
+
+public:
+  explicit RcuCell(std::unique_ptr<const T> initial = nullptr)
+      : m_current(initial.release()) {}
+  ~RcuCell() { delete m_current.load(); }
+  RcuCell(const RcuCell &) = delete;
+  RcuCell &operator=(const RcuCell &) = delete;
+
+  class Reader {
+  public:
+    explicit Reader(RcuCell &cell) : m_cell(cell), m_slot(cell.attach()) {}
+    ~Reader() { m_cell.detach(m_slot); }
+    Reader(const Reader &) = delete;
+    Reader &operator=(const Reader &) = delete;
+
+    // The current version, valid until unlock(). Sections do not nest.
+    const T *lock() {
+      m_slot->epoch.store(m_cell.m_epoch.load());
+      return m_cell.m_current.load();
+    }
+    void unlock() { m_slot->epoch.store(0, std::memory_order_release); }
+
+  private:
+    RcuCell &m_cell;
+    Slot *m_slot;
+  };
+
+  // Pins the current version for the lifetime of the guard.
+  class Guard {
+  public:
+    explicit Guard(Reader &reader) : m_reader(reader), m_value(reader.lock()) {}
+    ~Guard() { m_reader.unlock(); }
+    Guard(const Guard &) = delete;
+    Guard &operator=(const Guard &) = delete;
+
+    const T *get() const { return m_value; }
+    const T *operator->() const { return m_value; }
+    explicit operator bool() const { return m_value != nullptr; }
+
+  private:
+    Reader &m_reader;
+    const T *m_value;
+  };
+
+  // Makes `next` the current version. Returns once no reader can still see
+  // the previous one, which has then been deleted.
+  void publish(std::unique_ptr<const T> next) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const T *old = m_current.exchange(next.release());
+    const uint64_t epoch = m_epoch.fetch_add(1) + 1;
+    for (auto &slot : m_slots) {
+      // A reader that entered before the exchange holds an older epoch.
+      for (uint64_t e; (e = slot.epoch.load()) != 0 && e < epoch;)
+        std::this_thread::yield();
+    }
+    delete old;
+  }
+
+  // The current version without pinning it; only safe on the thread that
+  // publishes.
+  const T *unsafe_get() const { return m_current.load(); }
+
+private:
+  Slot *attach() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto &slot : m_slots)
+      if (!slot.in_use) {
+        slot.in_use = true;
+        return &slot;
+      }
+    auto &slot = m_slots.emplace_back();
+    slot.in_use = true;
+    return &slot;
+  }
+
+  void detach(Slot *slot) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    slot->epoch.store(0);
+    slot->in_use = false;
+  }
+
+private:
+  std::atomic<const T *> m_current;
+  std::atomic<uint64_t> m_epoch{1};
+  // Slots never move once handed out; a deque keeps them in place.
+  std::deque<Slot> m_slots;
+  std::mutex m_mutex;
+};
+
+} // namespace ServerLang
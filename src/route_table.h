@@ -0,0 +1,159 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace ServerLang {
+
+// Immutable byte-wise radix tree over route patterns, stored in flat arrays.
+//
+// A pattern is either literal ("/home/test") or ends in a "/*" wildcard
+// ("/api/*"), which matches every path under that prefix, including the bare
+// "/api/". Lookup walks the path once, so it is O(path length) and does not
+// allocate. Precedence is most-specific-wins: an exact literal beats any
+// wildcard, and a longer wildcard prefix beats a shorter one. A '*' anywhere
+// but the last segment is matched literally.
+class RouteTable {
+public:
+  static constexpr int32_t no_route = -1;
+
+  RouteTable() = default;
+
+  // Later duplicates of a pattern replace earlier ones.
+  explicit RouteTable(
+      const std::vector<std::pair<std::string, int32_t>> &routes) {
+    std::vector<Key> keys;
+    keys.reserve(routes.size());
+    for (auto const &[pattern, value] : routes) {
+      const bool wildcard =
+          pattern.size() >= 2 &&
+          pattern.compare(pattern.size() - 2, 2, "/*") == 0;
+      keys.push_back({wildcard ? pattern.substr(0, pattern.size() - 1)
+                               : pattern,
+                      wildcard ? no_route : value,
+                      wildcard ? value : no_route});
+    }
+    std::stable_sort(keys.begin(), keys.end(),
+                     [](const Key &a, const Key &b) { return a.key < b.key; });
+
+    // Merge the exact and wildcard routes that share a key.
+    std::vector<Key> merged;
+    for (auto &k : keys) {
+      if (merged.empty() || merged.back().key != k.key) {
+        merged.push_back(std::move(k));
+        continue;
+      }
+      if (k.exact != no_route)
+        merged.back().exact = k.exact;
+      if (k.wildcard != no_route)
+        merged.back().wildcard = k.wildcard;
+    }
+
+    if (!merged.empty()) {
+      m_nodes.emplace_back();
+      build(merged, 0, merged.size(), 0, 0);
+    }
+  }
+
+public:
+  // Value of the most specific route matching `path`, or no_route.
+  int32_t lookup(const std::string_view path) const {
+    if (m_nodes.empty())
+      return no_route;
+    int32_t best = no_route;
+    uint32_t node = 0;
+    size_t pos = 0;
+    for (;;) {
+      auto const &n = m_nodes[node];
+      if (path.size() - pos < n.label_len ||
+          path.compare(pos, n.label_len, m_labels.data() + n.label,
+                       n.label_len) != 0)
+        return best;
+      pos += n.label_len;
+      if (n.wildcard != no_route)
+        best = n.wildcard;
+      if (pos == path.size())
+        return n.exact != no_route ? n.exact : best;
+
+      const auto c = static_cast<unsigned char>(path[pos]);
+      auto const *first = m_first_bytes.data() + n.first_child;
+      auto const *last = first + n.child_count;
+      auto const *it = std::lower_bound(first, last, c);
+      if (it == last || *it != c)
+        return best;
+      node = n.first_child + static_cast<uint32_t>(it - first);
+    }
+  }
+
+  size_t node_count() const { return m_nodes.size(); }
+  bool empty() const { return m_nodes.empty(); }
+
+private:
+  struct Key {
+    std::string key;
+    int32_t exact;
+    int32_t wildcard;
+  };
+
+  struct Node {
+    uint32_t label = 0; // offset into m_labels
+    uint32_t label_len = 0;
+    uint32_t first_child = 0; // index into m_nodes and m_first_bytes
+    uint32_t child_count = 0;
+    int32_t exact = no_route;
+    int32_t wildcard = no_route;
+  };
+
+  // Fills m_nodes[index] from keys [lo, hi), which share their first `depth`
+  // bytes. The children of a node are allocated as one contiguous run, with
+  // their first label bytes mirrored in m_first_bytes for the lookup.
+  void build(const std::vector<Key> &keys, size_t lo, const size_t hi,
+             const size_t depth, const uint32_t index) {
+    auto const &a = keys[lo].key, &b = keys[hi - 1].key;
+    size_t lcp = depth;
+    while (lcp < a.size() && lcp < b.size() && a[lcp] == b[lcp])
+      ++lcp;
+
+    Node n;
+    n.label = static_cast<uint32_t>(m_labels.size());
+    n.label_len = static_cast<uint32_t>(lcp - depth);
+    m_labels.append(a, depth, lcp - depth);
+    if (a.size() == lcp) {
+      n.exact = keys[lo].exact;
+      n.wildcard = keys[lo].wildcard;
+      ++lo;
+    }
+
+    std::vector<std::pair<size_t, size_t>> groups;
+    for (size_t i = lo; i < hi;) {
+      size_t j = i + 1;
+      while (j < hi && keys[j].key[lcp] == keys[i].key[lcp])
+        ++j;
+      groups.emplace_back(i, j);
+      i = j;
+    }
+
+    n.first_child = static_cast<uint32_t>(m_nodes.size());
+    n.child_count = static_cast<uint32_t>(groups.size());
+    m_nodes.resize(m_nodes.size() + groups.size());
+    m_first_bytes.resize(m_nodes.size());
+    m_nodes[index] = n;
+    for (size_t g = 0; g < groups.size(); ++g) {
+      m_first_bytes[n.first_child + g] =
+          static_cast<unsigned char>(keys[groups[g].first].key[lcp]);
+      build(keys, groups[g].first, groups[g].second, lcp,
+            static_cast<uint32_t>(n.first_child + g));
+    }
+  }
+
+private:
+  std::vector<Node> m_nodes;
+  std::vector<unsigned char> m_first_bytes;
+  std::string m_labels;
+};
+
+} // namespace ServerLang
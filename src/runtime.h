@@ -0,0 +1,364 @@
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "ast.h"
+#include "bytecode.h"
+#include "compiled_image.h"
+#include "compiler.h"
+#include "flat_ast.h"
+#include "interner.h"
+#include "libraries.h"
+#include "route_table.h"
+#include "trace.h"
+#include "vm.h"
+
+class Runtime {
+public:
+  Runtime() = default;
+  ~Runtime() {}
+
+public:
+  // Declares the nodes, compiles their function and route bodies to
+  // bytecode and runs the module's top-level initializers.
+  // Native calls resolve against the libraries in `_imports`.
+  ServerLang::node_ptr
+  eval(const ServerLang::node_list &_nodes,
+       const ServerLang::ArenaList<ServerLang::Import> *_imports) {
+    compile(_nodes, _imports);
+    return {};
+  }
+
+  // A parsed module along with its @lib imports.
+  ServerLang::node_ptr eval(const ServerLang::ParseResult &_result) {
+    return eval(_result.nodes(), &_result.imports());
+  }
+
+  // As above, and reports what the module added to program(), from which
+  // CompiledImage::build writes its image.
+  void eval(const ServerLang::ParseResult &_result,
+            ServerLang::CompiledModule &_module) {
+    _module = compile(_result.nodes(), &_result.imports());
+  }
+
+  // Evaluates a module from its compiled image without materializing any
+  // nodes: declares its roots, links its bytecode into the program and runs
+  // its initializers. Returns false, leaving the runtime as it was, if the
+  // image calls a function or native that neither the modules evaluated so
+  // far nor its @lib imports provide, or a native whose arity has changed,
+  // or if the program has no room for its chunks, globals or natives; its
+  // source has to be compiled instead.
+  bool eval(const ServerLang::CompiledImage &_image) {
+    auto const &_h = _image.header();
+    std::vector<uint16_t> _externs;
+    for (uint32_t i = 0; i < _h.extern_count; ++i) {
+      _externs.push_back(
+          m_program.function(ServerLang::intern(_image.external(i))));
+      if (_externs.back() == ServerLang::Program::no_chunk)
+        return false;
+    }
+    std::vector<const ServerLang::Native *> _natives;
+    for (uint32_t i = 0; i < _h.native_count; ++i) {
+      _natives.push_back(find_native(_image, _image.native(i)));
+      if (!_natives.back())
+        return false;
+    }
+    for (uint32_t i = 0; i < _h.chunk_count; ++i) {
+      auto const &_c = _image.chunk(i);
+      for (auto const *_in = _image.code(_c); _in != _image.code(_c) + _c.size;
+           ++_in)
+        if (_in->op == ServerLang::Op::CALLN &&
+            (_in->c < _natives[_in->b]->arity ||
+             (!_natives[_in->b]->variadic && _in->c > _natives[_in->b]->arity)))
+          return false;
+    }
+    std::vector<ServerLang::Symbol> _globals;
+    for (uint32_t i = 0; i < _h.global_count; ++i)
+      _globals.push_back(ServerLang::intern(_image.global(i)));
+    if (!m_program.has_room(_h.chunk_count, _globals, _natives))
+      return false;
+
+    const size_t _first_route = m_route_decls.size();
+    for (uint32_t i = 0; i < _image.root_count(); ++i) {
+      auto const &_n = _image.node(i);
+      if (!(_n.flags & ServerLang::Nslc::NULL_NODE))
+        declare(static_cast<ServerLang::Type>(_n.type),
+                ServerLang::intern(_image.string(_n.id)), static_cast<int>(i));
+    }
+    const auto _base = link(_image, _externs, _natives);
+    if (_base != ServerLang::Program::no_chunk) {
+      for (uint32_t i = 0; i < _h.route_count; ++i)
+        if (_image.route(i) != ServerLang::Program::no_chunk)
+          m_route_chunks[_first_route + i] =
+              static_cast<uint16_t>(_base + _image.route(i));
+    }
+    compile_routes();
+    if (_base != ServerLang::Program::no_chunk &&
+        _h.init_chunk != ServerLang::Program::no_chunk)
+      initialize(static_cast<uint16_t>(_base + _h.init_chunk));
+    return true;
+  }
+
+  // Declares the roots of a flat tree, which carries no bytecode.
+  void eval(const ServerLang::FlatTree &_tree) {
+    int i = 0;
+    for (auto r = _tree.root(); r != ServerLang::FlatTree::none;
+         r = _tree.next_sibling(r), ++i)
+      if (!_tree.is_null(r))
+        declare(_tree.tag(r), _tree.id(r), i);
+    compile_routes();
+  }
+
+  const ServerLang::Program &program() const { return m_program; }
+
+  // Pattern of the most specific route serving `path`, or nullptr.
+  const char *match_route(const std::string_view path) const {
+    auto const r = m_routes.lookup(path);
+    return r == ServerLang::RouteTable::no_route
+               ? nullptr
+               : m_route_decls[r].first.c_str();
+  }
+
+  // A Machine for serving requests on one thread, starting from the globals
+  // the initializers left. The Runtime must not be evaluated into again while
+  // it exists; until then any number of threads may each run routes on their
+  // own context.
+  std::unique_ptr<ServerLang::Machine> context() const {
+    return std::make_unique<ServerLang::Machine>(m_program, m_vm);
+  }
+
+  // Runs the route serving `path` on `_ctx` and stores what it returned in
+  // `_result`. `_body`, the request body, is what the route reads as
+  // RUNTIME_HTTP_BODY; it must stay in place as long as the result. The
+  // result and the `This` fields the route set, read through _ctx.field(),
+  // stay valid until the context's next request. Returns false if no route
+  // matches, the route has no compiled body, or it fails.
+  bool exec_route(const std::string_view path, ServerLang::Machine &_ctx,
+                  ServerLang::Value &_result,
+                  const std::string_view _body = {}) const {
+    auto const r = m_routes.lookup(path);
+    if (r == ServerLang::RouteTable::no_route ||
+        m_route_chunks[r] == ServerLang::Program::no_chunk)
+      return false;
+    _ctx.reset();
+    _ctx.set_request_body(_body);
+    _result = _ctx.run(m_route_chunks[r]);
+    if (!_ctx.ok()) {
+      fprintf(stderr, "[Error]: %s in route %s\n", _ctx.error().c_str(),
+              m_route_decls[r].first.c_str());
+      return false;
+    }
+    return true;
+  }
+
+private:
+  ServerLang::CompiledModule
+  compile(const ServerLang::node_list &_nodes,
+          const ServerLang::ArenaList<ServerLang::Import> *_imports) {
+    const size_t _first_route = m_route_decls.size();
+    for (size_t i = 0; i < _nodes.size(); ++i)
+      if (_nodes[i])
+        declare(_nodes[i]->type(), _nodes[i]->id(), static_cast<int>(i));
+
+    ServerLang::Compiler _compiler(m_program);
+    if (_imports)
+      for (auto const &_imp : *_imports)
+        if (_imp.kind == ServerLang::Import::Kind::LIBRARY)
+          _compiler.import_library(_imp.name);
+    const auto _init = _compiler.compile_module(_nodes);
+    for (size_t i = 0; i < _compiler.routes().size(); ++i)
+      m_route_chunks[_first_route + i] = _compiler.routes()[i].chunk;
+    compile_routes();
+
+    if (_init != ServerLang::Program::no_chunk)
+      initialize(_init);
+    return _compiler.module();
+  }
+
+  void initialize(const uint16_t _init) {
+    m_vm.run(_init);
+    if (!m_vm.ok())
+      fprintf(stderr, "[Error]: %s while initializing\n",
+              m_vm.error().c_str());
+  }
+
+  // The native `_name` among the image's @lib imports, or nullptr.
+  static const ServerLang::Native *
+  find_native(const ServerLang::CompiledImage &_image, const char *_name) {
+    auto const &_registry = ServerLang::builtin_libraries();
+    const auto _sym = ServerLang::intern(_name);
+    for (auto const &_imp : _image.imports())
+      if (_imp.kind == ServerLang::Import::Kind::LIBRARY)
+        if (auto const *_lib = _registry.find(_imp.name))
+          if (auto const *_n = _lib->find(_sym))
+            return _n;
+    return nullptr;
+  }
+
+  // Copies the image's chunks into the program with their operands pointed
+  // at its pools and defines its functions. Returns the index of the first
+  // chunk, or no_chunk if a pool, which has reported it, ran out of room.
+  uint16_t link(const ServerLang::CompiledImage &_image,
+                const std::vector<uint16_t> &_externs,
+                const std::vector<const ServerLang::Native *> &_natives) {
+    using ServerLang::Program;
+    auto const &_h = _image.header();
+    const auto _base = static_cast<uint16_t>(m_program.chunk_count());
+    for (uint32_t i = 0; i < _h.chunk_count; ++i)
+      if (m_program.add_chunk(ServerLang::intern(
+              _image.string(_image.chunk(i).name))) == Program::no_chunk)
+        return Program::no_chunk;
+    std::vector<uint16_t> _globals, _native_slots;
+    for (uint32_t i = 0; i < _h.global_count; ++i) {
+      _globals.push_back(
+          m_program.global(ServerLang::intern(_image.global(i))));
+      if (_globals.back() == Program::no_slot)
+        return Program::no_chunk;
+    }
+    for (auto const *_n : _natives) {
+      _native_slots.push_back(m_program.native(*_n));
+      if (_native_slots.back() == Program::no_slot)
+        return Program::no_chunk;
+    }
+
+    // Objects only refer to earlier constants, so one pass builds them all.
+    // Constants join the pool as code loads them.
+    std::vector<ServerLang::Value> _values(_h.constant_count);
+    std::vector<uint32_t> _constants(_h.constant_count, Program::no_constant);
+    for (uint32_t i = 0; i < _h.constant_count; ++i)
+      _values[i] = constant_value(_image, _image.constant(i), _values);
+    auto const _load = [&](const uint32_t k) {
+      if (_constants[k] != Program::no_constant)
+        return _constants[k];
+      auto const &_c = _image.constant(k);
+      const bool _format =
+          _c.kind == static_cast<uint8_t>(ServerLang::Value::Kind::FORMAT);
+      return _constants[k] = _format
+                                 ? m_program.format_constant(_image.text(_c))
+                                 : m_program.constant(_values[k]);
+    };
+
+    for (uint32_t i = 0; i < _h.chunk_count; ++i) {
+      auto const &_c = _image.chunk(i);
+      auto &_chunk = m_program.chunk(static_cast<uint16_t>(_base + i));
+      _chunk.params = _c.params;
+      _chunk.registers = _c.registers;
+      _chunk.code.assign(_image.code(_c), _image.code(_c) + _c.size);
+      for (auto &_in : _chunk.code)
+        switch (_in.op) {
+        case ServerLang::Op::LOADK:
+          if (const auto _k = _load(_in.b | uint32_t{_in.c} << 16);
+              _k == Program::no_constant)
+            _in = {ServerLang::Op::LOADNIL, _in.a, 0, 0};
+          else {
+            _in.b = static_cast<uint16_t>(_k);
+            _in.c = static_cast<uint16_t>(_k >> 16);
+          }
+          break;
+        case ServerLang::Op::GETG:
+        case ServerLang::Op::SETG:
+          _in.b = _globals[_in.b];
+          break;
+        case ServerLang::Op::CALLN:
+          _in.b = _native_slots[_in.b];
+          break;
+        case ServerLang::Op::CALL:
+          _in.b = _in.b < _h.chunk_count
+                      ? static_cast<uint16_t>(_base + _in.b)
+                      : _externs[_in.b - _h.chunk_count];
+          break;
+        default:
+          break;
+        }
+    }
+    for (uint32_t i = 0; i < _h.function_count; ++i) {
+      const auto _f = static_cast<uint16_t>(_base + i);
+      m_program.define_function(m_program.chunk(_f).name, _f);
+    }
+    return _base;
+  }
+
+  // The value of an image constant other than a format string; `_values`
+  // holds those before it.
+  ServerLang::Value
+  constant_value(const ServerLang::CompiledImage &_image,
+                 const ServerLang::Nslc::Constant &_c,
+                 const std::vector<ServerLang::Value> &_values) {
+    using Kind = ServerLang::Value::Kind;
+    switch (static_cast<Kind>(_c.kind)) {
+    case Kind::BOOL:
+      return ServerLang::Value::boolean(_c.bits != 0);
+    case Kind::INT:
+      return ServerLang::Value::integer(static_cast<int64_t>(_c.bits));
+    case Kind::FLOAT: {
+      double _f;
+      std::memcpy(&_f, &_c.bits, sizeof _f);
+      return ServerLang::Value::number(_f);
+    }
+    case Kind::STRING:
+      return ServerLang::Value::string(m_program.keep(_image.text(_c)));
+    case Kind::OBJECT: {
+      auto &_r = m_program.add_record();
+      _r.array = _c.flags & ServerLang::Nslc::ARRAY;
+      for (auto m = _c.bits; m < _c.bits + _c.size; ++m) {
+        auto const &_m = _image.member(static_cast<uint32_t>(m));
+        _r.members.push_back(
+            {ServerLang::symbol_name(
+                 ServerLang::intern(_image.string(_m.name))),
+             _values[_m.value]});
+      }
+      return ServerLang::Value::object(&_r);
+    }
+    default:
+      return {};
+    }
+  }
+
+  void declare(const ServerLang::Type _type, const ServerLang::Symbol _id,
+               const int i) {
+    switch (_type) {
+    case ServerLang::Type{1}... ServerLang::Type{11}:
+    case ServerLang::Type::FUNCTION:
+    case ServerLang::Type::CLASS:
+    case ServerLang::Type::ROUTE: {
+      TRACE_LOG(RUNTIME, INFO, "Adding variable declaration: %s",
+                ServerLang::symbol_name(_id));
+      // auto _pair = std::make_pair();
+      // decl_heap.insert(std::make_pair(std::string{_id}, std::move(v)));
+      decl_heap.insert_or_assign(_id, i);
+      if (_type == ServerLang::Type::ROUTE) {
+        m_route_decls.emplace_back(
+            ServerLang::symbol_name(_id),
+            static_cast<int32_t>(m_route_decls.size()));
+        m_route_chunks.push_back(ServerLang::Program::no_chunk);
+      }
+    }
+    default:
+      break;
+    }
+  }
+
+  // Routes from every eval so far; the table is rebuilt rather than mutated.
+  void compile_routes() {
+    if (m_route_decls.size() != m_compiled_routes) {
+      m_routes = ServerLang::RouteTable(m_route_decls);
+      m_compiled_routes = m_route_decls.size();
+    }
+  }
+
+private:
+  ServerLang::SymbolMap<int> decl_heap;
+  std::vector<std::pair<std::string, int32_t>> m_route_decls;
+  // Bytecode of each declared route, or no_chunk.
+  std::vector<uint16_t> m_route_chunks;
+  size_t m_compiled_routes = 0;
+  ServerLang::RouteTable m_routes;
+  ServerLang::Program m_program;
+  ServerLang::Machine m_vm{m_program};
+};
@@ -0,0 +1,378 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SERVERLANG_SCAN_X86 1
+#endif
+
+namespace ServerLang::Scan {
+
+enum class CharClass : uint8_t {
+  OTHER,
+  DIGIT,
+  IDENT,
+  PUNCT,
+  COLON,
+  DOLLAR,
+  DOT,
+  LOGIC,
+  STAR,
+  SLASH,
+  ARITH,
+  NEWLINE,
+  BLANK,
+  QUOTE,
+};
+
+constexpr std::array<CharClass, 256> build_class_table() {
+  std::array<CharClass, 256> table{};
+  for (int c = '0'; c <= '9'; ++c)
+    table[c] = CharClass::DIGIT;
+  for (int c = 'A'; c <= 'Z'; ++c)
+    table[c] = CharClass::IDENT;
+  for (int c = 'a'; c <= 'z'; ++c)
+    table[c] = CharClass::IDENT;
+  table['_'] = CharClass::IDENT;
+  for (unsigned char c : {'{', '}', '(', ')', '[', ']', ';', ',', '@'})
+    table[c] = CharClass::PUNCT;
+  table[':'] = CharClass::COLON;
+  table['$'] = CharClass::DOLLAR;
+  table['.'] = CharClass::DOT;
+  for (unsigned char c : {'!', '&', '|', '>', '<'})
+    table[c] = CharClass::LOGIC;
+  table['*'] = CharClass::STAR;
+  table['/'] = CharClass::SLASH;
+  for (unsigned char c : {'+', '-', '^', '='})
+    table[c] = CharClass::ARITH;
+  table['\r'] = CharClass::NEWLINE;
+  table['\n'] = CharClass::NEWLINE;
+  table['\t'] = CharClass::BLANK;
+  table[' '] = CharClass::BLANK;
+  table['"'] = CharClass::QUOTE;
+  return table;
+}
+
+inline constexpr std::array<CharClass, 256> class_table = build_class_table();
+
+inline CharClass classify(const char c) {
+  return class_table[static_cast<unsigned char>(c)];
+}
+
+// Span kernels. Each returns a pointer to the first byte in [p, end) that
+// stops the span, or `end`.
+//  - find_quote_or_eol: first '"', '\n' or '\r' (ends string and comment
+//    spans).
+//  - skip_blank: first byte that is not ' ', '\t', '\n' or '\r'.
+//  - find_escape: first '"', '\\' or control byte below 0x20, the bytes a
+//    JSON string has to escape.
+//  - json_block: classifies the 64 bytes at p (all readable) for the JSON
+//    structural index.
+//  - count_newlines: number of '\n' in [p, end), for sizing a line table.
+struct JsonBlock {
+  uint64_t quote;      // bit i set if p[i] is '"'
+  uint64_t backslash;  // ... '\\'
+  uint64_t structural; // ... one of { } [ ] : ,
+};
+
+struct Kernels {
+  const char *name;
+  const char *(*find_quote_or_eol)(const char *p, const char *end);
+  const char *(*skip_blank)(const char *p, const char *end);
+  const char *(*find_escape)(const char *p, const char *end);
+  void (*json_block)(const char *p, JsonBlock &out);
+  size_t (*count_newlines)(const char *p, const char *end);
+};
+
+inline const char *find_quote_or_eol_scalar(const char *p, const char *end) {
+  while (p < end) {
+    const auto c = classify(*p);
+    if (c == CharClass::QUOTE || c == CharClass::NEWLINE)
+      break;
+    ++p;
+  }
+  return p;
+}
+
+inline const char *skip_blank_scalar(const char *p, const char *end) {
+  while (p < end) {
+    const auto c = classify(*p);
+    if (c != CharClass::BLANK && c != CharClass::NEWLINE)
+      break;
+    ++p;
+  }
+  return p;
+}
+
+inline const char *find_escape_scalar(const char *p, const char *end) {
+  while (p < end && *p != '"' && *p != '\\' &&
+         static_cast<unsigned char>(*p) >= 0x20)
+    ++p;
+  return p;
+}
+
+inline void json_block_scalar(const char *p, JsonBlock &out) {
+  out = {};
+  for (unsigned i = 0; i < 64; ++i) {
+    const uint64_t bit = uint64_t{1} << i;
+    switch (p[i]) {
+    case '"':
+      out.quote |= bit;
+      break;
+    case '\\':
+      out.backslash |= bit;
+      break;
+    case '{':
+    case '}':
+    case '[':
+    case ']':
+    case ':':
+    case ',':
+      out.structural |= bit;
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+inline size_t count_newlines_scalar(const char *p, const char *end) {
+  size_t n = 0;
+  for (; p < end; ++p)
+    n += *p == '\n';
+  return n;
+}
+
+#ifdef SERVERLANG_SCAN_X86
+
+__attribute__((target("sse2"))) inline const char *
+find_quote_or_eol_sse2(const char *p, const char *end) {
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i lf = _mm_set1_epi8('\n');
+  const __m128i cr = _mm_set1_epi8('\r');
+  for (; end - p >= 16; p += 16) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    const __m128i hit =
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                                  _mm_cmpeq_epi8(v, lf)),
+                     _mm_cmpeq_epi8(v, cr));
+    if (const unsigned mask = _mm_movemask_epi8(hit))
+      return p + __builtin_ctz(mask);
+  }
+  return find_quote_or_eol_scalar(p, end);
+}
+
+__attribute__((target("sse2"))) inline const char *
+skip_blank_sse2(const char *p, const char *end) {
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i lf = _mm_set1_epi8('\n');
+  const __m128i cr = _mm_set1_epi8('\r');
+  for (; end - p >= 16; p += 16) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    const __m128i blank = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab)),
+        _mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr)));
+    if (const unsigned mask = ~_mm_movemask_epi8(blank) & 0xFFFFu)
+      return p + __builtin_ctz(mask);
+  }
+  return skip_blank_scalar(p, end);
+}
+
+// Bytes below 0x20 are those left unchanged by an unsigned max with 0x1F.
+__attribute__((target("sse2"))) inline const char *
+find_escape_sse2(const char *p, const char *end) {
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i control = _mm_set1_epi8(0x1F);
+  for (; end - p >= 16; p += 16) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    const __m128i hit = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+        _mm_cmpeq_epi8(_mm_max_epu8(v, control), control));
+    if (const unsigned mask = _mm_movemask_epi8(hit))
+      return p + __builtin_ctz(mask);
+  }
+  return find_escape_scalar(p, end);
+}
+
+// Brackets and braces are found together: '[' and ']' are '{' and '}'
+// with bit 5 cleared.
+__attribute__((target("sse2"))) inline void json_block_sse2(const char *p,
+                                                            JsonBlock &out) {
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i open = _mm_set1_epi8('{');
+  const __m128i close = _mm_set1_epi8('}');
+  const __m128i colon = _mm_set1_epi8(':');
+  const __m128i comma = _mm_set1_epi8(',');
+  const __m128i bit5 = _mm_set1_epi8(0x20);
+  out = {};
+  for (unsigned i = 0; i < 64; i += 16) {
+    const __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+    const __m128i folded = _mm_or_si128(v, bit5);
+    const __m128i structural = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(folded, open),
+                     _mm_cmpeq_epi8(folded, close)),
+        _mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, comma)));
+    auto const bits = [i](const __m128i m) {
+      return static_cast<uint64_t>(_mm_movemask_epi8(m) & 0xFFFF) << i;
+    };
+    out.quote |= bits(_mm_cmpeq_epi8(v, quote));
+    out.backslash |= bits(_mm_cmpeq_epi8(v, backslash));
+    out.structural |= bits(structural);
+  }
+}
+
+__attribute__((target("sse2"))) inline size_t
+count_newlines_sse2(const char *p, const char *end) {
+  const __m128i lf = _mm_set1_epi8('\n');
+  size_t n = 0;
+  for (; end - p >= 16; p += 16) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    n += static_cast<size_t>(
+        __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(v, lf))));
+  }
+  return n + count_newlines_scalar(p, end);
+}
+
+__attribute__((target("avx2"))) inline const char *
+find_quote_or_eol_avx2(const char *p, const char *end) {
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i lf = _mm256_set1_epi8('\n');
+  const __m256i cr = _mm256_set1_epi8('\r');
+  for (; end - p >= 32; p += 32) {
+    const __m256i v =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    const __m256i hit =
+        _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+                                        _mm256_cmpeq_epi8(v, lf)),
+                        _mm256_cmpeq_epi8(v, cr));
+    if (const unsigned mask = _mm256_movemask_epi8(hit))
+      return p + __builtin_ctz(mask);
+  }
+  return find_quote_or_eol_sse2(p, end);
+}
+
+__attribute__((target("avx2"))) inline const char *
+skip_blank_avx2(const char *p, const char *end) {
+  const __m256i space = _mm256_set1_epi8(' ');
+  const __m256i tab = _mm256_set1_epi8('\t');
+  const __m256i lf = _mm256_set1_epi8('\n');
+  const __m256i cr = _mm256_set1_epi8('\r');
+  for (; end - p >= 32; p += 32) {
+    const __m256i v =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    const __m256i blank = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, space),
+                        _mm256_cmpeq_epi8(v, tab)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, lf), _mm256_cmpeq_epi8(v, cr)));
+    const unsigned mask = ~static_cast<unsigned>(_mm256_movemask_epi8(blank));
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+  return skip_blank_sse2(p, end);
+}
+
+__attribute__((target("avx2"))) inline const char *
+find_escape_avx2(const char *p, const char *end) {
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i backslash = _mm256_set1_epi8('\\');
+  const __m256i control = _mm256_set1_epi8(0x1F);
+  for (; end - p >= 32; p += 32) {
+    const __m256i v =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    const __m256i hit = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+                        _mm256_cmpeq_epi8(v, backslash)),
+        _mm256_cmpeq_epi8(_mm256_max_epu8(v, control), control));
+    if (const unsigned mask = _mm256_movemask_epi8(hit))
+      return p + __builtin_ctz(mask);
+  }
+  return find_escape_sse2(p, end);
+}
+
+__attribute__((target("avx2"))) inline void json_block_avx2(const char *p,
+                                                            JsonBlock &out) {
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i backslash = _mm256_set1_epi8('\\');
+  const __m256i open = _mm256_set1_epi8('{');
+  const __m256i close = _mm256_set1_epi8('}');
+  const __m256i colon = _mm256_set1_epi8(':');
+  const __m256i comma = _mm256_set1_epi8(',');
+  const __m256i bit5 = _mm256_set1_epi8(0x20);
+  out = {};
+  for (unsigned i = 0; i < 64; i += 32) {
+    const __m256i v =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+    const __m256i folded = _mm256_or_si256(v, bit5);
+    const __m256i structural = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(folded, open),
+                        _mm256_cmpeq_epi8(folded, close)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, colon),
+                        _mm256_cmpeq_epi8(v, comma)));
+    const uint32_t q = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote));
+    const uint32_t b =
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, backslash));
+    const uint32_t s = _mm256_movemask_epi8(structural);
+    out.quote |= static_cast<uint64_t>(q) << i;
+    out.backslash |= static_cast<uint64_t>(b) << i;
+    out.structural |= static_cast<uint64_t>(s) << i;
+  }
+}
+
+__attribute__((target("avx2"))) inline size_t
+count_newlines_avx2(const char *p, const char *end) {
+  const __m256i lf = _mm256_set1_epi8('\n');
+  size_t n = 0;
+  for (; end - p >= 32; p += 32) {
+    const __m256i v =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    n += static_cast<size_t>(__builtin_popcount(static_cast<unsigned>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, lf)))));
+  }
+  return n + count_newlines_sse2(p, end);
+}
+
+#endif // SERVERLANG_SCAN_X86
+
+inline const Kernels &scalar_kernels() {
+  static const Kernels k{"scalar", find_quote_or_eol_scalar,
+                         skip_blank_scalar, find_escape_scalar,
+                         json_block_scalar, count_newlines_scalar};
+  return k;
+}
+
+// Kernels usable on this CPU, best first. The scalar set is always last.
+inline const std::vector<const Kernels *> &available_kernels() {
+  static const std::vector<const Kernels *> list = [] {
+    std::vector<const Kernels *> ret;
+#ifdef SERVERLANG_SCAN_X86
+    static const Kernels avx2{"avx2", find_quote_or_eol_avx2, skip_blank_avx2,
+                              find_escape_avx2, json_block_avx2,
+                              count_newlines_avx2};
+    static const Kernels sse2{"sse2", find_quote_or_eol_sse2, skip_blank_sse2,
+                              find_escape_sse2, json_block_sse2,
+                              count_newlines_sse2};
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+      ret.push_back(&avx2);
+    if (__builtin_cpu_supports("sse2"))
+      ret.push_back(&sse2);
+#endif
+    ret.push_back(&scalar_kernels());
+    return ret;
+  }();
+  return list;
+}
+
+inline const Kernels &best_kernels() {
+  static const Kernels &best = *available_kernels().front();
+  return best;
+}
+
+} // namespace ServerLang::Scan
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <fcntl.h>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only view of a script on disk. The file is mapped when possible and
+// otherwise read into memory with a single bulk read.
+class SourceFile {
+public:
+  SourceFile() = default;
+  ~SourceFile() { close(); }
+  SourceFile(const SourceFile &) = delete;
+  SourceFile &operator=(const SourceFile &) = delete;
+
+public:
+  // Tokens place themselves in the source by a 32-bit offset.
+  static constexpr size_t max_size = UINT32_MAX;
+
+  // Returns false if the file cannot be read or is over max_size.
+  bool open(const char *path) {
+    close();
+    const int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+      return false;
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      return false;
+    }
+    const size_t size = static_cast<size_t>(st.st_size);
+    if (size > max_size) {
+      ::close(fd);
+      return too_large(path);
+    }
+
+    if (size > 0) {
+      void *addr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (addr != MAP_FAILED) {
+        m_map = static_cast<const char *>(addr);
+        m_size = size;
+        ::close(fd);
+        return true;
+      }
+    }
+
+    const bool ok = read_all(fd, size);
+    ::close(fd);
+    if (ok && m_buffer.size() > max_size) {
+      m_buffer.clear();
+      return too_large(path);
+    }
+    return ok;
+  }
+
+  void close() {
+    if (m_map)
+      ::munmap(const_cast<char *>(m_map), m_size);
+    m_map = nullptr;
+    m_size = 0;
+    m_buffer.clear();
+  }
+
+  std::string_view data() const {
+    return m_map ? std::string_view{m_map, m_size} : m_buffer;
+  }
+
+private:
+  static bool too_large(const char *path) {
+    fprintf(stderr, "[Error]: %s is larger than %zu bytes\n", path, max_size);
+    return false;
+  }
+
+  bool read_all(const int fd, const size_t size_hint) {
+    m_buffer.resize(size_hint);
+    size_t done = 0;
+    for (;;) {
+      if (done == m_buffer.size())
+        m_buffer.resize(m_buffer.size() * 2 + 4096);
+      const ssize_t n =
+          ::read(fd, m_buffer.data() + done, m_buffer.size() - done);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0) {
+        m_buffer.clear();
+        return false;
+      }
+      if (n == 0)
+        break;
+      done += static_cast<size_t>(n);
+    }
+    m_buffer.resize(done);
+    return true;
+  }
+
+private:
+  const char *m_map = nullptr;
+  size_t m_size = 0;
+  std::string m_buffer;
+};
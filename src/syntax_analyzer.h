@@ -0,0 +1,519 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+#include "ast.h"
+#include "const_fold.h"
+#include "expression_parser.h"
+#include "tokenizer.h"
+#include "trace.h"
+
+#define NOT_DELIMETER(x, y)                                                    \
+  !(x->type() == Token::TokenType::PUNCTUATOR && x->const_data() == y)
+
+class SyntaxAnalyzer {
+  enum class State {
+    NO_OP,
+    VARIABLE_DECL,
+    CONST_DECL,
+    FUNCTION_DECL,
+    EXPRESSION,
+    RETURN_STMT,
+    TERMINATE_OPR
+  };
+
+  using node = ServerLang::node_ptr;
+  using node_list = ServerLang::node_list;
+  using object = ServerLang::Object;
+  using scope = ServerLang::Scope;
+
+public:
+  SyntaxAnalyzer() = default;
+  ~SyntaxAnalyzer() {}
+
+public:
+  // Parses straight from the stream; tokens are pulled as they are needed.
+  // Nested bodies are analyzed in place, so every token is visited a constant
+  // number of times regardless of nesting depth.
+  ServerLang::ParseResult analyze(TokenStream &tokens) {
+    ServerLang::ParseResult result;
+    m_arena = &result.arena();
+    m_imports = &result.imports();
+    m_errors = 0;
+    const size_t _syntax_errors = tokens.errors();
+    result.nodes() = analyze_tokens(tokens, false);
+    ServerLang::ConstantFolder _folder(result.arena());
+    _folder.fold(result.nodes());
+    result.set_errors(tokens.errors() - _syntax_errors + m_errors +
+                      _folder.errors());
+    m_arena = nullptr;
+    m_imports = nullptr;
+    return result;
+  }
+
+  // Analyzes an already lexed range without copying it.
+  ServerLang::ParseResult analyze(const Token *first, const Token *last) {
+    TokenStream tokens(first, last);
+    return analyze(tokens);
+  }
+
+  ServerLang::ParseResult analyze(const Tokenizer::token_list &tokens) {
+    return analyze(tokens.data(), tokens.data() + tokens.size());
+  }
+
+private:
+  // Analyzes statements until the stream ends or, for a compound statement
+  // body, until the closing brace (which is left for the caller).
+  node_list analyze_tokens(TokenStream &itr, const bool compound) {
+    node_list ret;
+    // State _i_state{State::NO_OP};
+    while (!itr.done()) {
+      if (compound && m_state == State::NO_OP &&
+          !NOT_DELIMETER(itr, "}"))
+        break;
+      switch (m_state) {
+      case State::NO_OP:
+        check_for_next_possible(itr);
+        // itr++;
+        break;
+      case State::CONST_DECL:
+        TRACE_TOKEN(DECL, INFO, "[CONST DECL]::begin => ", itr);
+        ++itr;
+        ret.push_back(*m_arena, check_for_const_decl(itr));
+        // itr++;
+        break;
+      case State::VARIABLE_DECL:
+        TRACE_TOKEN(DECL, INFO, "[VAR DECL]::begin => ", itr);
+        ++itr;
+        ret.push_back(*m_arena, check_for_variable_decl(itr));
+        // itr++;
+        break;
+      case State::FUNCTION_DECL:
+        TRACE_TOKEN(DECL, INFO, "[FUNCTION DECL]::begin => ", itr);
+        ++itr;
+        ret.push_back(*m_arena, check_for_fn_decl(itr));
+        // itr++;
+        break;
+      case State::EXPRESSION:
+        TRACE_TOKEN(EXPR, INFO, "[EXPRESSION]::begin => ", itr);
+        // itr++;
+        ret.push_back(*m_arena, check_for_expression(itr));
+        ++itr;
+        break;
+      case State::RETURN_STMT:
+        TRACE_TOKEN(EXPR, INFO, "[RETURN]::begin => ", itr);
+        ++itr;
+        ret.push_back(*m_arena, check_for_return(itr));
+        ++itr;
+        break;
+      case State::TERMINATE_OPR:
+        return ret;
+      default:
+        break;
+      }
+    }
+    return ret;
+  }
+
+private:
+  State m_state = {State::NO_OP};
+  ServerLang::Arena *m_arena = nullptr;
+  ServerLang::ArenaList<ServerLang::Import> *m_imports = nullptr;
+  size_t m_errors = 0; // reported other than through the token stream
+
+private: // helpers
+  void move_to_next_end(TokenStream &it, const std::string_view &delim = ";") {
+    while (!it.done() && NOT_DELIMETER(it, delim)) {
+      TRACE_TOKEN(EXPR, VERBOSE, "Skipping: ", it);
+      ++it;
+    }
+    ++it;
+  }
+
+  void err_expected_token(TokenStream &it,
+                          const char *_exp) {
+    it.begin_error();
+    if (it.done())
+      fprintf(stderr, "Expected token '%s'. Got the end of the file\n", _exp);
+    else
+      fprintf(stderr, "Expected token '%s'. Got %s '%.*s'\n", _exp,
+              Token::TokenNames.at(it->type()),
+              static_cast<int>(it->const_data().size()),
+              it->const_data().data());
+    while (it->type() != Token::TokenType::GARBAGE_TYPE) {
+      ++it;
+    }
+    m_state = State::TERMINATE_OPR;
+  }
+
+  static bool is_punctuator(const Token &t, const std::string_view text) {
+    return t.type() == Token::TokenType::PUNCTUATOR && t.const_data() == text;
+  }
+
+  void check_for_next_possible(TokenStream &it) {
+    switch (it->type()) {
+    case Token::TokenType::COMMENT:
+      m_state = State::NO_OP;
+      ++it;
+      break;
+    case Token::TokenType::ACCESS_OPERATOR:
+    case Token::TokenType::IDENTIFIER:
+      m_state = State::EXPRESSION;
+      break;
+    case Token::TokenType::KEYWORD:
+      switch (it->keyword()) {
+      case ServerLang::Keyword::CONST:
+        m_state = State::CONST_DECL;
+        break;
+      case ServerLang::Keyword::VAR:
+        m_state = State::VARIABLE_DECL;
+        break;
+      case ServerLang::Keyword::DEF:
+        m_state = State::FUNCTION_DECL;
+        break;
+      case ServerLang::Keyword::RETURN:
+        m_state = State::RETURN_STMT;
+        break;
+      default: // TODO: Control flow statements
+        m_state = State::NO_OP;
+        move_to_next_end(it);
+        break;
+      }
+      break;
+    case Token::TokenType::PUNCTUATOR:
+      m_state = State::NO_OP;
+      if (it->const_data() == "@" &&
+          it.peek(1).type() == Token::TokenType::IDENTIFIER) {
+        if (it.peek(1).const_data() == "script") {
+          ++it;
+          check_for_script_imports(it);
+          break;
+        }
+        if (it.peek(1).const_data() == "lib") {
+          ++it;
+          check_for_library_imports(it);
+          break;
+        }
+      }
+      move_to_next_end(it);
+      break;
+
+    default:
+      m_state = State::NO_OP;
+      move_to_next_end(it);
+      break;
+    }
+  }
+  void check_for_library_imports(TokenStream &it) {
+    check_for_import(it, ServerLang::Import::Kind::LIBRARY);
+  }
+  void check_for_script_imports(TokenStream &it) {
+    check_for_import(it, ServerLang::Import::Kind::SCRIPT);
+  }
+  // Expects the cursor on `script`/`lib`; records the quoted name and consumes
+  // the statement. Resolving it is left to the ImportResolver.
+  void check_for_import(TokenStream &it, const ServerLang::Import::Kind kind) {
+    if (++it; is_punctuator(*it, "["))
+      ++it;
+    if (it->type() == Token::TokenType::STRING_LITERAL) {
+      TRACE_TOKEN(DECL, INFO, "[IMPORT] => ", it);
+      m_imports->push_back(*m_arena,
+                           {kind, m_arena->copy_string(it->const_data())});
+      ++it;
+    } else {
+      it.begin_error();
+      fprintf(stderr, "Expected a quoted import name. Got '%.*s'\n",
+              static_cast<int>(it->const_data().size()),
+              it->const_data().data());
+    }
+    move_to_next_end(it);
+  }
+  // Parses one expression; the cursor is left on the ';'. A statement that
+  // does not parse is skipped and yields nullptr.
+  node check_for_expression(TokenStream &it) {
+    ServerLang::ExpressionParser _parser(it, *m_arena);
+    auto _ret = _parser.parse();
+    if (!_parser.finish())
+      _ret = err_expected_statement_end(it, _ret);
+    m_state = State::NO_OP;
+    return _ret;
+  }
+
+  // Expects the cursor after `return`; leaves it on the ';'.
+  node check_for_return(TokenStream &it) {
+    node _value = nullptr;
+    if (NOT_DELIMETER(it, ";"))
+      _value = check_for_expression(it);
+    m_state = State::NO_OP;
+    return m_arena->make<ServerLang::Expressions::ReturnExpression>(
+        _value, nullptr, ServerLang::Operators::RET);
+  }
+
+  // Reports whatever follows a parsed expression in place of its ';' and
+  // skips to the ';'. Returns nullptr so the statement is dropped.
+  node err_expected_statement_end(TokenStream &it, node parsed) {
+    if (parsed) {
+      it.begin_error();
+      fprintf(stderr, "Expected token ';'. Got '%.*s'\n",
+              static_cast<int>(it->const_data().size()),
+              it->const_data().data());
+    }
+    it.skip_to(";", Token::TokenType::PUNCTUATOR);
+    return nullptr;
+  }
+
+  node check_for_compound_stmnt(TokenStream &it) {
+    auto _tmp = m_arena->make<ServerLang::Scope>();
+    m_state = State::NO_OP;
+    _tmp->children() = analyze_tokens(it, true);
+    m_state = State::NO_OP;
+    ++it;
+    return _tmp;
+  }
+
+  // Expects the cursor after the '('; leaves it after the matching ')'. Each
+  // `[var] name: Type` becomes a declaration in `params`. Default values and
+  // nested parentheses are skipped.
+  void check_for_parameter_list(TokenStream &it, node_list *params) {
+    while (!it.done() && NOT_DELIMETER(it, ")")) {
+      TRACE_TOKEN(DECL, VERBOSE, "Param_List: ", it);
+      if (params && it->type() == Token::TokenType::IDENTIFIER &&
+          it.peek(1).type() == Token::TokenType::PUNCTUATOR &&
+          it.peek(1).const_data() == ":") {
+        auto const _id = it->symbol();
+        ++it;
+        ++it;
+        auto _param = ServerLang::get_type_instance(*m_arena,
+                                                    it->builtin_type());
+        if (!_param)
+          _param = ServerLang::get_type_instance(*m_arena,
+                                                 ServerLang::Type::VARIANT);
+        _param->setId(_id);
+        params->push_back(*m_arena, _param);
+      } else if (it->const_data() == "(" &&
+                 it->type() == Token::TokenType::PUNCTUATOR) {
+        ++it;
+        check_for_parameter_list(it, nullptr);
+        continue;
+      }
+      ++it;
+    }
+    ++it;
+  }
+
+  node check_for_variable_decl(TokenStream &it) {
+    auto const _id = it->symbol();
+    node _var = nullptr;
+
+    if (++it;
+        it->const_data() == ":" && it->type() == Token::TokenType::PUNCTUATOR) {
+      if (++it; it->builtin_type() != ServerLang::Type::UNDEFINED) {
+        auto _temp =
+            ServerLang::get_type_instance(*m_arena, it->builtin_type());
+        _temp->setId(_id);
+        _var = _temp;
+        TRACE_LOG(DECL, VERBOSE, "Variable pref_type: %d",
+                  static_cast<int>(_var->preferredType()));
+        ++it;
+      } else if (it->type() == Token::TokenType::IDENTIFIER) {
+        fprintf(stderr,
+                "<IMPL_DECL> of type: %.*s\nCurrently only internal types can "
+                "be implicitly declared \n",
+                static_cast<int>(it->const_data().size()),
+                it->const_data().data());
+        auto _temp = ServerLang::get_type_instance(*m_arena,
+                                                   ServerLang::Type::VARIANT);
+        _temp->setId(_id);
+        _var = _temp;
+        TRACE_LOG(DECL, VERBOSE, "Variable pref_type: %d",
+                  static_cast<int>(_var->preferredType()));
+        ++it;
+      } else {
+        err_expected_token(it, "Identifier");
+        m_state = State::NO_OP;
+      }
+    } else {
+      auto _temp = ServerLang::get_type_instance(*m_arena,
+                                                 ServerLang::Type::VARIANT);
+      _temp->setId(_id);
+      _var = _temp;
+      TRACE_LOG(DECL, VERBOSE, "Variable pref_type: %d",
+                  static_cast<int>(_var->preferredType()));
+    }
+    TRACE_TOKEN(DECL, VERBOSE, "Initializer: ", it);
+    if (it->const_data() == "=" &&
+        it->type() == Token::TokenType::ARITHMETIC_OPERATOR) {
+      if (++it; it->const_data() == "{" &&
+                it->type() == Token::TokenType::PUNCTUATOR) {
+        TRACE_TOKEN(COMPOUND, INFO, "Var_Decl::Before: ", it);
+        ++it;
+        TRACE_TOKEN(COMPOUND, VERBOSE, "Var_Decl::After: ", it);
+        auto const _body = check_for_compound_stmnt(it);
+        if (_var)
+          _var->children().push_back(*m_arena, _body);
+      } else {
+        check_for_initializer(it, _var);
+      }
+    } else {
+      err_expected_token(it, "=");
+    }
+
+    m_state = State::NO_OP;
+    return _var;
+  }
+
+  node check_for_const_decl(TokenStream &it) {
+    ServerLang::Symbol _id = ServerLang::no_id;
+    node _var = nullptr;
+
+    // A route is named by its path: `@[/path]`.
+    if (is_punctuator(*it, "@")) {
+      if (++it; is_punctuator(*it, "["))
+        ++it;
+      _id = it->symbol();
+      if (is_punctuator(it.peek(1), "]"))
+        ++it;
+    } else
+      _id = it->symbol();
+
+    if (++it;
+        it->const_data() == ":" && it->type() == Token::TokenType::PUNCTUATOR) {
+      if (++it; it->builtin_type() != ServerLang::Type::UNDEFINED) {
+        auto _temp =
+            ServerLang::get_type_instance(*m_arena, it->builtin_type());
+        _temp->setId(_id);
+        _var = _temp;
+        TRACE_LOG(DECL, VERBOSE, "Variable pref_type: %d",
+                  static_cast<int>(_var->preferredType()));
+        ++it;
+      } else if (it->type() == Token::TokenType::IDENTIFIER) {
+        fprintf(stderr,
+                "<IMPL_DECL> of type: %.*s\nCurrently only internal types can "
+                "be implicitly declared \n",
+                static_cast<int>(it->const_data().size()),
+                it->const_data().data());
+        auto _temp = ServerLang::get_type_instance(*m_arena,
+                                                   ServerLang::Type::VARIANT);
+        _temp->setId(_id);
+        _var = _temp;
+        TRACE_LOG(DECL, VERBOSE, "Variable pref_type: %d",
+                  static_cast<int>(_var->preferredType()));
+        ++it;
+      } else {
+        err_expected_token(it, "Identifier");
+        m_state = State::NO_OP;
+      }
+    } else {
+      auto _temp = ServerLang::get_type_instance(*m_arena,
+                                                 ServerLang::Type::VARIANT);
+      _temp->setId(_id);
+      _var = _temp;
+      TRACE_LOG(DECL, VERBOSE, "Variable pref_type: %d",
+                  static_cast<int>(_var->preferredType()));
+    }
+    if (_var)
+      _var->setConstant(true);
+    TRACE_TOKEN(DECL, VERBOSE, "Initializer: ", it);
+    if (it->const_data() == "=" &&
+        it->type() == Token::TokenType::ARITHMETIC_OPERATOR) {
+      if (++it; it->const_data() == "{" &&
+                it->type() == Token::TokenType::PUNCTUATOR) {
+        TRACE_TOKEN(COMPOUND, INFO, "Var_Decl::Before: ", it);
+        ++it;
+        TRACE_TOKEN(COMPOUND, VERBOSE, "Var_Decl::After: ", it);
+        _var->children().push_back(*m_arena, check_for_compound_stmnt(it));
+      } else {
+        check_for_initializer(it, _var);
+      }
+    } else {
+      err_expected_token(it, "=");
+    }
+
+    m_state = State::NO_OP;
+    return _var;
+  }
+
+  // Expects the cursor on the first token after '='; leaves it after the
+  // ';'. A literal is converted to the declared type and stored on `decl`;
+  // any other initializer is kept as the declaration's child. A Variant keeps
+  // non-string literals as a child too, and `null` leaves it empty.
+  void check_for_initializer(TokenStream &it, node decl) {
+    auto const _init = check_for_expression(it);
+    ++it;
+    if (!decl || !_init)
+      return;
+
+    auto const _value = ServerLang::Literals::value(_init);
+    if (_value.kind == ServerLang::Constant::Kind::NONE) {
+      if (_init->type() != ServerLang::Type::VARIANT)
+        decl->children().push_back(*m_arena, _init);
+    } else if (decl->type() == ServerLang::Type::VARIANT &&
+               _value.kind != ServerLang::Constant::Kind::STRING) {
+      decl->children().push_back(*m_arena, _init);
+    } else if (!ServerLang::Literals::store(decl, _value)) {
+      ++m_errors;
+      auto const _text = _value.to_string();
+      fprintf(stderr, "[Error]: '%s' is not a valid %s for '%s'\n",
+              _text.c_str(), decl->type_string(), decl->name());
+    }
+  }
+
+  node check_for_fn_decl(TokenStream &it) {
+    TRACE_TOKEN(DECL, INFO, "FN_NAME: ", it);
+    auto const _id = it->symbol();
+    auto _fn = m_arena->make<ServerLang::Function<ServerLang::node_ptr>>();
+    _fn->setId(_id);
+
+    if (++it;
+        it->const_data() == "(" && it->type() == Token::TokenType::PUNCTUATOR) {
+      ++it;
+      check_for_parameter_list(it, &_fn->parameters());
+    } else {
+      err_expected_token(it, "(");
+    }
+
+    if (it->const_data() == ":" && it->type() == Token::TokenType::PUNCTUATOR) {
+      ++it;
+      TRACE_TOKEN(DECL, VERBOSE, "Return type: ", it);
+      _fn->setReturn_t(it->builtin_type());
+    } else {
+      err_expected_token(it, ":");
+    }
+
+    if (++it;
+        it->const_data() == "{" && it->type() == Token::TokenType::PUNCTUATOR) {
+      ++it;
+      _fn->children().push_back(*m_arena, check_for_compound_stmnt(it));
+    } else {
+      err_expected_token(it, "{");
+    }
+
+    m_state = State::NO_OP;
+    return _fn;
+  }
+
+public: // Static members
+  static void print_tree(const ServerLang::node_list &_l,
+                         const int offset = 0) {
+    for (auto const &v : _l) {
+      if (v != nullptr) {
+        auto str = std::string(offset, '.');
+        fprintf(stdout, "%s| %s : %s\n", str.c_str(), v->name(),
+                v->type_string());
+        if (v->children_const().size()) {
+          print_tree(v->children_const(), offset + 3);
+        }
+      } else
+        fprintf(stdout, "[_NULL_OBJECT_]\n");
+    }
+  }
+};
+
+// TODO
+class Parser {
+public:
+  Parser() = default;
+  ~Parser() {}
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ServerLang {
+
+// Fixed set of worker threads draining a FIFO of tasks. The destructor
+// finishes the queued work before joining.
+class ThreadPool {
+public:
+  explicit ThreadPool(size_t threads = std::thread::hardware_concurrency()) {
+    if (threads == 0)
+      threads = 1;
+    m_workers.reserve(threads);
+    for (size_t i = 0; i < threads; ++i)
+      m_workers.emplace_back([this] { work(); });
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stopping = true;
+    }
+    m_ready.notify_all();
+    for (auto &t : m_workers)
+      t.join();
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+public:
+  void submit(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_tasks.push_back(std::move(task));
+    }
+    m_ready.notify_one();
+  }
+
+  size_t size() const { return m_workers.size(); }
+
+private:
+  void work() {
+    for (;;) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_ready.wait(lock, [this] { return m_stopping || !m_tasks.empty(); });
+        if (m_tasks.empty())
+          return;
+        task = std::move(m_tasks.front());
+        m_tasks.pop_front();
+      }
+      task();
+    }
+  }
+
+private:
+  std::mutex m_mutex;
+  std::condition_variable m_ready;
+  std::deque<std::function<void()>> m_tasks;
+  std::vector<std::thread> m_workers;
+  bool m_stopping = false;
+};
+
+} // namespace ServerLang
@@ -0,0 +1,472 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "interner.h"
+#include "keywords.h"
+#include "line_table.h"
+#include "scan.h"
+#include "trace.h"
+
+#define __NOT_STRING_OR_COMMENT__                                              \
+  current_token.type() !=                                                      \
+      Token::TokenType::STRING_LITERAL &&current_token.type() !=               \
+      Token::TokenType::COMMENT
+
+#define __NUMERIC_OR_WHITESPACE__                                              \
+  current_token.type() == Token::TokenType::NUMERIC_LITERAL ||                 \
+      current_token.type() == Token::TokenType::WHITE_SPACE
+
+class Token {
+public:
+  enum class TokenType {
+    GARBAGE_TYPE,
+    WHITE_SPACE,
+    COMMENT,
+    KEYWORD,
+    IDENTIFIER,
+    NUMERIC_LITERAL,
+    STRING_LITERAL,
+    ACCESS_OPERATOR,
+    ARITHMETIC_OPERATOR,
+    LOGIC_OPERATOR,
+    POINTER_OPERATOR,
+    PUNCTUATOR
+  };
+  const static std::map<const TokenType, const char *> TokenNames;
+
+public:
+  Token() = default;
+  ~Token() {}
+
+public: // Get, Set
+  TokenType type() const { return m_type; }
+  void setType(const TokenType newType) { m_type = newType; }
+
+  const std::string_view const_data() const {
+    return m_owned.empty() ? m_view : std::string_view{m_owned};
+  }
+  void setData(const std::string_view newData) {
+    m_view = {};
+    m_owned = newData;
+  }
+
+  // Extends the token by the source character `c`. While the characters are
+  // contiguous in the source the token is only a view into it; text with gaps
+  // (skipped characters) is copied into owned storage.
+  void append(const char &c) { append(&c, 1); }
+  void append(const char *first, const size_t count) {
+    if (!m_owned.empty())
+      m_owned.append(first, count);
+    else if (m_view.empty())
+      m_view = {first, count};
+    else if (m_view.data() + m_view.size() == first)
+      m_view = {m_view.data(), m_view.size() + count};
+    else {
+      m_owned.assign(m_view).append(first, count);
+      m_view = {};
+    }
+  }
+
+  // Byte offset in the source of the token's first character, the opening
+  // quote for a string literal. Lines and columns are only worked out from
+  // it when a diagnostic asks (see LineTable).
+  uint32_t offset() const { return m_offset; }
+  void set_offset(const uint32_t offset) { m_offset = offset; }
+
+  // Set by the tokenizer for KEYWORD tokens and for identifiers naming a
+  // built-in type, so the analyzer never compares token text against them.
+  ServerLang::Keyword keyword() const { return m_keyword; }
+  ServerLang::Type builtin_type() const { return m_builtin_type; }
+
+  // Identifiers are interned as they are lexed; any other token's text is
+  // interned on first request.
+  ServerLang::Symbol symbol() const {
+    return m_symbol != ServerLang::no_id ? m_symbol
+                                         : ServerLang::intern(const_data());
+  }
+
+  void classify() {
+    if (m_type != TokenType::IDENTIFIER)
+      return;
+    auto const e = ServerLang::Lexicon::find(const_data());
+    m_keyword = e.keyword;
+    m_builtin_type = e.type;
+    if (m_keyword != ServerLang::Keyword::NONE)
+      m_type = TokenType::KEYWORD;
+    else
+      m_symbol = ServerLang::intern(const_data());
+  }
+
+  void clear() {
+    m_view = {};
+    m_owned.clear();
+    m_keyword = ServerLang::Keyword::NONE;
+    m_builtin_type = ServerLang::Type::UNDEFINED;
+    m_symbol = ServerLang::no_id;
+  }
+
+private:
+  TokenType m_type = TokenType::WHITE_SPACE;
+  ServerLang::Keyword m_keyword = ServerLang::Keyword::NONE;
+  ServerLang::Type m_builtin_type = ServerLang::Type::UNDEFINED;
+  ServerLang::Symbol m_symbol = ServerLang::no_id;
+  uint32_t m_offset = 0;
+  std::string_view m_view;
+  std::string m_owned;
+};
+
+inline const std::map<const Token::TokenType, const char *>
+    Token::TokenNames = {
+    {Token::TokenType::WHITE_SPACE, "WhiteSpace"},
+    {Token::TokenType::COMMENT, "Comment"},
+    {Token::TokenType::KEYWORD, "KeyWord"},
+    {Token::TokenType::IDENTIFIER, "Identifier"},
+    {Token::TokenType::NUMERIC_LITERAL, "NumericLiteral"},
+    {Token::TokenType::STRING_LITERAL, "StringLiteral"},
+    {Token::TokenType::ACCESS_OPERATOR, "AccessOperator"},
+    {Token::TokenType::ARITHMETIC_OPERATOR, "ArithmeticOperator"},
+    {Token::TokenType::LOGIC_OPERATOR, "LogicOperator"},
+    {Token::TokenType::POINTER_OPERATOR, "PointerOperator"},
+    {Token::TokenType::PUNCTUATOR, "Punctuator"},
+};
+
+class Tokenizer {
+public: // typedefs
+  using token_list = std::vector<Token>;
+
+public:
+  Tokenizer() : Tokenizer(std::string_view{}) {}
+  // Tokens are views into `source`, which must outlive them. Their offsets
+  // are 32-bit, so the source must not be larger than UINT32_MAX bytes;
+  // SourceFile refuses files that are.
+  explicit Tokenizer(std::string_view source,
+                     const ServerLang::Scan::Kernels &kernels =
+                         ServerLang::Scan::best_kernels())
+      : m_begin(source.data()), m_p(source.data()),
+        m_end(source.data() + source.size()), m_token_start(source.data()),
+        m_kernels(&kernels) {
+    assert(source.size() <= UINT32_MAX);
+  }
+  ~Tokenizer() {}
+
+public:
+  // Lexes just far enough to produce the next token. Returns false once the
+  // source is exhausted.
+  bool next(Token &out) {
+    while (m_pending_size == 0) {
+      if (m_p == m_end)
+        return false;
+      step();
+    }
+    out = std::move(m_pending[m_pending_head]);
+    m_pending_head ^= 1;
+    --m_pending_size;
+    return true;
+  }
+
+public: // static methods
+  // Tokens are views into `source`, which must outlive the returned list.
+  static const token_list evaluate(std::string_view source) {
+    return evaluate(source, ServerLang::Scan::best_kernels());
+  }
+
+  static const token_list evaluate(std::string_view source,
+                                   const ServerLang::Scan::Kernels &kernels) {
+    token_list list;
+    Tokenizer tokenizer(source, kernels);
+    Token token;
+    while (tokenizer.next(token))
+      list.push_back(std::move(token));
+    return list;
+  }
+
+private:
+  // Consumes one span or one character. Characters are dispatched on their
+  // class from a lookup table; string literals, comments and whitespace runs
+  // are consumed a whole span at a time by the kernels.
+  void step() {
+    using ServerLang::Scan::CharClass;
+    Token &current_token = m_current;
+
+    switch (current_token.type()) {
+    case Token::TokenType::STRING_LITERAL:
+      // A string whose text is exactly "/" turns into a comment on the
+      // next '/', so those bytes go through the switch below.
+      if (current_token.const_data().empty() ||
+          current_token.const_data() == "/")
+        break;
+      [[fallthrough]];
+    case Token::TokenType::COMMENT:
+      if (auto const stop = m_kernels->find_quote_or_eol(m_p, m_end);
+          stop != m_p) {
+        current_token.append(m_p, stop - m_p);
+        m_p = stop;
+        return;
+      }
+      break;
+    case Token::TokenType::WHITE_SPACE:
+      // Nothing in progress: blanks and line breaks are no-ops. Whatever
+      // comes next may start a token.
+      m_p = m_kernels->skip_blank(m_p, m_end);
+      if (m_p == m_end)
+        return;
+      m_token_start = m_p;
+      break;
+    default:
+      break;
+    }
+
+    auto const &v = *m_p++;
+    switch (ServerLang::Scan::classify(v)) {
+    case CharClass::DIGIT:
+      if (current_token.type() == Token::TokenType::WHITE_SPACE) {
+        current_token.setType(Token::TokenType::NUMERIC_LITERAL);
+        current_token.append(v);
+      } else
+        current_token.append(v);
+      break;
+    case CharClass::IDENT:
+      if (__NOT_STRING_OR_COMMENT__)
+        current_token.setType(Token::TokenType::IDENTIFIER);
+      current_token.append(v);
+      break;
+    case CharClass::PUNCT:
+      if (__NOT_STRING_OR_COMMENT__) {
+        end_token();
+        current_token.setType(Token::TokenType::PUNCTUATOR);
+        current_token.append(v);
+        end_token();
+      } else
+        current_token.append(v);
+      break;
+    case CharClass::COLON:
+      if (current_token.type() == Token::TokenType::PUNCTUATOR &&
+          current_token.const_data() == ":") {
+        current_token.setType(Token::TokenType::ACCESS_OPERATOR);
+        current_token.append(v);
+        end_token();
+      } else if (__NOT_STRING_OR_COMMENT__) {
+        end_token();
+        current_token.setType(Token::TokenType::PUNCTUATOR);
+        current_token.append(v);
+      } else
+        current_token.append(v);
+      break;
+    case CharClass::DOLLAR:
+      if (__NOT_STRING_OR_COMMENT__) {
+        current_token.setType(Token::TokenType::POINTER_OPERATOR);
+        current_token.append(v);
+        end_token();
+      } else
+        current_token.append(v);
+      break;
+    case CharClass::DOT:
+      if (current_token.type() == Token::TokenType::NUMERIC_LITERAL)
+        current_token.append(v);
+      else if (__NOT_STRING_OR_COMMENT__) {
+        current_token.setType(Token::TokenType::ACCESS_OPERATOR);
+        current_token.append(v);
+        end_token();
+      } else
+        current_token.append(v);
+      break;
+    case CharClass::LOGIC:
+      if (__NOT_STRING_OR_COMMENT__)
+        current_token.setType(Token::TokenType::LOGIC_OPERATOR);
+      current_token.append(v);
+      break;
+    case CharClass::STAR:
+      if (__NOT_STRING_OR_COMMENT__ && current_token.const_data() == "/")
+        current_token.setType(Token::TokenType::IDENTIFIER);
+      else if (__NOT_STRING_OR_COMMENT__)
+        current_token.setType(Token::TokenType::ARITHMETIC_OPERATOR);
+      current_token.append(v);
+      break;
+    case CharClass::SLASH:
+      if (current_token.const_data() == "/")
+        current_token.setType(Token::TokenType::COMMENT);
+      [[fallthrough]];
+    case CharClass::ARITH:
+      if (__NOT_STRING_OR_COMMENT__)
+        current_token.setType(Token::TokenType::ARITHMETIC_OPERATOR);
+      current_token.append(v);
+      break;
+    case CharClass::NEWLINE:
+      end_token();
+      break;
+    case CharClass::BLANK:
+      if (current_token.type() == Token::TokenType::STRING_LITERAL ||
+          current_token.type() == Token::TokenType::COMMENT)
+        current_token.append(v);
+      else
+        end_token();
+      break;
+    case CharClass::QUOTE:
+      if (__NOT_STRING_OR_COMMENT__) {
+        end_token();
+        current_token.setType(Token::TokenType::STRING_LITERAL);
+      } else if (current_token.type() == Token::TokenType::STRING_LITERAL)
+        end_token();
+      break;
+    case CharClass::OTHER:
+      if (current_token.type() == Token::TokenType::STRING_LITERAL ||
+          current_token.type() == Token::TokenType::COMMENT)
+        current_token.append(v);
+      break;
+    }
+  }
+
+  // Emits the token in progress. A token can only start in a blank or right
+  // where the previous one ended, at the byte being consumed.
+  void end_token() {
+    if (m_current.type() != Token::TokenType::WHITE_SPACE) {
+      m_current.set_offset(static_cast<uint32_t>(m_token_start - m_begin));
+      m_current.classify();
+      TRACE_LOG(LEXER, VERBOSE, "%s : %.*s",
+                Token::TokenNames.at(m_current.type()),
+                static_cast<int>(m_current.const_data().size()),
+                m_current.const_data().data());
+      m_pending[(m_pending_head + m_pending_size) & 1] = std::move(m_current);
+      ++m_pending_size;
+    }
+    m_current.setType(Token::TokenType::WHITE_SPACE);
+    m_current.clear();
+    m_token_start = m_p - 1;
+  }
+
+private:
+  const char *m_begin = nullptr;
+  const char *m_p = nullptr;
+  const char *m_end = nullptr;
+  const char *m_token_start = nullptr; // first byte of the token in progress
+  const ServerLang::Scan::Kernels *m_kernels = nullptr;
+  Token m_current;
+  // A single character can finish one token and emit another ('(' right
+  // after an identifier), so at most two tokens are ever pending.
+  Token m_pending[2];
+  uint8_t m_pending_head = 0;
+  uint8_t m_pending_size = 0;
+};
+
+// Pull-based cursor over a Tokenizer. Tokens are lexed on demand into a small
+// ring buffer, so the analyzer never needs the whole token list and lexing
+// overlaps with parsing. A token returned by peek() stays valid until
+// `lookahead` further tokens have been pulled.
+//
+// A stream can also walk an already lexed [first, last) range in place; the
+// range must outlive the stream. Given the source it was lexed from, it can
+// place its tokens in it too.
+class TokenStream {
+public:
+  static constexpr size_t lookahead = 16;
+
+  explicit TokenStream(std::string_view source,
+                       const ServerLang::Scan::Kernels &kernels =
+                           ServerLang::Scan::best_kernels())
+      : m_tokenizer(source, kernels), m_lines(source, kernels) {
+    m_end_token.setType(Token::TokenType::GARBAGE_TYPE);
+    m_end_token.set_offset(static_cast<uint32_t>(source.size()));
+  }
+
+  TokenStream(const Token *first, const Token *last,
+              const std::string_view source = {})
+      : m_first(first), m_last(last), m_eof(true), m_lines(source) {
+    assert(source.size() <= UINT32_MAX);
+    m_end_token.setType(Token::TokenType::GARBAGE_TYPE);
+    m_end_token.set_offset(static_cast<uint32_t>(source.size()));
+  }
+
+public:
+  // The token `n` positions past the cursor, or a GARBAGE_TYPE token once the
+  // source is exhausted.
+  const Token &peek(const size_t n = 0) {
+    assert(n < lookahead);
+    if (m_first)
+      return n < static_cast<size_t>(m_last - m_first) ? m_first[n]
+                                                       : m_end_token;
+    while (m_size <= n && !m_eof) {
+      if (m_tokenizer.next(m_ring[(m_head + m_size) % lookahead]))
+        ++m_size;
+      else
+        m_eof = true;
+    }
+    return n < m_size ? m_ring[(m_head + n) % lookahead] : m_end_token;
+  }
+
+  // Returns the current token and moves the cursor past it.
+  const Token &next() {
+    const Token &current = peek();
+    advance();
+    return current;
+  }
+
+  void advance() {
+    if (m_first) {
+      m_first += m_first != m_last;
+      return;
+    }
+    if (peek(); m_size) {
+      m_head = (m_head + 1) % lookahead;
+      --m_size;
+    }
+  }
+
+  // Moves the cursor to the next `delim` token of the given type (or the end)
+  // without copying the skipped span. Returns the number of tokens skipped.
+  size_t skip_to(const std::string_view delim, const Token::TokenType type) {
+    size_t skipped = 0;
+    for (; !done() && !(peek().type() == type && peek().const_data() == delim);
+         advance())
+      ++skipped;
+    return skipped;
+  }
+
+  bool done() { return peek().type() == Token::TokenType::GARBAGE_TYPE; }
+
+  // Line and column of the byte `skip` bytes into `t`, a token of this
+  // stream; the end token stands at the end of the source. The line table
+  // is built on the first call.
+  ServerLang::SourcePosition position(const Token &t, const size_t skip = 0) {
+    return m_lines.position(t.offset() + skip);
+  }
+
+  // Starts a diagnostic about the token under the cursor, `skip` bytes into
+  // it: "[Error]: 12:5: ", or "[Error]: " if the source is not known.
+  void begin_error(const size_t skip = 0) {
+    ++m_errors;
+    auto const at = position(peek(), skip);
+    if (at.line)
+      fprintf(stderr, "[Error]: %u:%u: ", at.line, at.column);
+    else
+      fprintf(stderr, "[Error]: ");
+  }
+  // Number of diagnostics begun so far.
+  size_t errors() const { return m_errors; }
+
+  const Token &operator*() { return peek(); }
+  const Token *operator->() { return &peek(); }
+  TokenStream &operator++() {
+    advance();
+    return *this;
+  }
+
+private:
+  Tokenizer m_tokenizer;
+  const Token *m_first = nullptr;
+  const Token *m_last = nullptr;
+  std::array<Token, lookahead> m_ring;
+  size_t m_head = 0;
+  size_t m_size = 0;
+  bool m_eof = false;
+  Token m_end_token;
+  ServerLang::LineTable m_lines;
+  size_t m_errors = 0;
+};
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string_view>
+
+#ifdef SERVERLANG_TRACE
+#include <atomic>
+#include <cstdarg>
+#include <mutex>
+#include <string>
+#endif
+
+// Parser/runtime tracing. Built with SERVERLANG_TRACE (the CMake option of the
+// same name) every TRACE_LOG site checks a per-category level and, when it is
+// enabled, formats into a buffered sink that is flushed to stderr. Without it
+// the macros expand to nothing and their arguments are never evaluated.
+//
+// Categories are enabled at runtime with a spec such as "decl,expr:2" or
+// "all", taken from --trace or the SERVERLANG_TRACE environment variable.
+
+namespace ServerLang::Trace {
+
+enum class Category : uint8_t { LEXER, DECL, COMPOUND, EXPR, RUNTIME, COUNT };
+
+enum class Level : uint8_t { OFF, INFO, VERBOSE };
+
+inline constexpr std::array<std::string_view,
+                            static_cast<size_t>(Category::COUNT)>
+    category_names = {"lexer", "decl", "compound", "expr", "runtime"};
+
+#ifdef SERVERLANG_TRACE
+
+inline constexpr bool compiled_in = true;
+
+inline std::array<std::atomic<uint8_t>, static_cast<size_t>(Category::COUNT)>
+    levels{};
+
+inline bool enabled(const Category c, const Level l) {
+  return levels[static_cast<size_t>(c)].load(std::memory_order_relaxed) >=
+         static_cast<uint8_t>(l);
+}
+
+// Collects formatted lines and writes them out in large blocks.
+class Sink {
+public:
+  ~Sink() { flush(); }
+
+  void write(const Category c, const char *fmt, va_list args) {
+    char line[512];
+    const auto tag = category_names[static_cast<size_t>(c)];
+    int n = snprintf(line, sizeof(line), "[%.*s] ",
+                     static_cast<int>(tag.size()), tag.data());
+    const int body = vsnprintf(line + n, sizeof(line) - n, fmt, args);
+    n = std::min<int>(n + std::max(body, 0), sizeof(line) - 2);
+    line[n++] = '\n';
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_buffer.append(line, n);
+    if (m_buffer.size() >= flush_threshold)
+      flush_locked();
+  }
+
+  void flush() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    flush_locked();
+  }
+
+private:
+  static constexpr size_t flush_threshold = 64 * 1024;
+
+  void flush_locked() {
+    if (m_buffer.empty())
+      return;
+    fwrite(m_buffer.data(), 1, m_buffer.size(), stderr);
+    fflush(stderr);
+    m_buffer.clear();
+  }
+
+  std::mutex m_mutex;
+  std::string m_buffer;
+};
+
+inline Sink &sink() {
+  static Sink s;
+  return s;
+}
+
+__attribute__((format(printf, 2, 3))) inline void
+write(const Category c, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  sink().write(c, fmt, args);
+  va_end(args);
+}
+
+inline void flush() { sink().flush(); }
+
+inline void set_level(const Category c, const Level l) {
+  levels[static_cast<size_t>(c)].store(static_cast<uint8_t>(l),
+                                       std::memory_order_relaxed);
+}
+
+#else
+
+inline constexpr bool compiled_in = false;
+
+inline bool enabled(const Category, const Level) { return false; }
+inline void flush() {}
+inline void set_level(const Category, const Level) {}
+
+#endif // SERVERLANG_TRACE
+
+// Parses a comma separated list of `category[:level]` entries, where level is
+// 1 (INFO, the default) or 2 (VERBOSE). Returns false on an unknown category
+// or level; entries before the bad one stay applied.
+inline bool configure(std::string_view spec) {
+  while (!spec.empty()) {
+    const auto comma = spec.find(',');
+    auto entry = spec.substr(0, comma);
+    spec = comma == std::string_view::npos ? std::string_view{}
+                                           : spec.substr(comma + 1);
+
+    auto level = Level::INFO;
+    if (const auto colon = entry.find(':'); colon != std::string_view::npos) {
+      const auto l = entry.substr(colon + 1);
+      if (l == "0")
+        level = Level::OFF;
+      else if (l == "1")
+        level = Level::INFO;
+      else if (l == "2")
+        level = Level::VERBOSE;
+      else
+        return false;
+      entry = entry.substr(0, colon);
+    }
+
+    if (entry == "all") {
+      for (size_t i = 0; i < category_names.size(); ++i)
+        set_level(static_cast<Category>(i), level);
+      continue;
+    }
+
+    size_t i = 0;
+    while (i < category_names.size() && category_names[i] != entry)
+      ++i;
+    if (i == category_names.size())
+      return false;
+    set_level(static_cast<Category>(i), level);
+  }
+  return true;
+}
+
+inline bool configure_from_env() {
+  const char *spec = std::getenv("SERVERLANG_TRACE");
+  return spec ? configure(spec) : true;
+}
+
+} // namespace ServerLang::Trace
+
+#ifdef SERVERLANG_TRACE
+#define TRACE_LOG(category, level, ...)                                        \
+  do {                                                                         \
+    if (::ServerLang::Trace::enabled(                                          \
+            ::ServerLang::Trace::Category::category,                           \
+            ::ServerLang::Trace::Level::level))                                \
+      ::ServerLang::Trace::write(::ServerLang::Trace::Category::category,      \
+                                 __VA_ARGS__);                                 \
+  } while (0)
+#else
+#define TRACE_LOG(category, level, ...)                                        \
+  do {                                                                         \
+  } while (0)
+#endif
+
+// Logs `label` followed by the text of the token under `x` (a TokenStream or
+// Token pointer).
+#define TRACE_TOKEN(category, level, label, x)                                 \
+  TRACE_LOG(category, level, "%s%.*s", label,                                  \
+            static_cast<int>((x)->const_data().size()),                        \
+            (x)->const_data().data())
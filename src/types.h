@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+
+namespace ServerLang {
+
+enum class Type : uint8_t {
+  UNDEFINED,
+  I16,
+  I32,
+  I64,
+  U8,
+  U16,
+  F32,
+  F64,
+  BOOL,
+  COMPLEX,
+  STRING,
+  VARIANT,
+  VOID,
+  ARRAY,
+  CLASS,
+  STRUCT,
+  JSON,
+  ROUTE,
+  SCOPE,
+  OBJECT,
+  FUNCTION,
+  PRIMITIVE,
+  EXPRESSION,
+  ARITHMETICEXPRESSION,
+  LOGICALEXPRESSION,
+  ASSIGNMENTEXPRESSION,
+  CALLEXPRESSION,
+  ACCESSEXPRESSION,
+  IDENTIFIER,
+  RETURNEXPRESSION,
+};
+
+} // namespace ServerLang
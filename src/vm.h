@@ -0,0 +1,444 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bytecode.h"
+
+namespace ServerLang {
+
+// Register machine for Program chunks. Frames are windows onto one value
+// stack: a call's arguments are already in place as the callee's first
+// registers, and its result lands in the register just below them.
+//
+// Dispatch is threaded through a table of label addresses (the GNU
+// labels-as-values extension), so each handler jumps straight to the next.
+//
+// A Machine is used by one thread at a time. To run a Program on several
+// threads, each takes its own fork of the Machine that initialized it.
+class Machine {
+public:
+  explicit Machine(const Program &program, const size_t stack_size = 1 << 16)
+      : m_program(program), m_stack(stack_size) {
+    m_frames.reserve(max_depth);
+  }
+
+  // A request context over `base`, whose globals it starts from. Neither
+  // the Program nor `base` may change while the fork exists; the fork's own
+  // writes to globals are undone by reset().
+  Machine(const Program &program, const Machine &base,
+          const size_t stack_size = 1 << 16)
+      : Machine(program, stack_size) {
+    m_base = &base;
+    m_globals = base.m_globals;
+    m_globals.resize(program.global_count());
+    m_global_text.resize(m_globals.size());
+    m_written.resize(m_globals.size());
+  }
+  Machine(const Machine &) = delete;
+  Machine &operator=(const Machine &) = delete;
+
+public:
+  // Runs `chunk` with `args`. Returns null and sets error() if execution
+  // fails. Strings in the result stay valid until release() frees them.
+  Value run(const uint16_t chunk, const Value *args = nullptr,
+            const size_t argc = 0) {
+    m_error.clear();
+    if (m_globals.size() < m_program.global_count()) {
+      m_globals.resize(m_program.global_count());
+      m_global_text.resize(m_program.global_count());
+    }
+    auto const &c = m_program.chunk(chunk);
+    if (c.registers > m_stack.size())
+      return fail("Stack overflow");
+    for (size_t i = 0; i < c.params; ++i)
+      m_stack[i] = i < argc ? args[i] : Value{};
+    return execute(chunk);
+  }
+
+  const std::string &error() const { return m_error; }
+  bool ok() const { return m_error.empty(); }
+
+  // Strings built while running are kept until released. A caller handling a
+  // request takes a mark() before running and releases back to it afterwards.
+  size_t mark() const { return m_heap.size(); }
+  void release(const size_t mark) { m_heap.resize(mark); }
+
+  const Value &global(const uint16_t slot) const { return m_globals[slot]; }
+
+  // For natives: keeps `text` alive as long as the strings the running code
+  // builds itself, and fails the call in progress with `message`.
+  const std::string *keep(std::string text) {
+    return &m_heap.emplace_back(std::move(text));
+  }
+  void raise(std::string message) { m_error = std::move(message); }
+
+  // The request fields set by the last run.
+  const Value &field(const Field f) const {
+    return m_fields[static_cast<int>(f)];
+  }
+
+  // The body of the request being served. It is not looked at until the
+  // running code reads it, and must stay in place until reset().
+  void set_request_body(const std::string_view body) {
+    m_request_body = body;
+    m_body_ready = false;
+  }
+
+  // Starts a new request: frees its predecessor's strings, clears `This`
+  // and the body and, on a fork, puts back the globals it wrote.
+  void reset() {
+    m_heap.clear();
+    for (auto &f : m_fields)
+      f = Value{};
+    set_request_body({});
+    for (const auto slot : m_dirty) {
+      m_globals[slot] = slot < m_base->m_globals.size()
+                            ? m_base->m_globals[slot]
+                            : Value{};
+      m_written[slot] = false;
+    }
+    m_dirty.clear();
+  }
+
+private:
+  struct Frame {
+    const Instr *ip;
+    Value *base;
+  };
+
+  static constexpr size_t max_depth = 1024;
+
+  Value fail(std::string message) {
+    m_error = std::move(message);
+    return {};
+  }
+
+  const std::string *concat(const Value &x, const Value &y) {
+    auto &out = m_heap.emplace_back();
+    if (x.kind == Value::Kind::STRING && y.kind == Value::Kind::STRING) {
+      out.reserve(x.s->size() + y.s->size());
+      out.append(*x.s).append(*y.s);
+    } else
+      out = x.to_string() + y.to_string();
+    return &out;
+  }
+
+  Value execute(const uint16_t entry) {
+    static const void *const handlers[op_count] = {
+        &&op_LOADK, &&op_LOADNIL, &&op_MOVE, &&op_GETG, &&op_SETG,
+        &&op_ADD,   &&op_SUB,     &&op_MUL,  &&op_DIV,  &&op_AND,
+        &&op_OR,    &&op_XOR,     &&op_NOT,  &&op_EQ,   &&op_LT,
+        &&op_LE,    &&op_GETF,    &&op_SETF, &&op_INDEX, &&op_BODY,
+        &&op_CALL,  &&op_CALLN,   &&op_RET,  &&op_RETNIL};
+
+    auto &frames = m_frames;
+    frames.clear();
+    Value *const stack_end = m_stack.data() + m_stack.size();
+    Value *base = m_stack.data();
+    const Instr *ip = m_program.chunk(entry).code.data();
+    const Instr *in = nullptr;
+    Value result;
+
+#define VM_NEXT()                                                              \
+  in = ip++;                                                                   \
+  goto *handlers[static_cast<uint8_t>(in->op)]
+#define R(x) base[x]
+
+    VM_NEXT();
+
+  op_LOADK:
+    R(in->a) = m_program.constant_at(in->b | uint32_t{in->c} << 16);
+    VM_NEXT();
+  op_LOADNIL:
+    R(in->a) = Value{};
+    VM_NEXT();
+  op_MOVE:
+    R(in->a) = R(in->b);
+    VM_NEXT();
+  op_GETG:
+    R(in->a) = m_globals[in->b];
+    VM_NEXT();
+  op_SETG:
+    set_global(in->b, R(in->a));
+    VM_NEXT();
+
+  op_ADD: {
+    auto const &x = R(in->b), &y = R(in->c);
+    if (x.kind == Value::Kind::INT && y.kind == Value::Kind::INT)
+      R(in->a) = Value::integer(wrap(x.i, y.i, Op::ADD));
+    else if (x.kind == Value::Kind::STRING || y.kind == Value::Kind::STRING ||
+             x.kind == Value::Kind::JSON || y.kind == Value::Kind::JSON)
+      R(in->a) = Value::string(concat(x, y));
+    else if (!arith(in->a, x, y, Op::ADD, base))
+      return fail("Operands of '+' must be numbers or strings");
+    VM_NEXT();
+  }
+  op_SUB: {
+    auto const &x = R(in->b), &y = R(in->c);
+    if (x.kind == Value::Kind::INT && y.kind == Value::Kind::INT)
+      R(in->a) = Value::integer(wrap(x.i, y.i, Op::SUB));
+    else if (!arith(in->a, x, y, Op::SUB, base))
+      return fail("Operands of '-' must be numbers");
+    VM_NEXT();
+  }
+  op_MUL: {
+    auto const &x = R(in->b), &y = R(in->c);
+    if (x.kind == Value::Kind::INT && y.kind == Value::Kind::INT)
+      R(in->a) = Value::integer(wrap(x.i, y.i, Op::MUL));
+    else if (!arith(in->a, x, y, Op::MUL, base))
+      return fail("Operands of '*' must be numbers");
+    VM_NEXT();
+  }
+  op_DIV: {
+    auto const &x = R(in->b), &y = R(in->c);
+    if (x.kind == Value::Kind::INT && y.kind == Value::Kind::INT) {
+      if (y.i == 0 || (y.i == -1 && x.i == INT64_MIN))
+        return fail("Integer division by zero or overflow");
+      R(in->a) = Value::integer(x.i / y.i);
+    } else if (!arith(in->a, x, y, Op::DIV, base))
+      return fail("Operands of '/' must be numbers");
+    VM_NEXT();
+  }
+
+  op_AND:
+  op_OR:
+  op_XOR: {
+    auto const &x = R(in->b), &y = R(in->c);
+    if (x.kind == Value::Kind::BOOL && y.kind == Value::Kind::BOOL)
+      R(in->a) = Value::boolean(in->op == Op::AND  ? x.b && y.b
+                                : in->op == Op::OR ? x.b || y.b
+                                                   : x.b != y.b);
+    else if (x.kind == Value::Kind::INT && y.kind == Value::Kind::INT)
+      R(in->a) = Value::integer(in->op == Op::AND  ? x.i & y.i
+                                : in->op == Op::OR ? x.i | y.i
+                                                   : x.i ^ y.i);
+    else
+      return fail("Operands of a logical operator must both be booleans or "
+                  "integers");
+    VM_NEXT();
+  }
+  op_NOT: {
+    auto const &x = R(in->b);
+    if (x.kind == Value::Kind::BOOL)
+      R(in->a) = Value::boolean(!x.b);
+    else if (x.kind == Value::Kind::INT)
+      R(in->a) = Value::integer(~x.i);
+    else
+      return fail("Operand of a negation must be a boolean or an integer");
+    VM_NEXT();
+  }
+
+  op_EQ:
+    R(in->a) = Value::boolean(equal(R(in->b), R(in->c)));
+    VM_NEXT();
+  op_LT:
+  op_LE: {
+    auto const &x = R(in->b), &y = R(in->c);
+    int order;
+    if (!compare(x, y, order))
+      return fail("Operands of a comparison must both be numbers or strings");
+    R(in->a) = Value::boolean(in->op == Op::LT ? order < 0 : order <= 0);
+    VM_NEXT();
+  }
+
+  op_GETF:
+    R(in->a) = m_fields[in->b];
+    VM_NEXT();
+  op_SETF:
+    // Constants, globals and the request's strings all live until reset().
+    m_fields[in->b] = R(in->a);
+    VM_NEXT();
+  op_INDEX:
+    R(in->a) = index(R(in->b), R(in->c));
+    VM_NEXT();
+  op_BODY:
+    R(in->a) = body();
+    VM_NEXT();
+
+  op_CALL: {
+    auto const &callee = m_program.chunk(in->b);
+    Value *const callee_base = base + in->a + 1;
+    if (frames.size() == max_depth ||
+        callee_base + callee.registers > stack_end)
+      return fail("Stack overflow");
+    for (uint16_t i = in->c; i < callee.params; ++i)
+      callee_base[i] = Value{};
+    frames.push_back({ip, base});
+    base = callee_base;
+    ip = callee.code.data();
+    VM_NEXT();
+  }
+  op_CALLN:
+    R(in->a) = m_program.native_at(in->b).fn(*this, &R(in->a + 1), in->c);
+    if (!m_error.empty())
+      return {};
+    VM_NEXT();
+  op_RET:
+    result = R(in->a);
+    goto do_return;
+  op_RETNIL:
+    result = Value{};
+  do_return:
+    if (frames.empty())
+      return result;
+    base[-1] = result;
+    ip = frames.back().ip;
+    base = frames.back().base;
+    frames.pop_back();
+    VM_NEXT();
+
+#undef R
+#undef VM_NEXT
+  }
+
+  // Integer arithmetic wraps around instead of overflowing.
+  static int64_t wrap(const int64_t x, const int64_t y, const Op op) {
+    const auto l = static_cast<uint64_t>(x), r = static_cast<uint64_t>(y);
+    return static_cast<int64_t>(op == Op::ADD   ? l + r
+                                : op == Op::SUB ? l - r
+                                                : l * r);
+  }
+
+  static bool equal(const Value &x, const Value &y) {
+    int order;
+    if (x.kind == Value::Kind::BOOL && y.kind == Value::Kind::BOOL)
+      return x.b == y.b;
+    if (x.kind == Value::Kind::NIL || y.kind == Value::Kind::NIL)
+      return x.kind == y.kind;
+    return compare(x, y, order) && order == 0;
+  }
+
+  // Sets `order` to the sign of x - y. Integers compare exactly, mixed
+  // numbers as doubles and strings, body strings included, by their bytes.
+  static bool compare(const Value &x, const Value &y, int &order) {
+    using K = Value::Kind;
+    std::string_view l, r;
+    if (x.kind == K::INT && y.kind == K::INT)
+      order = (x.i > y.i) - (x.i < y.i);
+    else if (x.kind == K::STRING && y.kind == K::STRING)
+      order = x.s->compare(*y.s);
+    else if (x.text(l) && y.text(r))
+      order = l.compare(r);
+    else if ((x.kind == K::INT || x.kind == K::FLOAT) &&
+             (y.kind == K::INT || y.kind == K::FLOAT)) {
+      const double l = x.kind == K::INT ? static_cast<double>(x.i) : x.f;
+      const double r = y.kind == K::INT ? static_cast<double>(y.i) : y.f;
+      // NaN orders as neither less nor equal.
+      order = l < r ? -1 : l > r ? 1 : l == r ? 0 : 2;
+    } else
+      return false;
+    return true;
+  }
+
+  // The slow path of the arithmetic handlers: any mix of integers and floats.
+  static bool arith(const uint8_t dst, const Value &x, const Value &y,
+                    const Op op, Value *base) {
+    auto const num = [](const Value &v, double &out) {
+      if (v.kind == Value::Kind::INT)
+        out = static_cast<double>(v.i);
+      else if (v.kind == Value::Kind::FLOAT)
+        out = v.f;
+      else
+        return false;
+      return true;
+    };
+    double l, r;
+    if (!num(x, l) || !num(y, r))
+      return false;
+    switch (op) {
+    case Op::ADD:
+      base[dst] = Value::number(l + r);
+      break;
+    case Op::SUB:
+      base[dst] = Value::number(l - r);
+      break;
+    case Op::MUL:
+      base[dst] = Value::number(l * r);
+      break;
+    default:
+      base[dst] = Value::number(l / r);
+      break;
+    }
+    return true;
+  }
+
+  // Member `key` of an object, or element `key` of an array; null if there
+  // is none or `x` is neither.
+  static Value index(const Value &x, const Value &key) {
+    std::string_view name;
+    const bool named = key.text(name);
+    const bool numbered = key.kind == Value::Kind::INT && key.i >= 0;
+    if (x.kind == Value::Kind::JSON) {
+      if (named)
+        return json_value(x.d, x.d->find(x.at, name));
+      if (numbered)
+        return json_value(x.d, x.d->at(x.at, static_cast<size_t>(key.i)));
+    } else if (x.kind == Value::Kind::OBJECT) {
+      auto const &members = x.o->members;
+      if (named && !x.o->array) {
+        for (auto const &m : members)
+          if (m.name == name)
+            return m.value;
+      } else if (numbered && static_cast<size_t>(key.i) < members.size())
+        return members[static_cast<size_t>(key.i)].value;
+    }
+    return {};
+  }
+
+  // The request body: its JSON value, or its text if it is not JSON. The
+  // structural index is built on the first read; values are looked up in it
+  // as the code asks for them.
+  Value body() {
+    if (!m_body_ready) {
+      m_body_ready = true;
+      m_body = Value{};
+      if (m_document.index(m_request_body))
+        m_body = json_value(&m_document, JsonDocument::root);
+      else if (!m_request_body.empty())
+        m_body = Value::string(keep(std::string(m_request_body)));
+    }
+    return m_body;
+  }
+
+  // Globals outlive released request strings, so they keep their own copy.
+  // Parts of a request body become strings of their text. A global assigned
+  // its own text (`g = g;`) already holds it.
+  void set_global(const uint16_t slot, const Value &v) {
+    if (m_base && !m_written[slot]) {
+      m_written[slot] = true;
+      m_dirty.push_back(slot);
+    }
+    if (v.kind == Value::Kind::STRING && v.s == &m_global_text[slot])
+      m_globals[slot] = v;
+    else if (v.kind == Value::Kind::STRING || v.kind == Value::Kind::JSON) {
+      m_global_text[slot].clear();
+      v.append_to(m_global_text[slot]);
+      m_globals[slot] = Value::string(&m_global_text[slot]);
+    } else
+      m_globals[slot] = v;
+  }
+
+private:
+  const Program &m_program;
+  const Machine *m_base = nullptr;
+  std::vector<Value> m_stack;
+  std::vector<Frame> m_frames;
+  std::vector<Value> m_globals;
+  std::deque<std::string> m_global_text;
+  std::deque<std::string> m_heap;
+  std::string m_error;
+  Value m_fields[field_count];
+  JsonDocument m_document;
+  std::string_view m_request_body;
+  bool m_body_ready = false;
+  Value m_body;
+  // Globals a fork has written since its last reset().
+  std::vector<uint16_t> m_dirty;
+  std::vector<bool> m_written;
+};
+
+} // namespace ServerLang